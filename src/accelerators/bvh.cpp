@@ -37,7 +37,12 @@
 #include "paramset.h"
 #include "stats.h"
 #include "parallel.h"
+#include "shapes/triangle.h"
 #include <algorithm>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define PBRT_BVH_SSE
+#endif
 
 namespace pbrt {
 
@@ -45,6 +50,13 @@ STAT_MEMORY_COUNTER("Memory/BVH tree", treeBytes);
 STAT_RATIO("BVH/Primitives per leaf node", totalPrimitives, totalLeafNodes);
 STAT_COUNTER("BVH/Interior nodes", interiorNodes);
 STAT_COUNTER("BVH/Leaf nodes", leafNodes);
+STAT_COUNTER("BVH/Wide nodes", wideBVHNodes);
+
+// Nodes with at least this many primitives build their two subtrees in
+// parallel and bin their primitives in parallel chunks, respectively
+static PBRT_CONSTEXPR int parallelBuildMinPrimitives = 16384;
+static PBRT_CONSTEXPR int parallelBinningMinPrimitives = 131072;
+static PBRT_CONSTEXPR int binningChunkSize = 32768;
 
 // BVHAccel Local Declarations
 struct BVHPrimitiveInfo {
@@ -103,6 +115,28 @@ struct LinearBVHNode {
     uint8_t pad[1];        // ensure 32 byte total size
 };
 
+template <int N>
+struct WideBVHNode {
+    // Child bounds in structure-of-arrays layout so that a ray can be tested
+    // against all children at once: _bounds[0]_ holds the minima and
+    // _bounds[1]_ the maxima along each axis
+    float bounds[2][3][N];
+    int32_t offset[N];        // leaf: first primitive, interior: child node
+    uint16_t nPrimitives[N];  // 0 -> interior child or empty slot
+};
+
+struct WideBVHRay {
+    WideBVHRay(const Ray &ray) {
+        for (int a = 0; a < 3; ++a) {
+            o[a] = ray.o[a];
+            invDir[a] = 1 / (float)ray.d[a];
+            dirIsNeg[a] = invDir[a] < 0;
+        }
+    }
+    float o[3], invDir[3];
+    int dirIsNeg[3];
+};
+
 // BVHAccel Utility Functions
 inline uint32_t LeftShift3(uint32_t x) {
     CHECK_LE(x, (1 << 10));
@@ -179,9 +213,617 @@ static void RadixSort(std::vector<MortonPrimitive> *v) {
     if (nPasses & 1) std::swap(*v, tempVector);
 }
 
+// Wide BVH child bounds are stored in single precision, rounded outward
+inline float RoundBoundDown(Float v) {
+    float f = v;
+    return f > v ? NextFloatDown(f) : f;
+}
+
+inline float RoundBoundUp(Float v) {
+    float f = v;
+    return f < v ? NextFloatUp(f) : f;
+}
+
+template <int N>
+static int CollapseBVHTree(const BVHBuildNode *node,
+                           std::vector<WideBVHNode<N>> *wideNodes) {
+    // Gather up to _N_ descendants of _node_ as the wide node's children,
+    // repeatedly opening the interior child with the largest surface area
+    const BVHBuildNode *children[N];
+    int nChildren = 0;
+    if (node->nPrimitives > 0)
+        children[nChildren++] = node;
+    else {
+        children[nChildren++] = node->children[0];
+        children[nChildren++] = node->children[1];
+        while (nChildren < N) {
+            int open = -1;
+            Float maxArea = -1;
+            for (int i = 0; i < nChildren; ++i)
+                if (children[i]->nPrimitives == 0 &&
+                    children[i]->bounds.SurfaceArea() > maxArea) {
+                    open = i;
+                    maxArea = children[i]->bounds.SurfaceArea();
+                }
+            if (open == -1) break;
+            const BVHBuildNode *c = children[open];
+            children[open] = c->children[0];
+            children[nChildren++] = c->children[1];
+        }
+    }
+
+    // Initialize child slots of the wide node, leaving unused slots empty
+    int nodeIndex = wideNodes->size();
+    wideNodes->push_back(WideBVHNode<N>());
+    ++wideBVHNodes;
+    for (int i = 0; i < N; ++i) {
+        Float pMin[3] = {Infinity, Infinity, Infinity};
+        Float pMax[3] = {-Infinity, -Infinity, -Infinity};
+        int offset = -1, nPrimitives = 0;
+        if (i < nChildren) {
+            const BVHBuildNode *c = children[i];
+            for (int a = 0; a < 3; ++a) {
+                pMin[a] = c->bounds.pMin[a];
+                pMax[a] = c->bounds.pMax[a];
+            }
+            if (c->nPrimitives > 0) {
+                offset = c->firstPrimOffset;
+                nPrimitives = c->nPrimitives;
+            } else
+                offset = CollapseBVHTree(c, wideNodes);
+        }
+        WideBVHNode<N> &wideNode = (*wideNodes)[nodeIndex];
+        for (int a = 0; a < 3; ++a) {
+            wideNode.bounds[0][a][i] = RoundBoundDown(pMin[a]);
+            wideNode.bounds[1][a][i] = RoundBoundUp(pMax[a]);
+        }
+        wideNode.offset[i] = offset;
+        wideNode.nPrimitives[i] = nPrimitives;
+    }
+    return nodeIndex;
+}
+
+template <int N>
+static WideBVHNode<N> *CreateWideBVH(const BVHBuildNode *root, int *nNodes) {
+    std::vector<WideBVHNode<N>> wideNodes;
+    CollapseBVHTree(root, &wideNodes);
+    *nNodes = wideNodes.size();
+    WideBVHNode<N> *nodes = AllocAligned<WideBVHNode<N>>(wideNodes.size());
+    std::copy(wideNodes.begin(), wideNodes.end(), nodes);
+    return nodes;
+}
+
+// Slab tests of a ray against _n_ boxes given by their near and far planes
+// along each axis. Returns a bit mask of the boxes that are hit and their
+// entry distances in _tNear_. Slab distances that are NaN (zero direction
+// component with the origin on the plane) are ignored, as in
+// _Bounds3::IntersectP()_.
+inline int IntersectSlabs(int n, const float *const pNear[3],
+                          const float *const pFar[3], const WideBVHRay &ray,
+                          float tMax, float *tNear) {
+    const float farScale = 1 + 2 * gamma(3);
+    int hitMask = 0;
+    for (int i = 0; i < n; ++i) {
+        float t0 = 0, t1 = tMax;
+        for (int a = 0; a < 3; ++a) {
+            float tSlab0 = (pNear[a][i] - ray.o[a]) * ray.invDir[a];
+            float tSlab1 = (pFar[a][i] - ray.o[a]) * ray.invDir[a] * farScale;
+            t0 = tSlab0 > t0 ? tSlab0 : t0;
+            t1 = tSlab1 < t1 ? tSlab1 : t1;
+        }
+        tNear[i] = t0;
+        if (t0 <= t1) hitMask |= 1 << i;
+    }
+    return hitMask;
+}
+
+#ifdef PBRT_BVH_SSE
+inline int IntersectSlabs4(const float *const pNear[3],
+                           const float *const pFar[3], const WideBVHRay &ray,
+                           float tMax, float *tNear) {
+    // _mm_max_ps()_ and _mm_min_ps()_ return their second operand if either
+    // is NaN, which ignores NaN slab distances
+    const __m128 farScale = _mm_set1_ps(1 + 2 * gamma(3));
+    __m128 t0 = _mm_setzero_ps(), t1 = _mm_set1_ps(tMax);
+    for (int a = 0; a < 3; ++a) {
+        __m128 o = _mm_set1_ps(ray.o[a]), invDir = _mm_set1_ps(ray.invDir[a]);
+        __m128 tSlab0 =
+            _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(pNear[a]), o), invDir);
+        __m128 tSlab1 = _mm_mul_ps(
+            _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(pFar[a]), o), invDir),
+            farScale);
+        t0 = _mm_max_ps(tSlab0, t0);
+        t1 = _mm_min_ps(tSlab1, t1);
+    }
+    _mm_storeu_ps(tNear, t0);
+    return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+}
+#endif  // PBRT_BVH_SSE
+
+#ifdef __AVX__
+inline int IntersectSlabs8(const float *const pNear[3],
+                           const float *const pFar[3], const WideBVHRay &ray,
+                           float tMax, float *tNear) {
+    const __m256 farScale = _mm256_set1_ps(1 + 2 * gamma(3));
+    __m256 t0 = _mm256_setzero_ps(), t1 = _mm256_set1_ps(tMax);
+    for (int a = 0; a < 3; ++a) {
+        __m256 o = _mm256_set1_ps(ray.o[a]);
+        __m256 invDir = _mm256_set1_ps(ray.invDir[a]);
+        __m256 tSlab0 =
+            _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(pNear[a]), o), invDir);
+        __m256 tSlab1 = _mm256_mul_ps(
+            _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(pFar[a]), o), invDir),
+            farScale);
+        t0 = _mm256_max_ps(tSlab0, t0);
+        t1 = _mm256_min_ps(tSlab1, t1);
+    }
+    _mm256_storeu_ps(tNear, t0);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+}
+#endif  // __AVX__
+
+template <int N>
+inline int IntersectChildren(const WideBVHNode<N> &node, const WideBVHRay &ray,
+                             float tMax, float *tNear) {
+    const float *pNear[3], *pFar[3];
+    for (int a = 0; a < 3; ++a) {
+        pNear[a] = node.bounds[ray.dirIsNeg[a]][a];
+        pFar[a] = node.bounds[1 - ray.dirIsNeg[a]][a];
+    }
+#ifdef __AVX__
+    if (N == 8) return IntersectSlabs8(pNear, pFar, ray, tMax, tNear);
+#endif
+#ifdef PBRT_BVH_SSE
+    int hitMask = 0;
+    for (int i = 0; i < N; i += 4) {
+        const float *pNear4[3] = {pNear[0] + i, pNear[1] + i, pNear[2] + i};
+        const float *pFar4[3] = {pFar[0] + i, pFar[1] + i, pFar[2] + i};
+        hitMask |= IntersectSlabs4(pNear4, pFar4, ray, tMax, tNear + i) << i;
+    }
+    return hitMask;
+#else
+    return IntersectSlabs(N, pNear, pFar, ray, tMax, tNear);
+#endif
+}
+
+template <int N>
+static bool IntersectWideBVH(
+    const WideBVHNode<N> *nodes,
+    const std::vector<std::shared_ptr<Primitive>> &primitives, const Ray &ray,
+    SurfaceInteraction *isect) {
+    bool hit = false;
+    WideBVHRay wideRay(ray);
+    // Follow ray through BVH nodes to find primitive intersections, visiting
+    // the children of each node in order of their entry distance
+    struct NodeToVisit {
+        int nodeIndex;
+        float tNear;
+    };
+    NodeToVisit nodesToVisit[64 * (N - 1) + 1];
+    int toVisitOffset = 0;
+    nodesToVisit[toVisitOffset++] = {0, 0.f};
+    while (toVisitOffset > 0) {
+        NodeToVisit current = nodesToVisit[--toVisitOffset];
+        if (current.tNear > ray.tMax) continue;
+        const WideBVHNode<N> &node = nodes[current.nodeIndex];
+        float tNear[N];
+        int hitMask = IntersectChildren(node, wideRay, ray.tMax, tNear);
+
+        // Intersect ray with primitives in leaf children that are hit and
+        // sort interior children that are hit, farthest first
+        NodeToVisit interior[N];
+        int nInterior = 0;
+        for (int i = 0; i < N; ++i) {
+            if (!(hitMask & (1 << i))) continue;
+            if (node.nPrimitives[i] > 0) {
+                for (int j = 0; j < node.nPrimitives[i]; ++j)
+                    if (primitives[node.offset[i] + j]->Intersect(ray, isect))
+                        hit = true;
+            } else {
+                int k = nInterior++;
+                while (k > 0 && interior[k - 1].tNear < tNear[i]) {
+                    interior[k] = interior[k - 1];
+                    --k;
+                }
+                interior[k] = {node.offset[i], tNear[i]};
+            }
+        }
+        for (int i = 0; i < nInterior; ++i)
+            nodesToVisit[toVisitOffset++] = interior[i];
+    }
+    return hit;
+}
+
+template <int N>
+static bool IntersectPWideBVH(
+    const WideBVHNode<N> *nodes,
+    const std::vector<std::shared_ptr<Primitive>> &primitives,
+    const Ray &ray) {
+    WideBVHRay wideRay(ray);
+    int nodesToVisit[64 * (N - 1) + 1];
+    int toVisitOffset = 0;
+    nodesToVisit[toVisitOffset++] = 0;
+    while (toVisitOffset > 0) {
+        const WideBVHNode<N> &node = nodes[nodesToVisit[--toVisitOffset]];
+        float tNear[N];
+        int hitMask = IntersectChildren(node, wideRay, ray.tMax, tNear);
+        for (int i = 0; i < N; ++i) {
+            if (!(hitMask & (1 << i))) continue;
+            if (node.nPrimitives[i] > 0) {
+                for (int j = 0; j < node.nPrimitives[i]; ++j)
+                    if (primitives[node.offset[i] + j]->IntersectP(ray))
+                        return true;
+            } else
+                nodesToVisit[toVisitOffset++] = node.offset[i];
+        }
+    }
+    return false;
+}
+
+#ifdef PBRT_BVH_SSE
+// Up to four rays in SoA form, traced through the binary BVH together; the
+// slab test mirrors _IntersectSlabs4()_ with the roles of rays and boxes
+// exchanged.
+struct BVHRayPacket {
+    BVHRayPacket(const Ray *rays, int n) : rays(rays), n(n) {
+        for (int a = 0; a < 3; ++a) {
+            float o[4], invDir[4];
+            for (int i = 0; i < 4; ++i) {
+                // Unused lanes repeat the last ray and are masked out
+                const Ray &ray = rays[std::min(i, n - 1)];
+                o[i] = ray.o[a];
+                invDir[i] = 1 / ray.d[a];
+                if (invDir[i] < 0) dirIsNeg[a] |= 1 << i;
+            }
+            this->o[a] = _mm_loadu_ps(o);
+            this->invDir[a] = _mm_loadu_ps(invDir);
+            negMask[a] = _mm_cmplt_ps(this->invDir[a], _mm_setzero_ps());
+        }
+        UpdateTMax();
+    }
+    void UpdateTMax() {
+        float t[4];
+        for (int i = 0; i < 4; ++i) t[i] = rays[std::min(i, n - 1)].tMax;
+        tMax = _mm_loadu_ps(t);
+    }
+    int IntersectP(const Bounds3f &b) const {
+        const __m128 farScale = _mm_set1_ps(1 + 2 * gamma(3));
+        __m128 t0 = _mm_setzero_ps(), t1 = tMax;
+        for (int a = 0; a < 3; ++a) {
+            __m128 pMin = _mm_set1_ps(b.pMin[a]), pMax = _mm_set1_ps(b.pMax[a]);
+            __m128 pNear = _mm_or_ps(_mm_and_ps(negMask[a], pMax),
+                                     _mm_andnot_ps(negMask[a], pMin));
+            __m128 pFar = _mm_or_ps(_mm_and_ps(negMask[a], pMin),
+                                    _mm_andnot_ps(negMask[a], pMax));
+            __m128 tSlab0 = _mm_mul_ps(_mm_sub_ps(pNear, o[a]), invDir[a]);
+            __m128 tSlab1 = _mm_mul_ps(
+                _mm_mul_ps(_mm_sub_ps(pFar, o[a]), invDir[a]), farScale);
+            t0 = _mm_max_ps(tSlab0, t0);
+            t1 = _mm_min_ps(tSlab1, t1);
+        }
+        return _mm_movemask_ps(_mm_cmple_ps(t0, t1)) & ((1 << n) - 1);
+    }
+
+    const Ray *rays;
+    int n;
+    __m128 o[3], invDir[3], negMask[3], tMax;
+    int dirIsNeg[3] = {0, 0, 0};
+};
+
+STAT_RATIO("BVH/Rays per packet", nPacketRays, nRayPackets);
+
+// Traces up to four rays through a binary BVH, following the first ray
+// that hits each interior node to choose which child to visit first.
+static void IntersectPacket(
+    const LinearBVHNode *nodes,
+    const std::vector<std::shared_ptr<Primitive>> &primitives,
+    const Ray *rays, SurfaceInteraction *isects, bool *hits, int n) {
+    ++nRayPackets;
+    nPacketRays += n;
+    BVHRayPacket packet(rays, n);
+    for (int i = 0; i < n; ++i) hits[i] = false;
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    int nodesToVisit[64];
+    while (true) {
+        const LinearBVHNode *node = &nodes[currentNodeIndex];
+        int mask = packet.IntersectP(node->bounds);
+        if (mask && node->nPrimitives > 0) {
+            // Intersect active rays with primitives in leaf BVH node
+            for (int i = 0; i < node->nPrimitives; ++i) {
+                const Primitive &prim = *primitives[node->primitivesOffset + i];
+                for (int m = mask; m; m &= m - 1) {
+                    int j = CountTrailingZeros(m);
+                    if (prim.Intersect(rays[j], &isects[j])) hits[j] = true;
+                }
+            }
+            packet.UpdateTMax();
+        } else if (mask) {
+            // Advance to the near child for the first active ray
+            int first = CountTrailingZeros(mask);
+            if (packet.dirIsNeg[node->axis] & (1 << first)) {
+                nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                currentNodeIndex = node->secondChildOffset;
+            } else {
+                nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+                currentNodeIndex = currentNodeIndex + 1;
+            }
+            continue;
+        }
+        if (toVisitOffset == 0) break;
+        currentNodeIndex = nodesToVisit[--toVisitOffset];
+    }
+}
+
+static void IntersectPPacket(
+    const LinearBVHNode *nodes,
+    const std::vector<std::shared_ptr<Primitive>> &primitives,
+    const Ray *rays, bool *occluded, int n) {
+    ++nRayPackets;
+    nPacketRays += n;
+    BVHRayPacket packet(rays, n);
+    for (int i = 0; i < n; ++i) occluded[i] = false;
+    int active = (1 << n) - 1;
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    int nodesToVisit[64];
+    while (true) {
+        const LinearBVHNode *node = &nodes[currentNodeIndex];
+        int mask = packet.IntersectP(node->bounds) & active;
+        if (mask && node->nPrimitives > 0) {
+            // Retire rays that are occluded by primitives in the leaf
+            for (int i = 0; i < node->nPrimitives && mask; ++i) {
+                const Primitive &prim = *primitives[node->primitivesOffset + i];
+                for (int m = mask; m; m &= m - 1) {
+                    int j = CountTrailingZeros(m);
+                    if (prim.IntersectP(rays[j])) {
+                        occluded[j] = true;
+                        mask &= ~(1 << j);
+                        active &= ~(1 << j);
+                    }
+                }
+            }
+            if (!active) return;
+        } else if (mask) {
+            int first = CountTrailingZeros(mask);
+            if (packet.dirIsNeg[node->axis] & (1 << first)) {
+                nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                currentNodeIndex = node->secondChildOffset;
+            } else {
+                nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+                currentNodeIndex = currentNodeIndex + 1;
+            }
+            continue;
+        }
+        if (toVisitOffset == 0) break;
+        currentNodeIndex = nodesToVisit[--toVisitOffset];
+    }
+}
+#endif  // PBRT_BVH_SSE
+
+#if defined(PBRT_BVH_SSE) && !defined(PBRT_FLOAT_AS_DOUBLE)
+#define PBRT_BVH_TRIANGLE_CLUSTERS
+// TriangleCluster Declarations
+
+// Up to four triangles of a BVH leaf with their vertex positions stored in
+// SoA form, so that the watertight ray--triangle test runs for all of them
+// at once with SSE. The test performs the same floating-point operations
+// as _Triangle::Intersect()_; triangles that pass it, or that need its
+// double-precision fallback at edges, are then intersected through their
+// primitive to fill in the _SurfaceInteraction_.
+class TriangleCluster : public Aggregate {
+  public:
+    // TriangleCluster Public Methods
+    TriangleCluster(const std::shared_ptr<Primitive> *prims, int n);
+    static bool CanCluster(const Primitive &prim);
+    Bounds3f WorldBound() const { return bounds; }
+    bool Intersect(const Ray &ray, SurfaceInteraction *isect) const;
+    bool IntersectP(const Ray &ray) const;
+
+  private:
+    // TriangleCluster Private Methods
+    int Test(const Ray &ray, int *scalarMask) const;
+
+    // TriangleCluster Private Data
+    float p[3][3][4];  // [vertex][axis][triangle]
+    std::shared_ptr<Primitive> prims[4];
+    int nTriangles, alphaMask = 0;
+    Bounds3f bounds;
+};
+
+STAT_COUNTER("BVH/Triangle clusters", nTriangleClusters);
+STAT_PERCENT("Intersections/Triangle cluster tests passed to primitives",
+             nClusterScalarTests, nClusterTests);
+
+// TriangleCluster Method Definitions
+static const Triangle *ClusterTriangle(const Primitive &prim) {
+    const GeometricPrimitive *gp =
+        dynamic_cast<const GeometricPrimitive *>(&prim);
+    return gp ? dynamic_cast<const Triangle *>(gp->GetShape()) : nullptr;
+}
+
+bool TriangleCluster::CanCluster(const Primitive &prim) {
+    return ClusterTriangle(prim) != nullptr;
+}
+
+TriangleCluster::TriangleCluster(const std::shared_ptr<Primitive> *prim,
+                                 int n)
+    : nTriangles(n) {
+    CHECK(n > 0 && n <= 4);
+    ++nTriangleClusters;
+    for (int i = 0; i < 4; ++i) {
+        // Unused slots repeat the last triangle and are masked out
+        prims[i] = prim[std::min(i, n - 1)];
+        const Triangle *tri = ClusterTriangle(*prims[i]);
+        Point3f v[3];
+        tri->GetVertices(v);
+        for (int j = 0; j < 3; ++j)
+            for (int a = 0; a < 3; ++a) p[j][a][i] = v[j][a];
+        if (i < n) {
+            bounds = Union(bounds, prims[i]->WorldBound());
+            if (tri->HasAlphaTexture()) alphaMask |= 1 << i;
+        }
+    }
+}
+
+// Returns the triangles that the ray hits, excluding the ones in
+// _scalarMask_ whose edge functions need the scalar test's double-precision
+// fallback.
+int TriangleCluster::Test(const Ray &ray, int *scalarMask) const {
+    ++nClusterTests;
+    // Permute components of the ray direction and compute shear
+    int kz = MaxDimension(Abs(ray.d));
+    int kx = kz + 1;
+    if (kx == 3) kx = 0;
+    int ky = kx + 1;
+    if (ky == 3) ky = 0;
+    Vector3f d = Permute(ray.d, kx, ky, kz);
+    Float Sx = -d.x / d.z;
+    Float Sy = -d.y / d.z;
+    Float Sz = 1.f / d.z;
+
+    // Translate, permute and shear the vertices of all triangles
+    __m128 pt[3][3];
+    const int axes[3] = {kx, ky, kz};
+    for (int j = 0; j < 3; ++j) {
+        for (int a = 0; a < 3; ++a)
+            pt[j][a] = _mm_sub_ps(_mm_loadu_ps(p[j][axes[a]]),
+                                  _mm_set1_ps(ray.o[axes[a]]));
+        pt[j][0] = _mm_add_ps(pt[j][0],
+                              _mm_mul_ps(_mm_set1_ps(Sx), pt[j][2]));
+        pt[j][1] = _mm_add_ps(pt[j][1],
+                              _mm_mul_ps(_mm_set1_ps(Sy), pt[j][2]));
+    }
+
+    // Compute edge function coefficients and perform edge tests
+    __m128 e0 = _mm_sub_ps(_mm_mul_ps(pt[1][0], pt[2][1]),
+                           _mm_mul_ps(pt[1][1], pt[2][0]));
+    __m128 e1 = _mm_sub_ps(_mm_mul_ps(pt[2][0], pt[0][1]),
+                           _mm_mul_ps(pt[2][1], pt[0][0]));
+    __m128 e2 = _mm_sub_ps(_mm_mul_ps(pt[0][0], pt[1][1]),
+                           _mm_mul_ps(pt[0][1], pt[1][0]));
+    const __m128 zero = _mm_setzero_ps();
+    int used = (1 << nTriangles) - 1;
+    *scalarMask = used & _mm_movemask_ps(_mm_or_ps(
+                             _mm_or_ps(_mm_cmpeq_ps(e0, zero),
+                                       _mm_cmpeq_ps(e1, zero)),
+                             _mm_cmpeq_ps(e2, zero)));
+    int mask = used & ~*scalarMask;
+    __m128 anyNeg = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(e0, zero),
+                                        _mm_cmplt_ps(e1, zero)),
+                              _mm_cmplt_ps(e2, zero));
+    __m128 anyPos = _mm_or_ps(_mm_or_ps(_mm_cmpgt_ps(e0, zero),
+                                        _mm_cmpgt_ps(e1, zero)),
+                              _mm_cmpgt_ps(e2, zero));
+    mask &= ~_mm_movemask_ps(_mm_and_ps(anyNeg, anyPos));
+    __m128 det = _mm_add_ps(_mm_add_ps(e0, e1), e2);
+    mask &= ~_mm_movemask_ps(_mm_cmpeq_ps(det, zero));
+    if (!mask) return 0;
+
+    // Compute scaled hit distance and test against ray $t$ range
+    __m128 sz = _mm_set1_ps(Sz);
+    for (int j = 0; j < 3; ++j) pt[j][2] = _mm_mul_ps(pt[j][2], sz);
+    __m128 tScaled = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e0, pt[0][2]),
+                                           _mm_mul_ps(e1, pt[1][2])),
+                                _mm_mul_ps(e2, pt[2][2]));
+    __m128 tMaxDet = _mm_mul_ps(_mm_set1_ps(ray.tMax), det);
+    __m128 negOut = _mm_and_ps(_mm_cmplt_ps(det, zero),
+                               _mm_or_ps(_mm_cmpge_ps(tScaled, zero),
+                                         _mm_cmplt_ps(tScaled, tMaxDet)));
+    __m128 posOut = _mm_and_ps(_mm_cmpgt_ps(det, zero),
+                               _mm_or_ps(_mm_cmple_ps(tScaled, zero),
+                                         _mm_cmpgt_ps(tScaled, tMaxDet)));
+    mask &= ~_mm_movemask_ps(_mm_or_ps(negOut, posOut));
+    if (!mask) return 0;
+
+    // Ensure that computed triangle $t$ is conservatively greater than zero
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    auto abs = [&](__m128 v) { return _mm_and_ps(v, absMask); };
+    auto max3 = [&](__m128 a, __m128 b, __m128 c) {
+        return _mm_max_ps(abs(a), _mm_max_ps(abs(b), abs(c)));
+    };
+    __m128 invDet = _mm_div_ps(_mm_set1_ps(1.f), det);
+    __m128 t = _mm_mul_ps(tScaled, invDet);
+    __m128 maxZt = max3(pt[0][2], pt[1][2], pt[2][2]);
+    __m128 deltaZ = _mm_mul_ps(_mm_set1_ps(gamma(3)), maxZt);
+    __m128 maxXt = max3(pt[0][0], pt[1][0], pt[2][0]);
+    __m128 maxYt = max3(pt[0][1], pt[1][1], pt[2][1]);
+    __m128 deltaX =
+        _mm_mul_ps(_mm_set1_ps(gamma(5)), _mm_add_ps(maxXt, maxZt));
+    __m128 deltaY =
+        _mm_mul_ps(_mm_set1_ps(gamma(5)), _mm_add_ps(maxYt, maxZt));
+    __m128 deltaE = _mm_mul_ps(
+        _mm_set1_ps(2.f),
+        _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(_mm_mul_ps(_mm_set1_ps(gamma(2)), maxXt),
+                                  maxYt),
+                       _mm_mul_ps(deltaY, maxXt)),
+            _mm_mul_ps(deltaX, maxYt)));
+    __m128 maxE = max3(e0, e1, e2);
+    __m128 deltaT = _mm_mul_ps(
+        _mm_mul_ps(
+            _mm_set1_ps(3.f),
+            _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(_mm_mul_ps(_mm_set1_ps(gamma(3)), maxE),
+                                      maxZt),
+                           _mm_mul_ps(deltaE, maxZt)),
+                _mm_mul_ps(deltaZ, maxE))),
+        abs(invDet));
+    return mask & _mm_movemask_ps(_mm_cmpgt_ps(t, deltaT));
+}
+
+bool TriangleCluster::Intersect(const Ray &ray,
+                                SurfaceInteraction *isect) const {
+    int scalarMask;
+    int mask = Test(ray, &scalarMask) | scalarMask;
+    if (mask) ++nClusterScalarTests;
+    bool hit = false;
+    for (int i = 0; i < nTriangles; ++i)
+        if ((mask & (1 << i)) && prims[i]->Intersect(ray, isect)) hit = true;
+    return hit;
+}
+
+bool TriangleCluster::IntersectP(const Ray &ray) const {
+    int scalarMask;
+    int mask = Test(ray, &scalarMask);
+    // Without alpha textures, passing the test is a hit
+    if (mask & ~alphaMask) return true;
+    mask |= scalarMask;
+    if (mask) ++nClusterScalarTests;
+    for (int i = 0; i < nTriangles; ++i)
+        if ((mask & (1 << i)) && prims[i]->IntersectP(ray)) return true;
+    return false;
+}
+
+// Replaces the primitives of leaves that only hold triangles with
+// _TriangleCluster_s, appending the new leaf contents to _clustered_
+static void ClusterTriangles(
+    BVHBuildNode *node, const std::vector<std::shared_ptr<Primitive>> &prims,
+    std::vector<std::shared_ptr<Primitive>> *clustered) {
+    if (node->nPrimitives == 0) {
+        ClusterTriangles(node->children[0], prims, clustered);
+        ClusterTriangles(node->children[1], prims, clustered);
+        return;
+    }
+    const std::shared_ptr<Primitive> *first = &prims[node->firstPrimOffset];
+    int n = node->nPrimitives;
+    node->firstPrimOffset = clustered->size();
+    bool allTriangles = n > 1;
+    for (int i = 0; i < n; ++i)
+        allTriangles &= TriangleCluster::CanCluster(*first[i]);
+    if (!allTriangles) {
+        clustered->insert(clustered->end(), first, first + n);
+        return;
+    }
+    for (int i = 0; i < n; i += 4)
+        clustered->push_back(
+            std::make_shared<TriangleCluster>(first + i, std::min(4, n - i)));
+    node->nPrimitives = (n + 3) / 4;
+}
+#endif  // PBRT_BVH_SSE && !PBRT_FLOAT_AS_DOUBLE
+
 // BVHAccel Method Definitions
 BVHAccel::BVHAccel(std::vector<std::shared_ptr<Primitive>> p,
-                   int maxPrimsInNode, SplitMethod splitMethod)
+                   int maxPrimsInNode, SplitMethod splitMethod, int width,
+                   bool triangleClusters)
     : maxPrimsInNode(std::min(255, maxPrimsInNode)),
       splitMethod(splitMethod),
       primitives(std::move(p)) {
@@ -195,25 +837,62 @@ BVHAccel::BVHAccel(std::vector<std::shared_ptr<Primitive>> p,
         primitiveInfo[i] = {i, primitives[i]->WorldBound()};
 
     // Build BVH tree for primitives using _primitiveInfo_
-    MemoryArena arena(1024 * 1024);
+    std::vector<MemoryArena> threadArenas(MaxThreadIndex());
+    MemoryArena &arena = threadArenas[0];
     int totalNodes = 0;
     std::vector<std::shared_ptr<Primitive>> orderedPrims;
-    orderedPrims.reserve(primitives.size());
     BVHBuildNode *root;
-    if (splitMethod == SplitMethod::HLBVH)
+    if (splitMethod == SplitMethod::HLBVH) {
+        orderedPrims.reserve(primitives.size());
         root = HLBVHBuild(arena, primitiveInfo, &totalNodes, orderedPrims);
-    else
-        root = recursiveBuild(arena, primitiveInfo, 0, primitives.size(),
-                              &totalNodes, orderedPrims);
+    } else {
+        std::atomic<int> atomicTotal(0);
+        root = recursiveBuild(threadArenas.data(), primitiveInfo, 0,
+                              primitives.size(), &atomicTotal);
+        totalNodes = atomicTotal;
+        // Order primitives as they were partitioned during the build
+        orderedPrims.resize(primitives.size());
+        ParallelFor([&](int64_t i) {
+            orderedPrims[i] = primitives[primitiveInfo[i].primitiveNumber];
+        }, primitives.size(), binningChunkSize);
+    }
     primitives.swap(orderedPrims);
     primitiveInfo.resize(0);
+    bounds = root->bounds;
+#ifdef PBRT_BVH_TRIANGLE_CLUSTERS
+    if (triangleClusters) {
+        std::vector<std::shared_ptr<Primitive>> clustered;
+        ClusterTriangles(root, primitives, &clustered);
+        primitives.swap(clustered);
+    }
+#endif
+    size_t arenaBytes = 0;
+    for (const MemoryArena &a : threadArenas) arenaBytes += a.TotalAllocated();
+    if (width == 4 || width == 8) {
+        // Collapse the binary BVH into a wide BVH
+        int nWideNodes;
+        size_t nodeBytes;
+        if (width == 4) {
+            nodes4 = CreateWideBVH<4>(root, &nWideNodes);
+            nodeBytes = nWideNodes * sizeof(WideBVHNode<4>);
+        } else {
+            nodes8 = CreateWideBVH<8>(root, &nWideNodes);
+            nodeBytes = nWideNodes * sizeof(WideBVHNode<8>);
+        }
+        LOG(INFO) << StringPrintf("%d-wide BVH created with %d nodes for %d "
+                                  "primitives (%.2f MB)", width, nWideNodes,
+                                  (int)primitives.size(),
+                                  float(nodeBytes) / (1024.f * 1024.f));
+        treeBytes += nodeBytes + sizeof(*this) +
+                     primitives.size() * sizeof(primitives[0]);
+        return;
+    }
     LOG(INFO) << StringPrintf("BVH created with %d nodes for %d "
                               "primitives (%.2f MB), arena allocated %.2f MB",
                               totalNodes, (int)primitives.size(),
                               float(totalNodes * sizeof(LinearBVHNode)) /
                               (1024.f * 1024.f),
-                              float(arena.TotalAllocated()) /
-                              (1024.f * 1024.f));
+                              float(arenaBytes) / (1024.f * 1024.f));
 
     // Compute representation of depth-first traversal of BVH tree
     treeBytes += totalNodes * sizeof(LinearBVHNode) + sizeof(*this) +
@@ -224,9 +903,7 @@ BVHAccel::BVHAccel(std::vector<std::shared_ptr<Primitive>> p,
     CHECK_EQ(totalNodes, offset);
 }
 
-Bounds3f BVHAccel::WorldBound() const {
-    return nodes ? nodes[0].bounds : Bounds3f();
-}
+Bounds3f BVHAccel::WorldBound() const { return bounds; }
 
 struct BucketInfo {
     int count = 0;
@@ -234,43 +911,50 @@ struct BucketInfo {
 };
 
 BVHBuildNode *BVHAccel::recursiveBuild(
-    MemoryArena &arena, std::vector<BVHPrimitiveInfo> &primitiveInfo, int start,
-    int end, int *totalNodes,
-    std::vector<std::shared_ptr<Primitive>> &orderedPrims) {
+    MemoryArena *threadArenas, std::vector<BVHPrimitiveInfo> &primitiveInfo,
+    int start, int end, std::atomic<int> *totalNodes) {
     CHECK_NE(start, end);
-    BVHBuildNode *node = arena.Alloc<BVHBuildNode>();
-    (*totalNodes)++;
-    // Compute bounds of all primitives in BVH node
-    Bounds3f bounds;
-    for (int i = start; i < end; ++i)
-        bounds = Union(bounds, primitiveInfo[i].bounds);
+    CHECK_LT(ThreadIndex, MaxThreadIndex());
+    BVHBuildNode *node = threadArenas[ThreadIndex].Alloc<BVHBuildNode>();
+    ++*totalNodes;
+    // Compute bounds of all primitives and their centroids in BVH node
     int nPrimitives = end - start;
-    if (nPrimitives == 1) {
-        // Create leaf _BVHBuildNode_
-        int firstPrimOffset = orderedPrims.size();
+    Bounds3f bounds, centroidBounds;
+    if (nPrimitives < parallelBinningMinPrimitives) {
         for (int i = start; i < end; ++i) {
-            int primNum = primitiveInfo[i].primitiveNumber;
-            orderedPrims.push_back(primitives[primNum]);
+            bounds = Union(bounds, primitiveInfo[i].bounds);
+            centroidBounds = Union(centroidBounds, primitiveInfo[i].centroid);
         }
-        node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
+    } else {
+        int nChunks = (nPrimitives + binningChunkSize - 1) / binningChunkSize;
+        std::vector<Bounds3f> chunkBounds(nChunks), chunkCentroidBounds(nChunks);
+        ParallelFor([&](int64_t chunk) {
+            int chunkEnd = std::min(end, start + int(chunk + 1) * binningChunkSize);
+            for (int i = start + chunk * binningChunkSize; i < chunkEnd; ++i) {
+                chunkBounds[chunk] =
+                    Union(chunkBounds[chunk], primitiveInfo[i].bounds);
+                chunkCentroidBounds[chunk] = Union(chunkCentroidBounds[chunk],
+                                                   primitiveInfo[i].centroid);
+            }
+        }, nChunks, 1);
+        for (int chunk = 0; chunk < nChunks; ++chunk) {
+            bounds = Union(bounds, chunkBounds[chunk]);
+            centroidBounds = Union(centroidBounds, chunkCentroidBounds[chunk]);
+        }
+    }
+    if (nPrimitives == 1) {
+        // Create leaf _BVHBuildNode_
+        node->InitLeaf(start, nPrimitives, bounds);
         return node;
     } else {
-        // Compute bound of primitive centroids, choose split dimension _dim_
-        Bounds3f centroidBounds;
-        for (int i = start; i < end; ++i)
-            centroidBounds = Union(centroidBounds, primitiveInfo[i].centroid);
+        // Choose split dimension _dim_
         int dim = centroidBounds.MaximumExtent();
 
         // Partition primitives into two sets and build children
         int mid = (start + end) / 2;
         if (centroidBounds.pMax[dim] == centroidBounds.pMin[dim]) {
             // Create leaf _BVHBuildNode_
-            int firstPrimOffset = orderedPrims.size();
-            for (int i = start; i < end; ++i) {
-                int primNum = primitiveInfo[i].primitiveNumber;
-                orderedPrims.push_back(primitives[primNum]);
-            }
-            node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
+            node->InitLeaf(start, nPrimitives, bounds);
             return node;
         } else {
             // Partition primitives based on _splitMethod_
@@ -321,16 +1005,42 @@ BVHBuildNode *BVHAccel::recursiveBuild(
                     BucketInfo buckets[nBuckets];
 
                     // Initialize _BucketInfo_ for SAH partition buckets
-                    for (int i = start; i < end; ++i) {
-                        int b = nBuckets *
-                                centroidBounds.Offset(
-                                    primitiveInfo[i].centroid)[dim];
-                        if (b == nBuckets) b = nBuckets - 1;
-                        CHECK_GE(b, 0);
-                        CHECK_LT(b, nBuckets);
-                        buckets[b].count++;
-                        buckets[b].bounds =
-                            Union(buckets[b].bounds, primitiveInfo[i].bounds);
+                    auto addToBuckets = [&](int i0, int i1,
+                                            BucketInfo *buckets) {
+                        for (int i = i0; i < i1; ++i) {
+                            int b = nBuckets *
+                                    centroidBounds.Offset(
+                                        primitiveInfo[i].centroid)[dim];
+                            if (b == nBuckets) b = nBuckets - 1;
+                            CHECK_GE(b, 0);
+                            CHECK_LT(b, nBuckets);
+                            buckets[b].count++;
+                            buckets[b].bounds = Union(buckets[b].bounds,
+                                                      primitiveInfo[i].bounds);
+                        }
+                    };
+                    if (nPrimitives < parallelBinningMinPrimitives)
+                        addToBuckets(start, end, buckets);
+                    else {
+                        // Bin chunks of primitives in parallel and merge
+                        // the chunks' buckets
+                        int nChunks = (nPrimitives + binningChunkSize - 1) /
+                                      binningChunkSize;
+                        std::vector<BucketInfo> chunkBuckets(nChunks *
+                                                             nBuckets);
+                        ParallelFor([&](int64_t chunk) {
+                            int i0 = start + chunk * binningChunkSize;
+                            addToBuckets(i0, std::min(end, i0 + binningChunkSize),
+                                         &chunkBuckets[chunk * nBuckets]);
+                        }, nChunks, 1);
+                        for (int chunk = 0; chunk < nChunks; ++chunk)
+                            for (int b = 0; b < nBuckets; ++b) {
+                                const BucketInfo &cb =
+                                    chunkBuckets[chunk * nBuckets + b];
+                                buckets[b].count += cb.count;
+                                buckets[b].bounds =
+                                    Union(buckets[b].bounds, cb.bounds);
+                            }
                     }
 
                     // Compute costs for splitting after each bucket
@@ -379,23 +1089,31 @@ BVHBuildNode *BVHAccel::recursiveBuild(
                         mid = pmid - &primitiveInfo[0];
                     } else {
                         // Create leaf _BVHBuildNode_
-                        int firstPrimOffset = orderedPrims.size();
-                        for (int i = start; i < end; ++i) {
-                            int primNum = primitiveInfo[i].primitiveNumber;
-                            orderedPrims.push_back(primitives[primNum]);
-                        }
-                        node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
+                        node->InitLeaf(start, nPrimitives, bounds);
                         return node;
                     }
                 }
                 break;
             }
             }
-            node->InitInterior(dim,
-                               recursiveBuild(arena, primitiveInfo, start, mid,
-                                              totalNodes, orderedPrims),
-                               recursiveBuild(arena, primitiveInfo, mid, end,
-                                              totalNodes, orderedPrims));
+            // Build the children, in parallel for large nodes. Leaves refer
+            // to their primitives by position in _primitiveInfo_, so the
+            // result doesn't depend on the order subtrees are built in.
+            BVHBuildNode *children[2];
+            auto buildChild = [&](int64_t c) {
+                children[c] = c == 0 ? recursiveBuild(threadArenas,
+                                                      primitiveInfo, start,
+                                                      mid, totalNodes)
+                                     : recursiveBuild(threadArenas,
+                                                      primitiveInfo, mid, end,
+                                                      totalNodes);
+            };
+            if (nPrimitives < parallelBuildMinPrimitives) {
+                buildChild(0);
+                buildChild(1);
+            } else
+                ParallelFor(buildChild, 2, 1);
+            node->InitInterior(dim, children[0], children[1]);
         }
     }
     return node;
@@ -657,11 +1375,17 @@ int BVHAccel::flattenBVHTree(BVHBuildNode *node, int *offset) {
     return myOffset;
 }
 
-BVHAccel::~BVHAccel() { FreeAligned(nodes); }
+BVHAccel::~BVHAccel() {
+    FreeAligned(nodes);
+    FreeAligned(nodes4);
+    FreeAligned(nodes8);
+}
 
 bool BVHAccel::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
-    if (!nodes) return false;
     ProfilePhase p(Prof::AccelIntersect);
+    if (nodes4) return IntersectWideBVH(nodes4, primitives, ray, isect);
+    if (nodes8) return IntersectWideBVH(nodes8, primitives, ray, isect);
+    if (!nodes) return false;
     bool hit = false;
     Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
     int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
@@ -700,8 +1424,10 @@ bool BVHAccel::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
 }
 
 bool BVHAccel::IntersectP(const Ray &ray) const {
-    if (!nodes) return false;
     ProfilePhase p(Prof::AccelIntersectP);
+    if (nodes4) return IntersectPWideBVH(nodes4, primitives, ray);
+    if (nodes8) return IntersectPWideBVH(nodes8, primitives, ray);
+    if (!nodes) return false;
     Vector3f invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
     int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
     int nodesToVisit[64];
@@ -737,6 +1463,34 @@ bool BVHAccel::IntersectP(const Ray &ray) const {
     return false;
 }
 
+void BVHAccel::IntersectN(const Ray *rays, SurfaceInteraction *isects,
+                          bool *hits, int n) const {
+#ifdef PBRT_BVH_SSE
+    if (nodes) {
+        ProfilePhase p(Prof::AccelIntersect);
+        for (int i = 0; i < n; i += 4)
+            IntersectPacket(nodes, primitives, rays + i, isects + i, hits + i,
+                            std::min(4, n - i));
+        return;
+    }
+#endif
+    // Trace rays one at a time through wide BVHs
+    Aggregate::IntersectN(rays, isects, hits, n);
+}
+
+void BVHAccel::IntersectPN(const Ray *rays, bool *occluded, int n) const {
+#ifdef PBRT_BVH_SSE
+    if (nodes) {
+        ProfilePhase p(Prof::AccelIntersectP);
+        for (int i = 0; i < n; i += 4)
+            IntersectPPacket(nodes, primitives, rays + i, occluded + i,
+                             std::min(4, n - i));
+        return;
+    }
+#endif
+    Aggregate::IntersectPN(rays, occluded, n);
+}
+
 std::shared_ptr<BVHAccel> CreateBVHAccelerator(
     std::vector<std::shared_ptr<Primitive>> prims, const ParamSet &ps) {
     std::string splitMethodName = ps.FindOneString("splitmethod", "sah");
@@ -756,7 +1510,14 @@ std::shared_ptr<BVHAccel> CreateBVHAccelerator(
     }
 
     int maxPrimsInNode = ps.FindOneInt("maxnodeprims", 4);
-    return std::make_shared<BVHAccel>(std::move(prims), maxPrimsInNode, splitMethod);
+    int width = ps.FindOneInt("width", 2);
+    bool triangleClusters = ps.FindOneBool("triangleclusters", false);
+    if (width != 2 && width != 4 && width != 8) {
+        Warning("BVH width %d unsupported.  Using 2.", width);
+        width = 2;
+    }
+    return std::make_shared<BVHAccel>(std::move(prims), maxPrimsInNode,
+                                      splitMethod, width, triangleClusters);
 }
 
 }  // namespace pbrt
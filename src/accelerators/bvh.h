@@ -50,6 +50,8 @@ struct BVHBuildNode;
 struct BVHPrimitiveInfo;
 struct MortonPrimitive;
 struct LinearBVHNode;
+template <int N>
+struct WideBVHNode;
 
 // BVHAccel Declarations
 class BVHAccel : public Aggregate {
@@ -60,18 +62,21 @@ class BVHAccel : public Aggregate {
     // BVHAccel Public Methods
     BVHAccel(std::vector<std::shared_ptr<Primitive>> p,
              int maxPrimsInNode = 1,
-             SplitMethod splitMethod = SplitMethod::SAH);
+             SplitMethod splitMethod = SplitMethod::SAH, int width = 2,
+             bool triangleClusters = false);
     Bounds3f WorldBound() const;
     ~BVHAccel();
     bool Intersect(const Ray &ray, SurfaceInteraction *isect) const;
     bool IntersectP(const Ray &ray) const;
+    void IntersectN(const Ray *rays, SurfaceInteraction *isects, bool *hits,
+                    int n) const;
+    void IntersectPN(const Ray *rays, bool *occluded, int n) const;
 
   private:
     // BVHAccel Private Methods
     BVHBuildNode *recursiveBuild(
-        MemoryArena &arena, std::vector<BVHPrimitiveInfo> &primitiveInfo,
-        int start, int end, int *totalNodes,
-        std::vector<std::shared_ptr<Primitive>> &orderedPrims);
+        MemoryArena *threadArenas, std::vector<BVHPrimitiveInfo> &primitiveInfo,
+        int start, int end, std::atomic<int> *totalNodes);
     BVHBuildNode *HLBVHBuild(
         MemoryArena &arena, const std::vector<BVHPrimitiveInfo> &primitiveInfo,
         int *totalNodes,
@@ -91,7 +96,11 @@ class BVHAccel : public Aggregate {
     const int maxPrimsInNode;
     const SplitMethod splitMethod;
     std::vector<std::shared_ptr<Primitive>> primitives;
+    Bounds3f bounds;
+    // Exactly one of the binary or 4- or 8-wide node arrays is used
     LinearBVHNode *nodes = nullptr;
+    WideBVHNode<4> *nodes4 = nullptr;
+    WideBVHNode<8> *nodes8 = nullptr;
 };
 
 std::shared_ptr<BVHAccel> CreateBVHAccelerator(
@@ -0,0 +1,267 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+// accelerators/compactmesh.cpp*
+#include "accelerators/compactmesh.h"
+#include "interaction.h"
+#include "material.h"
+#include "stats.h"
+#include <algorithm>
+
+namespace pbrt {
+
+STAT_MEMORY_COUNTER("Memory/Compact mesh BVH", compactTreeBytes);
+STAT_COUNTER("Scene/Compact triangle meshes", nCompactMeshes);
+STAT_RATIO("BVH/Triangles per compact mesh leaf node", nLeafTriangles,
+           nCompactLeafNodes);
+
+// CompactMeshPrimitive Local Definitions
+static PBRT_CONSTEXPR int maxTrianglesInNode = 4;
+
+// CompactMeshPrimitive Method Definitions
+CompactMeshPrimitive::CompactMeshPrimitive(
+    TriangleMesh &triMesh, const Transform *ObjectToWorld,
+    bool reverseOrientation, const std::shared_ptr<Material> &material,
+    const MediumInterface &mediumInterface)
+    : material(material), mediumInterface(mediumInterface) {
+    ProfilePhase _(Prof::AccelConstruction);
+    ++nCompactMeshes;
+    // Build the BVH over the mesh's triangles; leaves refer to ranges of
+    // the reordered _triangles_, which the compact mesh is stored in
+    std::vector<int> triangles(triMesh.nTriangles);
+    std::vector<Bounds3f> triangleBounds(triMesh.nTriangles);
+    for (int i = 0; i < triMesh.nTriangles; ++i) {
+        triangles[i] = i;
+        const int *v = &triMesh.vertexIndices[3 * i];
+        triangleBounds[i] = Union(Bounds3f(triMesh.p[v[0]], triMesh.p[v[1]]),
+                                  triMesh.p[v[2]]);
+    }
+    if (!triangles.empty()) BuildNode(triangles, triangleBounds, 0, triangles.size());
+    nodes.shrink_to_fit();
+    compactTreeBytes += nodes.size() * sizeof(Node) + sizeof(*this);
+    std::vector<Bounds3f>().swap(triangleBounds);
+
+    mesh.reset(new CompactTriangleMesh(triMesh, triangles, reverseOrientation,
+                                       ObjectToWorld->SwapsHandedness()));
+}
+
+int CompactMeshPrimitive::BuildNode(std::vector<int> &triangles,
+                                    const std::vector<Bounds3f> &triangleBounds,
+                                    int start, int end) {
+    int nodeIndex = nodes.size();
+    nodes.push_back(Node());
+    // Compute bounds of triangles and of their centroids
+    Bounds3f bounds, centroidBounds;
+    for (int i = start; i < end; ++i) {
+        const Bounds3f &b = triangleBounds[triangles[i]];
+        bounds = Union(bounds, b);
+        centroidBounds = Union(centroidBounds, .5f * b.pMin + .5f * b.pMax);
+    }
+    nodes[nodeIndex].bounds = bounds;
+    int nTriangles = end - start;
+    int dim = centroidBounds.MaximumExtent();
+    auto centroid = [&](int tri) {
+        const Bounds3f &b = triangleBounds[tri];
+        return .5f * b.pMin + .5f * b.pMax;
+    };
+
+    // Leaves are always filled up to _maxTrianglesInNode_, trading a few
+    // more intersection tests for a BVH with fewer nodes
+    int mid = -1;
+    if (nTriangles <= maxTrianglesInNode)
+        ;
+    else if (centroidBounds.pMax[dim] == centroidBounds.pMin[dim])
+        mid = (start + end) / 2;
+    else {
+        // Partition triangles using approximate SAH
+        PBRT_CONSTEXPR int nBuckets = 12;
+        int counts[nBuckets] = {0};
+        Bounds3f bucketBounds[nBuckets];
+        auto bucket = [&](int tri) {
+            int b = nBuckets * centroidBounds.Offset(centroid(tri))[dim];
+            return std::min(b, nBuckets - 1);
+        };
+        for (int i = start; i < end; ++i) {
+            int b = bucket(triangles[i]);
+            ++counts[b];
+            bucketBounds[b] = Union(bucketBounds[b], triangleBounds[triangles[i]]);
+        }
+
+        // Compute costs for splitting after each bucket
+        Float minCost = Infinity;
+        int minCostSplitBucket = 0;
+        for (int i = 0; i < nBuckets - 1; ++i) {
+            Bounds3f b0, b1;
+            int count0 = 0, count1 = 0;
+            for (int j = 0; j <= i; ++j) {
+                b0 = Union(b0, bucketBounds[j]);
+                count0 += counts[j];
+            }
+            for (int j = i + 1; j < nBuckets; ++j) {
+                b1 = Union(b1, bucketBounds[j]);
+                count1 += counts[j];
+            }
+            Float cost = .125f + (count0 * b0.SurfaceArea() +
+                                  count1 * b1.SurfaceArea()) /
+                                     bounds.SurfaceArea();
+            if (cost < minCost) {
+                minCost = cost;
+                minCostSplitBucket = i;
+            }
+        }
+
+        // Split triangles at selected SAH bucket
+        int *pmid = std::partition(
+            &triangles[start], &triangles[end - 1] + 1,
+            [&](int tri) { return bucket(tri) <= minCostSplitBucket; });
+        mid = pmid - &triangles[0];
+        if (mid == start || mid == end) mid = (start + end) / 2;
+    }
+
+    if (mid == -1) {
+        // Create leaf _Node_
+        nodes[nodeIndex].trianglesOffset = start;
+        nodes[nodeIndex].nTriangles = nTriangles;
+        ++nCompactLeafNodes;
+        nLeafTriangles += nTriangles;
+    } else {
+        // Build children; the first one directly follows _nodeIndex_
+        BuildNode(triangles, triangleBounds, start, mid);
+        int second = BuildNode(triangles, triangleBounds, mid, end);
+        nodes[nodeIndex].secondChildOffset = second;
+        nodes[nodeIndex].nTriangles = 0;
+        nodes[nodeIndex].axis = dim;
+    }
+    return nodeIndex;
+}
+
+Bounds3f CompactMeshPrimitive::WorldBound() const {
+    return nodes.empty() ? Bounds3f() : nodes[0].bounds;
+}
+
+bool CompactMeshPrimitive::Intersect(const Ray &ray,
+                                     SurfaceInteraction *isect) const {
+    if (nodes.empty()) return false;
+    bool hit = false;
+    Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    // Follow ray through BVH nodes to find triangle intersections
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    int nodesToVisit[64];
+    while (true) {
+        const Node *node = &nodes[currentNodeIndex];
+        if (node->bounds.IntersectP(ray, invDir, dirIsNeg)) {
+            if (node->nTriangles > 0) {
+                // Intersect ray with triangles in leaf node
+                for (int i = 0; i < node->nTriangles; ++i) {
+                    Float tHit;
+                    if (mesh->Intersect(node->trianglesOffset + i, ray, &tHit,
+                                        isect)) {
+                        ray.tMax = tHit;
+                        hit = true;
+                    }
+                }
+                if (toVisitOffset == 0) break;
+                currentNodeIndex = nodesToVisit[--toVisitOffset];
+            } else {
+                // Put far node on _nodesToVisit_ stack, advance to near node
+                if (dirIsNeg[node->axis]) {
+                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex = node->secondChildOffset;
+                } else {
+                    nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+            }
+        } else {
+            if (toVisitOffset == 0) break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
+    if (!hit) return false;
+
+    isect->primitive = this;
+    CHECK_GE(Dot(isect->n, isect->shading.n), 0.);
+    // Initialize _SurfaceInteraction::mediumInterface_ after triangle
+    // intersection
+    if (mediumInterface.IsMediumTransition())
+        isect->mediumInterface = mediumInterface;
+    else
+        isect->mediumInterface = MediumInterface(ray.medium);
+    return true;
+}
+
+bool CompactMeshPrimitive::IntersectP(const Ray &ray) const {
+    if (nodes.empty()) return false;
+    Vector3f invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
+    int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    int nodesToVisit[64];
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    while (true) {
+        const Node *node = &nodes[currentNodeIndex];
+        if (node->bounds.IntersectP(ray, invDir, dirIsNeg)) {
+            // Process node for occlusion test
+            if (node->nTriangles > 0) {
+                for (int i = 0; i < node->nTriangles; ++i)
+                    if (mesh->IntersectP(node->trianglesOffset + i, ray))
+                        return true;
+                if (toVisitOffset == 0) break;
+                currentNodeIndex = nodesToVisit[--toVisitOffset];
+            } else {
+                if (dirIsNeg[node->axis]) {
+                    // Second child first
+                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex = node->secondChildOffset;
+                } else {
+                    nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+            }
+        } else {
+            if (toVisitOffset == 0) break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
+    return false;
+}
+
+void CompactMeshPrimitive::ComputeScatteringFunctions(
+    SurfaceInteraction *isect, MemoryArena &arena, TransportMode mode,
+    bool allowMultipleLobes) const {
+    ProfilePhase p(Prof::ComputeScatteringFuncs);
+    if (material)
+        material->ComputeScatteringFunctions(isect, arena, mode,
+                                             allowMultipleLobes);
+    CHECK_GE(Dot(isect->n, isect->shading.n), 0.);
+}
+
+}  // namespace pbrt
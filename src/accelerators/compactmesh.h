@@ -0,0 +1,97 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_ACCELERATORS_COMPACTMESH_H
+#define PBRT_ACCELERATORS_COMPACTMESH_H
+
+// accelerators/compactmesh.h*
+#include "pbrt.h"
+#include "primitive.h"
+#include "shapes/triangle.h"
+
+namespace pbrt {
+
+// CompactMeshPrimitive Declarations
+// A whole triangle mesh as a single primitive: the mesh is stored as a
+// _CompactTriangleMesh_ and intersected through a BVH over its triangles,
+// so that there are no _Triangle_ or _GeometricPrimitive_ objects per
+// face. Area lights aren't supported; they need a _Shape_ per triangle.
+class CompactMeshPrimitive : public Primitive {
+  public:
+    // CompactMeshPrimitive Public Methods
+    // Takes over the vertex data of _mesh_.
+    CompactMeshPrimitive(TriangleMesh &mesh, const Transform *ObjectToWorld,
+                         bool reverseOrientation,
+                         const std::shared_ptr<Material> &material,
+                         const MediumInterface &mediumInterface);
+    Bounds3f WorldBound() const;
+    bool Intersect(const Ray &r, SurfaceInteraction *isect) const;
+    bool IntersectP(const Ray &r) const;
+    const AreaLight *GetAreaLight() const { return nullptr; }
+    const Material *GetMaterial() const { return material.get(); }
+    void ComputeScatteringFunctions(SurfaceInteraction *isect,
+                                    MemoryArena &arena, TransportMode mode,
+                                    bool allowMultipleLobes) const;
+
+  private:
+    // CompactMeshPrimitive Private Types
+    struct Node {
+        Bounds3f bounds;
+        union {
+            int trianglesOffset;    // leaf
+            int secondChildOffset;  // interior
+        };
+        uint16_t nTriangles;  // 0 -> interior node
+        uint8_t axis;         // interior node: xyz
+        uint8_t pad[1];       // ensure 32 byte total size
+    };
+
+    // CompactMeshPrimitive Private Methods
+    int BuildNode(std::vector<int> &triangles,
+                  const std::vector<Bounds3f> &triangleBounds, int start,
+                  int end);
+
+    // CompactMeshPrimitive Private Data
+    std::unique_ptr<CompactTriangleMesh> mesh;
+    std::vector<Node> nodes;
+    std::shared_ptr<Material> material;
+    MediumInterface mediumInterface;
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_ACCELERATORS_COMPACTMESH_H
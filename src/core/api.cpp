@@ -32,6 +32,7 @@
 
 // core/api.cpp*
 #include "api.h"
+#include "bssrdf.h"
 #include "parallel.h"
 #include "paramset.h"
 #include "spectrum.h"
@@ -42,6 +43,7 @@
 
 // API Additional Headers
 #include "accelerators/bvh.h"
+#include "accelerators/compactmesh.h"
 #include "accelerators/kdtreeaccel.h"
 #include "cameras/environment.h"
 #include "cameras/orthographic.h"
@@ -59,6 +61,7 @@
 #include "integrators/path.h"
 #include "integrators/sppm.h"
 #include "integrators/volpath.h"
+#include "integrators/wavefront.h"
 #include "integrators/whitted.h"
 #include "lights/diffuse.h"
 #include "lights/distant.h"
@@ -537,6 +540,31 @@ std::vector<std::shared_ptr<Shape>> MakeShapes(const std::string &name,
     return shapes;
 }
 
+// Triangle meshes are stored as a single _CompactMeshPrimitive_ when
+// requested, unless an area light needs a _Shape_ for each triangle.
+static bool UseCompactMesh(const std::string &name) {
+    return PbrtOptions.compactMeshes && !PbrtOptions.cat &&
+           !PbrtOptions.toPly && graphicsState.areaLight == "" &&
+           (name == "trianglemesh" || name == "plymesh");
+}
+
+static std::shared_ptr<Primitive> MakeCompactMesh(
+    const std::string &name, const Transform *object2world,
+    bool reverseOrientation, const ParamSet &paramSet) {
+    std::shared_ptr<TriangleMesh> mesh =
+        name == "plymesh"
+            ? CreatePLYMeshData(object2world, paramSet,
+                                &*graphicsState.floatTextures)
+            : CreateTriangleMeshData(object2world, paramSet,
+                                     &*graphicsState.floatTextures);
+    if (!mesh || mesh->nTriangles == 0) return nullptr;
+    std::shared_ptr<Material> mtl = graphicsState.GetMaterialForShape(paramSet);
+    paramSet.ReportUnused();
+    return std::make_shared<CompactMeshPrimitive>(
+        *mesh, object2world, reverseOrientation, mtl,
+        graphicsState.CreateMediumInterface());
+}
+
 STAT_COUNTER("Scene/Materials created", nMaterialsCreated);
 
 std::shared_ptr<Material> MakeMaterial(const std::string &name,
@@ -708,28 +736,40 @@ std::shared_ptr<Medium> MakeMedium(const std::string &name,
     if (name == "homogeneous") {
         m = new HomogeneousMedium(sig_a, sig_s, g);
     } else if (name == "heterogeneous") {
-        int nitems;
-        const Float *data = paramSet.FindFloat("density", &nitems);
-        if (!data) {
-            Error("No \"density\" values provided for heterogeneous medium?");
-            return NULL;
-        }
-        int nx = paramSet.FindOneInt("nx", 1);
-        int ny = paramSet.FindOneInt("ny", 1);
-        int nz = paramSet.FindOneInt("nz", 1);
         Point3f p0 = paramSet.FindOnePoint3f("p0", Point3f(0.f, 0.f, 0.f));
         Point3f p1 = paramSet.FindOnePoint3f("p1", Point3f(1.f, 1.f, 1.f));
-        if (nitems != nx * ny * nz) {
-            Error(
-                "GridDensityMedium has %d density values; expected nx*ny*nz = "
-                "%d",
-                nitems, nx * ny * nz);
-            return NULL;
-        }
         Transform data2Medium = Translate(Vector3f(p0)) *
                                 Scale(p1.x - p0.x, p1.y - p0.y, p1.z - p0.z);
-        m = new GridDensityMedium(sig_a, sig_s, g, nx, ny, nz,
-                                  medium2world * data2Medium, data);
+        std::string filename = paramSet.FindOneFilename("filename", "");
+        if (!filename.empty()) {
+            // Use the sparse density grid stored in _filename_
+            std::unique_ptr<SparseDensityGrid> grid =
+                SparseDensityGrid::Read(filename);
+            if (!grid) return NULL;
+            m = new GridDensityMedium(sig_a, sig_s, g, std::move(grid),
+                                      medium2world * data2Medium);
+        } else {
+            int nitems;
+            const Float *data = paramSet.FindFloat("density", &nitems);
+            if (!data) {
+                Error(
+                    "No \"density\" values or \"filename\" provided for "
+                    "heterogeneous medium?");
+                return NULL;
+            }
+            int nx = paramSet.FindOneInt("nx", 1);
+            int ny = paramSet.FindOneInt("ny", 1);
+            int nz = paramSet.FindOneInt("nz", 1);
+            if (nitems != nx * ny * nz) {
+                Error(
+                    "GridDensityMedium has %d density values; expected "
+                    "nx*ny*nz = %d",
+                    nitems, nx * ny * nz);
+                return NULL;
+            }
+            m = new GridDensityMedium(sig_a, sig_s, g, nx, ny, nz,
+                                      medium2world * data2Medium, data);
+        }
     } else
         Warning("Medium \"%s\" unknown.", name.c_str());
     paramSet.ReportUnused();
@@ -841,6 +881,19 @@ std::shared_ptr<Sampler> MakeSampler(const std::string &name,
         sampler = CreateStratifiedSampler(paramSet);
     else
         Warning("Sampler \"%s\" unknown.", name.c_str());
+    if (sampler) {
+        // Adaptive sampling parameters are shared by all samplers. Stopping
+        // early underestimates pixels whose first samples all miss a rare
+        // bright contribution, so by default a quarter of the samples are
+        // always taken.
+        int64_t spp = sampler->samplesPerPixel;
+        sampler->adaptiveMaxError =
+            paramSet.FindOneFloat("adaptivethreshold", 0.f);
+        sampler->adaptiveMinSamples = std::min<int64_t>(
+            paramSet.FindOneInt("adaptiveminsamples",
+                                std::max<int64_t>(16, spp / 4)),
+            spp);
+    }
     paramSet.ReportUnused();
     return std::shared_ptr<Sampler>(sampler);
 }
@@ -902,6 +955,7 @@ void pbrtCleanup() {
     else if (currentApiState == APIState::WorldBlock)
         Error("pbrtCleanup() called while inside world block.");
     currentApiState = APIState::Uninitialized;
+    WriteBSSRDFTableCache();
     ParallelCleanup();
     CleanupProfiler();
 }
@@ -1352,24 +1406,33 @@ void pbrtShape(const std::string &name, const ParamSet &params) {
         // Create shapes for shape _name_
         Transform *ObjToWorld = transformCache.Lookup(curTransform[0]);
         Transform *WorldToObj = transformCache.Lookup(Inverse(curTransform[0]));
-        std::vector<std::shared_ptr<Shape>> shapes =
-            MakeShapes(name, ObjToWorld, WorldToObj,
-                       graphicsState.reverseOrientation, params);
-        if (shapes.empty()) return;
-        std::shared_ptr<Material> mtl = graphicsState.GetMaterialForShape(params);
-        params.ReportUnused();
-        MediumInterface mi = graphicsState.CreateMediumInterface();
-        prims.reserve(shapes.size());
-        for (auto s : shapes) {
-            // Possibly create area light for shape
-            std::shared_ptr<AreaLight> area;
-            if (graphicsState.areaLight != "") {
-                area = MakeAreaLight(graphicsState.areaLight, curTransform[0],
-                                     mi, graphicsState.areaLightParams, s);
-                if (area) areaLights.push_back(area);
+        if (UseCompactMesh(name)) {
+            std::shared_ptr<Primitive> prim = MakeCompactMesh(
+                name, ObjToWorld, graphicsState.reverseOrientation, params);
+            if (!prim) return;
+            prims.push_back(prim);
+        } else {
+            std::vector<std::shared_ptr<Shape>> shapes =
+                MakeShapes(name, ObjToWorld, WorldToObj,
+                           graphicsState.reverseOrientation, params);
+            if (shapes.empty()) return;
+            std::shared_ptr<Material> mtl =
+                graphicsState.GetMaterialForShape(params);
+            params.ReportUnused();
+            MediumInterface mi = graphicsState.CreateMediumInterface();
+            prims.reserve(shapes.size());
+            for (auto s : shapes) {
+                // Possibly create area light for shape
+                std::shared_ptr<AreaLight> area;
+                if (graphicsState.areaLight != "") {
+                    area = MakeAreaLight(graphicsState.areaLight,
+                                         curTransform[0], mi,
+                                         graphicsState.areaLightParams, s);
+                    if (area) areaLights.push_back(area);
+                }
+                prims.push_back(
+                    std::make_shared<GeometricPrimitive>(s, mtl, area, mi));
             }
-            prims.push_back(
-                std::make_shared<GeometricPrimitive>(s, mtl, area, mi));
         }
     } else {
         // Initialize _prims_ and _areaLights_ for animated shape
@@ -1380,18 +1443,27 @@ void pbrtShape(const std::string &name, const ParamSet &params) {
                 "Ignoring currently set area light when creating "
                 "animated shape");
         Transform *identity = transformCache.Lookup(Transform());
-        std::vector<std::shared_ptr<Shape>> shapes = MakeShapes(
-            name, identity, identity, graphicsState.reverseOrientation, params);
-        if (shapes.empty()) return;
-
-        // Create _GeometricPrimitive_(s) for animated shape
-        std::shared_ptr<Material> mtl = graphicsState.GetMaterialForShape(params);
-        params.ReportUnused();
-        MediumInterface mi = graphicsState.CreateMediumInterface();
-        prims.reserve(shapes.size());
-        for (auto s : shapes)
-            prims.push_back(
-                std::make_shared<GeometricPrimitive>(s, mtl, nullptr, mi));
+        if (UseCompactMesh(name)) {
+            std::shared_ptr<Primitive> prim = MakeCompactMesh(
+                name, identity, graphicsState.reverseOrientation, params);
+            if (!prim) return;
+            prims.push_back(prim);
+        } else {
+            std::vector<std::shared_ptr<Shape>> shapes =
+                MakeShapes(name, identity, identity,
+                           graphicsState.reverseOrientation, params);
+            if (shapes.empty()) return;
+
+            // Create _GeometricPrimitive_(s) for animated shape
+            std::shared_ptr<Material> mtl =
+                graphicsState.GetMaterialForShape(params);
+            params.ReportUnused();
+            MediumInterface mi = graphicsState.CreateMediumInterface();
+            prims.reserve(shapes.size());
+            for (auto s : shapes)
+                prims.push_back(
+                    std::make_shared<GeometricPrimitive>(s, mtl, nullptr, mi));
+        }
 
         // Create single _TransformedPrimitive_ for _prims_
 
@@ -1614,6 +1686,10 @@ void pbrtWorldEnd() {
     if (PbrtOptions.cat || PbrtOptions.toPly) {
         printf("%*sWorldEnd\n", catIndentCount, "");
     } else {
+        // Wait for image textures that are still loading in the background
+        ImageTexture<Float, Float>::FinishLoading();
+        ImageTexture<RGBSpectrum, Spectrum>::FinishLoading();
+
         std::unique_ptr<Integrator> integrator(renderOptions->MakeIntegrator());
         std::unique_ptr<Scene> scene(renderOptions->MakeScene());
 
@@ -1693,6 +1769,9 @@ Integrator *RenderOptions::MakeIntegrator() const {
         integrator = CreatePathIntegrator(IntegratorParams, sampler, camera);
     else if (IntegratorName == "volpath")
         integrator = CreateVolPathIntegrator(IntegratorParams, sampler, camera);
+    else if (IntegratorName == "wavefront")
+        integrator =
+            CreateWavefrontPathIntegrator(IntegratorParams, sampler, camera);
     else if (IntegratorName == "bdpt") {
         integrator = CreateBDPTIntegrator(IntegratorParams, sampler, camera);
     } else if (IntegratorName == "mlt") {
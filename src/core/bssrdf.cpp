@@ -36,9 +36,17 @@
 #include "interpolation.h"
 #include "parallel.h"
 #include "scene.h"
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <tuple>
 
 namespace pbrt {
 
+STAT_COUNTER("Scene/BSSRDF tables computed", nBSSRDFTablesComputed);
+STAT_COUNTER("Scene/BSSRDF tables reused", nBSSRDFTablesReused);
+
 // BSSRDF Utility Functions
 Float FresnelMoment1(Float eta) {
     Float eta2 = eta * eta, eta3 = eta2 * eta, eta4 = eta3 * eta,
@@ -174,6 +182,200 @@ void ComputeBeamDiffusionBSSRDF(Float g, Float eta, BSSRDFTable *t) {
     }, t->nRhoSamples);
 }
 
+// BSSRDF Table Cache Definitions
+namespace {
+
+// The tabulated profile only depends on $g$, $\eta$ and the resolution of
+// the discretization, so materials with the same parameters can share a
+// single table.
+struct BSSRDFTableKey {
+    Float g, eta;
+    int nRhoSamples, nRadiusSamples;
+    bool operator<(const BSSRDFTableKey &k) const {
+        return std::tie(g, eta, nRhoSamples, nRadiusSamples) <
+               std::tie(k.g, k.eta, k.nRhoSamples, k.nRadiusSamples);
+    }
+};
+
+// A table is inserted into the cache before it's computed, so that the
+// lock needn't be held while _ComputeBeamDiffusionBSSRDF()_ runs; other
+// threads that want the same table wait for _ready_ to be set.
+struct BSSRDFTableEntry {
+    std::shared_ptr<BSSRDFTable> table;
+    std::atomic<bool> ready{false};
+};
+
+std::mutex bssrdfTableMutex;
+std::map<BSSRDFTableKey, std::shared_ptr<BSSRDFTableEntry>> bssrdfTables;
+// Table sizes for which the sidecar file has been read; only the tables of
+// sizes that are requested are loaded from it (and written back).
+std::set<std::pair<int, int>> bssrdfCacheSizesRead;
+// Set when tables have been computed that aren't in the sidecar file yet.
+bool bssrdfCacheFileStale = false;
+
+// The sidecar file stores all tables in the cache in native byte order;
+// files written with a different _Float_ size are ignored.
+const char bssrdfCacheHeader[8] = {'B', 'S', 'S', 'R', 'D', 'F', 'T', '\x01'};
+
+bool ReadBSSRDFCacheFile(const std::string &filename, int nRhoSamples,
+                         int nRadiusSamples) {
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (!f) return false;
+    fseek(f, 0, SEEK_END);
+    int64_t fileLength = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    auto read = [&](void *target, size_t size, size_t count) -> bool {
+        return fread(target, size, count, f) == count;
+    };
+    char header[8];
+    int32_t floatSize, nTables;
+    if (!read(header, 1, 8) || memcmp(header, bssrdfCacheHeader, 8) != 0 ||
+        !read(&floatSize, sizeof(int32_t), 1) || floatSize != sizeof(Float) ||
+        !read(&nTables, sizeof(int32_t), 1) || nTables < 0) {
+        fclose(f);
+        Warning("BSSRDF cache file \"%s\" has an incompatible format. Ignoring.",
+                filename.c_str());
+        return false;
+    }
+    // Tables that were read completely before any error are kept. Each
+    // table's sizes are checked against what's left of the file before
+    // anything is allocated for it, and tables of sizes other than the
+    // requested one are skipped.
+    int32_t nRead = 0, nLoaded = 0;
+    for (; nRead < nTables; ++nRead) {
+        Float g, eta;
+        int32_t nRho, nRadius;
+        if (!read(&g, sizeof(Float), 1) || !read(&eta, sizeof(Float), 1) ||
+            !read(&nRho, sizeof(int32_t), 1) ||
+            !read(&nRadius, sizeof(int32_t), 1) || nRho <= 0 || nRadius <= 0)
+            break;
+        int64_t tableSize =
+            (2 * (int64_t)nRho + nRadius + 2 * (int64_t)nRho * nRadius) *
+            sizeof(Float);
+        if (tableSize > fileLength - ftell(f)) break;
+        if (nRho != nRhoSamples || nRadius != nRadiusSamples) {
+            if (fseek(f, tableSize, SEEK_CUR) != 0) break;
+            continue;
+        }
+        std::shared_ptr<BSSRDFTable> t =
+            std::make_shared<BSSRDFTable>(nRho, nRadius);
+        if (!read(t->rhoSamples.get(), sizeof(Float), nRho) ||
+            !read(t->radiusSamples.get(), sizeof(Float), nRadius) ||
+            !read(t->profile.get(), sizeof(Float), nRho * nRadius) ||
+            !read(t->rhoEff.get(), sizeof(Float), nRho) ||
+            !read(t->profileCDF.get(), sizeof(Float), nRho * nRadius))
+            break;
+        std::shared_ptr<BSSRDFTableEntry> entry =
+            std::make_shared<BSSRDFTableEntry>();
+        entry->table = std::move(t);
+        entry->ready = true;
+        bssrdfTables.emplace(BSSRDFTableKey{g, eta, nRho, nRadius},
+                             std::move(entry));
+        ++nLoaded;
+    }
+    fclose(f);
+    if (nRead < nTables) {
+        Warning("BSSRDF cache file \"%s\" is truncated or corrupt; only read "
+                "%d of %d tables.", filename.c_str(), nRead, nTables);
+        return false;
+    }
+    LOG(INFO) << "Read " << nLoaded << " " << nRhoSamples << "x"
+              << nRadiusSamples << " BSSRDF tables from " << filename;
+    return true;
+}
+
+void WriteBSSRDFCacheFile(const std::string &filename) {
+    // Write to a temporary file first so that concurrent renders never
+    // see a partially-written cache.
+    std::string tmpFilename = filename + ".tmp";
+    FILE *f = fopen(tmpFilename.c_str(), "wb");
+    if (!f) {
+        Warning("Unable to write BSSRDF cache file \"%s\"", filename.c_str());
+        return;
+    }
+    auto write = [&](const void *source, size_t size, size_t count) -> bool {
+        return fwrite(source, size, count, f) == count;
+    };
+    int32_t floatSize = sizeof(Float), nTables = 0;
+    for (const auto &entry : bssrdfTables)
+        if (entry.second->ready) ++nTables;
+    bool ok = write(bssrdfCacheHeader, 1, 8) &&
+              write(&floatSize, sizeof(int32_t), 1) &&
+              write(&nTables, sizeof(int32_t), 1);
+    for (const auto &entry : bssrdfTables) {
+        if (!entry.second->ready) continue;
+        const BSSRDFTableKey &k = entry.first;
+        const BSSRDFTable &t = *entry.second->table;
+        int32_t nRho = k.nRhoSamples, nRadius = k.nRadiusSamples;
+        ok = ok && write(&k.g, sizeof(Float), 1) &&
+             write(&k.eta, sizeof(Float), 1) &&
+             write(&nRho, sizeof(int32_t), 1) &&
+             write(&nRadius, sizeof(int32_t), 1) &&
+             write(t.rhoSamples.get(), sizeof(Float), nRho) &&
+             write(t.radiusSamples.get(), sizeof(Float), nRadius) &&
+             write(t.profile.get(), sizeof(Float), nRho * nRadius) &&
+             write(t.rhoEff.get(), sizeof(Float), nRho) &&
+             write(t.profileCDF.get(), sizeof(Float), nRho * nRadius);
+    }
+    fclose(f);
+    if (!ok || rename(tmpFilename.c_str(), filename.c_str()) != 0) {
+        Warning("Error writing BSSRDF cache file \"%s\"", filename.c_str());
+        remove(tmpFilename.c_str());
+    }
+}
+
+}  // anonymous namespace
+
+std::shared_ptr<const BSSRDFTable> GetBeamDiffusionBSSRDFTable(
+    Float g, Float eta, int nRhoSamples, int nRadiusSamples) {
+    BSSRDFTableKey key{g, eta, nRhoSamples, nRadiusSamples};
+    std::shared_ptr<BSSRDFTableEntry> entry;
+    bool compute = false;
+    {
+        std::lock_guard<std::mutex> lock(bssrdfTableMutex);
+        const std::string &cacheFile = PbrtOptions.bssrdfCacheFile;
+        if (!cacheFile.empty() &&
+            bssrdfCacheSizesRead.insert({nRhoSamples, nRadiusSamples}).second)
+            ReadBSSRDFCacheFile(cacheFile, nRhoSamples, nRadiusSamples);
+
+        std::shared_ptr<BSSRDFTableEntry> &e = bssrdfTables[key];
+        if (!e) {
+            e = std::make_shared<BSSRDFTableEntry>();
+            e->table =
+                std::make_shared<BSSRDFTable>(nRhoSamples, nRadiusSamples);
+            compute = true;
+        }
+        entry = e;
+    }
+
+    if (compute) {
+        // Compute the table without holding the lock, since
+        // _ComputeBeamDiffusionBSSRDF()_ is itself parallelized over the
+        // albedo samples.
+        ComputeBeamDiffusionBSSRDF(g, eta, entry->table.get());
+        ++nBSSRDFTablesComputed;
+        {
+            std::lock_guard<std::mutex> lock(bssrdfTableMutex);
+            entry->ready = true;
+            bssrdfCacheFileStale = true;
+        }
+        // Wake threads that are waiting for the table
+        WakeWorkers();
+    } else {
+        ++nBSSRDFTablesReused;
+        RunQueuedWorkUntil(nullptr, [&]() { return entry->ready.load(); });
+    }
+    return entry->table;
+}
+
+void WriteBSSRDFTableCache() {
+    std::lock_guard<std::mutex> lock(bssrdfTableMutex);
+    const std::string &cacheFile = PbrtOptions.bssrdfCacheFile;
+    if (cacheFile.empty() || !bssrdfCacheFileStale) return;
+    WriteBSSRDFCacheFile(cacheFile);
+    bssrdfCacheFileStale = false;
+}
+
 void SubsurfaceFromDiffuse(const BSSRDFTable &t, const Spectrum &rhoEff,
                            const Spectrum &mfp, Spectrum *sigma_a,
                            Spectrum *sigma_s) {
@@ -174,6 +174,9 @@ Float BeamDiffusionSS(Float sigma_s, Float sigma_a, Float g, Float eta,
 Float BeamDiffusionMS(Float sigma_s, Float sigma_a, Float g, Float eta,
                       Float r);
 void ComputeBeamDiffusionBSSRDF(Float g, Float eta, BSSRDFTable *t);
+std::shared_ptr<const BSSRDFTable> GetBeamDiffusionBSSRDFTable(
+    Float g, Float eta, int nRhoSamples = 100, int nRadiusSamples = 64);
+void WriteBSSRDFTableCache();
 void SubsurfaceFromDiffuse(const BSSRDFTable &table, const Spectrum &rhoEff,
                            const Spectrum &mfp, Spectrum *sigma_a,
                            Spectrum *sigma_s);
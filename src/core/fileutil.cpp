@@ -38,6 +38,15 @@
 #ifndef PBRT_IS_WINDOWS
 #include <libgen.h>
 #endif
+#ifdef PBRT_HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#elif defined(PBRT_IS_WINDOWS)
+#include <windows.h>  // Windows file mapping API
+#endif
 
 namespace pbrt {
 
@@ -126,4 +135,49 @@ void SetSearchDirectory(const std::string &dirname) {
     searchDirectory = dirname;
 }
 
+std::unique_ptr<MappedFile> MappedFile::Open(const std::string &filename) {
+#ifdef PBRT_HAVE_MMAP
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1) return nullptr;
+    struct stat stat;
+    if (fstat(fd, &stat) != 0 || stat.st_size == 0) {
+        close(fd);
+        return nullptr;
+    }
+    size_t size = stat.st_size;
+    void *ptr = mmap(0, size, PROT_READ, MAP_FILE | MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) return nullptr;
+    return std::unique_ptr<MappedFile>(new MappedFile((const char *)ptr, size));
+#elif defined(PBRT_IS_WINDOWS)
+    HANDLE fileHandle =
+        CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, 0,
+                    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (fileHandle == INVALID_HANDLE_VALUE) return nullptr;
+    LARGE_INTEGER liLen;
+    if (!GetFileSizeEx(fileHandle, &liLen) || liLen.QuadPart == 0) {
+        CloseHandle(fileHandle);
+        return nullptr;
+    }
+    HANDLE mapping = CreateFileMapping(fileHandle, 0, PAGE_READONLY, 0, 0, 0);
+    CloseHandle(fileHandle);
+    if (mapping == 0) return nullptr;
+    LPVOID ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (ptr == nullptr) return nullptr;
+    return std::unique_ptr<MappedFile>(
+        new MappedFile((const char *)ptr, liLen.QuadPart));
+#else
+    return nullptr;
+#endif
+}
+
+MappedFile::~MappedFile() {
+#ifdef PBRT_HAVE_MMAP
+    munmap((void *)data, size);
+#elif defined(PBRT_IS_WINDOWS)
+    UnmapViewOfFile(data);
+#endif
+}
+
 }  // namespace pbrt
@@ -40,6 +40,7 @@
 
 // core/fileutil.h*
 #include "pbrt.h"
+#include <memory>
 #include <string>
 #include <cctype>
 #include <string.h>
@@ -60,6 +61,26 @@ inline bool HasExtension(const std::string &value, const std::string &ending) {
         [](char a, char b) { return std::tolower(a) == std::tolower(b); });
 }
 
+// MappedFile maps the contents of a file into memory for reading.
+class MappedFile {
+  public:
+    // MappedFile Public Methods
+    // Returns nullptr if the file can't be opened or memory-mapped files
+    // aren't supported on the system
+    static std::unique_ptr<MappedFile> Open(const std::string &filename);
+    ~MappedFile();
+    const char *Data() const { return data; }
+    size_t Size() const { return size; }
+
+  private:
+    // MappedFile Private Methods
+    MappedFile(const char *data, size_t size) : data(data), size(size) {}
+
+    // MappedFile Private Data
+    const char *data;
+    size_t size;
+};
+
 }  // namespace pbrt
 
 #endif  // PBRT_CORE_FILEUTIL_H
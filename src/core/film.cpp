@@ -64,6 +64,11 @@ Film::Film(const Point2i &resolution, const Bounds2f &cropWindow,
     // Allocate film image storage
     pixels = std::unique_ptr<Pixel[]>(new Pixel[croppedPixelBounds.Area()]);
     filmPixelMemory += croppedPixelBounds.Area() * sizeof(Pixel);
+    pixelVariances.reset(new PixelVariance[croppedPixelBounds.Area()]);
+    filmPixelMemory += croppedPixelBounds.Area() * sizeof(PixelVariance);
+    int nStripes = (croppedPixelBounds.Diagonal().y + mergeStripeHeight - 1) /
+                   mergeStripeHeight;
+    mergeStripeMutexes.reset(new std::mutex[std::max(nStripes, 1)]);
 
     // Precompute filter weight table
     int offset = 0;
@@ -111,21 +116,56 @@ void Film::Clear() {
         for (int c = 0; c < 3; ++c)
             pixel.splatXYZ[c] = pixel.xyz[c] = 0;
         pixel.filterWeightSum = 0;
+        pixelVariances[PixelOffset(p)] = PixelVariance();
     }
 }
 
+PixelVariance Film::GetPixelVariance(const Point2i &p) const {
+    if (!InsideExclusive(p, croppedPixelBounds)) return PixelVariance();
+    return pixelVariances[PixelOffset(p)];
+}
+
+Float Film::AverageRelativeError() const {
+    // Average the relative error over the pixels that have been sampled
+    double errorSum = 0;
+    int nPixels = 0;
+    for (int i = 0; i < croppedPixelBounds.Area(); ++i) {
+        const PixelVariance &v = pixelVariances[i];
+        if (v.n == 0) continue;
+        if (v.n < 2) return Infinity;
+        errorSum += v.RelativeError();
+        ++nPixels;
+    }
+    return nPixels > 0 ? errorSum / nPixels : 0;
+}
+
 void Film::MergeFilmTile(std::unique_ptr<FilmTile> tile) {
     ProfilePhase p(Prof::MergeFilmTile);
     VLOG(1) << "Merging film tile " << tile->pixelBounds;
-    std::lock_guard<std::mutex> lock(mutex);
-    for (Point2i pixel : tile->GetPixelBounds()) {
-        // Merge _pixel_ into _Film::pixels_
-        const FilmTilePixel &tilePixel = tile->GetPixel(pixel);
-        Pixel &mergePixel = GetPixel(pixel);
-        Float xyz[3];
-        tilePixel.contribSum.ToXYZ(xyz);
-        for (int i = 0; i < 3; ++i) mergePixel.xyz[i] += xyz[i];
-        mergePixel.filterWeightSum += tilePixel.filterWeightSum;
+    Bounds2i tileBounds = tile->GetPixelBounds();
+    int y0 = tileBounds.pMin.y;
+    while (y0 < tileBounds.pMax.y) {
+        // Merge the tile rows in the current stripe of film rows
+        int stripe = (y0 - croppedPixelBounds.pMin.y) / mergeStripeHeight;
+        int y1 = std::min(tileBounds.pMax.y, croppedPixelBounds.pMin.y +
+                                                 (stripe + 1) * mergeStripeHeight);
+        std::lock_guard<std::mutex> lock(mergeStripeMutexes[stripe]);
+        for (int y = y0; y < y1; ++y)
+            for (int x = tileBounds.pMin.x; x < tileBounds.pMax.x; ++x) {
+                // Merge _pixel_ into _Film::pixels_
+                Point2i pixel(x, y);
+                const FilmTilePixel &tilePixel = tile->GetPixel(pixel);
+                Pixel &mergePixel = GetPixel(pixel);
+                Float xyz[3];
+                tilePixel.contribSum.ToXYZ(xyz);
+                for (int i = 0; i < 3; ++i) mergePixel.xyz[i] += xyz[i];
+                mergePixel.filterWeightSum += tilePixel.filterWeightSum;
+                // Only the pixels this tile took samples in have statistics
+                if (tilePixel.variance.n > 0)
+                    pixelVariances[PixelOffset(pixel)].Merge(
+                        tilePixel.variance);
+            }
+        y0 = y1;
     }
 }
 
@@ -139,6 +179,21 @@ void Film::SetImage(const Spectrum *img) const {
     }
 }
 
+std::vector<Float> Film::GetSplats() const {
+    int nPixels = croppedPixelBounds.Area();
+    std::vector<Float> splatXYZ(3 * nPixels);
+    for (int i = 0; i < nPixels; ++i)
+        for (int c = 0; c < 3; ++c) splatXYZ[3 * i + c] = pixels[i].splatXYZ[c];
+    return splatXYZ;
+}
+
+void Film::SetSplats(const std::vector<Float> &splatXYZ) {
+    int nPixels = croppedPixelBounds.Area();
+    CHECK_EQ(splatXYZ.size(), 3 * nPixels);
+    for (int i = 0; i < nPixels; ++i)
+        for (int c = 0; c < 3; ++c) pixels[i].splatXYZ[c] = splatXYZ[3 * i + c];
+}
+
 void Film::AddSplat(const Point2f &p, Spectrum v) {
     ProfilePhase pp(Prof::SplatFilm);
 
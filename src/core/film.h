@@ -48,10 +48,41 @@
 
 namespace pbrt {
 
+// PixelVariance Declarations
+struct PixelVariance {
+    // Running mean and variance of the luminance of a pixel's samples,
+    // updated with Welford's algorithm so that estimates from separate
+    // tiles can be merged.
+    void Add(Float y) {
+        ++n;
+        Float delta = y - mean;
+        mean += delta / n;
+        m2 += delta * (y - mean);
+    }
+    void Merge(const PixelVariance &v) {
+        if (v.n == 0) return;
+        int nSum = n + v.n;
+        Float delta = v.mean - mean;
+        mean += delta * v.n / nSum;
+        m2 += v.m2 + delta * delta * ((Float)n * v.n / nSum);
+        n = nSum;
+    }
+    Float Variance() const { return n > 1 ? m2 / (n - 1) : 0; }
+    Float RelativeError() const {
+        // Standard error of the pixel's mean relative to its luminance; the
+        // offset keeps nearly black pixels from never converging.
+        if (n < 2) return Infinity;
+        return std::sqrt(Variance() / n) / (std::abs(mean) + 0.01f);
+    }
+    Float mean = 0, m2 = 0;
+    int n = 0;
+};
+
 // FilmTilePixel Declarations
 struct FilmTilePixel {
     Spectrum contribSum = 0.f;
     Float filterWeightSum = 0.f;
+    PixelVariance variance;
 };
 
 // Film Declarations
@@ -68,8 +99,14 @@ class Film {
     void MergeFilmTile(std::unique_ptr<FilmTile> tile);
     void SetImage(const Spectrum *img) const;
     void AddSplat(const Point2f &p, Spectrum v);
+    // Sums of the values splatted at each pixel, as XYZ triples in
+    // scanline order, for integrators that checkpoint their progress
+    std::vector<Float> GetSplats() const;
+    void SetSplats(const std::vector<Float> &splatXYZ);
     void WriteImage(Float splatScale = 1);
     void Clear();
+    PixelVariance GetPixelVariance(const Point2i &p) const;
+    Float AverageRelativeError() const;
 
     // Film Public Data
     const Point2i fullResolution;
@@ -88,20 +125,24 @@ class Film {
         Float pad;
     };
     std::unique_ptr<Pixel[]> pixels;
+    std::unique_ptr<PixelVariance[]> pixelVariances;
     static PBRT_CONSTEXPR int filterTableWidth = 16;
     Float filterTable[filterTableWidth * filterTableWidth];
-    std::mutex mutex;
+    // Tiles are merged one stripe of rows at a time, each stripe under its
+    // own mutex, so that merges of tiles in different rows don't contend.
+    static PBRT_CONSTEXPR int mergeStripeHeight = 4;
+    std::unique_ptr<std::mutex[]> mergeStripeMutexes;
     const Float scale;
     const Float maxSampleLuminance;
 
     // Film Private Methods
-    Pixel &GetPixel(const Point2i &p) {
+    int PixelOffset(const Point2i &p) const {
         CHECK(InsideExclusive(p, croppedPixelBounds));
         int width = croppedPixelBounds.pMax.x - croppedPixelBounds.pMin.x;
-        int offset = (p.x - croppedPixelBounds.pMin.x) +
-                     (p.y - croppedPixelBounds.pMin.y) * width;
-        return pixels[offset];
+        return (p.x - croppedPixelBounds.pMin.x) +
+               (p.y - croppedPixelBounds.pMin.y) * width;
     }
+    Pixel &GetPixel(const Point2i &p) { return pixels[PixelOffset(p)]; }
 };
 
 class FilmTile {
@@ -123,6 +164,12 @@ class FilmTile {
         ProfilePhase _(Prof::AddFilmSample);
         if (L.y() > maxSampleLuminance)
             L *= maxSampleLuminance / L.y();
+
+        // Update luminance statistics of the pixel the sample was taken in
+        Point2i pPixel = (Point2i)Floor(pFilm);
+        if (InsideExclusive(pPixel, pixelBounds))
+            GetPixel(pPixel).variance.Add(L.y() * sampleWeight);
+
         // Compute sample's raster bounds
         Point2f pFilmDiscrete = pFilm - Vector2f(0.5f, 0.5f);
         Point2i p0 = (Point2i)Ceil(pFilmDiscrete - filterRadius);
@@ -42,6 +42,7 @@
 #include "progressreporter.h"
 #include "camera.h"
 #include "stats.h"
+#include <chrono>
 
 namespace pbrt {
 
@@ -51,6 +52,98 @@ STAT_COUNTER("Integrator/Camera rays traced", nCameraRays);
 Integrator::~Integrator() {}
 
 // Integrator Utility Functions
+Spectrum LightSampleContribution(const Interaction &it, const Light &light,
+                                 const Point2f &uLight, BxDFType bsdfFlags,
+                                 VisibilityTester *visibility) {
+    Vector3f wi;
+    Float lightPdf = 0, scatteringPdf = 0;
+    Spectrum Li = light.Sample_Li(it, uLight, &wi, &lightPdf, visibility);
+    VLOG(2) << "EstimateDirect uLight:" << uLight << " -> Li: " << Li << ", wi: "
+            << wi << ", pdf: " << lightPdf;
+    if (lightPdf == 0 || Li.IsBlack()) return Spectrum(0.f);
+
+    // Compute BSDF or phase function's value for light sample
+    Spectrum f;
+    if (it.IsSurfaceInteraction()) {
+        // Evaluate BSDF for light sampling strategy
+        const SurfaceInteraction &isect = (const SurfaceInteraction &)it;
+        f = isect.bsdf->f(isect.wo, wi, bsdfFlags) *
+            AbsDot(wi, isect.shading.n);
+        scatteringPdf = isect.bsdf->Pdf(isect.wo, wi, bsdfFlags);
+        VLOG(2) << "  surf f*dot :" << f << ", scatteringPdf: " << scatteringPdf;
+    } else {
+        // Evaluate phase function for light sampling strategy
+        const MediumInteraction &mi = (const MediumInteraction &)it;
+        Float p = mi.phase->p(mi.wo, wi);
+        f = Spectrum(p);
+        scatteringPdf = p;
+        VLOG(2) << "  medium p: " << p;
+    }
+    if (f.IsBlack()) return Spectrum(0.f);
+
+    // Weight light's contribution to reflected radiance
+    if (IsDeltaLight(light.flags)) return f * Li / lightPdf;
+    Float weight = PowerHeuristic(1, lightPdf, 1, scatteringPdf);
+    return f * Li * weight / lightPdf;
+}
+
+Spectrum ScatteringSampleContribution(const Interaction &it,
+                                      const Point2f &uScattering,
+                                      const Light &light, const Scene &scene,
+                                      BxDFType bsdfFlags,
+                                      Sampler *mediumSampler) {
+    if (IsDeltaLight(light.flags)) return Spectrum(0.f);
+    Vector3f wi;
+    Float scatteringPdf = 0;
+    Spectrum f;
+    bool sampledSpecular = false;
+    if (it.IsSurfaceInteraction()) {
+        // Sample scattered direction for surface interactions
+        BxDFType sampledType;
+        const SurfaceInteraction &isect = (const SurfaceInteraction &)it;
+        f = isect.bsdf->Sample_f(isect.wo, &wi, uScattering, &scatteringPdf,
+                                 bsdfFlags, &sampledType);
+        f *= AbsDot(wi, isect.shading.n);
+        sampledSpecular = (sampledType & BSDF_SPECULAR) != 0;
+    } else {
+        // Sample scattered direction for medium interactions
+        const MediumInteraction &mi = (const MediumInteraction &)it;
+        Float p = mi.phase->Sample_p(mi.wo, &wi, uScattering);
+        f = Spectrum(p);
+        scatteringPdf = p;
+    }
+    VLOG(2) << "  BSDF / phase sampling f: " << f << ", scatteringPdf: " <<
+        scatteringPdf;
+    if (f.IsBlack() || scatteringPdf == 0) return Spectrum(0.f);
+
+    // Account for light contributions along sampled direction _wi_
+    Float weight = 1;
+    if (!sampledSpecular) {
+        Float lightPdf = light.Pdf_Li(it, wi);
+        if (lightPdf == 0) return Spectrum(0.f);
+        weight = PowerHeuristic(1, scatteringPdf, 1, lightPdf);
+    }
+
+    // Find intersection and compute transmittance
+    SurfaceInteraction lightIsect;
+    Ray ray = it.SpawnRay(wi);
+    Spectrum Tr(1.f);
+    bool foundSurfaceInteraction =
+        mediumSampler
+            ? scene.IntersectTr(ray, *mediumSampler, &lightIsect, &Tr)
+            : scene.Intersect(ray, &lightIsect);
+
+    // Add light contribution from material sampling
+    Spectrum Li(0.f);
+    if (foundSurfaceInteraction) {
+        if (lightIsect.primitive->GetAreaLight() == &light)
+            Li = lightIsect.Le(-wi);
+    } else
+        Li = light.Le(ray);
+    if (Li.IsBlack()) return Spectrum(0.f);
+    return f * Li * Tr * weight / scatteringPdf;
+}
+
 Spectrum UniformSampleAllLights(const Interaction &it, const Scene &scene,
                                 MemoryArena &arena, Sampler &sampler,
                                 const std::vector<int> &nLightSamples,
@@ -69,7 +162,7 @@ Spectrum UniformSampleAllLights(const Interaction &it, const Scene &scene,
             Point2f uScattering = sampler.Get2D();
             L += EstimateDirect(it, uScattering, *light, uLight, scene, sampler,
                                 arena, handleMedia);
-        } else {
+        } else if (handleMedia) {
             // Estimate direct lighting using sample arrays
             Spectrum Ld(0.f);
             for (int k = 0; k < nSamples; ++k)
@@ -77,141 +170,129 @@ Spectrum UniformSampleAllLights(const Interaction &it, const Scene &scene,
                                      uLightArray[k], scene, sampler, arena,
                                      handleMedia);
             L += Ld / nSamples;
+        } else {
+            // Estimate direct lighting using sample arrays, tracing the
+            // coherent shadow rays of all light samples together
+            const BxDFType bsdfFlags = BxDFType(BSDF_ALL & ~BSDF_SPECULAR);
+            Spectrum Ld(0.f);
+            Spectrum *unshadowed = arena.Alloc<Spectrum>(nSamples);
+            Ray *shadowRays = arena.Alloc<Ray>(nSamples);
+            int nShadowRays = 0;
+            for (int k = 0; k < nSamples; ++k) {
+                VisibilityTester visibility;
+                Spectrum Lk = LightSampleContribution(
+                    it, *light, uLightArray[k], bsdfFlags, &visibility);
+                if (!Lk.IsBlack()) {
+                    unshadowed[nShadowRays] = Lk;
+                    shadowRays[nShadowRays++] =
+                        visibility.P0().SpawnRayTo(visibility.P1());
+                }
+                Ld += ScatteringSampleContribution(it, uScatteringArray[k],
+                                                   *light, scene, bsdfFlags);
+            }
+            bool *occluded = arena.Alloc<bool>(nShadowRays);
+            scene.IntersectPN(shadowRays, occluded, nShadowRays);
+            for (int k = 0; k < nShadowRays; ++k)
+                if (!occluded[k]) Ld += unshadowed[k];
+            L += Ld / nSamples;
         }
     }
     return L;
 }
 
-Spectrum UniformSampleOneLight(const Interaction &it, const Scene &scene,
-                               MemoryArena &arena, Sampler &sampler,
-                               bool handleMedia, const Distribution1D *lightDistrib) {
-    ProfilePhase p(Prof::DirectLighting);
-    // Randomly choose a single light to sample, _light_
+// Randomly chooses a single light to sample, returning nullptr if there's
+// none that can be sampled
+static const Light *ChooseLight(const Scene &scene, Sampler &sampler,
+                                const Distribution1D *lightDistrib,
+                                Float *lightPdf) {
     int nLights = int(scene.lights.size());
-    if (nLights == 0) return Spectrum(0.f);
+    if (nLights == 0) return nullptr;
     int lightNum;
-    Float lightPdf;
     if (lightDistrib) {
-        lightNum = lightDistrib->SampleDiscrete(sampler.Get1D(), &lightPdf);
-        if (lightPdf == 0) return Spectrum(0.f);
+        lightNum = lightDistrib->SampleDiscrete(sampler.Get1D(), lightPdf);
+        if (*lightPdf == 0) return nullptr;
     } else {
         lightNum = std::min((int)(sampler.Get1D() * nLights), nLights - 1);
-        lightPdf = Float(1) / nLights;
+        *lightPdf = Float(1) / nLights;
     }
-    const std::shared_ptr<Light> &light = scene.lights[lightNum];
+    return scene.lights[lightNum].get();
+}
+
+Spectrum UniformSampleOneLight(const Interaction &it, const Scene &scene,
+                               MemoryArena &arena, Sampler &sampler,
+                               bool handleMedia, const Distribution1D *lightDistrib) {
+    ProfilePhase p(Prof::DirectLighting);
+    // Randomly choose a single light to sample, _light_
+    Float lightPdf;
+    const Light *light = ChooseLight(scene, sampler, lightDistrib, &lightPdf);
+    if (!light) return Spectrum(0.f);
     Point2f uLight = sampler.Get2D();
     Point2f uScattering = sampler.Get2D();
     return EstimateDirect(it, uScattering, *light, uLight,
                           scene, sampler, arena, handleMedia) / lightPdf;
 }
 
+Spectrum UniformSampleOneLight(const Interaction &it, const Scene &scene,
+                               Sampler &sampler,
+                               const Distribution1D *lightDistrib,
+                               const Spectrum &beta,
+                               ShadowRayBatch *shadowRays) {
+    ProfilePhase p(Prof::DirectLighting);
+    Float lightPdf;
+    const Light *light = ChooseLight(scene, sampler, lightDistrib, &lightPdf);
+    if (!light) return Spectrum(0.f);
+    Point2f uLight = sampler.Get2D();
+    Point2f uScattering = sampler.Get2D();
+    const BxDFType bsdfFlags = BxDFType(BSDF_ALL & ~BSDF_SPECULAR);
+
+    // Queue the light sample's shadow ray and return the BSDF sample
+    VisibilityTester visibility;
+    Spectrum Ll =
+        LightSampleContribution(it, *light, uLight, bsdfFlags, &visibility);
+    if (!Ll.IsBlack())
+        shadowRays->Add(visibility.P0().SpawnRayTo(visibility.P1()),
+                        beta * Ll / lightPdf);
+    return beta *
+           ScatteringSampleContribution(it, uScattering, *light, scene,
+                                        bsdfFlags) /
+           lightPdf;
+}
+
 Spectrum EstimateDirect(const Interaction &it, const Point2f &uScattering,
                         const Light &light, const Point2f &uLight,
                         const Scene &scene, Sampler &sampler,
                         MemoryArena &arena, bool handleMedia, bool specular) {
     BxDFType bsdfFlags =
         specular ? BSDF_ALL : BxDFType(BSDF_ALL & ~BSDF_SPECULAR);
-    Spectrum Ld(0.f);
     // Sample light source with multiple importance sampling
-    Vector3f wi;
-    Float lightPdf = 0, scatteringPdf = 0;
     VisibilityTester visibility;
-    Spectrum Li = light.Sample_Li(it, uLight, &wi, &lightPdf, &visibility);
-    VLOG(2) << "EstimateDirect uLight:" << uLight << " -> Li: " << Li << ", wi: "
-            << wi << ", pdf: " << lightPdf;
-    if (lightPdf > 0 && !Li.IsBlack()) {
-        // Compute BSDF or phase function's value for light sample
-        Spectrum f;
-        if (it.IsSurfaceInteraction()) {
-            // Evaluate BSDF for light sampling strategy
-            const SurfaceInteraction &isect = (const SurfaceInteraction &)it;
-            f = isect.bsdf->f(isect.wo, wi, bsdfFlags) *
-                AbsDot(wi, isect.shading.n);
-            scatteringPdf = isect.bsdf->Pdf(isect.wo, wi, bsdfFlags);
-            VLOG(2) << "  surf f*dot :" << f << ", scatteringPdf: " << scatteringPdf;
-        } else {
-            // Evaluate phase function for light sampling strategy
-            const MediumInteraction &mi = (const MediumInteraction &)it;
-            Float p = mi.phase->p(mi.wo, wi);
-            f = Spectrum(p);
-            scatteringPdf = p;
-            VLOG(2) << "  medium p: " << p;
-        }
-        if (!f.IsBlack()) {
-            // Compute effect of visibility for light source sample
-            if (handleMedia) {
-                Li *= visibility.Tr(scene, sampler);
-                VLOG(2) << "  after Tr, Li: " << Li;
-            } else {
-              if (!visibility.Unoccluded(scene)) {
-                VLOG(2) << "  shadow ray blocked";
-                Li = Spectrum(0.f);
-              } else
-                VLOG(2) << "  shadow ray unoccluded";
-            }
-
-            // Add light's contribution to reflected radiance
-            if (!Li.IsBlack()) {
-                if (IsDeltaLight(light.flags))
-                    Ld += f * Li / lightPdf;
-                else {
-                    Float weight =
-                        PowerHeuristic(1, lightPdf, 1, scatteringPdf);
-                    Ld += f * Li * weight / lightPdf;
-                }
-            }
-        }
+    Spectrum Ld =
+        LightSampleContribution(it, light, uLight, bsdfFlags, &visibility);
+    if (!Ld.IsBlack()) {
+        // Compute effect of visibility for light source sample
+        if (handleMedia) {
+            Ld *= visibility.Tr(scene, sampler);
+            VLOG(2) << "  after Tr, Ld: " << Ld;
+        } else if (!visibility.Unoccluded(scene)) {
+            VLOG(2) << "  shadow ray blocked";
+            Ld = Spectrum(0.f);
+        } else
+            VLOG(2) << "  shadow ray unoccluded";
     }
 
     // Sample BSDF with multiple importance sampling
-    if (!IsDeltaLight(light.flags)) {
-        Spectrum f;
-        bool sampledSpecular = false;
-        if (it.IsSurfaceInteraction()) {
-            // Sample scattered direction for surface interactions
-            BxDFType sampledType;
-            const SurfaceInteraction &isect = (const SurfaceInteraction &)it;
-            f = isect.bsdf->Sample_f(isect.wo, &wi, uScattering, &scatteringPdf,
-                                     bsdfFlags, &sampledType);
-            f *= AbsDot(wi, isect.shading.n);
-            sampledSpecular = (sampledType & BSDF_SPECULAR) != 0;
-        } else {
-            // Sample scattered direction for medium interactions
-            const MediumInteraction &mi = (const MediumInteraction &)it;
-            Float p = mi.phase->Sample_p(mi.wo, &wi, uScattering);
-            f = Spectrum(p);
-            scatteringPdf = p;
-        }
-        VLOG(2) << "  BSDF / phase sampling f: " << f << ", scatteringPdf: " <<
-            scatteringPdf;
-        if (!f.IsBlack() && scatteringPdf > 0) {
-            // Account for light contributions along sampled direction _wi_
-            Float weight = 1;
-            if (!sampledSpecular) {
-                lightPdf = light.Pdf_Li(it, wi);
-                if (lightPdf == 0) return Ld;
-                weight = PowerHeuristic(1, scatteringPdf, 1, lightPdf);
-            }
+    return Ld + ScatteringSampleContribution(it, uScattering, light, scene,
+                                             bsdfFlags,
+                                             handleMedia ? &sampler : nullptr);
+}
 
-            // Find intersection and compute transmittance
-            SurfaceInteraction lightIsect;
-            Ray ray = it.SpawnRay(wi);
-            Spectrum Tr(1.f);
-            bool foundSurfaceInteraction =
-                handleMedia ? scene.IntersectTr(ray, sampler, &lightIsect, &Tr)
-                            : scene.Intersect(ray, &lightIsect);
-
-            // Add light contribution from material sampling
-            Spectrum Li(0.f);
-            if (foundSurfaceInteraction) {
-                if (lightIsect.primitive->GetAreaLight() == &light)
-                    Li = lightIsect.Le(-wi);
-            } else
-                Li = light.Le(ray);
-            if (!Li.IsBlack()) Ld += f * Li * Tr * weight / scatteringPdf;
-        }
-    }
-    return Ld;
+// ShadowRayBatch Method Definitions
+void ShadowRayBatch::Flush() {
+    bool occluded[MaxPendingRays];
+    scene.IntersectPN(rays, occluded, nPending);
+    for (int i = 0; i < nPending; ++i)
+        if (!occluded[i]) L += unoccludedLd[i];
+    nPending = 0;
 }
 
 std::unique_ptr<Distribution1D> ComputeLightPowerDistribution(
@@ -235,9 +316,58 @@ void SamplerIntegrator::Render(const Scene &scene) {
     const int tileSize = 16;
     Point2i nTiles((sampleExtent.x + tileSize - 1) / tileSize,
                    (sampleExtent.y + tileSize - 1) / tileSize);
-    ProgressReporter reporter(nTiles.x * nTiles.y, "Rendering");
-    {
+
+    // Choose the sample-count waves to render the image in; each wave takes
+    // every pixel up to _waveEnd_ samples. Progressive rendering doubles the
+    // number of samples with each wave.
+    std::vector<int64_t> waveEnd;
+    const int64_t spp = sampler->samplesPerPixel;
+    if (!PbrtOptions.progressive)
+        waveEnd.push_back(spp);
+    else
+        for (int64_t n = 1;; n *= 2) {
+            waveEnd.push_back(std::min(n, spp));
+            if (n >= spp) break;
+        }
+    const int nWaves = waveEnd.size();
+
+    // Tile samplers persist across waves so that each wave continues where
+    // the previous one left off.
+    std::vector<std::unique_ptr<Sampler>> tileSamplers(nTiles.x * nTiles.y);
+
+    // With adaptive sampling, a pixel is done once the luminance statistics
+    // from earlier waves and the current tile show it has converged.
+    auto pixelConverged = [&](const Point2i &pixel, const FilmTile &tile) {
+        if (sampler->adaptiveMaxError <= 0) return false;
+        PixelVariance v = camera->film->GetPixelVariance(pixel);
+        if (InsideExclusive(pixel, tile.GetPixelBounds()))
+            v.Merge(tile.GetPixel(pixel).variance);
+        return v.n >= sampler->adaptiveMinSamples &&
+               v.RelativeError() <= sampler->adaptiveMaxError;
+    };
+
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point startTime = Clock::now(), lastWriteTime = startTime;
+    auto secondsSince = [](Clock::time_point t) {
+        return std::chrono::duration<Float>(Clock::now() - t).count();
+    };
+    auto outOfTime = [&]() {
+        return PbrtOptions.timeLimit > 0 &&
+               secondsSince(startTime) >= PbrtOptions.timeLimit;
+    };
+
+    ProgressReporter reporter(nTiles.x * nTiles.y * nWaves, "Rendering");
+    for (int wave = 0; wave < nWaves; ++wave) {
+        int64_t waveStart = wave == 0 ? 0 : waveEnd[wave - 1];
         ParallelFor2D([&](Point2i tile) {
+            // Once the time budget is spent, skip the rest of the wave; the
+            // first wave is always completed so that every pixel has a
+            // sample.
+            if (wave > 0 && outOfTime()) {
+                reporter.Update();
+                return;
+            }
+
             // Render section of image corresponding to _tile_
 
             // Allocate _MemoryArena_ for tile
@@ -245,7 +375,8 @@ void SamplerIntegrator::Render(const Scene &scene) {
 
             // Get sampler instance for tile
             int seed = tile.y * nTiles.x + tile.x;
-            std::unique_ptr<Sampler> tileSampler = sampler->Clone(seed);
+            std::unique_ptr<Sampler> &tileSampler = tileSamplers[seed];
+            if (!tileSampler) tileSampler = sampler->Clone(seed);
 
             // Compute sample bounds for tile
             int x0 = sampleBounds.pMin.x + tile.x * tileSize;
@@ -261,10 +392,27 @@ void SamplerIntegrator::Render(const Scene &scene) {
 
             // Loop over pixels in tile to render them
             for (Point2i pixel : tileBounds) {
+                // When rendering in waves, samplers that generate a
+                // randomized sample set for each pixel must generate the
+                // same set in every wave, so that the union of the waves'
+                // samples keeps its stratification. Their generators are
+                // restarted from a per-pixel sequence before _StartPixel()_
+                // and moved to a per-wave sequence after it, so that
+                // sample dimensions beyond the set don't repeat values
+                // from earlier waves.
+                uint64_t pixelSequence = 0;
+                if (nWaves > 1) {
+                    Vector2i pOffset = pixel - sampleBounds.pMin;
+                    pixelSequence =
+                        ((uint64_t)pOffset.y * sampleExtent.x + pOffset.x) *
+                        (nWaves + 1);
+                    tileSampler->Reseed(pixelSequence);
+                }
                 {
                     ProfilePhase pp(Prof::StartPixel);
                     tileSampler->StartPixel(pixel);
                 }
+                if (nWaves > 1) tileSampler->Reseed(pixelSequence + 1 + wave);
 
                 // Do this check after the StartPixel() call; this keeps
                 // the usage of RNG values from (most) Samplers that use
@@ -273,6 +421,10 @@ void SamplerIntegrator::Render(const Scene &scene) {
                 if (!InsideExclusive(pixel, pixelBounds))
                     continue;
 
+                if (waveStart > 0) {
+                    if (pixelConverged(pixel, *filmTile)) continue;
+                    tileSampler->SetSampleNumber(waveStart);
+                }
                 do {
                     // Initialize _CameraSample_ for current sample
                     CameraSample cameraSample =
@@ -322,16 +474,42 @@ void SamplerIntegrator::Render(const Scene &scene) {
                     // Free _MemoryArena_ memory from computing image sample
                     // value
                     arena.Reset();
-                } while (tileSampler->StartNextSample());
+                } while (!pixelConverged(pixel, *filmTile) &&
+                         tileSampler->StartNextSample() &&
+                         tileSampler->CurrentSampleNumber() < waveEnd[wave]);
             }
             LOG(INFO) << "Finished image tile " << tileBounds;
 
+            // Release the tile's sampler after its last wave
+            if (wave == nWaves - 1) tileSampler.reset();
+
             // Merge image tile into _Film_
             camera->film->MergeFilmTile(std::move(filmTile));
             reporter.Update();
         }, nTiles);
-        reporter.Done();
+        LOG(INFO) << "Finished wave " << wave << " (" << waveEnd[wave]
+                  << " samples per pixel)";
+
+        // Decide whether to stop after this wave and write intermediate
+        // images
+        if (wave == nWaves - 1) break;
+        if (outOfTime()) {
+            LOG(INFO) << "Time limit reached after " << waveEnd[wave]
+                      << " samples per pixel";
+            break;
+        }
+        if (PbrtOptions.noiseTarget > 0) {
+            Float error = camera->film->AverageRelativeError();
+            LOG(INFO) << "Estimated relative error " << error;
+            if (error <= PbrtOptions.noiseTarget) break;
+        }
+        if (PbrtOptions.writeInterval > 0 &&
+            secondsSince(lastWriteTime) >= PbrtOptions.writeInterval) {
+            camera->film->WriteImage();
+            lastWriteTime = Clock::now();
+        }
     }
+    reporter.Done();
     LOG(INFO) << "Rendering finished";
 
     // Save final image after rendering
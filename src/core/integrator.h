@@ -70,9 +70,64 @@ Spectrum EstimateDirect(const Interaction &it, const Point2f &uShading,
                         const Scene &scene, Sampler &sampler,
                         MemoryArena &arena, bool handleMedia = false,
                         bool specular = false);
+// The light and BSDF sampling halves of _EstimateDirect()_, for callers
+// that trace the light sample's shadow ray themselves. The light sample's
+// contribution excludes visibility, which _visibility_ is set up to test;
+// the BSDF sample accounts for media if _mediumSampler_ is given.
+Spectrum LightSampleContribution(const Interaction &it, const Light &light,
+                                 const Point2f &uLight, BxDFType bsdfFlags,
+                                 VisibilityTester *visibility);
+Spectrum ScatteringSampleContribution(const Interaction &it,
+                                      const Point2f &uScattering,
+                                      const Light &light, const Scene &scene,
+                                      BxDFType bsdfFlags,
+                                      Sampler *mediumSampler = nullptr);
 std::unique_ptr<Distribution1D> ComputeLightPowerDistribution(
     const Scene &scene);
 
+// ShadowRayBatch Declarations
+// Collects the shadow rays of light samples so that they can be traced
+// together with _Scene::IntersectPN()_; _Trace()_ returns the summed
+// contributions of the unoccluded ones.
+class ShadowRayBatch {
+  public:
+    // ShadowRayBatch Public Methods
+    ShadowRayBatch(const Scene &scene) : scene(scene) {}
+    void Add(const Ray &ray, const Spectrum &Ld) {
+        if (nPending == MaxPendingRays) Flush();
+        rays[nPending] = ray;
+        unoccludedLd[nPending++] = Ld;
+        ++nAdded;
+    }
+    int Count() const { return nAdded; }
+    Spectrum Trace() {
+        Flush();
+        return L;
+    }
+
+  private:
+    // ShadowRayBatch Private Methods
+    void Flush();
+
+    // ShadowRayBatch Private Data
+    static PBRT_CONSTEXPR int MaxPendingRays = 16;
+    const Scene &scene;
+    Ray rays[MaxPendingRays];
+    Spectrum unoccludedLd[MaxPendingRays];
+    int nPending = 0, nAdded = 0;
+    Spectrum L = Spectrum(0.f);
+};
+
+// Like _UniformSampleOneLight()_ without media, except that the light
+// sample's shadow ray is added to _shadowRays_ rather than traced. Both
+// samples' contributions are scaled by _beta_; the BSDF sample's is
+// returned.
+Spectrum UniformSampleOneLight(const Interaction &it, const Scene &scene,
+                               Sampler &sampler,
+                               const Distribution1D *lightDistrib,
+                               const Spectrum &beta,
+                               ShadowRayBatch *shadowRays);
+
 // SamplerIntegrator Declarations
 class SamplerIntegrator : public Integrator {
   public:
@@ -44,6 +44,11 @@
 #include "texture.h"
 #include "stats.h"
 #include "parallel.h"
+#include "texcache.h"
+#if (defined(__SSE2__) || defined(_M_X64)) && !defined(PBRT_FLOAT_AS_DOUBLE)
+#include <immintrin.h>
+#define PBRT_MIPMAP_SSE
+#endif
 
 namespace pbrt {
 
@@ -58,6 +63,48 @@ struct ResampleWeight {
     Float weight[4];
 };
 
+// Computes EWA filter weights for the four texels $s, \ldots, s+3$ of row
+// $t$; texels outside the ellipse get a weight of zero.
+inline void EWAWeights4(Float A, Float B, Float C, Point2f st, int s, int t,
+                        const Float *weightLut, int lutSize, Float w[4]) {
+    Float tt = t - st[1];
+#ifdef PBRT_MIPMAP_SSE
+    __m128 ss = _mm_sub_ps(
+        _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(s),
+                                      _mm_set_epi32(3, 2, 1, 0))),
+        _mm_set1_ps(st[0]));
+    __m128 r2 = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(_mm_mul_ps(_mm_set1_ps(A), ss), ss),
+                   _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(B), ss), _mm_set1_ps(tt))),
+        _mm_set1_ps(C * tt * tt));
+    int inside = _mm_movemask_ps(_mm_cmplt_ps(r2, _mm_set1_ps(1.f)));
+    __m128i index = _mm_cvttps_epi32(_mm_min_ps(
+        _mm_mul_ps(r2, _mm_set1_ps(lutSize)), _mm_set1_ps(lutSize - 1)));
+    int32_t idx[4];
+    _mm_storeu_si128((__m128i *)idx, index);
+    for (int i = 0; i < 4; ++i)
+        w[i] = (inside & (1 << i)) ? weightLut[idx[i]] : 0;
+#else
+    for (int i = 0; i < 4; ++i) {
+        Float ss = s + i - st[0];
+        Float r2 = A * ss * ss + B * ss * tt + C * tt * tt;
+        w[i] = (r2 < 1) ? weightLut[std::min((int)(r2 * lutSize), lutSize - 1)]
+                        : 0;
+    }
+#endif  // PBRT_MIPMAP_SSE
+}
+
+inline void ConvertTiledTexel(const float *v, int nChannels, Float scale,
+                              Float *texel) {
+    *texel = scale * (nChannels == 1 ? v[0] : RGBSpectrum::FromRGB(v).y());
+}
+
+inline void ConvertTiledTexel(const float *v, int nChannels, Float scale,
+                              RGBSpectrum *texel) {
+    Float rgb[3] = {v[0], v[nChannels == 3 ? 1 : 0], v[nChannels == 3 ? 2 : 0]};
+    *texel = scale * RGBSpectrum::FromRGB(rgb);
+}
+
 // MIPMap Declarations
 template <typename T>
 class MIPMap {
@@ -65,15 +112,53 @@ class MIPMap {
     // MIPMap Public Methods
     MIPMap(const Point2i &resolution, const T *data, bool doTri = false,
            Float maxAniso = 8.f, ImageWrap wrapMode = ImageWrap::Repeat);
+    MIPMap(std::unique_ptr<TiledImagePyramid> tiledPyramid, Float scale,
+           bool doTri = false, Float maxAniso = 8.f,
+           ImageWrap wrapMode = ImageWrap::Repeat);
+    ~MIPMap();
     int Width() const { return resolution[0]; }
     int Height() const { return resolution[1]; }
-    int Levels() const { return pyramid.size(); }
-    const T &Texel(int level, int s, int t) const;
+    int Levels() const { return levelResolution.size(); }
+    T Texel(int level, int s, int t) const;
     T Lookup(const Point2f &st, Float width = 0.f) const;
     T Lookup(const Point2f &st, Vector2f dstdx, Vector2f dstdy) const;
 
   private:
+    // MIPMap Private Declarations
+    class TexelAccessor {
+      public:
+        // TexelAccessor looks up texels of a single level. For tiled MIP
+        // maps, it holds on to the last tile used so that lookups of
+        // neighboring texels don't go through the tile cache.
+        TexelAccessor(const MIPMap<T> &mipmap, int level)
+            : mipmap(mipmap), level(level) {}
+        T operator()(int s, int t) {
+            if (!mipmap.WrapTexel(level, &s, &t)) return T(0.f);
+            if (!mipmap.tiledPyramid) return (*mipmap.pyramid[level])(s, t);
+            int index = mipmap.tiledPyramid->TileIndex(level, s, t);
+            int tileSize = mipmap.tiledPyramid->TileSize();
+            int offset = (t & (tileSize - 1)) * tileSize + (s & (tileSize - 1));
+            if (mipmap.mappedTexels)
+                return mipmap.mappedTexels[size_t(index) * tileSize * tileSize +
+                                           offset];
+            if (index != tileIndex) {
+                tile = mipmap.GetTile(index);
+                tileIndex = index;
+            }
+            return (*tile)[offset];
+        }
+
+      private:
+        const MIPMap<T> &mipmap;
+        const int level;
+        int tileIndex = -1;
+        std::shared_ptr<const std::vector<T>> tile;
+    };
+
     // MIPMap Private Methods
+    bool WrapTexel(int level, int *s, int *t) const;
+    std::shared_ptr<const std::vector<T>> GetTile(int tileIndex) const;
+    static void InitWeightLut();
     std::unique_ptr<ResampleWeight[]> resampleWeights(int oldRes, int newRes) {
         CHECK_GE(newRes, oldRes);
         std::unique_ptr<ResampleWeight[]> wt(new ResampleWeight[newRes]);
@@ -107,7 +192,17 @@ class MIPMap {
     const Float maxAnisotropy;
     const ImageWrap wrapMode;
     Point2i resolution;
+    std::vector<Point2i> levelResolution;
     std::vector<std::unique_ptr<BlockedArray<T>>> pyramid;
+    // Tiled MIP maps load texels on demand through the texture tile cache
+    std::unique_ptr<TiledImagePyramid> tiledPyramid;
+    const Float tiledScale = 1;
+    uint64_t tiledTextureId = 0;
+    // Set once a tile couldn't be read, so that the error is only reported
+    // once per texture
+    mutable std::atomic<bool> tileReadFailed{false};
+    // Texels of a tiled MIP map whose file is mapped into memory
+    const T *mappedTexels = nullptr;
     static PBRT_CONSTEXPR int WeightLUTSize = 128;
     static Float weightLut[WeightLUTSize];
 };
@@ -184,28 +279,74 @@ MIPMap<T>::MIPMap(const Point2i &res, const T *img, bool doTrilinear,
     // Initialize levels of MIPMap from image
     int nLevels = 1 + Log2Int(std::max(resolution[0], resolution[1]));
     pyramid.resize(nLevels);
+    levelResolution.resize(nLevels);
 
     // Initialize most detailed level of MIPMap
     pyramid[0].reset(
         new BlockedArray<T>(resolution[0], resolution[1],
                             resampledImage ? resampledImage.get() : img));
+    levelResolution[0] = resolution;
     for (int i = 1; i < nLevels; ++i) {
         // Initialize $i$th MIPMap level from $i-1$st level
         int sRes = std::max(1, pyramid[i - 1]->uSize() / 2);
         int tRes = std::max(1, pyramid[i - 1]->vSize() / 2);
         pyramid[i].reset(new BlockedArray<T>(sRes, tRes));
+        levelResolution[i] = Point2i(sRes, tRes);
 
-        // Filter four texels from finer level of pyramid
+        // Filter four texels from finer level of pyramid; all four are
+        // inside the finer level unless one of its dimensions is one texel
+        const BlockedArray<T> &finer = *pyramid[i - 1];
+        bool inside = finer.uSize() > 1 && finer.vSize() > 1;
         ParallelFor([&](int t) {
             for (int s = 0; s < sRes; ++s)
-                (*pyramid[i])(s, t) =
-                    .25f * (Texel(i - 1, 2 * s, 2 * t) +
-                            Texel(i - 1, 2 * s + 1, 2 * t) +
-                            Texel(i - 1, 2 * s, 2 * t + 1) +
-                            Texel(i - 1, 2 * s + 1, 2 * t + 1));
+                if (inside)
+                    (*pyramid[i])(s, t) =
+                        .25f * (finer(2 * s, 2 * t) + finer(2 * s + 1, 2 * t) +
+                                finer(2 * s, 2 * t + 1) +
+                                finer(2 * s + 1, 2 * t + 1));
+                else
+                    (*pyramid[i])(s, t) =
+                        .25f * (Texel(i - 1, 2 * s, 2 * t) +
+                                Texel(i - 1, 2 * s + 1, 2 * t) +
+                                Texel(i - 1, 2 * s, 2 * t + 1) +
+                                Texel(i - 1, 2 * s + 1, 2 * t + 1));
         }, tRes, 16);
     }
 
+    InitWeightLut();
+    mipMapMemory += (4 * resolution[0] * resolution[1] * sizeof(T)) / 3;
+}
+
+template <typename T>
+MIPMap<T>::MIPMap(std::unique_ptr<TiledImagePyramid> tiled, Float scale,
+                  bool doTrilinear, Float maxAnisotropy, ImageWrap wrapMode)
+    : doTrilinear(doTrilinear),
+      maxAnisotropy(maxAnisotropy),
+      wrapMode(wrapMode),
+      tiledPyramid(std::move(tiled)),
+      tiledScale(scale) {
+    // Take levels from the tiled pyramid; their texels are loaded on demand
+    for (int i = 0; i < tiledPyramid->Levels(); ++i)
+        levelResolution.push_back(tiledPyramid->LevelResolution(i));
+    resolution = levelResolution[0];
+    // Use the file's texels in place if they are stored as _T_ values
+    if (scale == 1 &&
+        sizeof(T) == tiledPyramid->Channels() * sizeof(float) &&
+        tiledPyramid->MapTiles())
+        mappedTexels = (const T *)tiledPyramid->MappedTiles();
+    else
+        tiledTextureId = GetTextureTileCache()->NewTextureId();
+    InitWeightLut();
+}
+
+template <typename T>
+MIPMap<T>::~MIPMap() {
+    if (tiledPyramid && !mappedTexels)
+        GetTextureTileCache()->ReleaseTexture(tiledTextureId);
+}
+
+template <typename T>
+void MIPMap<T>::InitWeightLut() {
     // Initialize EWA filter weights if needed
     if (weightLut[0] == 0.) {
         for (int i = 0; i < WeightLUTSize; ++i) {
@@ -214,31 +355,62 @@ MIPMap<T>::MIPMap(const Point2i &res, const T *img, bool doTrilinear,
             weightLut[i] = std::exp(-alpha * r2) - std::exp(-alpha);
         }
     }
-    mipMapMemory += (4 * resolution[0] * resolution[1] * sizeof(T)) / 3;
 }
 
 template <typename T>
-const T &MIPMap<T>::Texel(int level, int s, int t) const {
-    CHECK_LT(level, pyramid.size());
-    const BlockedArray<T> &l = *pyramid[level];
+bool MIPMap<T>::WrapTexel(int level, int *s, int *t) const {
+    CHECK_LT(level, Levels());
+    const Point2i &res = levelResolution[level];
     // Compute texel $(s,t)$ accounting for boundary conditions
     switch (wrapMode) {
     case ImageWrap::Repeat:
-        s = Mod(s, l.uSize());
-        t = Mod(t, l.vSize());
+        *s = Mod(*s, res.x);
+        *t = Mod(*t, res.y);
         break;
     case ImageWrap::Clamp:
-        s = Clamp(s, 0, l.uSize() - 1);
-        t = Clamp(t, 0, l.vSize() - 1);
+        *s = Clamp(*s, 0, res.x - 1);
+        *t = Clamp(*t, 0, res.y - 1);
         break;
-    case ImageWrap::Black: {
-        static const T black = 0.f;
-        if (s < 0 || s >= (int)l.uSize() || t < 0 || t >= (int)l.vSize())
-            return black;
+    case ImageWrap::Black:
+        if (*s < 0 || *s >= res.x || *t < 0 || *t >= res.y) return false;
         break;
     }
+    return true;
+}
+
+template <typename T>
+T MIPMap<T>::Texel(int level, int s, int t) const {
+    return TexelAccessor(*this, level)(s, t);
+}
+
+template <typename T>
+std::shared_ptr<const std::vector<T>> MIPMap<T>::GetTile(int tileIndex) const {
+    int tileSize = tiledPyramid->TileSize();
+    int nTexels = tileSize * tileSize;
+    std::shared_ptr<const void> tile = GetTextureTileCache()->GetTile(
+        tiledTextureId, tileIndex, nTexels * sizeof(T), [&]() {
+            // Read tile from disk and convert its texels to type _T_
+            int nChannels = tiledPyramid->Channels();
+            std::vector<float> values(nChannels * nTexels, 0.f);
+            if (!tiledPyramid->ReadTile(tileIndex, values.data()))
+                return std::shared_ptr<const void>();
+            std::shared_ptr<std::vector<T>> texels =
+                std::make_shared<std::vector<T>>(nTexels);
+            for (int i = 0; i < nTexels; ++i)
+                ConvertTiledTexel(&values[i * nChannels], nChannels,
+                                  tiledScale, &(*texels)[i]);
+            return std::shared_ptr<const void>(texels);
+        });
+    if (!tile) {
+        // The tile isn't cached, so later lookups will try to read it
+        // again; until then, its texels are black
+        if (!tileReadFailed.exchange(true))
+            Error("%s: unable to read tile %d. Texels in unreadable tiles "
+                  "will be black.", tiledPyramid->Filename().c_str(),
+                  tileIndex);
+        return std::make_shared<const std::vector<T>>(nTexels, T(0.f));
     }
-    return l(s, t);
+    return std::static_pointer_cast<const std::vector<T>>(tile);
 }
 
 template <typename T>
@@ -263,14 +435,15 @@ T MIPMap<T>::Lookup(const Point2f &st, Float width) const {
 template <typename T>
 T MIPMap<T>::triangle(int level, const Point2f &st) const {
     level = Clamp(level, 0, Levels() - 1);
-    Float s = st[0] * pyramid[level]->uSize() - 0.5f;
-    Float t = st[1] * pyramid[level]->vSize() - 0.5f;
+    Float s = st[0] * levelResolution[level].x - 0.5f;
+    Float t = st[1] * levelResolution[level].y - 0.5f;
     int s0 = std::floor(s), t0 = std::floor(t);
     Float ds = s - s0, dt = t - t0;
-    return (1 - ds) * (1 - dt) * Texel(level, s0, t0) +
-           (1 - ds) * dt * Texel(level, s0, t0 + 1) +
-           ds * (1 - dt) * Texel(level, s0 + 1, t0) +
-           ds * dt * Texel(level, s0 + 1, t0 + 1);
+    TexelAccessor texel(*this, level);
+    return (1 - ds) * (1 - dt) * texel(s0, t0) +
+           (1 - ds) * dt * texel(s0, t0 + 1) +
+           ds * (1 - dt) * texel(s0 + 1, t0) +
+           ds * dt * texel(s0 + 1, t0 + 1);
 }
 
 template <typename T>
@@ -306,12 +479,12 @@ template <typename T>
 T MIPMap<T>::EWA(int level, Point2f st, Vector2f dst0, Vector2f dst1) const {
     if (level >= Levels()) return Texel(Levels() - 1, 0, 0);
     // Convert EWA coordinates to appropriate scale for level
-    st[0] = st[0] * pyramid[level]->uSize() - 0.5f;
-    st[1] = st[1] * pyramid[level]->vSize() - 0.5f;
-    dst0[0] *= pyramid[level]->uSize();
-    dst0[1] *= pyramid[level]->vSize();
-    dst1[0] *= pyramid[level]->uSize();
-    dst1[1] *= pyramid[level]->vSize();
+    st[0] = st[0] * levelResolution[level].x - 0.5f;
+    st[1] = st[1] * levelResolution[level].y - 0.5f;
+    dst0[0] *= levelResolution[level].x;
+    dst0[1] *= levelResolution[level].y;
+    dst1[0] *= levelResolution[level].x;
+    dst1[1] *= levelResolution[level].y;
 
     // Compute ellipse coefficients to bound EWA filter region
     Float A = dst0[1] * dst0[1] + dst1[1] * dst1[1] + 1;
@@ -331,21 +504,27 @@ T MIPMap<T>::EWA(int level, Point2f st, Vector2f dst0, Vector2f dst1) const {
     int t0 = std::ceil(st[1] - 2 * invDet * vSqrt);
     int t1 = std::floor(st[1] + 2 * invDet * vSqrt);
 
-    // Scan over ellipse bound and compute quadratic equation
+    // Wrap texel coordinates only if the bound isn't inside the level
+    const Point2i &res = levelResolution[level];
+    const BlockedArray<T> *inside =
+        (!tiledPyramid && s0 >= 0 && s1 < res.x && t0 >= 0 && t1 < res.y)
+            ? pyramid[level].get()
+            : nullptr;
+
+    // Scan over ellipse bound and filter texels inside ellipse
+    TexelAccessor texel(*this, level);
     T sum(0.f);
     Float sumWts = 0;
     for (int it = t0; it <= t1; ++it) {
-        Float tt = it - st[1];
-        for (int is = s0; is <= s1; ++is) {
-            Float ss = is - st[0];
-            // Compute squared radius and filter texel if inside ellipse
-            Float r2 = A * ss * ss + B * ss * tt + C * tt * tt;
-            if (r2 < 1) {
-                int index =
-                    std::min((int)(r2 * WeightLUTSize), WeightLUTSize - 1);
-                Float weight = weightLut[index];
-                sum += Texel(level, is, it) * weight;
-                sumWts += weight;
+        // Compute filter weights four texels at a time
+        for (int is = s0; is <= s1; is += 4) {
+            Float w[4];
+            EWAWeights4(A, B, C, st, is, it, weightLut, WeightLUTSize, w);
+            for (int i = 0; i < std::min(4, s1 - is + 1); ++i) {
+                if (w[i] == 0) continue;
+                sum += (inside ? (*inside)(is + i, it) : texel(is + i, it)) *
+                       w[i];
+                sumWts += w[i];
             }
         }
     }
@@ -35,7 +35,8 @@
 #include "parallel.h"
 #include "memory.h"
 #include "stats.h"
-#include <list>
+#include <algorithm>
+#include <deque>
 #include <thread>
 #include <condition_variable>
 
@@ -45,20 +46,40 @@ namespace pbrt {
 static std::vector<std::thread> threads;
 static bool shutdownThreads = false;
 class ParallelForLoop;
-static ParallelForLoop *workList = nullptr;
-static std::mutex workListMutex;
+class WorkQueue;
+
+// Each thread (including the main thread, at index 0) owns a _WorkQueue_
+// that it pushes its loops onto; idle threads steal loops from the other
+// threads' queues.
+static std::unique_ptr<WorkQueue[]> workQueues;
+static int nWorkQueues = 0;
+// Number of loops currently held in all of the work queues.
+static std::atomic<int> nQueuedLoops{0};
+
+// Idle workers sleep on _workerCondition_; it's also used to wake them up
+// for shutdown and for stats reporting, and to wake threads that are
+// waiting for a loop or task to finish.
+static std::mutex workerMutex;
+static std::condition_variable workerCondition;
+// Incremented (with _workerMutex_ held) by _WakeWorkers()_, so that
+// waiting threads can tell whether they missed a wakeup.
+static std::atomic<uint64_t> workEpoch{0};
 
 // Bookkeeping variables to help with the implementation of
 // MergeWorkerThreadStats().
-static std::atomic<bool> reportWorkerStats{false};
+// Incremented each time the main thread asks workers to report their stats.
+static std::atomic<int> statsReportEpoch{0};
 // Number of workers that still need to report their stats.
-static std::atomic<int> reporterCount;
+static int reporterCount;
 // After kicking the workers to report their stats, the main thread waits
 // on this condition variable until they've all done so.
 static std::condition_variable reportDoneCondition;
-static std::mutex reportDoneMutex;
 
-class ParallelForLoop {
+// The loop whose iterations the calling thread is currently running, if
+// any; loops and tasks issued from them record it as their parent.
+static PBRT_THREAD_LOCAL ParallelForLoop *currentLoop;
+
+class ParallelForLoop : public std::enable_shared_from_this<ParallelForLoop> {
   public:
     // ParallelForLoop Public Methods
     ParallelForLoop(std::function<void(int64_t)> func1D, int64_t maxIndex,
@@ -66,32 +87,125 @@ class ParallelForLoop {
         : func1D(std::move(func1D)),
           maxIndex(maxIndex),
           chunkSize(chunkSize),
-          profilerState(profilerState) {}
+          profilerState(profilerState),
+          parent(CurrentLoop()) {}
     ParallelForLoop(const std::function<void(Point2i)> &f, const Point2i &count,
                     uint64_t profilerState)
         : func2D(f),
           maxIndex(count.x * count.y),
           chunkSize(1),
-          profilerState(profilerState) {
+          profilerState(profilerState),
+          parent(CurrentLoop()) {
         nX = count.x;
     }
 
-  public:
+    // Claims the next chunk of loop iterations and runs it in the calling
+    // thread. Returns false if all iterations have already been claimed.
+    bool RunChunk() {
+        // Find the set of loop iterations to run next
+        int64_t indexStart = nextIndex.fetch_add(chunkSize);
+        if (indexStart >= maxIndex) return false;
+        int64_t indexEnd = std::min(indexStart + chunkSize, maxIndex);
+
+        // Run loop indices in _[indexStart, indexEnd)_
+        uint64_t oldState = ProfilerState;
+        ProfilerState = profilerState;
+        ParallelForLoop *oldLoop = currentLoop;
+        currentLoop = this;
+        for (int64_t index = indexStart; index < indexEnd; ++index) {
+            if (func1D) {
+                func1D(index);
+            }
+            // Handle other types of loops
+            else {
+                CHECK(func2D);
+                func2D(Point2i(index % nX, index / nX));
+            }
+        }
+        ProfilerState = oldState;
+        currentLoop = oldLoop;
+
+        // Update _loop_ to reflect completion of iterations; threads that
+        // went to sleep waiting for the loop need to be woken once it's done
+        if (nFinished.fetch_add(indexEnd - indexStart) +
+                (indexEnd - indexStart) ==
+            maxIndex)
+            WakeWorkers();
+        return true;
+    }
+    bool Exhausted() const { return nextIndex.load() >= maxIndex; }
+    bool Finished() const { return nFinished.load() == maxIndex; }
+    // Returns true if this is _loop_ or was issued (possibly indirectly)
+    // from one of its iterations.
+    bool IsWithin(const ParallelForLoop *loop) const {
+        for (const ParallelForLoop *l = this; l; l = l->parent.get())
+            if (l == loop) return true;
+        return false;
+    }
+
+  private:
+    // ParallelForLoop Private Methods
+    static std::shared_ptr<ParallelForLoop> CurrentLoop() {
+        return currentLoop ? currentLoop->shared_from_this() : nullptr;
+    }
+
     // ParallelForLoop Private Data
     std::function<void(int64_t)> func1D;
     std::function<void(Point2i)> func2D;
     const int64_t maxIndex;
     const int chunkSize;
     uint64_t profilerState;
-    int64_t nextIndex = 0;
-    int activeWorkers = 0;
-    ParallelForLoop *next = nullptr;
+    // Holding the parent keeps the whole chain valid for _IsWithin()_.
+    const std::shared_ptr<ParallelForLoop> parent;
+    std::atomic<int64_t> nextIndex{0};
+    std::atomic<int64_t> nFinished{0};
     int nX = -1;
+};
 
-    // ParallelForLoop Private Methods
-    bool Finished() const {
-        return nextIndex >= maxIndex && activeWorkers == 0;
+// Loops are kept alive with shared_ptrs: a thief may still hold a loop
+// after the thread that issued it has returned from ParallelFor(), though it
+// will find no more iterations to claim.
+class WorkQueue {
+  public:
+    // WorkQueue Public Methods
+    void Push(std::shared_ptr<ParallelForLoop> loop) {
+        std::lock_guard<std::mutex> lock(mutex);
+        loops.push_back(std::move(loop));
+        ++size;
+        ++nQueuedLoops;
+    }
+    // Returns a loop with unclaimed iterations that's within _within_ (or
+    // any loop, if _within_ is nullptr). The owning thread takes work from
+    // the back of its queue, so that nested loops run before the loops that
+    // issued them, while thieves take the oldest (and usually largest)
+    // loops from the front.
+    std::shared_ptr<ParallelForLoop> Find(const ParallelForLoop *within,
+                                          bool fromBack) {
+        if (size == 0) return nullptr;
+        std::lock_guard<std::mutex> lock(mutex);
+        // Drop loops that have no iterations left to claim
+        auto exhausted = [](const std::shared_ptr<ParallelForLoop> &loop) {
+            return loop->Exhausted();
+        };
+        auto end = std::remove_if(loops.begin(), loops.end(), exhausted);
+        int nRemoved = loops.end() - end;
+        loops.erase(end, loops.end());
+        size -= nRemoved;
+        nQueuedLoops -= nRemoved;
+
+        for (size_t i = 0; i < loops.size(); ++i) {
+            const std::shared_ptr<ParallelForLoop> &loop =
+                loops[fromBack ? loops.size() - 1 - i : i];
+            if (!within || loop->IsWithin(within)) return loop;
+        }
+        return nullptr;
     }
+
+  private:
+    // WorkQueue Private Data
+    std::mutex mutex;
+    std::deque<std::shared_ptr<ParallelForLoop>> loops;
+    std::atomic<int> size{0};
 };
 
 void Barrier::Wait() {
@@ -107,7 +221,45 @@ void Barrier::Wait() {
         cv.wait(lock, [this] { return count == 0; });
 }
 
-static std::condition_variable workListCondition;
+// Returns a loop with unclaimed iterations that's within _within_ (or any
+// loop, if _within_ is nullptr), preferring the calling thread's own queue,
+// or nullptr if there's currently no such work anywhere.
+static std::shared_ptr<ParallelForLoop> FindWork(
+    int tIndex, const ParallelForLoop *within) {
+    if (nQueuedLoops == 0) return nullptr;
+    CHECK_LT(tIndex, nWorkQueues);
+    std::shared_ptr<ParallelForLoop> loop =
+        workQueues[tIndex].Find(within, true);
+    for (int i = 1; !loop && i < nWorkQueues; ++i)
+        loop = workQueues[(tIndex + i) % nWorkQueues].Find(within, false);
+    return loop;
+}
+
+void WakeWorkers() {
+    // Taking the mutex ensures that a thread that just found no work is
+    // either already waiting (and is woken) or will see the new epoch.
+    {
+        std::lock_guard<std::mutex> lock(workerMutex);
+        ++workEpoch;
+    }
+    workerCondition.notify_all();
+}
+
+static void EnqueueLoop(std::shared_ptr<ParallelForLoop> loop) {
+    CHECK_LT(ThreadIndex, nWorkQueues);
+    workQueues[ThreadIndex].Push(std::move(loop));
+    WakeWorkers();
+}
+
+// Runs chunks of _loop_ until all of its iterations have completed.
+static void RunLoopToCompletion(ParallelForLoop &loop) {
+    while (loop.RunChunk())
+        ;
+    // Other threads are finishing up the last chunks; run chunks of loops
+    // that they issue from them in the meantime, so that those make
+    // progress.
+    RunQueuedWorkUntil(&loop, [&loop]() { return loop.Finished(); });
+}
 
 static void workerThreadFunc(int tIndex, std::shared_ptr<Barrier> barrier) {
     LOG(INFO) << "Started execution in worker thread " << tIndex;
@@ -126,56 +278,33 @@ static void workerThreadFunc(int tIndex, std::shared_ptr<Barrier> barrier) {
     // the threads have cleared it.
     barrier.reset();
 
-    std::unique_lock<std::mutex> lock(workListMutex);
-    while (!shutdownThreads) {
-        if (reportWorkerStats) {
+    int reportedEpoch = statsReportEpoch;
+    while (true) {
+        if (statsReportEpoch != reportedEpoch) {
             ReportThreadStats();
+            reportedEpoch = statsReportEpoch;
+            std::lock_guard<std::mutex> lock(workerMutex);
             if (--reporterCount == 0)
                 // Once all worker threads have merged their stats, wake up
                 // the main thread.
                 reportDoneCondition.notify_one();
-            // Now sleep again.
-            workListCondition.wait(lock);
-        } else if (!workList) {
-            // Sleep until there are more tasks to run
-            workListCondition.wait(lock);
-        } else {
-            // Get work from _workList_ and run loop iterations
-            ParallelForLoop &loop = *workList;
-
-            // Run a chunk of loop iterations for _loop_
-
-            // Find the set of loop iterations to run next
-            int64_t indexStart = loop.nextIndex;
-            int64_t indexEnd =
-                std::min(indexStart + loop.chunkSize, loop.maxIndex);
-
-            // Update _loop_ to reflect iterations this thread will run
-            loop.nextIndex = indexEnd;
-            if (loop.nextIndex == loop.maxIndex) workList = loop.next;
-            loop.activeWorkers++;
-
-            // Run loop indices in _[indexStart, indexEnd)_
-            lock.unlock();
-            for (int64_t index = indexStart; index < indexEnd; ++index) {
-                uint64_t oldState = ProfilerState;
-                ProfilerState = loop.profilerState;
-                if (loop.func1D) {
-                    loop.func1D(index);
-                }
-                // Handle other types of loops
-                else {
-                    CHECK(loop.func2D);
-                    loop.func2D(Point2i(index % loop.nX, index / loop.nX));
-                }
-                ProfilerState = oldState;
-            }
-            lock.lock();
+            continue;
+        }
 
-            // Update _loop_ to reflect completion of iterations
-            loop.activeWorkers--;
-            if (loop.Finished()) workListCondition.notify_all();
+        // Get work from one of the _workQueues_ and run loop iterations
+        // until they have all been claimed
+        std::shared_ptr<ParallelForLoop> loop = FindWork(tIndex, nullptr);
+        if (loop) {
+            while (loop->RunChunk())
+                ;
+            continue;
         }
+
+        // Sleep until there are more tasks to run
+        std::unique_lock<std::mutex> lock(workerMutex);
+        if (shutdownThreads) break;
+        if (nQueuedLoops == 0 && statsReportEpoch == reportedEpoch)
+            workerCondition.wait(lock);
     }
     LOG(INFO) << "Exiting worker thread " << tIndex;
 }
@@ -192,50 +321,12 @@ void ParallelFor(std::function<void(int64_t)> func, int64_t count,
     }
 
     // Create and enqueue _ParallelForLoop_ for this loop
-    ParallelForLoop loop(std::move(func), count, chunkSize,
-                         CurrentProfilerState());
-    workListMutex.lock();
-    loop.next = workList;
-    workList = &loop;
-    workListMutex.unlock();
-
-    // Notify worker threads of work to be done
-    std::unique_lock<std::mutex> lock(workListMutex);
-    workListCondition.notify_all();
+    std::shared_ptr<ParallelForLoop> loop = std::make_shared<ParallelForLoop>(
+        std::move(func), count, chunkSize, CurrentProfilerState());
+    EnqueueLoop(loop);
 
     // Help out with parallel loop iterations in the current thread
-    while (!loop.Finished()) {
-        // Run a chunk of loop iterations for _loop_
-
-        // Find the set of loop iterations to run next
-        int64_t indexStart = loop.nextIndex;
-        int64_t indexEnd = std::min(indexStart + loop.chunkSize, loop.maxIndex);
-
-        // Update _loop_ to reflect iterations this thread will run
-        loop.nextIndex = indexEnd;
-        if (loop.nextIndex == loop.maxIndex) workList = loop.next;
-        loop.activeWorkers++;
-
-        // Run loop indices in _[indexStart, indexEnd)_
-        lock.unlock();
-        for (int64_t index = indexStart; index < indexEnd; ++index) {
-            uint64_t oldState = ProfilerState;
-            ProfilerState = loop.profilerState;
-            if (loop.func1D) {
-                loop.func1D(index);
-            }
-            // Handle other types of loops
-            else {
-                CHECK(loop.func2D);
-                loop.func2D(Point2i(index % loop.nX, index / loop.nX));
-            }
-            ProfilerState = oldState;
-        }
-        lock.lock();
-
-        // Update _loop_ to reflect completion of iterations
-        loop.activeWorkers--;
-    }
+    RunLoopToCompletion(*loop);
 }
 
 PBRT_THREAD_LOCAL int ThreadIndex;
@@ -253,48 +344,46 @@ void ParallelFor2D(std::function<void(Point2i)> func, const Point2i &count) {
         return;
     }
 
-    ParallelForLoop loop(std::move(func), count, CurrentProfilerState());
-    {
-        std::lock_guard<std::mutex> lock(workListMutex);
-        loop.next = workList;
-        workList = &loop;
-    }
-
-    std::unique_lock<std::mutex> lock(workListMutex);
-    workListCondition.notify_all();
+    std::shared_ptr<ParallelForLoop> loop =
+        std::make_shared<ParallelForLoop>(func, count, CurrentProfilerState());
+    EnqueueLoop(loop);
 
     // Help out with parallel loop iterations in the current thread
-    while (!loop.Finished()) {
-        // Run a chunk of loop iterations for _loop_
-
-        // Find the set of loop iterations to run next
-        int64_t indexStart = loop.nextIndex;
-        int64_t indexEnd = std::min(indexStart + loop.chunkSize, loop.maxIndex);
+    RunLoopToCompletion(*loop);
+}
 
-        // Update _loop_ to reflect iterations this thread will run
-        loop.nextIndex = indexEnd;
-        if (loop.nextIndex == loop.maxIndex) workList = loop.next;
-        loop.activeWorkers++;
+std::shared_ptr<ParallelForLoop> EnqueueAsyncTask(std::function<void()> task) {
+    if (threads.empty()) {
+        task();
+        return nullptr;
+    }
+    std::shared_ptr<ParallelForLoop> loop = std::make_shared<ParallelForLoop>(
+        [task](int64_t) { task(); }, 1, 1, CurrentProfilerState());
+    EnqueueLoop(loop);
+    return loop;
+}
 
-        // Run loop indices in _[indexStart, indexEnd)_
-        lock.unlock();
-        for (int64_t index = indexStart; index < indexEnd; ++index) {
-            uint64_t oldState = ProfilerState;
-            ProfilerState = loop.profilerState;
-            if (loop.func1D) {
-                loop.func1D(index);
-            }
-            // Handle other types of loops
-            else {
-                CHECK(loop.func2D);
-                loop.func2D(Point2i(index % loop.nX, index / loop.nX));
-            }
-            ProfilerState = oldState;
+void RunQueuedWorkUntil(const ParallelForLoop *loop,
+                        const std::function<bool()> &done) {
+    // Spin briefly, since the work being waited on is usually about to
+    // finish, and then sleep until a loop is enqueued or finishes.
+    const int maxSpins = 64;
+    int nSpins = 0;
+    while (true) {
+        uint64_t epoch = workEpoch;
+        if (done()) return;
+        std::shared_ptr<ParallelForLoop> work =
+            (threads.empty() || !loop) ? nullptr : FindWork(ThreadIndex, loop);
+        if (work && work->RunChunk()) {
+            nSpins = 0;
+            continue;
         }
-        lock.lock();
-
-        // Update _loop_ to reflect completion of iterations
-        loop.activeWorkers--;
+        if (++nSpins < maxSpins) {
+            std::this_thread::yield();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(workerMutex);
+        workerCondition.wait(lock, [&]() { return workEpoch != epoch; });
     }
 }
 
@@ -306,6 +395,8 @@ void ParallelInit() {
     CHECK_EQ(threads.size(), 0);
     int nThreads = MaxThreadIndex();
     ThreadIndex = 0;
+    workQueues.reset(new WorkQueue[nThreads]);
+    nWorkQueues = nThreads;
 
     // Create a barrier so that we can be sure all worker threads get past
     // their call to ProfilerWorkerThreadInit() before we return from this
@@ -325,31 +416,31 @@ void ParallelCleanup() {
     if (threads.empty()) return;
 
     {
-        std::lock_guard<std::mutex> lock(workListMutex);
+        std::lock_guard<std::mutex> lock(workerMutex);
         shutdownThreads = true;
-        workListCondition.notify_all();
+        workerCondition.notify_all();
     }
 
     for (std::thread &thread : threads) thread.join();
     threads.erase(threads.begin(), threads.end());
     shutdownThreads = false;
+    workQueues.reset();
+    nWorkQueues = 0;
+    nQueuedLoops = 0;
 }
 
 void MergeWorkerThreadStats() {
-    std::unique_lock<std::mutex> lock(workListMutex);
-    std::unique_lock<std::mutex> doneLock(reportDoneMutex);
+    std::unique_lock<std::mutex> lock(workerMutex);
     // Set up state so that the worker threads will know that we would like
     // them to report their thread-specific stats when they wake up.
-    reportWorkerStats = true;
     reporterCount = threads.size();
+    ++statsReportEpoch;
 
     // Wake up the worker threads.
-    workListCondition.notify_all();
+    workerCondition.notify_all();
 
     // Wait for all of them to merge their stats.
     reportDoneCondition.wait(lock, []() { return reporterCount == 0; });
-
-    reportWorkerStats = false;
 }
 
 }  // namespace pbrt
@@ -45,6 +45,8 @@
 #include <condition_variable>
 #include <functional>
 #include <atomic>
+#include <future>
+#include <thread>
 
 namespace pbrt {
 
@@ -105,6 +107,67 @@ void ParallelFor2D(std::function<void(Point2i)> func, const Point2i &count);
 int MaxThreadIndex();
 int NumSystemCores();
 
+// Asynchronous tasks run on the same threads as ParallelFor() loops. Each
+// task is run as a one-iteration loop.
+class ParallelForLoop;
+std::shared_ptr<ParallelForLoop> EnqueueAsyncTask(std::function<void()> task);
+
+// Runs chunks of _loop_, and of loops issued (possibly indirectly) from
+// its iterations, in the calling thread until _done_ returns true; it
+// sleeps when there are none to run. If _loop_ is nullptr, it only sleeps.
+// Code that makes _done_ true other than by finishing a loop must call
+// _WakeWorkers()_ afterward, or the waiting thread may never wake up.
+//
+// Waiting threads only help with the work they're waiting for, so a loop
+// body never has another iteration of its own loop (or of an unrelated
+// loop) run in the middle of it on the same thread; per-_ThreadIndex_
+// state that a loop body uses isn't re-entered by the loops it waits on
+// unless they use the same state. Because the waited-on work may still
+// need locks, neither waiting nor calling ParallelFor() should be done
+// while holding a lock that other loops or tasks may need.
+void RunQueuedWorkUntil(const ParallelForLoop *loop,
+                        const std::function<bool()> &done);
+// Wakes up idle worker threads and threads sleeping in
+// _RunQueuedWorkUntil()_.
+void WakeWorkers();
+
+template <typename T>
+class Future {
+  public:
+    // Future Public Methods
+    Future() = default;
+    Future(std::future<T> f, std::shared_ptr<ParallelForLoop> loop)
+        : f(std::move(f)), loop(std::move(loop)) {}
+    bool Valid() const { return f.valid(); }
+    bool Ready() const {
+        return f.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+    void Wait() {
+        RunQueuedWorkUntil(loop.get(), [this]() { return Ready(); });
+    }
+    T Get() {
+        Wait();
+        return f.get();
+    }
+
+  private:
+    // Future Private Data
+    std::future<T> f;
+    // The loop that runs the task
+    std::shared_ptr<ParallelForLoop> loop;
+};
+
+template <typename F>
+Future<typename std::result_of<F()>::type> RunAsync(F func) {
+    using T = typename std::result_of<F()>::type;
+    std::shared_ptr<std::packaged_task<T()>> task =
+        std::make_shared<std::packaged_task<T()>>(std::move(func));
+    std::future<T> f = task->get_future();
+    std::shared_ptr<ParallelForLoop> loop =
+        EnqueueAsyncTask([task]() { (*task)(); });
+    return Future<T>(std::move(f), std::move(loop));
+}
+
 void ParallelInit();
 void ParallelCleanup();
 void MergeWorkerThreadStats();
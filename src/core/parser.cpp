@@ -59,7 +59,7 @@
 
 namespace pbrt {
 
-Loc *parserLoc;
+PBRT_THREAD_LOCAL Loc *parserLoc;
 
 static std::string toString(string_view s) {
     return std::string(s.data(), s.size());
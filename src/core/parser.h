@@ -57,8 +57,11 @@ struct Loc {
     int line = 1, column = 0;
 };
 
-// If not nullptr, stores the current file location of the parser.
-extern Loc *parserLoc;
+// If not nullptr, stores the current file location of the parser. It's
+// only set on the parsing thread, so that messages from work done
+// asynchronously (e.g., texture loading) don't report a location the
+// parser has since moved past.
+extern PBRT_THREAD_LOCAL Loc *parserLoc;
 
 // Reimplement enough of absl/std::string_view as needed for the below
 // (Bringing on the abseil dependency at this point just for this seems
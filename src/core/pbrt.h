@@ -180,6 +180,17 @@ struct Options {
     bool quiet = false;
     bool cat = false, toPly = false;
     std::string imageFile;
+    std::string bssrdfCacheFile;
+    // Progressive rendering: time limit, intermediate image interval (both
+    // in seconds) and target relative error; zero disables each.
+    bool progressive = false;
+    Float timeLimit = 0, writeInterval = 0, noiseTarget = 0;
+    // Texture tile cache budget, in MB
+    int textureCacheSize = 1024;
+    // Ptex cache limits: open files and memory, in MB
+    int ptexMaxFiles = 100, ptexMaxMem = 4096;
+    // Store triangle meshes as _CompactMeshPrimitive_s
+    bool compactMeshes = false;
     // x0, x1, y0, y1
     Float cropWindow[2][2];
 };
@@ -43,6 +43,15 @@ STAT_MEMORY_COUNTER("Memory/Primitives", primitiveMemory);
 
 // Primitive Method Definitions
 Primitive::~Primitive() {}
+void Primitive::IntersectN(const Ray *rays, SurfaceInteraction *isects,
+                           bool *hits, int n) const {
+    for (int i = 0; i < n; ++i) hits[i] = Intersect(rays[i], &isects[i]);
+}
+
+void Primitive::IntersectPN(const Ray *rays, bool *occluded, int n) const {
+    for (int i = 0; i < n; ++i) occluded[i] = IntersectP(rays[i]);
+}
+
 const AreaLight *Aggregate::GetAreaLight() const {
     LOG(FATAL) <<
         "Aggregate::GetAreaLight() method"
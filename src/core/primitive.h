@@ -55,6 +55,9 @@ class Primitive {
     virtual Bounds3f WorldBound() const = 0;
     virtual bool Intersect(const Ray &r, SurfaceInteraction *) const = 0;
     virtual bool IntersectP(const Ray &r) const = 0;
+    virtual void IntersectN(const Ray *rays, SurfaceInteraction *isects,
+                            bool *hits, int n) const;
+    virtual void IntersectPN(const Ray *rays, bool *occluded, int n) const;
     virtual const AreaLight *GetAreaLight() const = 0;
     virtual const Material *GetMaterial() const = 0;
     virtual void ComputeScatteringFunctions(SurfaceInteraction *isect,
@@ -79,6 +82,7 @@ class GeometricPrimitive : public Primitive {
     void ComputeScatteringFunctions(SurfaceInteraction *isect,
                                     MemoryArena &arena, TransportMode mode,
                                     bool allowMultipleLobes) const;
+    const Shape *GetShape() const { return shape.get(); }
 
   private:
     // GeometricPrimitive Private Data
@@ -64,6 +64,10 @@ class Sampler {
     virtual bool StartNextSample();
     virtual std::unique_ptr<Sampler> Clone(int seed) = 0;
     virtual bool SetSampleNumber(int64_t sampleNum);
+    // Restarts the sampler's random number generator, if it has one, at
+    // the given sequence, so that the samples generated for a pixel can be
+    // reproduced later.
+    virtual void Reseed(uint64_t sequenceIndex) {}
     std::string StateString() const {
       return StringPrintf("(%d,%d), sample %" PRId64, currentPixel.x,
                           currentPixel.y, currentPixelSampleIndex);
@@ -72,6 +76,11 @@ class Sampler {
 
     // Sampler Public Data
     const int64_t samplesPerPixel;
+    // Adaptive sampling stops taking samples in a pixel once it has at least
+    // _adaptiveMinSamples_ and its estimated relative error is below
+    // _adaptiveMaxError_; it is disabled when _adaptiveMaxError_ is zero.
+    Float adaptiveMaxError = 0;
+    int64_t adaptiveMinSamples = 0;
 
   protected:
     // Sampler Protected Data
@@ -92,6 +101,7 @@ class PixelSampler : public Sampler {
     PixelSampler(int64_t samplesPerPixel, int nSampledDimensions);
     bool StartNextSample();
     bool SetSampleNumber(int64_t);
+    void Reseed(uint64_t sequenceIndex) { rng.SetSequence(sequenceIndex); }
     Float Get1D();
     Point2f Get2D();
 
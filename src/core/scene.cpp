@@ -54,6 +54,19 @@ bool Scene::IntersectP(const Ray &ray) const {
     return aggregate->IntersectP(ray);
 }
 
+void Scene::IntersectN(const Ray *rays, SurfaceInteraction *isects,
+                       bool *hits, int n) const {
+    nIntersectionTests += n;
+    for (int i = 0; i < n; ++i) DCHECK_NE(rays[i].d, Vector3f(0,0,0));
+    aggregate->IntersectN(rays, isects, hits, n);
+}
+
+void Scene::IntersectPN(const Ray *rays, bool *occluded, int n) const {
+    nShadowTests += n;
+    for (int i = 0; i < n; ++i) DCHECK_NE(rays[i].d, Vector3f(0,0,0));
+    aggregate->IntersectPN(rays, occluded, n);
+}
+
 bool Scene::IntersectTr(Ray ray, Sampler &sampler, SurfaceInteraction *isect,
                         Spectrum *Tr) const {
     *Tr = Spectrum(1.f);
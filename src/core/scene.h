@@ -64,6 +64,11 @@ class Scene {
     const Bounds3f &WorldBound() const { return worldBound; }
     bool Intersect(const Ray &ray, SurfaceInteraction *isect) const;
     bool IntersectP(const Ray &ray) const;
+    // Trace _n_ rays together, which is faster than tracing them one at a
+    // time when they are coherent
+    void IntersectN(const Ray *rays, SurfaceInteraction *isects, bool *hits,
+                    int n) const;
+    void IntersectPN(const Ray *rays, bool *occluded, int n) const;
     bool IntersectTr(Ray ray, Sampler &sampler, SurfaceInteraction *isect,
                      Spectrum *transmittance) const;
 
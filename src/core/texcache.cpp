@@ -0,0 +1,254 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+// core/texcache.cpp*
+#include "texcache.h"
+#include "stats.h"
+#include <cstring>
+
+namespace pbrt {
+
+STAT_COUNTER("Texture/Tile cache hits", nTileCacheHits);
+STAT_COUNTER("Texture/Tile cache misses", nTileCacheMisses);
+STAT_COUNTER("Texture/Tile cache evictions", nTileCacheEvictions);
+STAT_MEMORY_COUNTER("Memory/Texture tiles read", tileBytesRead);
+STAT_MEMORY_COUNTER("Memory/Texture tiles mapped", tileBytesMapped);
+
+// TiledImagePyramid Local Definitions
+static const char tiledPyramidMagic[8] = {'P', 'B', 'R', 'T', 'M', 'I', 'P', 1};
+static PBRT_CONSTEXPR int64_t tiledPyramidAlignment = 4096;
+
+static int64_t TiledPyramidFirstTileOffset(int nLevels) {
+    int64_t headerBytes =
+        sizeof(tiledPyramidMagic) + (3 + 2 * nLevels) * sizeof(int32_t);
+    return (headerBytes + tiledPyramidAlignment - 1) / tiledPyramidAlignment *
+           tiledPyramidAlignment;
+}
+
+// TiledImagePyramid Method Definitions
+std::unique_ptr<TiledImagePyramid> TiledImagePyramid::Read(
+    const std::string &filename) {
+    std::unique_ptr<TiledImagePyramid> pyramid(new TiledImagePyramid);
+    pyramid->filename = filename;
+    std::ifstream &in = pyramid->file;
+    in.open(filename, std::ios::binary);
+    if (!in) {
+        Error("%s: unable to open tiled texture file", filename.c_str());
+        return nullptr;
+    }
+
+    // Read and validate the header
+    char magic[sizeof(tiledPyramidMagic)];
+    int32_t header[3];
+    in.read(magic, sizeof(magic));
+    in.read((char *)header, sizeof(header));
+    if (!in || memcmp(magic, tiledPyramidMagic, sizeof(magic)) != 0) {
+        Error("%s: not a tiled texture file", filename.c_str());
+        return nullptr;
+    }
+    pyramid->nChannels = header[0];
+    pyramid->tileSize = header[1];
+    int nLevels = header[2];
+    if ((pyramid->nChannels != 1 && pyramid->nChannels != 3) ||
+        pyramid->tileSize < 32 || !IsPowerOf2(pyramid->tileSize) ||
+        nLevels < 1 || nLevels > 32) {
+        Error("%s: invalid tiled texture header", filename.c_str());
+        return nullptr;
+    }
+
+    // Read level resolutions and compute tile layout
+    int nTiles = 0;
+    for (int level = 0; level < nLevels; ++level) {
+        int32_t res[2];
+        in.read((char *)res, sizeof(res));
+        if (!in || res[0] < 1 || res[1] < 1) {
+            Error("%s: invalid tiled texture level resolution",
+                  filename.c_str());
+            return nullptr;
+        }
+        Point2i tiles((res[0] + pyramid->tileSize - 1) / pyramid->tileSize,
+                      (res[1] + pyramid->tileSize - 1) / pyramid->tileSize);
+        pyramid->levelResolution.push_back(Point2i(res[0], res[1]));
+        pyramid->levelTiles.push_back(tiles);
+        pyramid->levelFirstTile.push_back(nTiles);
+        nTiles += tiles.x * tiles.y;
+    }
+    pyramid->nTiles = nTiles;
+    pyramid->firstTileOffset = TiledPyramidFirstTileOffset(nLevels);
+    return pyramid;
+}
+
+bool TiledImagePyramid::MapTiles() {
+    if (mappedTiles) return true;
+    std::unique_ptr<MappedFile> mapped = MappedFile::Open(filename);
+    if (!mapped ||
+        mapped->Size() < firstTileOffset + size_t(nTiles) * TileBytes())
+        return false;
+    mappedFile = std::move(mapped);
+    mappedTiles = (const float *)(mappedFile->Data() + firstTileOffset);
+    tileBytesMapped += mappedFile->Size() - firstTileOffset;
+    return true;
+}
+
+bool TiledImagePyramid::Write(const std::string &filename, int nChannels,
+                              int tileSize,
+                              const std::vector<Point2i> &levelResolution,
+                              const std::vector<const float *> &levels) {
+    CHECK(nChannels == 1 || nChannels == 3);
+    CHECK(tileSize >= 32 && IsPowerOf2(tileSize));
+    CHECK_EQ(levelResolution.size(), levels.size());
+    std::ofstream out(filename, std::ios::binary);
+    if (!out) {
+        Error("%s: unable to open tiled texture file for writing",
+              filename.c_str());
+        return false;
+    }
+
+    // Write header and pad to the first tile
+    int nLevels = levels.size();
+    int32_t header[3] = {nChannels, tileSize, nLevels};
+    out.write(tiledPyramidMagic, sizeof(tiledPyramidMagic));
+    out.write((const char *)header, sizeof(header));
+    for (const Point2i &res : levelResolution) {
+        int32_t r[2] = {res.x, res.y};
+        out.write((const char *)r, sizeof(r));
+    }
+    std::vector<char> padding(TiledPyramidFirstTileOffset(nLevels) -
+                              int64_t(out.tellp()));
+    out.write(padding.data(), padding.size());
+
+    // Write the tiles of each level
+    std::vector<float> tile(nChannels * tileSize * tileSize);
+    for (int level = 0; level < nLevels; ++level) {
+        Point2i res = levelResolution[level];
+        for (int ty = 0; ty < res.y; ty += tileSize)
+            for (int tx = 0; tx < res.x; tx += tileSize) {
+                std::fill(tile.begin(), tile.end(), 0.f);
+                for (int t = ty; t < std::min(ty + tileSize, res.y); ++t)
+                    for (int s = tx; s < std::min(tx + tileSize, res.x); ++s)
+                        for (int c = 0; c < nChannels; ++c)
+                            tile[((t - ty) * tileSize + (s - tx)) * nChannels +
+                                 c] =
+                                levels[level][(t * res.x + s) * nChannels + c];
+                out.write((const char *)tile.data(),
+                          tile.size() * sizeof(float));
+            }
+    }
+    if (!out) {
+        Error("%s: error writing tiled texture file", filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool TiledImagePyramid::ReadTile(int tileIndex, float *texels) const {
+    if (mappedTiles) {
+        memcpy(texels, (const char *)mappedTiles + tileIndex * TileBytes(),
+               TileBytes());
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(fileMutex);
+    file.seekg(firstTileOffset + int64_t(tileIndex) * TileBytes());
+    file.read((char *)texels, TileBytes());
+    if (!file) {
+        file.clear();
+        return false;
+    }
+    tileBytesRead += TileBytes();
+    return true;
+}
+
+// TextureTileCache Method Definitions
+TextureTileCache::TextureTileCache(size_t maxBytes)
+    : maxShardBytes(maxBytes / nShards) {}
+
+std::shared_ptr<const void> TextureTileCache::GetTile(
+    uint64_t textureId, int tileIndex, size_t tileBytes,
+    const std::function<std::shared_ptr<const void>()> &loadTile) {
+    TileKey key{textureId, tileIndex};
+    Shard &shard = shards[TileKeyHash()(key) % nShards];
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto iter = shard.tileMap.find(key);
+        if (iter != shard.tileMap.end()) {
+            // Move tile to the front of the shard's LRU list
+            ++nTileCacheHits;
+            shard.tiles.splice(shard.tiles.begin(), shard.tiles, iter->second);
+            return iter->second->texels;
+        }
+    }
+
+    // Load the tile without holding the shard's lock; if another thread
+    // loads the same tile concurrently, the first one to finish is kept.
+    ++nTileCacheMisses;
+    std::shared_ptr<const void> texels = loadTile();
+    if (!texels) return nullptr;
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto iter = shard.tileMap.find(key);
+    if (iter != shard.tileMap.end()) return iter->second->texels;
+    shard.tiles.push_front({key, texels, tileBytes});
+    shard.tileMap[key] = shard.tiles.begin();
+    shard.bytes += tileBytes;
+
+    // Evict least recently used tiles while over budget. Tiles still in use
+    // by lookups stay alive until the lookups finish with them.
+    while (shard.bytes > maxShardBytes && shard.tiles.size() > 1) {
+        const Tile &tile = shard.tiles.back();
+        shard.bytes -= tile.bytes;
+        shard.tileMap.erase(tile.key);
+        shard.tiles.pop_back();
+        ++nTileCacheEvictions;
+    }
+    return texels;
+}
+
+void TextureTileCache::ReleaseTexture(uint64_t textureId) {
+    for (Shard &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto iter = shard.tiles.begin(); iter != shard.tiles.end();) {
+            if (iter->key.textureId == textureId) {
+                shard.bytes -= iter->bytes;
+                shard.tileMap.erase(iter->key);
+                iter = shard.tiles.erase(iter);
+            } else
+                ++iter;
+        }
+    }
+}
+
+TextureTileCache *GetTextureTileCache() {
+    static TextureTileCache cache(size_t(PbrtOptions.textureCacheSize) << 20);
+    return &cache;
+}
+
+}  // namespace pbrt
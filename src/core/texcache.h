@@ -0,0 +1,167 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_CORE_TEXCACHE_H
+#define PBRT_CORE_TEXCACHE_H
+
+// core/texcache.h*
+#include "pbrt.h"
+#include "geometry.h"
+#include "fileutil.h"
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace pbrt {
+
+// TiledImagePyramid Declarations
+
+// A tiled image pyramid file stores the levels of a MIP map, finest first,
+// as square tiles of 32-bit float texels. The header gives the number of
+// channels, the tile size and the resolution of each level. The tiles of
+// each level follow in row-major order, starting at the first page boundary
+// after the header; tiles are at least 32x32 texels so that each one starts
+// on a page boundary. Tiles at the right and top edges of a level are
+// padded to the full tile size. Rows are in texture space, with $t=0$ at the
+// bottom of the image.
+class TiledImagePyramid {
+  public:
+    // TiledImagePyramid Public Methods
+    static std::unique_ptr<TiledImagePyramid> Read(const std::string &filename);
+    static bool Write(const std::string &filename, int nChannels, int tileSize,
+                      const std::vector<Point2i> &levelResolution,
+                      const std::vector<const float *> &levels);
+    const std::string &Filename() const { return filename; }
+    int Channels() const { return nChannels; }
+    int TileSize() const { return tileSize; }
+    int Levels() const { return levelResolution.size(); }
+    Point2i LevelResolution(int level) const { return levelResolution[level]; }
+    int TileIndex(int level, int s, int t) const {
+        // Returns the index of the tile holding texel $(s,t)$, counting the
+        // tiles of all levels
+        return levelFirstTile[level] + (t / tileSize) * levelTiles[level].x +
+               s / tileSize;
+    }
+    size_t TileBytes() const {
+        return sizeof(float) * nChannels * tileSize * tileSize;
+    }
+    bool ReadTile(int tileIndex, float *texels) const;
+    bool MapTiles();
+    const float *MappedTiles() const { return mappedTiles; }
+
+  private:
+    // TiledImagePyramid Private Methods
+    TiledImagePyramid() {}
+
+    // TiledImagePyramid Private Data
+    std::string filename;
+    int nChannels, tileSize;
+    std::vector<Point2i> levelResolution, levelTiles;
+    std::vector<int> levelFirstTile;
+    int nTiles;
+    int64_t firstTileOffset;
+    // When the file is mapped into memory, _mappedTiles_ points to its
+    // first tile
+    std::unique_ptr<MappedFile> mappedFile;
+    const float *mappedTiles = nullptr;
+    mutable std::mutex fileMutex;
+    mutable std::ifstream file;
+};
+
+// TextureTileCache Declarations
+
+// TextureTileCache keeps recently used tiles of tiled textures in memory up
+// to a fixed budget, evicting the least recently used tiles beyond it. Tiles
+// are identified by a texture id from _NewTextureId()_ and a tile index, and
+// are loaded on demand by a caller-supplied function. If that function
+// returns nullptr, nothing is cached and _GetTile()_ returns nullptr.
+class TextureTileCache {
+  public:
+    // TextureTileCache Public Methods
+    TextureTileCache(size_t maxBytes);
+    uint64_t NewTextureId() { return nextTextureId++; }
+    std::shared_ptr<const void> GetTile(
+        uint64_t textureId, int tileIndex, size_t tileBytes,
+        const std::function<std::shared_ptr<const void>()> &loadTile);
+    void ReleaseTexture(uint64_t textureId);
+
+  private:
+    // TextureTileCache Private Declarations
+    struct TileKey {
+        bool operator==(const TileKey &k) const {
+            return textureId == k.textureId && tileIndex == k.tileIndex;
+        }
+        uint64_t textureId;
+        int tileIndex;
+    };
+    struct TileKeyHash {
+        size_t operator()(const TileKey &k) const {
+            return std::hash<uint64_t>()(k.textureId * 0x9e3779b97f4a7c15ull ^
+                                         (uint64_t)k.tileIndex);
+        }
+    };
+    struct Tile {
+        TileKey key;
+        std::shared_ptr<const void> texels;
+        size_t bytes;
+    };
+    // The cache is split into shards with separate locks and budgets so that
+    // lookups from different threads rarely contend
+    struct Shard {
+        std::mutex mutex;
+        // Tiles in order of use, most recently used first
+        std::list<Tile> tiles;
+        std::unordered_map<TileKey, std::list<Tile>::iterator, TileKeyHash>
+            tileMap;
+        size_t bytes = 0;
+    };
+    static PBRT_CONSTEXPR int nShards = 64;
+
+    // TextureTileCache Private Data
+    const size_t maxShardBytes;
+    Shard shards[nShards];
+    std::atomic<uint64_t> nextTextureId{1};
+};
+
+TextureTileCache *GetTextureTileCache();
+
+}  // namespace pbrt
+
+#endif  // PBRT_CORE_TEXCACHE_H
@@ -44,6 +44,11 @@
 #include "paramset.h"
 #include "sampling.h"
 #include "progressreporter.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
 
 namespace pbrt {
 
@@ -55,6 +60,63 @@ static const int lightStreamIndex = 1;
 static const int connectionStreamIndex = 2;
 static const int nSampleStreams = 3;
 
+// MLT Checkpoint Local Definitions
+static const char mltCheckpointMagic[8] = {'P', 'B', 'R', 'T', 'M', 'L', 'T', 2};
+
+template <typename T>
+static void WriteValue(std::ostream &out, const T &v) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "values must be trivially copyable");
+    out.write((const char *)&v, sizeof(T));
+}
+
+template <typename T>
+static bool ReadValue(std::istream &in, T *v) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "values must be trivially copyable");
+    in.read((char *)v, sizeof(T));
+    return (bool)in;
+}
+
+// Returns the world bounds, the power and a sampled emitted ray of each
+// light, and where a grid of camera rays hits the scene; a checkpoint is
+// only resumed if these match, so that it isn't applied to a scene whose
+// geometry or lights have changed.
+static std::vector<Float> SceneFingerprint(const Scene &scene,
+                                           const Camera &camera) {
+    const Bounds3f &b = scene.WorldBound();
+    std::vector<Float> fingerprint = {b.pMin.x, b.pMin.y, b.pMin.z,
+                                      b.pMax.x, b.pMax.y, b.pMax.z};
+    for (const auto &light : scene.lights) {
+        fingerprint.push_back(light->Power().y());
+        Ray ray;
+        Normal3f nLight;
+        Float pdfPos, pdfDir;
+        light->Sample_Le(Point2f(0.5f, 0.5f), Point2f(0.5f, 0.5f), 0, &ray,
+                         &nLight, &pdfPos, &pdfDir);
+        fingerprint.insert(fingerprint.end(),
+                           {ray.o.x, ray.o.y, ray.o.z, ray.d.x, ray.d.y,
+                            ray.d.z});
+    }
+    Bounds2i sampleBounds = camera.film->GetSampleBounds();
+    Vector2i extent = sampleBounds.Diagonal();
+    for (int y = 0; y < 4; ++y)
+        for (int x = 0; x < 4; ++x) {
+            CameraSample cs;
+            cs.pFilm = Point2f(sampleBounds.pMin) +
+                       Vector2f((x + 0.5f) * extent.x / 4,
+                                (y + 0.5f) * extent.y / 4);
+            cs.pLens = Point2f(0.5f, 0.5f);
+            cs.time = 0;
+            Ray ray;
+            camera.GenerateRay(cs, &ray);
+            SurfaceInteraction isect;
+            fingerprint.push_back(scene.Intersect(ray, &isect) ? ray.tMax
+                                                               : Infinity);
+        }
+    return fingerprint;
+}
+
 // MLTSampler Method Definitions
 Float MLTSampler::Get1D() {
     ProfilePhase _(Prof::GetSample);
@@ -116,6 +178,26 @@ void MLTSampler::Reject() {
     --currentIteration;
 }
 
+void MLTSampler::WriteState(std::ostream &out) const {
+    WriteValue(out, rng);
+    WriteValue(out, currentIteration);
+    WriteValue(out, largeStep);
+    WriteValue(out, lastLargeStepIteration);
+    WriteValue(out, (int64_t)X.size());
+    out.write((const char *)X.data(), X.size() * sizeof(PrimarySample));
+}
+
+bool MLTSampler::ReadState(std::istream &in) {
+    int64_t nSamples;
+    if (!ReadValue(in, &rng) || !ReadValue(in, &currentIteration) ||
+        !ReadValue(in, &largeStep) || !ReadValue(in, &lastLargeStepIteration) ||
+        !ReadValue(in, &nSamples) || nSamples < 0 || nSamples > (1 << 20))
+        return false;
+    X.resize(nSamples);
+    in.read((char *)X.data(), X.size() * sizeof(PrimarySample));
+    return (bool)in;
+}
+
 void MLTSampler::StartStream(int index) {
     CHECK_LT(index, streamCount);
     streamIndex = index;
@@ -162,6 +244,138 @@ Spectrum MLTIntegrator::L(const Scene &scene, MemoryArena &arena,
            nStrategies;
 }
 
+// MLTChain Definitions
+struct MLTChain {
+    RNG rng;
+    std::unique_ptr<MLTSampler> sampler;
+    int depth;
+    Point2f pCurrent;
+    Spectrum LCurrent;
+    int64_t nMutations = 0;
+};
+
+bool MLTIntegrator::ReadCheckpoint(const Scene &scene,
+                                   std::vector<Float> *bootstrapWeights,
+                                   std::vector<MLTChain> *chains) const {
+    std::ifstream in(checkpointFilename, std::ios::binary);
+    if (!in) return false;
+
+    // Check that the checkpoint was made with the same parameters and scene
+    char magic[sizeof(mltCheckpointMagic)];
+    int32_t header[9];
+    Float params[2];
+    in.read(magic, sizeof(magic));
+    if (!in || memcmp(magic, mltCheckpointMagic, sizeof(magic)) != 0 ||
+        !ReadValue(in, &header) || !ReadValue(in, &params)) {
+        Warning("%s: not an MLT checkpoint file. Starting over.",
+                checkpointFilename.c_str());
+        return false;
+    }
+    Bounds2i sampleBounds = camera->film->GetSampleBounds();
+    int32_t expected[9] = {(int32_t)sizeof(Float), Spectrum::nSamples,
+                           maxDepth,               nBootstrap,
+                           nChains,                sampleBounds.pMin.x,
+                           sampleBounds.pMin.y,    sampleBounds.pMax.x,
+                           sampleBounds.pMax.y};
+    if (memcmp(header, expected, sizeof(header)) != 0 || params[0] != sigma ||
+        params[1] != largeStepProbability) {
+        Warning(
+            "%s: MLT checkpoint was made with different integrator or film "
+            "settings. Starting over.",
+            checkpointFilename.c_str());
+        return false;
+    }
+    std::vector<Float> expectedFingerprint = SceneFingerprint(scene, *camera);
+    int32_t fingerprintSize;
+    std::vector<Float> fingerprint;
+    if (ReadValue(in, &fingerprintSize) &&
+        fingerprintSize == (int32_t)expectedFingerprint.size()) {
+        fingerprint.resize(fingerprintSize);
+        in.read((char *)fingerprint.data(), fingerprintSize * sizeof(Float));
+    }
+    if (!in || fingerprint != expectedFingerprint) {
+        Warning(
+            "%s: MLT checkpoint was made with different scene geometry or "
+            "lights. Starting over.",
+            checkpointFilename.c_str());
+        return false;
+    }
+
+    // Read bootstrap weights, chain states and film splats
+    int nBootstrapSamples = nBootstrap * (maxDepth + 1);
+    bootstrapWeights->resize(nBootstrapSamples);
+    in.read((char *)bootstrapWeights->data(), nBootstrapSamples * sizeof(Float));
+    chains->resize(nChains);
+    for (MLTChain &chain : *chains) {
+        chain.sampler.reset(new MLTSampler(mutationsPerPixel, 0, sigma,
+                                           largeStepProbability,
+                                           nSampleStreams));
+        if (!ReadValue(in, &chain.nMutations) || !ReadValue(in, &chain.rng) ||
+            !ReadValue(in, &chain.depth) || !ReadValue(in, &chain.pCurrent) ||
+            !chain.sampler->ReadState(in))
+            break;
+        for (int c = 0; c < Spectrum::nSamples; ++c)
+            ReadValue(in, &chain.LCurrent[c]);
+    }
+    std::vector<Float> splats(3 * camera->film->croppedPixelBounds.Area());
+    in.read((char *)splats.data(), splats.size() * sizeof(Float));
+    if (!in) {
+        Warning("%s: MLT checkpoint file is truncated. Starting over.",
+                checkpointFilename.c_str());
+        bootstrapWeights->clear();
+        chains->clear();
+        return false;
+    }
+    camera->film->SetSplats(splats);
+    return true;
+}
+
+bool MLTIntegrator::WriteCheckpoint(const Scene &scene,
+                                    const std::vector<Float> &bootstrapWeights,
+                                    const std::vector<MLTChain> &chains) const {
+    // Write the checkpoint to a temporary file and then rename it, so that
+    // an interrupted write doesn't lose the previous checkpoint
+    std::string tempFilename = checkpointFilename + ".tmp";
+    std::ofstream out(tempFilename, std::ios::binary);
+    Bounds2i sampleBounds = camera->film->GetSampleBounds();
+    int32_t header[9] = {(int32_t)sizeof(Float), Spectrum::nSamples,
+                         maxDepth,               nBootstrap,
+                         nChains,                sampleBounds.pMin.x,
+                         sampleBounds.pMin.y,    sampleBounds.pMax.x,
+                         sampleBounds.pMax.y};
+    Float params[2] = {sigma, largeStepProbability};
+    out.write(mltCheckpointMagic, sizeof(mltCheckpointMagic));
+    WriteValue(out, header);
+    WriteValue(out, params);
+    std::vector<Float> fingerprint = SceneFingerprint(scene, *camera);
+    WriteValue(out, (int32_t)fingerprint.size());
+    out.write((const char *)fingerprint.data(),
+              fingerprint.size() * sizeof(Float));
+    out.write((const char *)bootstrapWeights.data(),
+              bootstrapWeights.size() * sizeof(Float));
+    for (const MLTChain &chain : chains) {
+        WriteValue(out, chain.nMutations);
+        WriteValue(out, chain.rng);
+        WriteValue(out, chain.depth);
+        WriteValue(out, chain.pCurrent);
+        chain.sampler->WriteState(out);
+        for (int c = 0; c < Spectrum::nSamples; ++c)
+            WriteValue(out, chain.LCurrent[c]);
+    }
+    std::vector<Float> splats = camera->film->GetSplats();
+    out.write((const char *)splats.data(), splats.size() * sizeof(Float));
+    out.close();
+#ifdef PBRT_IS_WINDOWS
+    // rename() doesn't replace existing files on Windows
+    if (out) std::remove(checkpointFilename.c_str());
+#endif
+    if (!out || std::rename(tempFilename.c_str(), checkpointFilename.c_str())) {
+        Error("%s: unable to write MLT checkpoint", checkpointFilename.c_str());
+        return false;
+    }
+    return true;
+}
+
 void MLTIntegrator::Render(const Scene &scene) {
     std::unique_ptr<Distribution1D> lightDistr =
         ComputeLightPowerDistribution(scene);
@@ -174,10 +388,16 @@ void MLTIntegrator::Render(const Scene &scene) {
     for (size_t i = 0; i < scene.lights.size(); ++i)
         lightToIndex[scene.lights[i].get()] = i;
 
+    // Resume from the checkpoint file, if there is one
+    std::vector<Float> bootstrapWeights;
+    std::vector<MLTChain> chains;
+    bool resumed = !checkpointFilename.empty() &&
+                   ReadCheckpoint(scene, &bootstrapWeights, &chains);
+
     // Generate bootstrap samples and compute normalization constant $b$
     int nBootstrapSamples = nBootstrap * (maxDepth + 1);
-    std::vector<Float> bootstrapWeights(nBootstrapSamples, 0);
-    if (scene.lights.size() > 0) {
+    if (!resumed) bootstrapWeights.resize(nBootstrapSamples, 0);
+    if (!resumed && scene.lights.size() > 0) {
         ProgressReporter progress(nBootstrap / 256,
                                   "Generating bootstrap paths");
         std::vector<MemoryArena> bootstrapThreadArenas(MaxThreadIndex());
@@ -205,64 +425,103 @@ void MLTIntegrator::Render(const Scene &scene) {
     Film &film = *camera->film;
     int64_t nTotalMutations =
         (int64_t)mutationsPerPixel * (int64_t)film.GetSampleBounds().Area();
+    int64_t nMutationsDone = nTotalMutations;
     if (scene.lights.size() > 0) {
+        if (!resumed) {
+            // Select initial states of the chains from the bootstrap samples
+            chains.resize(nChains);
+            ParallelFor([&](int i) {
+                MLTChain &chain = chains[i];
+                MemoryArena arena;
+                chain.rng.SetSequence(i);
+                int bootstrapIndex =
+                    bootstrap.SampleDiscrete(chain.rng.UniformFloat());
+                chain.depth = bootstrapIndex % (maxDepth + 1);
+                chain.sampler.reset(new MLTSampler(mutationsPerPixel,
+                                                   bootstrapIndex, sigma,
+                                                   largeStepProbability,
+                                                   nSampleStreams));
+                chain.LCurrent = L(scene, arena, lightDistr, lightToIndex,
+                                   *chain.sampler, chain.depth, &chain.pCurrent);
+            }, nChains);
+        }
+
+        // Advance the chains in rounds, checkpointing between them
         const int progressFrequency = 32768;
         ProgressReporter progress(nTotalMutations / progressFrequency,
                                   "Rendering");
-        ParallelFor([&](int i) {
-            int64_t nChainMutations =
-                std::min((i + 1) * nTotalMutations / nChains, nTotalMutations) -
-                i * nTotalMutations / nChains;
-            // Follow {i}th Markov chain for _nChainMutations_
-            MemoryArena arena;
-
-            // Select initial state from the set of bootstrap samples
-            RNG rng(i);
-            int bootstrapIndex = bootstrap.SampleDiscrete(rng.UniformFloat());
-            int depth = bootstrapIndex % (maxDepth + 1);
-
-            // Initialize local variables for selected state
-            MLTSampler sampler(mutationsPerPixel, bootstrapIndex, sigma,
-                               largeStepProbability, nSampleStreams);
-            Point2f pCurrent;
-            Spectrum LCurrent =
-                L(scene, arena, lightDistr, lightToIndex, sampler, depth, &pCurrent);
-
-            // Run the Markov chain for _nChainMutations_ steps
-            for (int64_t j = 0; j < nChainMutations; ++j) {
-                sampler.StartIteration();
-                Point2f pProposed;
-                Spectrum LProposed =
-                    L(scene, arena, lightDistr, lightToIndex, sampler, depth, &pProposed);
-                // Compute acceptance probability for proposed sample
-                Float accept = std::min((Float)1, LProposed.y() / LCurrent.y());
-
-                // Splat both current and proposed samples to _film_
-                if (accept > 0)
-                    film.AddSplat(pProposed,
-                                  LProposed * accept / LProposed.y());
-                film.AddSplat(pCurrent, LCurrent * (1 - accept) / LCurrent.y());
-
-                // Accept or reject the proposal
-                if (rng.UniformFloat() < accept) {
-                    pCurrent = pProposed;
-                    LCurrent = LProposed;
-                    sampler.Accept();
-                    ++acceptedMutations;
-                } else
-                    sampler.Reject();
-                ++totalMutations;
-                if ((i * nTotalMutations / nChains + j) % progressFrequency ==
-                    0)
-                    progress.Update();
-                arena.Reset();
+        nMutationsDone = 0;
+        for (const MLTChain &chain : chains) nMutationsDone += chain.nMutations;
+        progress.Update(std::min(nMutationsDone, nTotalMutations) /
+                        progressFrequency);
+        auto lastCheckpoint = std::chrono::steady_clock::now();
+        const int nRounds = checkpointFilename.empty() ? 1 : 64;
+        for (int round = 1; round <= nRounds; ++round) {
+            ParallelFor([&](int i) {
+                MLTChain &chain = chains[i];
+                MLTSampler &sampler = *chain.sampler;
+                MemoryArena arena;
+                int64_t nChainMutations =
+                    std::min((i + 1) * nTotalMutations / nChains,
+                             nTotalMutations) -
+                    i * nTotalMutations / nChains;
+                // Follow {i}th Markov chain up to this round's share of its
+                // _nChainMutations_ steps
+                for (; chain.nMutations < nChainMutations * round / nRounds;
+                     ++chain.nMutations) {
+                    sampler.StartIteration();
+                    Point2f pProposed;
+                    Spectrum LProposed =
+                        L(scene, arena, lightDistr, lightToIndex, sampler,
+                          chain.depth, &pProposed);
+                    // Compute acceptance probability for proposed sample
+                    Float accept = std::min((Float)1,
+                                            LProposed.y() / chain.LCurrent.y());
+
+                    // Splat both current and proposed samples to _film_
+                    if (accept > 0)
+                        film.AddSplat(pProposed,
+                                      LProposed * accept / LProposed.y());
+                    film.AddSplat(chain.pCurrent, chain.LCurrent * (1 - accept) /
+                                                      chain.LCurrent.y());
+
+                    // Accept or reject the proposal
+                    if (chain.rng.UniformFloat() < accept) {
+                        chain.pCurrent = pProposed;
+                        chain.LCurrent = LProposed;
+                        sampler.Accept();
+                        ++acceptedMutations;
+                    } else
+                        sampler.Reject();
+                    ++totalMutations;
+                    if ((i * nTotalMutations / nChains + chain.nMutations) %
+                            progressFrequency ==
+                        0)
+                        progress.Update();
+                    arena.Reset();
+                }
+            }, nChains);
+
+            // Periodically checkpoint the chains
+            std::chrono::duration<Float> sinceCheckpoint =
+                std::chrono::steady_clock::now() - lastCheckpoint;
+            if (!checkpointFilename.empty() &&
+                (round == nRounds ||
+                 sinceCheckpoint.count() >= checkpointInterval)) {
+                WriteCheckpoint(scene, bootstrapWeights, chains);
+                lastCheckpoint = std::chrono::steady_clock::now();
             }
-        }, nChains);
+        }
         progress.Done();
+        nMutationsDone = 0;
+        for (const MLTChain &chain : chains) nMutationsDone += chain.nMutations;
     }
 
-    // Store final image computed with MLT
-    camera->film->WriteImage(b / mutationsPerPixel);
+    // Store final image computed with MLT; a resumed checkpoint may have
+    // run more mutations than were requested this time
+    Float mutationsPerPixelDone =
+        (double)nMutationsDone / film.GetSampleBounds().Area();
+    camera->film->WriteImage(b / mutationsPerPixelDone);
 }
 
 MLTIntegrator *CreateMLTIntegrator(const ParamSet &params,
@@ -274,12 +533,16 @@ MLTIntegrator *CreateMLTIntegrator(const ParamSet &params,
     Float largeStepProbability =
         params.FindOneFloat("largestepprobability", 0.3f);
     Float sigma = params.FindOneFloat("sigma", .01f);
+    std::string checkpointFilename =
+        params.FindOneFilename("checkpointfile", "");
+    Float checkpointInterval = params.FindOneFloat("checkpointinterval", 600);
     if (PbrtOptions.quickRender) {
         mutationsPerPixel = std::max(1, mutationsPerPixel / 16);
         nBootstrap = std::max(1, nBootstrap / 16);
     }
     return new MLTIntegrator(camera, maxDepth, nBootstrap, nChains,
-                             mutationsPerPixel, sigma, largeStepProbability);
+                             mutationsPerPixel, sigma, largeStepProbability,
+                             checkpointFilename, checkpointInterval);
 }
 
 }  // namespace pbrt
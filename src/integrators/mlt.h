@@ -45,6 +45,7 @@
 #include "spectrum.h"
 #include "film.h"
 #include "rng.h"
+#include <iosfwd>
 #include <unordered_map>
 
 namespace pbrt {
@@ -68,6 +69,9 @@ class MLTSampler : public Sampler {
     void Reject();
     void StartStream(int index);
     int GetNextIndex() { return streamIndex + streamCount * sampleIndex++; }
+    // Save and restore the state of the sampler's chain, for checkpointing
+    void WriteState(std::ostream &out) const;
+    bool ReadState(std::istream &in);
 
   protected:
     // MLTSampler Private Declarations
@@ -104,19 +108,25 @@ class MLTSampler : public Sampler {
 };
 
 // MLT Declarations
+struct MLTChain;
+
 class MLTIntegrator : public Integrator {
   public:
     // MLTIntegrator Public Methods
     MLTIntegrator(std::shared_ptr<const Camera> camera, int maxDepth,
                   int nBootstrap, int nChains, int mutationsPerPixel,
-                  Float sigma, Float largeStepProbability)
+                  Float sigma, Float largeStepProbability,
+                  const std::string &checkpointFilename = "",
+                  Float checkpointInterval = 600)
         : camera(camera),
           maxDepth(maxDepth),
           nBootstrap(nBootstrap),
           nChains(nChains),
           mutationsPerPixel(mutationsPerPixel),
           sigma(sigma),
-          largeStepProbability(largeStepProbability) {}
+          largeStepProbability(largeStepProbability),
+          checkpointFilename(checkpointFilename),
+          checkpointInterval(checkpointInterval) {}
     void Render(const Scene &scene);
     Spectrum L(const Scene &scene, MemoryArena &arena,
                const std::unique_ptr<Distribution1D> &lightDistr,
@@ -124,6 +134,14 @@ class MLTIntegrator : public Integrator {
                MLTSampler &sampler, int k, Point2f *pRaster);
 
   private:
+    // MLTIntegrator Private Methods
+    bool ReadCheckpoint(const Scene &scene,
+                        std::vector<Float> *bootstrapWeights,
+                        std::vector<MLTChain> *chains) const;
+    bool WriteCheckpoint(const Scene &scene,
+                         const std::vector<Float> &bootstrapWeights,
+                         const std::vector<MLTChain> &chains) const;
+
     // MLTIntegrator Private Data
     std::shared_ptr<const Camera> camera;
     const int maxDepth;
@@ -131,6 +149,12 @@ class MLTIntegrator : public Integrator {
     const int nChains;
     const int mutationsPerPixel;
     const Float sigma, largeStepProbability;
+    // When _checkpointFilename_ is given, the bootstrap weights, the state
+    // of the Markov chains and the film's splats are saved there every
+    // _checkpointInterval_ seconds and at the end, and rendering resumes
+    // from them if the file exists
+    const std::string checkpointFilename;
+    const Float checkpointInterval;
 };
 
 MLTIntegrator *CreateMLTIntegrator(const ParamSet &params,
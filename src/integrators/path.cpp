@@ -77,6 +77,9 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
     // avoid terminating refracted rays that are about to be refracted back
     // out of a medium and thus have their beta value increased.
     Float etaScale = 1;
+    // The shadow rays of the path's light samples are traced together once
+    // the path is complete
+    ShadowRayBatch shadowRays(scene);
 
     for (bounces = 0;; ++bounces) {
         // Find next path vertex and accumulate contribution
@@ -119,10 +122,12 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
         if (isect.bsdf->NumComponents(BxDFType(BSDF_ALL & ~BSDF_SPECULAR)) >
             0) {
             ++totalPaths;
-            Spectrum Ld = beta * UniformSampleOneLight(isect, scene, arena,
-                                                       sampler, false, distrib);
+            int nShadowRays = shadowRays.Count();
+            Spectrum Ld = UniformSampleOneLight(isect, scene, sampler, distrib,
+                                                beta, &shadowRays);
             VLOG(2) << "Sampled direct lighting Ld = " << Ld;
-            if (Ld.IsBlack()) ++zeroRadiancePaths;
+            if (Ld.IsBlack() && shadowRays.Count() == nShadowRays)
+                ++zeroRadiancePaths;
             CHECK_GE(Ld.y(), 0.f);
             L += Ld;
         }
@@ -160,8 +165,9 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
             beta *= S / pdf;
 
             // Account for the direct subsurface scattering component
-            L += beta * UniformSampleOneLight(pi, scene, arena, sampler, false,
-                                              lightDistribution->Lookup(pi.p));
+            L += UniformSampleOneLight(pi, scene, sampler,
+                                       lightDistribution->Lookup(pi.p), beta,
+                                       &shadowRays);
 
             // Account for the indirect subsurface scattering component
             Spectrum f = pi.bsdf->Sample_f(pi.wo, &wi, sampler.Get2D(), &pdf,
@@ -184,7 +190,7 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
         }
     }
     ReportValue(pathLength, bounces);
-    return L;
+    return L + shadowRays.Trace();
 }
 
 PathIntegrator *CreatePathIntegrator(const ParamSet &params,
@@ -57,12 +57,13 @@ STAT_INT_DISTRIBUTION(
     "Stochastic Progressive Photon Mapping/Grid cells per visible point",
     gridCellsPerVisiblePoint);
 STAT_MEMORY_COUNTER("Memory/SPPM Pixels", pixelMemoryBytes);
+STAT_MEMORY_COUNTER("Memory/SPPM Visible point grid", gridMemoryBytes);
 STAT_FLOAT_DISTRIBUTION("Memory/SPPM BSDF and Grid Memory", memoryArenaMB);
 
 // SPPM Local Definitions
 struct SPPMPixel {
     // SPPMPixel Public Methods
-    SPPMPixel() : M(0) {}
+    SPPMPixel() {}
 
     // SPPMPixel Public Data
     Float radius = 0;
@@ -78,15 +79,78 @@ struct SPPMPixel {
         const BSDF *bsdf = nullptr;
         Spectrum beta;
     } vp;
-    AtomicFloat Phi[Spectrum::nSamples];
-    std::atomic<int> M;
+    // Photon contributions; these are only updated through
+    // _SPPMPhotonBuffer::Flush()_
+    Spectrum Phi;
+    int M = 0;
     Float N = 0;
     Spectrum tau;
 };
 
-struct SPPMPixelListNode {
-    SPPMPixel *pixel;
-    SPPMPixelListNode *next;
+// Entry of the SPPM visible point grid; it keeps a copy of the visible
+// point's position and squared search radius so that photon lookups only
+// touch the pixel for visible points within range
+struct SPPMGridEntry {
+    Point3f p;
+    Float radius2;
+    int pixelIndex;
+};
+
+// SPPM photon contributions to visible points are buffered per thread and
+// added to the pixels in batches, so that threads don't contend for the
+// pixels' cache lines while tracing photons. Each batch is split into
+// ranges of pixels, which are updated while holding a lock for the range.
+struct SPPMPhotonContribution {
+    int pixelIndex;
+    Spectrum Phi;
+};
+
+class alignas(PBRT_L1_CACHE_LINE_SIZE) SPPMPhotonBuffer {
+  public:
+    // SPPMPhotonBuffer Public Methods
+    static PBRT_CONSTEXPR int PixelsPerShard = 4096;
+    static PBRT_CONSTEXPR int MaxBufferedContributions = 1 << 15;
+    SPPMPhotonBuffer(int nPixels)
+        : shardStart((nPixels + PixelsPerShard - 1) / PixelsPerShard + 1) {
+        contributions.reserve(MaxBufferedContributions);
+    }
+    // Returns true when the buffer is full and should be flushed
+    bool Add(int pixelIndex, const Spectrum &Phi) {
+        contributions.push_back({pixelIndex, Phi});
+        return contributions.size() == MaxBufferedContributions;
+    }
+    void Flush(SPPMPixel *pixels, std::vector<std::mutex> &shardMutexes) {
+        if (contributions.empty()) return;
+        // Sort contributions by pixel shard, keeping each pixel's
+        // contributions in the order they were made
+        int nShards = shardStart.size() - 1;
+        std::fill(shardStart.begin(), shardStart.end(), 0);
+        for (const SPPMPhotonContribution &c : contributions)
+            ++shardStart[c.pixelIndex / PixelsPerShard + 1];
+        for (int s = 0; s < nShards; ++s) shardStart[s + 1] += shardStart[s];
+        sorted.resize(contributions.size());
+        for (const SPPMPhotonContribution &c : contributions)
+            sorted[shardStart[c.pixelIndex / PixelsPerShard]++] = c;
+
+        // Add each shard's contributions to its pixels
+        int start = 0;
+        for (int s = 0; s < nShards; ++s) {
+            int end = shardStart[s];
+            if (start == end) continue;
+            std::lock_guard<std::mutex> lock(shardMutexes[s]);
+            for (int i = start; i < end; ++i) {
+                pixels[sorted[i].pixelIndex].Phi += sorted[i].Phi;
+                ++pixels[sorted[i].pixelIndex].M;
+            }
+            start = end;
+        }
+        contributions.clear();
+    }
+
+  private:
+    // SPPMPhotonBuffer Private Data
+    std::vector<SPPMPhotonContribution> contributions, sorted;
+    std::vector<int> shardStart;
 };
 
 static bool ToGrid(const Point3f &p, const Bounds3f &bounds,
@@ -130,9 +194,25 @@ void SPPMIntegrator::Render(const Scene &scene) {
     Point2i nTiles((pixelExtent.x + tileSize - 1) / tileSize,
                    (pixelExtent.y + tileSize - 1) / tileSize);
     ProgressReporter progress(2 * nIterations, "Rendering");
+
+    // Allocate storage that is reused by all SPPM iterations
+    std::vector<MemoryArena> perThreadArenas(MaxThreadIndex());
+    std::vector<MemoryArena> photonShootArenas(MaxThreadIndex());
+    std::vector<SPPMPhotonBuffer> photonBuffers(MaxThreadIndex(),
+                                                SPPMPhotonBuffer(nPixels));
+    std::vector<std::mutex> photonShardMutexes(
+        (nPixels + SPPMPhotonBuffer::PixelsPerShard - 1) /
+        SPPMPhotonBuffer::PixelsPerShard);
+    // The visible point grid is a hash table whose cells' entries are
+    // stored contiguously in _gridEntries_, starting at _gridCellStart_;
+    // it's rebuilt in place in each iteration with a counting sort
+    const int hashSize = nPixels;
+    std::vector<std::atomic<int>> gridCellCount(hashSize);
+    std::vector<int> gridCellStart(hashSize + 1);
+    std::vector<SPPMGridEntry> gridEntries;
     for (int iter = 0; iter < nIterations; ++iter) {
         // Generate SPPM visible points
-        std::vector<MemoryArena> perThreadArenas(MaxThreadIndex());
+        for (MemoryArena &arena : perThreadArenas) arena.Reset();
         {
             ProfilePhase _(Prof::SPPMCameraPass);
             ParallelFor2D([&](Point2i tile) {
@@ -171,6 +251,7 @@ void SPPMIntegrator::Render(const Scene &scene) {
                         pPixelO.y * (pixelBounds.pMax.x - pixelBounds.pMin.x);
                     SPPMPixel &pixel = pixels[pixelOffset];
                     bool specularBounce = false;
+                    ShadowRayBatch shadowRays(scene);
                     for (int depth = 0; depth < maxDepth; ++depth) {
                         SurfaceInteraction isect;
                         ++totalPhotonSurfaceInteractions;
@@ -197,9 +278,9 @@ void SPPMIntegrator::Render(const Scene &scene) {
                         Vector3f wo = -ray.d;
                         if (depth == 0 || specularBounce)
                             pixel.Ld += beta * isect.Le(wo);
-                        pixel.Ld +=
-                            beta * UniformSampleOneLight(isect, scene, arena,
-                                                         *tileSampler);
+                        pixel.Ld += UniformSampleOneLight(
+                            isect, scene, *tileSampler, nullptr, beta,
+                            &shadowRays);
 
                         // Possibly create visible point and end camera path
                         bool isDiffuse = bsdf.NumComponents(BxDFType(
@@ -233,6 +314,7 @@ void SPPMIntegrator::Render(const Scene &scene) {
                             ray = (RayDifferential)isect.SpawnRay(wi);
                         }
                     }
+                    pixel.Ld += shadowRays.Trace();
                 }
             }, nTiles);
         }
@@ -241,9 +323,6 @@ void SPPMIntegrator::Render(const Scene &scene) {
         // Create grid of all SPPM visible points
         int gridRes[3];
         Bounds3f gridBounds;
-        // Allocate grid for SPPM visible points
-        const int hashSize = nPixels;
-        std::vector<std::atomic<SPPMPixelListNode *>> grid(hashSize);
         {
             ProfilePhase _(Prof::SPPMGridConstruction);
 
@@ -265,47 +344,71 @@ void SPPMIntegrator::Render(const Scene &scene) {
             for (int i = 0; i < 3; ++i)
                 gridRes[i] = std::max((int)(baseGridRes * diag[i] / maxDiag), 1);
 
-            // Add visible points to SPPM grid
+            // Computes the range of grid cells that the visible point of
+            // _pixel_ overlaps
+            auto visiblePointCells = [&](const SPPMPixel &pixel, Point3i *pMin,
+                                         Point3i *pMax) {
+                Float radius = pixel.radius;
+                ToGrid(pixel.vp.p - Vector3f(radius, radius, radius),
+                       gridBounds, gridRes, pMin);
+                ToGrid(pixel.vp.p + Vector3f(radius, radius, radius),
+                       gridBounds, gridRes, pMax);
+            };
+
+            // Count the visible points that overlap each grid cell
             ParallelFor([&](int pixelIndex) {
-                MemoryArena &arena = perThreadArenas[ThreadIndex];
-                SPPMPixel &pixel = pixels[pixelIndex];
-                if (!pixel.vp.beta.IsBlack()) {
-                    // Add pixel's visible point to applicable grid cells
-                    Float radius = pixel.radius;
-                    Point3i pMin, pMax;
-                    ToGrid(pixel.vp.p - Vector3f(radius, radius, radius),
-                           gridBounds, gridRes, &pMin);
-                    ToGrid(pixel.vp.p + Vector3f(radius, radius, radius),
-                           gridBounds, gridRes, &pMax);
-                    for (int z = pMin.z; z <= pMax.z; ++z)
-                        for (int y = pMin.y; y <= pMax.y; ++y)
-                            for (int x = pMin.x; x <= pMax.x; ++x) {
-                                // Add visible point to grid cell $(x, y, z)$
-                                int h = hash(Point3i(x, y, z), hashSize);
-                                SPPMPixelListNode *node =
-                                    arena.Alloc<SPPMPixelListNode>();
-                                node->pixel = &pixel;
-
-                                // Atomically add _node_ to the start of
-                                // _grid[h]_'s linked list
-                                node->next = grid[h];
-                                while (grid[h].compare_exchange_weak(
-                                           node->next, node) == false)
-                                    ;
-                            }
-                    ReportValue(gridCellsPerVisiblePoint,
-                                (1 + pMax.x - pMin.x) * (1 + pMax.y - pMin.y) *
-                                    (1 + pMax.z - pMin.z));
-                }
+                const SPPMPixel &pixel = pixels[pixelIndex];
+                if (pixel.vp.beta.IsBlack()) return;
+                Point3i pMin, pMax;
+                visiblePointCells(pixel, &pMin, &pMax);
+                for (int z = pMin.z; z <= pMax.z; ++z)
+                    for (int y = pMin.y; y <= pMax.y; ++y)
+                        for (int x = pMin.x; x <= pMax.x; ++x)
+                            gridCellCount[hash(Point3i(x, y, z), hashSize)]
+                                .fetch_add(1, std::memory_order_relaxed);
+                ReportValue(gridCellsPerVisiblePoint,
+                            (1 + pMax.x - pMin.x) * (1 + pMax.y - pMin.y) *
+                                (1 + pMax.z - pMin.z));
+            }, nPixels, 4096);
+
+            // Compute the start of each cell's entries from the counts
+            gridCellStart[0] = 0;
+            for (int h = 0; h < hashSize; ++h)
+                gridCellStart[h + 1] =
+                    gridCellStart[h] +
+                    gridCellCount[h].load(std::memory_order_relaxed);
+            if (gridCellStart[hashSize] > (int)gridEntries.size())
+                gridEntries.resize(gridCellStart[hashSize]);
+
+            // Add visible points to SPPM grid; counting each cell's entries
+            // back down also leaves _gridCellCount_ zeroed for the next
+            // iteration
+            ParallelFor([&](int pixelIndex) {
+                const SPPMPixel &pixel = pixels[pixelIndex];
+                if (pixel.vp.beta.IsBlack()) return;
+                SPPMGridEntry entry{pixel.vp.p, pixel.radius * pixel.radius,
+                                    pixelIndex};
+                Point3i pMin, pMax;
+                visiblePointCells(pixel, &pMin, &pMax);
+                for (int z = pMin.z; z <= pMax.z; ++z)
+                    for (int y = pMin.y; y <= pMax.y; ++y)
+                        for (int x = pMin.x; x <= pMax.x; ++x) {
+                            int h = hash(Point3i(x, y, z), hashSize);
+                            int slot = gridCellStart[h] +
+                                       gridCellCount[h].fetch_sub(
+                                           1, std::memory_order_relaxed) -
+                                       1;
+                            gridEntries[slot] = entry;
+                        }
             }, nPixels, 4096);
         }
 
         // Trace photons and accumulate contributions
         {
             ProfilePhase _(Prof::SPPMPhotonPass);
-            std::vector<MemoryArena> photonShootArenas(MaxThreadIndex());
             ParallelFor([&](int photonIndex) {
                 MemoryArena &arena = photonShootArenas[ThreadIndex];
+                SPPMPhotonBuffer &photonBuffer = photonBuffers[ThreadIndex];
                 // Follow photon path for _photonIndex_
                 uint64_t haltonIndex =
                     (uint64_t)iter * (uint64_t)photonsPerIteration +
@@ -353,24 +456,24 @@ void SPPMIntegrator::Render(const Scene &scene) {
                                    &photonGridIndex)) {
                             int h = hash(photonGridIndex, hashSize);
                             // Add photon contribution to visible points in
-                            // _grid[h]_
-                            for (SPPMPixelListNode *node =
-                                     grid[h].load(std::memory_order_relaxed);
-                                 node != nullptr; node = node->next) {
+                            // grid cell _h_
+                            for (int e = gridCellStart[h];
+                                 e < gridCellStart[h + 1]; ++e) {
                                 ++visiblePointsChecked;
-                                SPPMPixel &pixel = *node->pixel;
-                                Float radius = pixel.radius;
-                                if (DistanceSquared(pixel.vp.p, isect.p) >
-                                    radius * radius)
+                                const SPPMGridEntry &entry = gridEntries[e];
+                                if (DistanceSquared(entry.p, isect.p) >
+                                    entry.radius2)
                                     continue;
-                                // Update _pixel_ $\Phi$ and $M$ for nearby
-                                // photon
+                                const SPPMPixel &pixel =
+                                    pixels[entry.pixelIndex];
+                                // Record _pixel_ $\Phi$ and $M$ update for
+                                // nearby photon
                                 Vector3f wi = -photonRay.d;
                                 Spectrum Phi =
                                     beta * pixel.vp.bsdf->f(pixel.vp.wo, wi);
-                                for (int i = 0; i < Spectrum::nSamples; ++i)
-                                    pixel.Phi[i].Add(Phi[i]);
-                                ++pixel.M;
+                                if (photonBuffer.Add(entry.pixelIndex, Phi))
+                                    photonBuffer.Flush(pixels.get(),
+                                                       photonShardMutexes);
                             }
                         }
                     }
@@ -410,6 +513,10 @@ void SPPMIntegrator::Render(const Scene &scene) {
                 }
                 arena.Reset();
             }, photonsPerIteration, 8192);
+            // Add the remaining buffered photon contributions to the pixels
+            ParallelFor([&](int i) {
+                photonBuffers[i].Flush(pixels.get(), photonShardMutexes);
+            }, photonBuffers.size());
             progress.Update();
             photonPaths += photonsPerIteration;
         }
@@ -425,16 +532,12 @@ void SPPMIntegrator::Render(const Scene &scene) {
                     Float gamma = (Float)2 / (Float)3;
                     Float Nnew = p.N + gamma * p.M;
                     Float Rnew = p.radius * std::sqrt(Nnew / (p.N + p.M));
-                    Spectrum Phi;
-                    for (int j = 0; j < Spectrum::nSamples; ++j)
-                        Phi[j] = p.Phi[j];
-                    p.tau = (p.tau + p.vp.beta * Phi) * (Rnew * Rnew) /
+                    p.tau = (p.tau + p.vp.beta * p.Phi) * (Rnew * Rnew) /
                             (p.radius * p.radius);
                     p.N = Nnew;
                     p.radius = Rnew;
                     p.M = 0;
-                    for (int j = 0; j < Spectrum::nSamples; ++j)
-                        p.Phi[j] = (Float)0;
+                    p.Phi = Spectrum(0.f);
                 }
                 // Reset _VisiblePoint_ in pixel
                 p.vp.beta = 0.;
@@ -497,6 +600,8 @@ void SPPMIntegrator::Render(const Scene &scene) {
         }
     }
     progress.Done();
+    gridMemoryBytes = hashSize * (sizeof(std::atomic<int>) + sizeof(int)) +
+                      gridEntries.capacity() * sizeof(SPPMGridEntry);
 }
 
 Integrator *CreateSPPMIntegrator(const ParamSet &params,
@@ -0,0 +1,538 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+// integrators/wavefront.cpp*
+#include "integrators/wavefront.h"
+#include "bssrdf.h"
+#include "camera.h"
+#include "film.h"
+#include "interaction.h"
+#include "parallel.h"
+#include "paramset.h"
+#include "progressreporter.h"
+#include "sampling.h"
+#include "scene.h"
+#include "stats.h"
+#include <algorithm>
+#include <functional>
+
+namespace pbrt {
+
+STAT_COUNTER("Integrator/Camera rays traced", nCameraRays);
+STAT_INT_DISTRIBUTION("Integrator/Path length", pathLength);
+STAT_RATIO("Integrator/Paths per wavefront batch", nWavefrontPaths,
+           nWavefrontBatches);
+
+// WavefrontPathIntegrator Local Declarations
+
+// Offsets of the sample values that each path vertex uses, which are
+// requested from the _Sampler_ in the order that _PathIntegrator::Li()_
+// requests them: light selection and direct lighting, BSDF sampling,
+// BSSRDF sampling followed by direct lighting and BSDF sampling at the exit
+// point, and Russian roulette.
+static const int LightSampleOffset = 0, BSDFSampleOffset = 5,
+                 BSSRDFSampleOffset = 7, ExitLightSampleOffset = 10,
+                 ExitBSDFSampleOffset = 15, RouletteSampleOffset = 17,
+                 SamplesPerVertex = 18;
+
+struct WavefrontPath {
+    Point2f pFilm;
+    Float rayWeight;
+    RayDifferential ray;
+    Spectrum L, beta;
+    Float etaScale;
+    int bounces;
+    bool specularBounce;
+};
+
+// Part of a 16x16 image tile; samples _firstSample_ through
+// _firstSample_ + _nSamples_ - 1 of its pixels are traced in the same batch
+// and accumulated in their own _FilmTile_.
+struct FilmPiece {
+    Bounds2i bounds;
+    int seed;
+    int64_t firstSample, nSamples;
+    int64_t firstPath, nPaths;
+};
+
+enum class PathStatus : uint8_t { Done, Shade, Continue };
+
+// Storage for a batch of paths, reused across batches. _active_ holds the
+// indices of the paths that are still being traced; the remaining arrays
+// are indexed by position in _active_.
+struct WavefrontQueues {
+    explicit WavefrontQueues(int nThreads) : arenas(nThreads) {}
+    std::vector<WavefrontPath> paths;
+    std::vector<Float> samples;
+    std::vector<int64_t> active, shading, shadowed;
+    std::vector<SurfaceInteraction> isects;
+    std::vector<PathStatus> status;
+    std::vector<Ray> shadowRays;
+    std::vector<Spectrum> shadowLd;
+    std::vector<MemoryArena> arenas;
+};
+
+// WavefrontPathIntegrator Utility Functions
+static void GetVertexSamples(Sampler &sampler, Float *u) {
+    auto get2D = [&](int offset) {
+        Point2f p = sampler.Get2D();
+        u[offset] = p.x;
+        u[offset + 1] = p.y;
+    };
+    u[LightSampleOffset] = sampler.Get1D();
+    get2D(LightSampleOffset + 1);
+    get2D(LightSampleOffset + 3);
+    get2D(BSDFSampleOffset);
+    u[BSSRDFSampleOffset] = sampler.Get1D();
+    get2D(BSSRDFSampleOffset + 1);
+    u[ExitLightSampleOffset] = sampler.Get1D();
+    get2D(ExitLightSampleOffset + 1);
+    get2D(ExitLightSampleOffset + 3);
+    get2D(ExitBSDFSampleOffset);
+    u[RouletteSampleOffset] = sampler.Get1D();
+}
+
+// Samples a light for direct lighting at _it_ like _UniformSampleOneLight()_,
+// using the five sample values at _u_. The light sample's contribution is
+// returned in _*Ld_ along with the shadow ray that must be unoccluded for
+// it to count; the BSDF sample's contribution is returned directly.
+static Spectrum SampleOneLight(const Interaction &it, const Scene &scene,
+                               const Distribution1D *lightDistrib,
+                               const Float *u, Spectrum *Ld, Ray *shadowRay) {
+    *Ld = Spectrum(0.f);
+    if (scene.lights.empty()) return Spectrum(0.f);
+    Float lightPdf;
+    int lightNum = lightDistrib->SampleDiscrete(u[0], &lightPdf);
+    if (lightPdf == 0) return Spectrum(0.f);
+    const Light &light = *scene.lights[lightNum];
+    const BxDFType bsdfFlags = BxDFType(BSDF_ALL & ~BSDF_SPECULAR);
+    VisibilityTester visibility;
+    Spectrum Ll = LightSampleContribution(it, light, Point2f(u[1], u[2]),
+                                          bsdfFlags, &visibility);
+    if (!Ll.IsBlack()) {
+        *Ld = Ll / lightPdf;
+        *shadowRay = visibility.P0().SpawnRayTo(visibility.P1());
+    }
+    return ScatteringSampleContribution(it, Point2f(u[3], u[4]), light,
+                                        scene, bsdfFlags) /
+           lightPdf;
+}
+
+// Samples the BSDF (and BSSRDF, if present) at the path's current vertex to
+// find its next ray, as _PathIntegrator::Li()_ does after direct lighting.
+// Returns false if the path terminates.
+static bool SampleNextVertex(const Scene &scene,
+                             const SurfaceInteraction &isect, const Float *u,
+                             const LightDistribution &lightDistribution,
+                             Float rrThreshold, MemoryArena &arena,
+                             WavefrontPath *path) {
+    // Sample BSDF to get new path direction
+    Vector3f wo = -path->ray.d, wi;
+    Float pdf;
+    BxDFType flags;
+    Spectrum f = isect.bsdf->Sample_f(
+        wo, &wi, Point2f(u[BSDFSampleOffset], u[BSDFSampleOffset + 1]), &pdf,
+        BSDF_ALL, &flags);
+    if (f.IsBlack() || pdf == 0.f) return false;
+    path->beta *= f * AbsDot(wi, isect.shading.n) / pdf;
+    DCHECK(!std::isinf(path->beta.y()));
+    path->specularBounce = (flags & BSDF_SPECULAR) != 0;
+    if ((flags & BSDF_SPECULAR) && (flags & BSDF_TRANSMISSION)) {
+        Float eta = isect.bsdf->eta;
+        path->etaScale *=
+            (Dot(wo, isect.n) > 0) ? (eta * eta) : 1 / (eta * eta);
+    }
+    path->ray = isect.SpawnRay(wi);
+
+    // Account for subsurface scattering, if applicable
+    if (isect.bssrdf && (flags & BSDF_TRANSMISSION)) {
+        // Importance sample the BSSRDF
+        const Float *us = u + BSSRDFSampleOffset;
+        SurfaceInteraction pi;
+        Spectrum S = isect.bssrdf->Sample_S(scene, us[0], Point2f(us[1], us[2]),
+                                            arena, &pi, &pdf);
+        if (S.IsBlack() || pdf == 0) return false;
+        path->beta *= S / pdf;
+
+        // Account for the direct subsurface scattering component; its shadow
+        // ray is traced right away
+        Spectrum Ld;
+        Ray shadowRay;
+        path->L += path->beta * SampleOneLight(pi, scene,
+                                               lightDistribution.Lookup(pi.p),
+                                               u + ExitLightSampleOffset, &Ld,
+                                               &shadowRay);
+        if (!Ld.IsBlack() && !scene.IntersectP(shadowRay))
+            path->L += path->beta * Ld;
+
+        // Account for the indirect subsurface scattering component
+        const Float *ub = u + ExitBSDFSampleOffset;
+        Spectrum f = pi.bsdf->Sample_f(pi.wo, &wi, Point2f(ub[0], ub[1]), &pdf,
+                                       BSDF_ALL, &flags);
+        if (f.IsBlack() || pdf == 0) return false;
+        path->beta *= f * AbsDot(wi, pi.shading.n) / pdf;
+        DCHECK(!std::isinf(path->beta.y()));
+        path->specularBounce = (flags & BSDF_SPECULAR) != 0;
+        path->ray = pi.SpawnRay(wi);
+    }
+
+    // Possibly terminate the path with Russian roulette
+    Spectrum rrBeta = path->beta * path->etaScale;
+    if (rrBeta.MaxComponentValue() < rrThreshold && path->bounces > 3) {
+        Float q = std::max((Float).05, 1 - rrBeta.MaxComponentValue());
+        if (u[RouletteSampleOffset] < q) return false;
+        path->beta /= 1 - q;
+        DCHECK(!std::isinf(path->beta.y()));
+    }
+    ++path->bounces;
+    return true;
+}
+
+// WavefrontPathIntegrator Method Definitions
+WavefrontPathIntegrator::WavefrontPathIntegrator(
+    int maxDepth, std::shared_ptr<const Camera> camera,
+    std::shared_ptr<Sampler> sampler, const Bounds2i &pixelBounds,
+    Float rrThreshold, const std::string &lightSampleStrategy, int queueSize)
+    : maxDepth(maxDepth),
+      camera(camera),
+      sampler(sampler),
+      pixelBounds(pixelBounds),
+      rrThreshold(rrThreshold),
+      lightSampleStrategy(lightSampleStrategy),
+      queueSize(queueSize) {}
+
+WavefrontPathIntegrator::~WavefrontPathIntegrator() {}
+
+void WavefrontPathIntegrator::Render(const Scene &scene) {
+    lightDistribution =
+        CreateLightSampleDistribution(lightSampleStrategy, scene);
+
+    // Limit the number of paths per batch so that their precomputed sample
+    // values take at most 64 MB
+    const int64_t spp = sampler->samplesPerPixel;
+    const int64_t samplesPerPath = maxDepth * SamplesPerVertex;
+    const int64_t maxPaths = std::max<int64_t>(
+        1, std::min<int64_t>(
+               queueSize, (int64_t(64) << 20) /
+                              (std::max<int64_t>(1, samplesPerPath) *
+                               sizeof(Float))));
+
+    // Split image tiles into pieces that fit in a batch: whole rows when a
+    // row fits, runs of pixels within a row otherwise, and ranges of a
+    // single pixel's samples if even one pixel has too many
+    Bounds2i sampleBounds = camera->film->GetSampleBounds();
+    const int tileSize = 16;
+    const int64_t samplesPerPiece = std::min(spp, maxPaths);
+    std::vector<FilmPiece> pieces;
+    for (int y0 = sampleBounds.pMin.y; y0 < sampleBounds.pMax.y;
+         y0 += tileSize)
+        for (int x0 = sampleBounds.pMin.x; x0 < sampleBounds.pMax.x;
+             x0 += tileSize) {
+            int x1 = std::min(x0 + tileSize, sampleBounds.pMax.x);
+            int y1 = std::min(y0 + tileSize, sampleBounds.pMax.y);
+            int rows = std::max<int64_t>(1, maxPaths / ((x1 - x0) * spp));
+            int cols = std::max<int64_t>(
+                1, std::min<int64_t>(x1 - x0, maxPaths / spp));
+            for (int y = y0; y < y1; y += rows)
+                for (int x = x0; x < x1; x += cols)
+                    for (int64_t s = 0; s < spp; s += samplesPerPiece) {
+                        FilmPiece piece;
+                        piece.bounds = Bounds2i(
+                            Point2i(x, y), Point2i(std::min(x + cols, x1),
+                                                   std::min(y + rows, y1)));
+                        piece.seed = pieces.size();
+                        piece.firstSample = s;
+                        piece.nSamples = std::min(samplesPerPiece, spp - s);
+                        piece.nPaths = 0;
+                        for (Point2i pixel : piece.bounds)
+                            if (InsideExclusive(pixel, pixelBounds))
+                                piece.nPaths += piece.nSamples;
+                        pieces.push_back(piece);
+                    }
+        }
+
+    // Trace consecutive pieces in batches of up to _maxPaths_ paths
+    WavefrontQueues queues(MaxThreadIndex());
+    ProgressReporter reporter(pieces.size(), "Rendering");
+    for (size_t begin = 0; begin < pieces.size();) {
+        size_t end = begin;
+        int64_t nPaths = 0;
+        while (end < pieces.size() &&
+               (end == begin || nPaths + pieces[end].nPaths <= maxPaths)) {
+            pieces[end].firstPath = nPaths;
+            nPaths += pieces[end++].nPaths;
+        }
+        TraceBatch(scene, &pieces[begin], end - begin, nPaths, &queues);
+        reporter.Update(end - begin);
+        begin = end;
+    }
+    reporter.Done();
+    LOG(INFO) << "Rendering finished";
+
+    // Save final image after rendering
+    camera->film->WriteImage();
+}
+
+void WavefrontPathIntegrator::TraceBatch(const Scene &scene,
+                                         const FilmPiece *pieces, int nPieces,
+                                         int64_t nPaths,
+                                         WavefrontQueues *q) const {
+    ++nWavefrontBatches;
+    nWavefrontPaths += nPaths;
+    const int64_t samplesPerPath = maxDepth * SamplesPerVertex;
+    q->paths.resize(nPaths);
+    q->samples.resize(nPaths * samplesPerPath);
+    auto vertexSamples = [&](int64_t pathIndex) {
+        return q->samples.data() + pathIndex * samplesPerPath +
+               q->paths[pathIndex].bounces * SamplesPerVertex;
+    };
+
+    // Generate camera rays and all sample values for the batch's paths
+    ParallelFor([&](int64_t i) {
+        const FilmPiece &piece = pieces[i];
+        std::unique_ptr<Sampler> pieceSampler = sampler->Clone(piece.seed);
+        int64_t index = piece.firstPath;
+        for (Point2i pixel : piece.bounds) {
+            pieceSampler->StartPixel(pixel);
+            if (!InsideExclusive(pixel, pixelBounds)) continue;
+            if (piece.firstSample > 0)
+                pieceSampler->SetSampleNumber(piece.firstSample);
+            for (int64_t s = 0; s < piece.nSamples; ++s) {
+                CameraSample cameraSample =
+                    pieceSampler->GetCameraSample(pixel);
+                WavefrontPath &path = q->paths[index];
+                path.pFilm = cameraSample.pFilm;
+                path.rayWeight =
+                    camera->GenerateRayDifferential(cameraSample, &path.ray);
+                path.ray.ScaleDifferentials(
+                    1 / std::sqrt((Float)pieceSampler->samplesPerPixel));
+                ++nCameraRays;
+                path.L = Spectrum(0.f);
+                path.beta = Spectrum(1.f);
+                path.etaScale = 1;
+                path.bounces = 0;
+                path.specularBounce = false;
+                Float *u = q->samples.data() + index * samplesPerPath;
+                for (int v = 0; v < maxDepth; ++v)
+                    GetVertexSamples(*pieceSampler, u + v * SamplesPerVertex);
+                ++index;
+                pieceSampler->StartNextSample();
+            }
+        }
+        CHECK_EQ(index, piece.firstPath + piece.nPaths);
+    }, nPieces);
+    q->active.clear();
+    for (int64_t i = 0; i < nPaths; ++i)
+        if (q->paths[i].rayWeight > 0) q->active.push_back(i);
+
+    // Advance all active paths by one vertex per iteration
+    const int rayChunkSize = 64;
+    while (!q->active.empty()) {
+        int64_t nActive = q->active.size();
+        if (q->isects.size() < nActive) q->isects.resize(nActive);
+        q->status.resize(nActive);
+        q->shadowRays.resize(nActive);
+        q->shadowLd.resize(nActive);
+
+        // Intersect rays of active paths and add emitted light
+        ParallelFor([&](int64_t c) {
+            int64_t start = c * rayChunkSize;
+            int n = std::min<int64_t>(rayChunkSize, nActive - start);
+            Ray rays[rayChunkSize];
+            bool hits[rayChunkSize];
+            for (int i = 0; i < n; ++i)
+                rays[i] = q->paths[q->active[start + i]].ray;
+            scene.IntersectN(rays, &q->isects[start], hits, n);
+            for (int i = 0; i < n; ++i) {
+                int64_t k = start + i;
+                WavefrontPath &path = q->paths[q->active[k]];
+                if (path.bounces == 0 || path.specularBounce) {
+                    // Add emitted light at path vertex or from the environment
+                    if (hits[i])
+                        path.L += path.beta * q->isects[k].Le(-path.ray.d);
+                    else
+                        for (const auto &light : scene.infiniteLights)
+                            path.L += path.beta * light->Le(path.ray);
+                }
+                // Terminate path if ray escaped or _maxDepth_ was reached
+                if (!hits[i] || path.bounces >= maxDepth) {
+                    ReportValue(pathLength, path.bounces);
+                    q->status[k] = PathStatus::Done;
+                } else
+                    q->status[k] = PathStatus::Shade;
+            }
+        }, (nActive + rayChunkSize - 1) / rayChunkSize);
+
+        // Compute scattering functions with paths sorted by material and
+        // skip over medium boundaries
+        q->shading.clear();
+        for (int64_t k = 0; k < nActive; ++k)
+            if (q->status[k] == PathStatus::Shade) q->shading.push_back(k);
+        std::stable_sort(q->shading.begin(), q->shading.end(),
+                         [&](int64_t a, int64_t b) {
+                             return std::less<const Material *>()(
+                                 q->isects[a].primitive->GetMaterial(),
+                                 q->isects[b].primitive->GetMaterial());
+                         });
+        ParallelFor([&](int64_t i) {
+            int64_t k = q->shading[i];
+            SurfaceInteraction &isect = q->isects[k];
+            WavefrontPath &path = q->paths[q->active[k]];
+            isect.bsdf = nullptr;
+            isect.bssrdf = nullptr;
+            isect.ComputeScatteringFunctions(path.ray, q->arenas[ThreadIndex],
+                                             true);
+            if (!isect.bsdf) {
+                path.ray = isect.SpawnRay(path.ray.d);
+                q->status[k] = PathStatus::Continue;
+            }
+        }, q->shading.size(), 64);
+
+        // Sample illumination from lights, deferring the shadow rays.
+        // (But skip this for perfectly specular BSDFs.)
+        ParallelFor([&](int64_t i) {
+            int64_t k = q->shading[i];
+            q->shadowLd[k] = Spectrum(0.f);
+            if (q->status[k] != PathStatus::Shade) return;
+            const SurfaceInteraction &isect = q->isects[k];
+            if (isect.bsdf->NumComponents(
+                    BxDFType(BSDF_ALL & ~BSDF_SPECULAR)) == 0)
+                return;
+            int64_t pathIndex = q->active[k];
+            WavefrontPath &path = q->paths[pathIndex];
+            Spectrum Ld;
+            path.L += path.beta *
+                      SampleOneLight(isect, scene,
+                                     lightDistribution->Lookup(isect.p),
+                                     vertexSamples(pathIndex) +
+                                         LightSampleOffset,
+                                     &Ld, &q->shadowRays[k]);
+            q->shadowLd[k] = path.beta * Ld;
+        }, q->shading.size(), 64);
+
+        // Trace shadow rays and add unoccluded light samples
+        q->shadowed.clear();
+        for (int64_t k : q->shading)
+            if (!q->shadowLd[k].IsBlack()) q->shadowed.push_back(k);
+        int64_t nShadowed = q->shadowed.size();
+        ParallelFor([&](int64_t c) {
+            int64_t start = c * rayChunkSize;
+            int n = std::min<int64_t>(rayChunkSize, nShadowed - start);
+            Ray rays[rayChunkSize];
+            bool occluded[rayChunkSize];
+            for (int i = 0; i < n; ++i)
+                rays[i] = q->shadowRays[q->shadowed[start + i]];
+            scene.IntersectPN(rays, occluded, n);
+            for (int i = 0; i < n; ++i) {
+                int64_t k = q->shadowed[start + i];
+                if (!occluded[i]) q->paths[q->active[k]].L += q->shadowLd[k];
+            }
+        }, (nShadowed + rayChunkSize - 1) / rayChunkSize);
+
+        // Sample BSDFs to find the paths' next rays
+        ParallelFor([&](int64_t i) {
+            int64_t k = q->shading[i];
+            if (q->status[k] != PathStatus::Shade) return;
+            int64_t pathIndex = q->active[k];
+            WavefrontPath &path = q->paths[pathIndex];
+            if (SampleNextVertex(scene, q->isects[k], vertexSamples(pathIndex),
+                                 *lightDistribution, rrThreshold,
+                                 q->arenas[ThreadIndex], &path))
+                q->status[k] = PathStatus::Continue;
+            else {
+                ReportValue(pathLength, path.bounces);
+                q->status[k] = PathStatus::Done;
+            }
+        }, q->shading.size(), 64);
+
+        // Free scattering functions and keep the paths that continue
+        for (MemoryArena &arena : q->arenas) arena.Reset();
+        int64_t nContinuing = 0;
+        for (int64_t k = 0; k < nActive; ++k)
+            if (q->status[k] == PathStatus::Continue)
+                q->active[nContinuing++] = q->active[k];
+        q->active.resize(nContinuing);
+    }
+
+    // Add the batch's samples to the film
+    ParallelFor([&](int64_t i) {
+        const FilmPiece &piece = pieces[i];
+        std::unique_ptr<FilmTile> filmTile =
+            camera->film->GetFilmTile(piece.bounds);
+        for (int64_t j = piece.firstPath; j < piece.firstPath + piece.nPaths;
+             ++j) {
+            const WavefrontPath &path = q->paths[j];
+            Spectrum L = path.L;
+            // Issue warning if unexpected radiance value returned
+            if (L.HasNaNs() || L.y() < -1e-5 || std::isinf(L.y())) {
+                LOG(ERROR) << "Invalid radiance value " << L
+                           << " for film position " << path.pFilm
+                           << ". Setting to black.";
+                L = Spectrum(0.f);
+            }
+            filmTile->AddSample(path.pFilm, L, path.rayWeight);
+        }
+        camera->film->MergeFilmTile(std::move(filmTile));
+    }, nPieces);
+}
+
+WavefrontPathIntegrator *CreateWavefrontPathIntegrator(
+    const ParamSet &params, std::shared_ptr<Sampler> sampler,
+    std::shared_ptr<const Camera> camera) {
+    int maxDepth = params.FindOneInt("maxdepth", 5);
+    int np;
+    const int *pb = params.FindInt("pixelbounds", &np);
+    Bounds2i pixelBounds = camera->film->GetSampleBounds();
+    if (pb) {
+        if (np != 4)
+            Error("Expected four values for \"pixelbounds\" parameter. Got %d.",
+                  np);
+        else {
+            pixelBounds = Intersect(pixelBounds,
+                                    Bounds2i{{pb[0], pb[2]}, {pb[1], pb[3]}});
+            if (pixelBounds.Area() == 0)
+                Error("Degenerate \"pixelbounds\" specified.");
+        }
+    }
+    Float rrThreshold = params.FindOneFloat("rrthreshold", 1.);
+    std::string lightStrategy =
+        params.FindOneString("lightsamplestrategy", "spatial");
+    int queueSize = params.FindOneInt("queuesize", 1 << 16);
+    if (queueSize < 1) {
+        Error("\"queuesize\" must be positive. Using 65536.");
+        queueSize = 1 << 16;
+    }
+    return new WavefrontPathIntegrator(maxDepth, camera, sampler, pixelBounds,
+                                       rrThreshold, lightStrategy, queueSize);
+}
+
+}  // namespace pbrt
@@ -0,0 +1,92 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_INTEGRATORS_WAVEFRONT_H
+#define PBRT_INTEGRATORS_WAVEFRONT_H
+
+// integrators/wavefront.h*
+#include "pbrt.h"
+#include "integrator.h"
+#include "lightdistrib.h"
+
+namespace pbrt {
+
+// WavefrontPathIntegrator Forward Declarations
+struct FilmPiece;
+struct WavefrontQueues;
+
+// WavefrontPathIntegrator Declarations
+
+// Computes the same estimate as _PathIntegrator_, but advances large
+// batches of paths one vertex at a time: each bounce runs separate stages
+// for intersection, material evaluation (with paths sorted by material),
+// light sampling, shadow rays and BSDF sampling, and each stage processes
+// the whole batch with _ParallelFor()_.
+class WavefrontPathIntegrator : public Integrator {
+  public:
+    // WavefrontPathIntegrator Public Methods
+    WavefrontPathIntegrator(int maxDepth, std::shared_ptr<const Camera> camera,
+                            std::shared_ptr<Sampler> sampler,
+                            const Bounds2i &pixelBounds, Float rrThreshold,
+                            const std::string &lightSampleStrategy,
+                            int queueSize);
+    ~WavefrontPathIntegrator();
+    void Render(const Scene &scene);
+
+  private:
+    // WavefrontPathIntegrator Private Methods
+    void TraceBatch(const Scene &scene, const FilmPiece *pieces, int nPieces,
+                    int64_t nPaths, WavefrontQueues *queues) const;
+
+    // WavefrontPathIntegrator Private Data
+    const int maxDepth;
+    std::shared_ptr<const Camera> camera;
+    std::shared_ptr<Sampler> sampler;
+    const Bounds2i pixelBounds;
+    const Float rrThreshold;
+    const std::string lightSampleStrategy;
+    const int queueSize;
+    std::unique_ptr<LightDistribution> lightDistribution;
+};
+
+WavefrontPathIntegrator *CreateWavefrontPathIntegrator(
+    const ParamSet &params, std::shared_ptr<Sampler> sampler,
+    std::shared_ptr<const Camera> camera);
+
+}  // namespace pbrt
+
+#endif  // PBRT_INTEGRATORS_WAVEFRONT_H
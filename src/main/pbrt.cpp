@@ -46,13 +46,32 @@ static void usage(const char *msg = nullptr) {
 
     fprintf(stderr, R"(usage: pbrt [<options>] <filename.pbrt...>
 Rendering options:
+  --bssrdfcache <filename> Read and write precomputed BSSRDF tables to the
+                       given file so that they can be reused across runs.
+  --compactmeshes      Store triangle meshes without area lights in a
+                       compressed form, with one primitive per mesh rather
+                       than per triangle. Shading normals and (u,v)s are
+                       quantized.
   --cropwindow <x0,x1,y0,y1> Specify an image crop window.
   --help               Print this help text.
+  --noisetarget <err>  Stop progressive rendering once the estimated average
+                       relative pixel error drops below the given value.
   --nthreads <num>     Use specified number of threads for rendering.
   --outfile <filename> Write the final image to the given filename.
+  --progressive        Render in waves of increasing sample counts over the
+                       whole image.
+  --ptexmaxfiles <n>   Maximum number of Ptex files kept open. Default: 100.
+  --ptexmaxmem <MB>    Memory budget of the Ptex cache. Default: 4096.
   --quick              Automatically reduce a number of quality settings to
                        render more quickly.
   --quiet              Suppress all text output other than error messages.
+  --texturecache <MB>  Memory budget for texture tiles loaded on demand from
+                       tiled (.tmip) MIP maps that can't be used in place
+                       through a memory mapping. Default: 1024.
+  --timelimit <secs>   Stop progressive rendering after the given wall-clock
+                       time.
+  --writeinterval <secs> Write intermediate images during progressive
+                       rendering at the given interval.
 
 Logging options:
   --logdir <dir>       Specify directory that log files should be written to.
@@ -91,6 +110,13 @@ int main(int argc, char *argv[]) {
             if (i + 1 == argc)
                 usage("missing value after --outfile argument");
             options.imageFile = argv[++i];
+        } else if (!strcmp(argv[i], "--bssrdfcache") ||
+                   !strcmp(argv[i], "-bssrdfcache")) {
+            if (i + 1 == argc)
+                usage("missing value after --bssrdfcache argument");
+            options.bssrdfCacheFile = argv[++i];
+        } else if (!strncmp(argv[i], "--bssrdfcache=", 14)) {
+            options.bssrdfCacheFile = &argv[i][14];
         } else if (!strcmp(argv[i], "--cropwindow") || !strcmp(argv[i], "-cropwindow")) {
             if (i + 4 >= argc)
                 usage("missing value after --cropwindow argument");
@@ -113,6 +139,45 @@ int main(int argc, char *argv[]) {
             FLAGS_minloglevel = atoi(argv[++i]);
         } else if (!strncmp(argv[i], "--minloglevel=", 14)) {
             FLAGS_minloglevel = atoi(&argv[i][14]);
+        } else if (!strcmp(argv[i], "--progressive") ||
+                   !strcmp(argv[i], "-progressive")) {
+            options.progressive = true;
+        } else if (!strcmp(argv[i], "--compactmeshes") ||
+                   !strcmp(argv[i], "-compactmeshes")) {
+            options.compactMeshes = true;
+        } else if (!strcmp(argv[i], "--texturecache") ||
+                   !strcmp(argv[i], "-texturecache")) {
+            if (i + 1 == argc)
+                usage("missing value after --texturecache argument");
+            options.textureCacheSize = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--timelimit") ||
+                   !strcmp(argv[i], "-timelimit")) {
+            if (i + 1 == argc)
+                usage("missing value after --timelimit argument");
+            options.timeLimit = atof(argv[++i]);
+            options.progressive = true;
+        } else if (!strcmp(argv[i], "--writeinterval") ||
+                   !strcmp(argv[i], "-writeinterval")) {
+            if (i + 1 == argc)
+                usage("missing value after --writeinterval argument");
+            options.writeInterval = atof(argv[++i]);
+            options.progressive = true;
+        } else if (!strcmp(argv[i], "--noisetarget") ||
+                   !strcmp(argv[i], "-noisetarget")) {
+            if (i + 1 == argc)
+                usage("missing value after --noisetarget argument");
+            options.noiseTarget = atof(argv[++i]);
+            options.progressive = true;
+        } else if (!strcmp(argv[i], "--ptexmaxfiles") ||
+                   !strcmp(argv[i], "-ptexmaxfiles")) {
+            if (i + 1 == argc)
+                usage("missing value after --ptexmaxfiles argument");
+            options.ptexMaxFiles = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--ptexmaxmem") ||
+                   !strcmp(argv[i], "-ptexmaxmem")) {
+            if (i + 1 == argc)
+                usage("missing value after --ptexmaxmem argument");
+            options.ptexMaxMem = atoi(argv[++i]);
         } else if (!strcmp(argv[i], "--quick") || !strcmp(argv[i], "-quick")) {
             options.quickRender = true;
         } else if (!strcmp(argv[i], "--quiet") || !strcmp(argv[i], "-quiet")) {
@@ -1,4 +1,5 @@
 #include "plugin/multipole/multipole.hpp"
+#include "parallel.h"
 #include <vector>
 
 int main(int argc, char const *argv[])
@@ -8,7 +9,9 @@ int main(int argc, char const *argv[])
 	
 	MultipoleOptions options{ 0.005f, 62};
 
+	pbrt::ParallelInit();
 	MultipoleTable table = ComputeMultipoleDiffusionProfile(layers, options);
+	pbrt::ParallelCleanup();
 
 
 	for (auto i = 0; i < table.NSamples(); i++)
@@ -5,6 +5,9 @@
 #include "interpolation.h"
 #include "paramset.h"
 #include "interaction.h"
+#include "parallel.h"
+#include "plugin/multipole/multipole.hpp"
+#include <algorithm>
 
 namespace pbrt
 {
@@ -31,37 +34,125 @@ namespace pbrt
 		BxDF *spec = ARENA_ALLOC(arena, MicrofacetReflection)(ks, distrib, fresnel);
 		si->bsdf->Add(spec);
 
+		/* Light refracted into the skin is what the BSSRDF below scatters back out. */
+		si->bsdf->Add(ARENA_ALLOC(arena, MicrofacetTransmission)(
+			Spectrum(1.f), distrib, 1.f, 1.5f, mode));
 
 		/* BSSRDF which represent light interaction with the layers derm and epiderm of the skin. */
-		Float Ch = hemoglobinFraction->Evaluate(*si);
 		Float Cm = melaninFraction->Evaluate(*si);
 		Float Bm = melaninBlend->Evaluate(*si);
 
-		Spectrum sig_a, sig_s;
-		ComputeSigmas(Ch, Cm, Bm, &sig_a, &sig_s);
+		Spectrum sig_a = ComputeSigmaA(Cm, Bm);
+		const MultipoleProfile *layered[Spectrum::nSamples];
+		for (int c = 0; c < Spectrum::nSamples; ++c)
+			layered[c] = LayeredProfile(c, sig_a[c]);
 		/* The fourth parameter (1.5f) is a eta parameter I must understand it better. I do not know 
 		if it is correct. */ 
-		si->bssrdf = ARENA_ALLOC(arena, TabulatedBSSRDF)(*si, this, mode, 1.5f, sig_a, sig_s, table);
+		si->bssrdf = ARENA_ALLOC(arena, MultipoleBSSRDF)(*si, this, mode, 1.5f, layered);
 	}
 
-	void SkinMaterial::ComputeSigmas(const Float &Ch, const Float &Cm, const Float &Bm, 
-		Spectrum *sigma_a, Spectrum *sigma_s) const
+	/* The melanin, baseline and scattering curves only depend on the wavelength, so they are 
+	 * tabulated once per spectral bin; ComputeSigmas() then only has to blend them. */
+	struct SkinChromophoreSpectra
 	{
-		Float gamma = 0.75f;
-		Spectrum em, pm, baseline, epiderm;
-		int c = 0;
-		int step = (sampledLambdaEnd - sampledLambdaStart)/Spectrum::nSamples;
-
-		for (int lambda = sampledLambdaStart; lambda < sampledLambdaEnd; lambda += step) {
-			
-			/* Compute sigma_a and sigma_s from epiderm */
-			em[c] = 6.6e10 * std::pow(lambda, -3.33);
-			pm[c] = 2.9e14 * std::pow(lambda, -4.75);
-			baseline[c] = 0.0244 + 8.53 * std::exp(-(lambda-154) / 66.2);
-			
-			(*sigma_a)[c] = Cm*(Bm*em[c] + (1 - Bm)*pm[c]) + (1-Cm)*baseline[c];
-			(*sigma_s)[c] = 14.74 * std::pow(lambda, -0.22) + 2.2e11 * std::pow(lambda, -4);
+		SkinChromophoreSpectra()
+		{
+			int step = (sampledLambdaEnd - sampledLambdaStart)/Spectrum::nSamples;
+			for (int c = 0; c < Spectrum::nSamples; ++c) {
+				Float lambda = sampledLambdaStart + c * step;
+				em[c] = 6.6e10 * std::pow(lambda, -3.33);
+				pm[c] = 2.9e14 * std::pow(lambda, -4.75);
+				baseline[c] = 0.0244 + 8.53 * std::exp(-(lambda-154) / 66.2);
+				sigma_s[c] = 14.74 * std::pow(lambda, -0.22) + 2.2e11 * std::pow(lambda, -4);
+			}
 		}
+
+		Spectrum em, pm, baseline, sigma_s;
+	};
+
+	static const SkinChromophoreSpectra &GetSkinChromophoreSpectra()
+	{
+		static const SkinChromophoreSpectra spectra;
+		return spectra;
+	}
+
+	Spectrum SkinMaterial::ComputeSigmaA(Float Cm, Float Bm) const
+	{
+		const SkinChromophoreSpectra &cs = GetSkinChromophoreSpectra();
+
+		/* sigma_a = Cm*(Bm*em + (1-Bm)*pm) + (1-Cm)*baseline, as a weighted sum of the 
+		 * precomputed spectra. With the fractions in [0,1] it stays between the smallest and 
+		 * largest of them, which bounds the profile levels that are needed. */
+		Cm = Clamp(Cm, 0, 1);
+		Bm = Clamp(Bm, 0, 1);
+		Float wEm = Cm * Bm, wPm = Cm * (1 - Bm), wBaseline = 1 - Cm;
+		Spectrum sigma_a;
+		for (int c = 0; c < Spectrum::nSamples; ++c)
+			sigma_a[c] = wEm * cs.em[c] + wPm * cs.pm[c] + wBaseline * cs.baseline[c];
+		return sigma_a;
+	}
+
+	int SkinMaterial::ProfileLevel(Float sigma_a) const
+	{
+		int level = maxProfileLevel;
+		if (sigma_a < std::exp2((Float)maxProfileLevel / nProfileLevelsPerOctave))
+			level = sigma_a > 0 ? (int)std::round(std::log2(sigma_a) * nProfileLevelsPerOctave) : minProfileLevel;
+		return Clamp(level, minProfileLevel, maxProfileLevel);
+	}
+
+	/* The skin is modelled as an epidermis, whose absorption comes from ComputeSigmaA(), over a 
+	 * thick dermis with the baseline absorption. The dermis and the scattering only depend on the 
+	 * channel, so profiles are precomputed per channel and quantized epidermal absorption; 
+	 * GetMultipoleDiffusionProfile() shares the underlying tables between materials. Computing 
+	 * them here rather than on first use keeps the multipole solver's parallel loops out of 
+	 * shading. */
+	SkinMaterial::SkinMaterial(const std::shared_ptr<Texture<Spectrum>> &oilness,
+							   const std::shared_ptr<Texture<Float>> &hemoglobinFraction,
+							   const std::shared_ptr<Texture<Float>> &melaninFraction,
+							   const std::shared_ptr<Texture<Float>> &melaninBlend,
+							   const std::shared_ptr<Texture<Float>> &roughness,
+							   const std::shared_ptr<Texture<Float>> &bumpMap):
+		oilness(oilness),
+		hemoglobinFraction(hemoglobinFraction),
+		melaninFraction(melaninFraction),
+		melaninBlend(melaninBlend),
+		roughness(roughness),
+		bumpMap(bumpMap),
+		profiles(Spectrum::nSamples * nProfileLevels)
+	{
+		const SkinChromophoreSpectra &cs = GetSkinChromophoreSpectra();
+		std::vector<std::pair<int, int>> needed;
+		for (int c = 0; c < Spectrum::nSamples; ++c) {
+			minLevel[c] = ProfileLevel(std::min({cs.em[c], cs.pm[c], cs.baseline[c]}));
+			maxLevel[c] = ProfileLevel(std::max({cs.em[c], cs.pm[c], cs.baseline[c]}));
+			for (int level = minLevel[c]; level <= maxLevel[c]; ++level)
+				needed.push_back(std::make_pair(c, level));
+		}
+
+		ParallelFor([&](int64_t i) {
+			int c = needed[i].first, level = needed[i].second;
+			const Float eta = 1.5f, epidermisThickness = 0.25f, dermisThickness = 20.f;
+			std::vector<MultipoleLayer> layers;
+			layers.push_back(MultipoleLayer(1.f, eta, epidermisThickness, 
+				std::exp2((Float)level / nProfileLevelsPerOctave), cs.sigma_s[c]));
+			layers.push_back(MultipoleLayer(eta, eta, dermisThickness, cs.baseline[c], cs.sigma_s[c]));
+
+			/* The table covers radii up to length - 1 steps; make that six diffusion lengths of 
+			 * the dermis. */
+			const int length = 128;
+			Float sigma_tr = std::sqrt(3 * cs.baseline[c] * (cs.baseline[c] + cs.sigma_s[c]));
+			MultipoleOptions options(6 / (sigma_tr * (length - 1)), length);
+			profiles[c * nProfileLevels + level - minProfileLevel].reset(
+				new MultipoleProfile(*GetMultipoleDiffusionProfile(layers, options)));
+		}, needed.size());
+	}
+
+	SkinMaterial::~SkinMaterial() {}
+
+	const MultipoleProfile *SkinMaterial::LayeredProfile(int ch, Float sigma_a) const
+	{
+		int level = Clamp(ProfileLevel(sigma_a), minLevel[ch], maxLevel[ch]);
+		return profiles[ch * nProfileLevels + level - minProfileLevel].get();
 	}
 
 	SkinMaterial *CreateSkinMaterial(const TextureParams &mp)
@@ -105,7 +196,7 @@ namespace pbrt
 		Spectrum sig_s = scale * sigma_s->Evaluate(*si).Clamp();
 
 		/* GetMediumScatteringProperties("skin2", &sig_a,  &sig_s); */
-		si->bssrdf = ARENA_ALLOC(arena, TabulatedBSSRDF)(*si, this, mode, eta, sig_a, sig_s, table);
+		si->bssrdf = ARENA_ALLOC(arena, TabulatedBSSRDF)(*si, this, mode, eta, sig_a, sig_s, *table);
 	}
 
 	SimpleSkinMaterial *CreateSimpleSkinMaterial(const TextureParams &mp)
@@ -15,6 +15,10 @@
 #include "material.h"
 #include "reflection.h"
 #include "bssrdf.h"
+#include <memory>
+#include <vector>
+
+class MultipoleProfile;
 
 namespace pbrt 
 {
@@ -28,24 +32,23 @@ namespace pbrt
 					 const std::shared_ptr<Texture<Float>> &melaninFraction,
 					 const std::shared_ptr<Texture<Float>> &melaninBlend,
 					 const std::shared_ptr<Texture<Float>> &roughness,
-					 const std::shared_ptr<Texture<Float>> &bumpMap):
-		oilness(oilness),
-		hemoglobinFraction(hemoglobinFraction),
-		melaninFraction(melaninFraction),
-		melaninBlend(melaninBlend),
-		roughness(roughness),
-		bumpMap(bumpMap),
-		table(100, 64) {
-			/* g = 0.0, eta = 1.33*/
-			ComputeBeamDiffusionBSSRDF(0, 1.33, &table);
-		}
+					 const std::shared_ptr<Texture<Float>> &bumpMap);
+		~SkinMaterial();
 
 		void ComputeScatteringFunctions(SurfaceInteraction *si, MemoryArena &arena, TransportMode mode, 
 			bool allowMultipleLobes) const;
 
 	private:
-		void ComputeSigmas(const Float &Ch, const Float &Cm, const Float &Bm, 
-			Spectrum *sigma_a, Spectrum *sigma_s) const;
+		Spectrum ComputeSigmaA(Float Cm, Float Bm) const;
+		int ProfileLevel(Float sigma_a) const;
+		const MultipoleProfile *LayeredProfile(int ch, Float sigma_a) const;
+
+		/* Layered profiles are looked up with the epidermal absorption rounded to one of 
+		 * nProfileLevelsPerOctave levels per octave, from 2^-12 to 2^10. */
+		static PBRT_CONSTEXPR int nProfileLevelsPerOctave = 8;
+		static PBRT_CONSTEXPR int minProfileLevel = -12 * nProfileLevelsPerOctave;
+		static PBRT_CONSTEXPR int maxProfileLevel = 10 * nProfileLevelsPerOctave;
+		static PBRT_CONSTEXPR int nProfileLevels = maxProfileLevel - minProfileLevel + 1;
 
 	private:
 		std::shared_ptr<Texture<Spectrum>> oilness;
@@ -55,7 +58,10 @@ namespace pbrt
 
 		std::shared_ptr<Texture<Float>> roughness;		
 		std::shared_ptr<Texture<Float>> bumpMap;
-		BSSRDFTable table;
+		/* Profiles for each spectral channel and absorption level; only the levels from 
+		 * minLevel[c] to maxLevel[c], which the epidermal absorption can reach, are computed. */
+		std::vector<std::unique_ptr<const MultipoleProfile>> profiles;
+		int minLevel[Spectrum::nSamples], maxLevel[Spectrum::nSamples];
 	};
 
 	SkinMaterial *CreateSkinMaterial(const TextureParams &mp);
@@ -82,10 +88,7 @@ namespace pbrt
 		 eta(eta),
 		 scale(scale),
 		 bumpMap(bumpMap),
-		 table(100, 64)
-		 {
-		 	ComputeBeamDiffusionBSSRDF(g, eta, &table);
-		 }
+		 table(GetBeamDiffusionBSSRDFTable(g, eta)) {}
 
 		void ComputeScatteringFunctions(SurfaceInteraction *si, MemoryArena &arena, TransportMode mode,
 			bool allowMultipleLobes) const;
@@ -98,7 +101,7 @@ namespace pbrt
 		Float eta;
 		Float scale;
 		std::shared_ptr<Texture<Float>> bumpMap;
-		BSSRDFTable table;
+		std::shared_ptr<const BSSRDFTable> table;
 	};
 
 	SimpleSkinMaterial *CreateSimpleSkinMaterial(const TextureParams &mp);
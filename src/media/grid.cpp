@@ -33,6 +33,7 @@
 
 // media/grid.cpp*
 #include "media/grid.h"
+#include "parallel.h"
 #include "paramset.h"
 #include "sampler.h"
 #include "stats.h"
@@ -41,8 +42,96 @@
 namespace pbrt {
 
 STAT_RATIO("Media/Grid steps per Tr() call", nTrSteps, nTrCalls);
+STAT_RATIO("Media/Grid steps per Sample() call", nSampleSteps,
+           nSampleCalls);
+
+// Each majorant grid cell covers up to this many density voxels per axis
+static const int MajorantCellSize = 8;
+
+// MajorantIterator Declarations
+
+// Steps through the cells of a _GridDensityMedium_'s majorant grid that a
+// ray in medium space passes through over $[t_{\roman{min}},
+// t_{\roman{max}}]$, using a 3D DDA.
+class MajorantIterator {
+  public:
+    MajorantIterator(const Point3i &res, const Ray &ray, Float tMin,
+                     Float tMax)
+        : tMin(tMin), tMax(tMax) {
+        Point3f pGrid = ray(tMin);
+        for (int axis = 0; axis < 3; ++axis) {
+            // Initialize DDA state for _axis_
+            cell[axis] = Clamp(int(pGrid[axis] * res[axis]), 0, res[axis] - 1);
+            if (ray.d[axis] == 0) {
+                nextCrossingT[axis] = Infinity;
+                deltaT[axis] = Infinity;
+                step[axis] = 0;
+                cellLimit[axis] = -1;
+            } else if (ray.d[axis] > 0) {
+                Float nextPos = Float(cell[axis] + 1) / res[axis];
+                nextCrossingT[axis] =
+                    tMin + (nextPos - pGrid[axis]) / ray.d[axis];
+                deltaT[axis] = 1 / (ray.d[axis] * res[axis]);
+                step[axis] = 1;
+                cellLimit[axis] = res[axis];
+            } else {
+                Float nextPos = Float(cell[axis]) / res[axis];
+                nextCrossingT[axis] =
+                    tMin + (nextPos - pGrid[axis]) / ray.d[axis];
+                deltaT[axis] = -1 / (ray.d[axis] * res[axis]);
+                step[axis] = -1;
+                cellLimit[axis] = -1;
+            }
+        }
+    }
+
+    // Returns the next cell and the parametric range of the ray inside it
+    bool Next(Point3i *c, Float *t0, Float *t1) {
+        if (tMin >= tMax) return false;
+        // Find _stepAxis_ for stepping to next cell and its exit distance
+        int stepAxis = 0;
+        if (nextCrossingT[1] < nextCrossingT[stepAxis]) stepAxis = 1;
+        if (nextCrossingT[2] < nextCrossingT[stepAxis]) stepAxis = 2;
+        Float tExit = std::min(tMax, nextCrossingT[stepAxis]);
+        *c = cell;
+        *t0 = tMin;
+        *t1 = tExit;
+
+        // Advance to the next cell, if the ray hasn't left the grid
+        tMin = tExit;
+        cell[stepAxis] += step[stepAxis];
+        if (cell[stepAxis] == cellLimit[stepAxis]) tMin = tMax;
+        nextCrossingT[stepAxis] += deltaT[stepAxis];
+        return true;
+    }
+
+  private:
+    Float tMin, tMax;
+    Point3i cell;
+    Float nextCrossingT[3], deltaT[3];
+    int step[3], cellLimit[3];
+};
 
 // GridDensityMedium Method Definitions
+GridDensityMedium::GridDensityMedium(
+    const Spectrum &sigma_a, const Spectrum &sigma_s, Float g,
+    std::unique_ptr<SparseDensityGrid> grid, const Transform &mediumToWorld)
+    : sigma_a(sigma_a),
+      sigma_s(sigma_s),
+      g(g),
+      nx(grid->Resolution().x),
+      ny(grid->Resolution().y),
+      nz(grid->Resolution().z),
+      WorldToMedium(Inverse(mediumToWorld)),
+      sparseGrid(std::move(grid)) {
+    sigma_t = (sigma_a + sigma_s)[0];
+    if (Spectrum(sigma_t) != sigma_a + sigma_s)
+        Error(
+            "GridDensityMedium requires a spectrally uniform attenuation "
+            "coefficient!");
+    InitMajorants();
+}
+
 Float GridDensityMedium::Density(const Point3f &p) const {
     // Compute voxel coordinates and offsets for _p_
     Point3f pSamples(p.x * nx - .5f, p.y * ny - .5f, p.z * nz - .5f);
@@ -59,6 +148,45 @@ Float GridDensityMedium::Density(const Point3f &p) const {
     return Lerp(d.z, d0, d1);
 }
 
+void GridDensityMedium::InitMajorants() {
+    majorantRes = Point3i((nx + MajorantCellSize - 1) / MajorantCellSize,
+                          (ny + MajorantCellSize - 1) / MajorantCellSize,
+                          (nz + MajorantCellSize - 1) / MajorantCellSize);
+    majorants.resize(majorantRes.x * majorantRes.y * majorantRes.z);
+    densityBytes += majorants.size() * sizeof(Float);
+    // Find the voxels whose values _Density()_ interpolates for points in
+    // the cell, on each axis
+    auto voxelRange = [](int cell, int res, int n, int *v0, int *v1) {
+        *v0 = std::max(0, (int)std::floor(Float(cell) / res * n - .5f));
+        *v1 = std::min(n - 1,
+                       (int)std::floor(Float(cell + 1) / res * n - .5f) + 1);
+    };
+    ParallelFor([&](int64_t z) {
+        int z0, z1;
+        voxelRange(z, majorantRes.z, nz, &z0, &z1);
+        for (int y = 0; y < majorantRes.y; ++y) {
+            int y0, y1;
+            voxelRange(y, majorantRes.y, ny, &y0, &y1);
+            for (int x = 0; x < majorantRes.x; ++x) {
+                int x0, x1;
+                voxelRange(x, majorantRes.x, nx, &x0, &x1);
+                Float maxDensity = 0;
+                if (sparseGrid)
+                    maxDensity = sparseGrid->MaxDensity(Bounds3i(
+                        Point3i(x0, y0, z0), Point3i(x1 + 1, y1 + 1, z1 + 1)));
+                else
+                    for (int vz = z0; vz <= z1; ++vz)
+                        for (int vy = y0; vy <= y1; ++vy)
+                            for (int vx = x0; vx <= x1; ++vx)
+                                maxDensity = std::max(maxDensity,
+                                                      D(Point3i(vx, vy, vz)));
+                majorants[(z * majorantRes.y + y) * majorantRes.x + x] =
+                    maxDensity;
+            }
+        }
+    }, majorantRes.z);
+}
+
 Spectrum GridDensityMedium::Sample(const Ray &rWorld, Sampler &sampler,
                                    MemoryArena &arena,
                                    MediumInteraction *mi) const {
@@ -70,17 +198,29 @@ Spectrum GridDensityMedium::Sample(const Ray &rWorld, Sampler &sampler,
     Float tMin, tMax;
     if (!b.IntersectP(ray, &tMin, &tMax)) return Spectrum(1.f);
 
-    // Run delta-tracking iterations to sample a medium interaction
-    Float t = tMin;
-    while (true) {
-        t -= std::log(1 - sampler.Get1D()) * invMaxDensity / sigma_t;
-        if (t >= tMax) break;
-        if (Density(ray(t)) * invMaxDensity > sampler.Get1D()) {
-            // Populate _mi_ with medium interaction information and return
-            PhaseFunction *phase = ARENA_ALLOC(arena, HenyeyGreenstein)(g);
-            *mi = MediumInteraction(rWorld(t), -rWorld.d, rWorld.time, this,
-                                    phase);
-            return sigma_s / sigma_t;
+    // Run delta-tracking iterations against each majorant cell's maximum
+    // density to sample a medium interaction
+    ++nSampleCalls;
+    MajorantIterator iter(majorantRes, ray, tMin, tMax);
+    Point3i cell;
+    Float t0, t1;
+    while (iter.Next(&cell, &t0, &t1)) {
+        Float maxDensity = Majorant(cell);
+        if (maxDensity == 0) continue;
+        Float invMaxDensity = 1 / maxDensity;
+        Float t = t0;
+        while (true) {
+            ++nSampleSteps;
+            t -= std::log(1 - sampler.Get1D()) * invMaxDensity / sigma_t;
+            if (t >= t1) break;
+            if (Density(ray(t)) * invMaxDensity > sampler.Get1D()) {
+                // Populate _mi_ with medium interaction information and
+                // return
+                PhaseFunction *phase = ARENA_ALLOC(arena, HenyeyGreenstein)(g);
+                *mi = MediumInteraction(rWorld(t), -rWorld.d, rWorld.time,
+                                        this, phase);
+                return sigma_s / sigma_t;
+            }
         }
     }
     return Spectrum(1.f);
@@ -97,21 +237,31 @@ Spectrum GridDensityMedium::Tr(const Ray &rWorld, Sampler &sampler) const {
     Float tMin, tMax;
     if (!b.IntersectP(ray, &tMin, &tMax)) return Spectrum(1.f);
 
-    // Perform ratio tracking to estimate the transmittance value
-    Float Tr = 1, t = tMin;
-    while (true) {
-        ++nTrSteps;
-        t -= std::log(1 - sampler.Get1D()) * invMaxDensity / sigma_t;
-        if (t >= tMax) break;
-        Float density = Density(ray(t));
-        Tr *= 1 - std::max((Float)0, density * invMaxDensity);
-        // Added after book publication: when transmittance gets low,
-        // start applying Russian roulette to terminate sampling.
-        const Float rrThreshold = .1;
-        if (Tr < rrThreshold) {
-            Float q = std::max((Float).05, 1 - Tr);
-            if (sampler.Get1D() < q) return 0;
-            Tr /= 1 - q;
+    // Perform ratio tracking through the majorant cells to estimate the
+    // transmittance value
+    Float Tr = 1;
+    MajorantIterator iter(majorantRes, ray, tMin, tMax);
+    Point3i cell;
+    Float t0, t1;
+    while (iter.Next(&cell, &t0, &t1)) {
+        Float maxDensity = Majorant(cell);
+        if (maxDensity == 0) continue;
+        Float invMaxDensity = 1 / maxDensity;
+        Float t = t0;
+        while (true) {
+            ++nTrSteps;
+            t -= std::log(1 - sampler.Get1D()) * invMaxDensity / sigma_t;
+            if (t >= t1) break;
+            Float density = Density(ray(t));
+            Tr *= 1 - std::max((Float)0, density * invMaxDensity);
+            // Added after book publication: when transmittance gets low,
+            // start applying Russian roulette to terminate sampling.
+            const Float rrThreshold = .1;
+            if (Tr < rrThreshold) {
+                Float q = std::max((Float).05, 1 - Tr);
+                if (sampler.Get1D() < q) return 0;
+                Tr /= 1 - q;
+            }
         }
     }
     return Spectrum(Tr);
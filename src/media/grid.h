@@ -40,6 +40,7 @@
 
 // media/grid.h*
 #include "medium.h"
+#include "media/sparsegrid.h"
 #include "transform.h"
 #include "stats.h"
 
@@ -70,14 +71,15 @@ class GridDensityMedium : public Medium {
             Error(
                 "GridDensityMedium requires a spectrally uniform attenuation "
                 "coefficient!");
-        Float maxDensity = 0;
-        for (int i = 0; i < nx * ny * nz; ++i)
-            maxDensity = std::max(maxDensity, density[i]);
-        invMaxDensity = 1 / maxDensity;
+        InitMajorants();
     }
+    GridDensityMedium(const Spectrum &sigma_a, const Spectrum &sigma_s, Float g,
+                      std::unique_ptr<SparseDensityGrid> sparseGrid,
+                      const Transform &mediumToWorld);
 
     Float Density(const Point3f &p) const;
     Float D(const Point3i &p) const {
+        if (sparseGrid) return sparseGrid->D(p);
         Bounds3i sampleBounds(Point3i(0, 0, 0), Point3i(nx, ny, nz));
         if (!InsideExclusive(p, sampleBounds)) return 0;
         return density[(p.z * ny + p.y) * nx + p.x];
@@ -87,14 +89,27 @@ class GridDensityMedium : public Medium {
     Spectrum Tr(const Ray &ray, Sampler &sampler) const;
 
   private:
+    // GridDensityMedium Private Methods
+    void InitMajorants();
+    Float Majorant(const Point3i &cell) const {
+        return majorants[(cell.z * majorantRes.y + cell.y) * majorantRes.x +
+                         cell.x];
+    }
+
     // GridDensityMedium Private Data
     const Spectrum sigma_a, sigma_s;
     const Float g;
     const int nx, ny, nz;
     const Transform WorldToMedium;
+    // Density values are stored either densely in _density_ or in
+    // _sparseGrid_
     std::unique_ptr<Float[]> density;
+    std::unique_ptr<SparseDensityGrid> sparseGrid;
     Float sigma_t;
-    Float invMaxDensity;
+    // Maximum density over each cell of a coarse grid that covers the
+    // medium; delta and ratio tracking use these as local majorants
+    Point3i majorantRes;
+    std::vector<Float> majorants;
 };
 
 }  // namespace pbrt
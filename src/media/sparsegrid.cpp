@@ -0,0 +1,220 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+
+// media/sparsegrid.cpp*
+#include "media/sparsegrid.h"
+#include "stats.h"
+#include <cstring>
+#include <fstream>
+
+namespace pbrt {
+
+STAT_MEMORY_COUNTER("Memory/Sparse density grid bricks", brickBytes);
+STAT_COUNTER("Media/Sparse density grid bricks", nBricks);
+
+// SparseDensityGrid Local Definitions
+static const char sparseGridMagic[8] = {'P', 'B', 'R', 'T', 'S', 'V', 'G', 1};
+static PBRT_CONSTEXPR int64_t sparseGridAlignment = 4096;
+
+static int64_t SparseGridFirstBrickOffset(int64_t nTableEntries) {
+    int64_t headerBytes = sizeof(sparseGridMagic) + 4 * sizeof(int32_t) +
+                          nTableEntries * (sizeof(int32_t) + sizeof(float));
+    return (headerBytes + sparseGridAlignment - 1) / sparseGridAlignment *
+           sparseGridAlignment;
+}
+
+// SparseDensityGrid Method Definitions
+std::unique_ptr<SparseDensityGrid> SparseDensityGrid::Read(
+    const std::string &filename) {
+    std::unique_ptr<SparseDensityGrid> grid(new SparseDensityGrid);
+    const char *data;
+    size_t size;
+    grid->mappedFile = MappedFile::Open(filename);
+    if (grid->mappedFile) {
+        data = grid->mappedFile->Data();
+        size = grid->mappedFile->Size();
+    } else {
+        // Read the whole file if it can't be mapped
+        std::ifstream in(filename, std::ios::binary | std::ios::ate);
+        if (!in) {
+            Error("%s: unable to open sparse density grid file",
+                  filename.c_str());
+            return nullptr;
+        }
+        grid->fileContents.resize(in.tellg());
+        in.seekg(0);
+        in.read(grid->fileContents.data(), grid->fileContents.size());
+        if (!in) {
+            Error("%s: error reading sparse density grid file",
+                  filename.c_str());
+            return nullptr;
+        }
+        data = grid->fileContents.data();
+        size = grid->fileContents.size();
+    }
+
+    // Read and validate the header
+    int32_t header[4];
+    if (size < sizeof(sparseGridMagic) + sizeof(header) ||
+        memcmp(data, sparseGridMagic, sizeof(sparseGridMagic)) != 0) {
+        Error("%s: not a sparse density grid file", filename.c_str());
+        return nullptr;
+    }
+    memcpy(header, data + sizeof(sparseGridMagic), sizeof(header));
+    grid->res = Point3i(header[0], header[1], header[2]);
+    grid->nStoredBricks = header[3];
+    if (grid->res.x < 1 || grid->res.y < 1 || grid->res.z < 1 ||
+        grid->nStoredBricks < 0) {
+        Error("%s: invalid sparse density grid header", filename.c_str());
+        return nullptr;
+    }
+    grid->brickRes = Point3i((grid->res.x + BrickSize - 1) / BrickSize,
+                             (grid->res.y + BrickSize - 1) / BrickSize,
+                             (grid->res.z + BrickSize - 1) / BrickSize);
+    int64_t nTableEntries =
+        int64_t(grid->brickRes.x) * grid->brickRes.y * grid->brickRes.z;
+    int64_t firstBrickOffset = SparseGridFirstBrickOffset(nTableEntries);
+    if (size < firstBrickOffset + grid->nStoredBricks * BrickVoxelCount *
+                                      sizeof(float)) {
+        Error("%s: sparse density grid file is truncated", filename.c_str());
+        return nullptr;
+    }
+    grid->brickTable = (const int32_t *)(data + sizeof(sparseGridMagic) +
+                                         sizeof(header));
+    grid->brickMax = (const float *)(grid->brickTable + nTableEntries);
+    grid->bricks = (const float *)(data + firstBrickOffset);
+    for (int64_t i = 0; i < nTableEntries; ++i)
+        if (grid->brickTable[i] >= grid->nStoredBricks) {
+            Error("%s: invalid sparse density grid brick index",
+                  filename.c_str());
+            return nullptr;
+        }
+    brickBytes += grid->nStoredBricks * BrickVoxelCount * sizeof(float);
+    nBricks += grid->nStoredBricks;
+    return grid;
+}
+
+bool SparseDensityGrid::Write(
+    const std::string &filename, const Point3i &res,
+    const std::function<Float(const Point3i &)> &density) {
+    CHECK(res.x > 0 && res.y > 0 && res.z > 0);
+    std::ofstream out(filename, std::ios::binary);
+    if (!out) {
+        Error("%s: unable to open sparse density grid file for writing",
+              filename.c_str());
+        return false;
+    }
+
+    // Write the bricks that have nonzero voxels, after space for the
+    // header and tables
+    Point3i brickRes((res.x + BrickSize - 1) / BrickSize,
+                     (res.y + BrickSize - 1) / BrickSize,
+                     (res.z + BrickSize - 1) / BrickSize);
+    int64_t nTableEntries = int64_t(brickRes.x) * brickRes.y * brickRes.z;
+    CHECK_LT(nTableEntries, std::numeric_limits<int32_t>::max());
+    out.seekp(SparseGridFirstBrickOffset(nTableEntries));
+    std::vector<int32_t> brickTable(nTableEntries, -1);
+    std::vector<float> brickMax(nTableEntries, 0.f), voxels(BrickVoxelCount);
+    int32_t nStoredBricks = 0;
+    for (int bz = 0; bz < brickRes.z; ++bz)
+        for (int by = 0; by < brickRes.y; ++by)
+            for (int bx = 0; bx < brickRes.x; ++bx) {
+                float maxValue = 0;
+                bool empty = true;
+                for (int z = 0; z < BrickSize; ++z)
+                    for (int y = 0; y < BrickSize; ++y)
+                        for (int x = 0; x < BrickSize; ++x) {
+                            Point3i p(bx * BrickSize + x, by * BrickSize + y,
+                                      bz * BrickSize + z);
+                            float v = 0;
+                            if (p.x < res.x && p.y < res.y && p.z < res.z)
+                                v = density(p);
+                            voxels[(z * BrickSize + y) * BrickSize + x] = v;
+                            maxValue = std::max(maxValue, v);
+                            empty &= (v == 0);
+                        }
+                if (empty) continue;
+                int64_t brick =
+                    (int64_t(bz) * brickRes.y + by) * brickRes.x + bx;
+                brickTable[brick] = nStoredBricks++;
+                brickMax[brick] = maxValue;
+                out.write((const char *)voxels.data(),
+                          voxels.size() * sizeof(float));
+            }
+
+    // Write the header and tables, now that the bricks are known
+    int32_t header[4] = {res.x, res.y, res.z, nStoredBricks};
+    out.seekp(0);
+    out.write(sparseGridMagic, sizeof(sparseGridMagic));
+    out.write((const char *)header, sizeof(header));
+    out.write((const char *)brickTable.data(),
+              brickTable.size() * sizeof(int32_t));
+    out.write((const char *)brickMax.data(), brickMax.size() * sizeof(float));
+    // Pad the file to its full size if no bricks follow the tables
+    if (nStoredBricks == 0) {
+        std::vector<char> padding(SparseGridFirstBrickOffset(nTableEntries) -
+                                  int64_t(out.tellp()));
+        out.write(padding.data(), padding.size());
+    }
+    if (!out) {
+        Error("%s: error writing sparse density grid file", filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+Float SparseDensityGrid::MaxDensity(const Bounds3i &voxels) const {
+    // Take the maximum over the bricks that overlap _voxels_
+    Bounds3i clipped = Intersect(voxels, Bounds3i(Point3i(0, 0, 0), res));
+    if (clipped.pMin.x >= clipped.pMax.x || clipped.pMin.y >= clipped.pMax.y ||
+        clipped.pMin.z >= clipped.pMax.z)
+        return 0;
+    Point3i b0(clipped.pMin.x >> LogBrickSize, clipped.pMin.y >> LogBrickSize,
+               clipped.pMin.z >> LogBrickSize);
+    Point3i b1((clipped.pMax.x - 1) >> LogBrickSize,
+               (clipped.pMax.y - 1) >> LogBrickSize,
+               (clipped.pMax.z - 1) >> LogBrickSize);
+    Float maxDensity = 0;
+    for (int bz = b0.z; bz <= b1.z; ++bz)
+        for (int by = b0.y; by <= b1.y; ++by)
+            for (int bx = b0.x; bx <= b1.x; ++bx)
+                maxDensity = std::max(
+                    maxDensity,
+                    (Float)brickMax[(int64_t(bz) * brickRes.y + by) *
+                                        brickRes.x +
+                                    bx]);
+    return maxDensity;
+}
+
+}  // namespace pbrt
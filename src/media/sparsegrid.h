@@ -0,0 +1,133 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_MEDIA_SPARSEGRID_H
+#define PBRT_MEDIA_SPARSEGRID_H
+
+// media/sparsegrid.h*
+#include "pbrt.h"
+#include "geometry.h"
+#include "fileutil.h"
+#include "parallel.h"
+#include <functional>
+
+namespace pbrt {
+
+// SparseDensityGrid Declarations
+
+// A sparse density grid file stores an nx*ny*nz grid of 32-bit float
+// density values as bricks of 8x8x8 voxels, much like the leaf nodes of
+// OpenVDB; bricks whose voxels are all zero aren't stored. The header gives
+// the grid resolution and the number of stored bricks. It is followed by a
+// table with one entry per brick of the grid, in x-major order, holding the
+// index of the brick's stored voxels or -1 for an empty brick, and then by
+// a table of the maximum density of each brick. The stored bricks start at
+// the first page boundary after that, each with its voxels in x-major order.
+class SparseDensityGrid {
+  public:
+    // SparseDensityGrid Public Methods
+    static std::unique_ptr<SparseDensityGrid> Read(const std::string &filename);
+    static bool Write(const std::string &filename, const Point3i &res,
+                      const std::function<Float(const Point3i &)> &density);
+    Point3i Resolution() const { return res; }
+    int64_t StoredBricks() const { return nStoredBricks; }
+    Float D(const Point3i &p) const {
+        if (p.x < 0 || p.x >= res.x || p.y < 0 || p.y >= res.y || p.z < 0 ||
+            p.z >= res.z)
+            return 0;
+        // Find the brick holding _p_ through the calling thread's leaf cache
+        Point3i b(p.x >> LogBrickSize, p.y >> LogBrickSize,
+                  p.z >> LogBrickSize);
+        int64_t brick = (int64_t(b.z) * brickRes.y + b.y) * brickRes.x + b.x;
+        LeafCacheEntry &entry =
+            leafCaches[ThreadIndex].entries[(b.x & 1) | ((b.y & 1) << 1) |
+                                            ((b.z & 1) << 2)];
+        if (entry.brick != brick) {
+            entry.brick = brick;
+            entry.voxels = BrickVoxels(brick);
+        }
+        if (!entry.voxels) return 0;
+        const int mask = BrickSize - 1;
+        return entry.voxels[((p.z & mask) * BrickSize + (p.y & mask)) *
+                                BrickSize +
+                            (p.x & mask)];
+    }
+    // Returns an upper bound of the values of the voxels in _voxels_, not
+    // including its upper corner
+    Float MaxDensity(const Bounds3i &voxels) const;
+
+  private:
+    // SparseDensityGrid Private Declarations
+    static PBRT_CONSTEXPR int LogBrickSize = 3;
+    static PBRT_CONSTEXPR int BrickSize = 1 << LogBrickSize;
+    static PBRT_CONSTEXPR int BrickVoxelCount =
+        BrickSize * BrickSize * BrickSize;
+    struct LeafCacheEntry {
+        int64_t brick = -1;
+        const float *voxels = nullptr;
+    };
+    // Each thread remembers the last brick it used at each combination of
+    // odd and even brick coordinates, so that the eight lookups of a
+    // trilinear interpolation never evict each other, even at brick corners
+    struct alignas(PBRT_L1_CACHE_LINE_SIZE) LeafCache {
+        LeafCacheEntry entries[8];
+    };
+
+    // SparseDensityGrid Private Methods
+    SparseDensityGrid() : leafCaches(MaxThreadIndex()) {}
+    const float *BrickVoxels(int64_t brick) const {
+        int32_t index = brickTable[brick];
+        return index < 0 ? nullptr
+                         : bricks + int64_t(index) * BrickVoxelCount;
+    }
+
+    // SparseDensityGrid Private Data
+    Point3i res, brickRes;
+    int64_t nStoredBricks;
+    std::unique_ptr<MappedFile> mappedFile;
+    // Holds the file's contents when it can't be mapped into memory
+    std::vector<char> fileContents;
+    const int32_t *brickTable;
+    const float *brickMax;
+    const float *bricks;
+    mutable std::vector<LeafCache> leafCaches;
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_MEDIA_SPARSEGRID_H
@@ -4,9 +4,11 @@
 #define MULTIPOLE_HPP_INCLUDED
 
 #include "pbrt.h"
+#include "bssrdf.h"
 #include <vector>
 #include "external/simple_fft/fft_settings.h"
 #include <algorithm>
+#include <memory>
 
 // --------------------------- Dipole Solver ---------------------------------------------------
 
@@ -95,6 +97,56 @@ private:
 };
 
 
+// -------------------- Multipole Profile -------------------------------------------------------
+// Radial diffusion profile built from the reflectance of a MultipoleTable. The table samples are
+// sorted by radius and the radial density 2*pi*r*R(r) is treated as piecewise linear, which gives
+// a closed-form CDF: radii are sampled with a binary search plus a quadratic solve, and the pdf
+// is evaluated by a binary search.
+class MultipoleProfile
+{
+public:
+	MultipoleProfile(const MultipoleTable &table);
+
+	// Reflectance profile R(r) per unit area.
+	Float Sr(Float r) const;
+	// Samples a radius proportionally to 2*pi*r*R(r); returns -1 for an empty profile.
+	Float Sample(Float u) const;
+	// Density per unit area of the radii returned by Sample().
+	Float Pdf(Float r) const;
+
+	Float RMax() const { return m_radius.back(); }
+	Float TotalReflectance() const { return m_cdf.back(); }
+
+private:
+	Float RadialDensity(Float r) const;
+
+	std::vector<Float> m_radius;
+	std::vector<Float> m_radialProfile;
+	std::vector<Float> m_cdf;
+};
+
+// -------------------- Multipole BSSRDF --------------------------------------------------------
+// SeparableBSSRDF backed by one MultipoleProfile per spectral channel.
+class MultipoleBSSRDF : public pbrt::SeparableBSSRDF
+{
+public:
+	MultipoleBSSRDF(const pbrt::SurfaceInteraction &po, const pbrt::Material *material, 
+		pbrt::TransportMode mode, Float eta, const MultipoleProfile *const profiles[pbrt::Spectrum::nSamples])
+		:pbrt::SeparableBSSRDF(po, eta, material, mode)
+	{
+		for (int ch = 0; ch < pbrt::Spectrum::nSamples; ++ch)
+			m_profiles[ch] = profiles[ch];
+	}
+
+	pbrt::Spectrum Sr(Float r) const;
+	Float Sample_Sr(int ch, Float u) const { return m_profiles[ch]->Sample(u); }
+	Float Pdf_Sr(int ch, Float r) const { return m_profiles[ch]->Pdf(r); }
+
+private:
+	const MultipoleProfile *m_profiles[pbrt::Spectrum::nSamples];
+};
+
+
 // ----------------------- Fast Fourier Matrix "adapter" ---------------------------------------------
 template<typename T>
 class FFTMatrix
@@ -222,4 +274,9 @@ struct MatrixProfile
 MultipoleTable ComputeMultipoleDiffusionProfile(const std::vector<MultipoleLayer> &layers, 
 	const MultipoleOptions &options);
 
+// Memoized version of ComputeMultipoleDiffusionProfile(): materials that use 
+// the same layer stack and options share a single table.
+std::shared_ptr<const MultipoleTable> GetMultipoleDiffusionProfile(
+	const std::vector<MultipoleLayer> &layers, const MultipoleOptions &options);
+
 #endif
\ No newline at end of file
@@ -1,8 +1,12 @@
 #include "multipole.hpp"
 #include "external/simple_fft/fft.h"
+#include "parallel.h"
 
+#include <atomic>
 #include <cmath>
 #include <complex>
+#include <map>
+#include <mutex>
 
 // static constant
 // From the original code - 11 dipole pair is enough to get a good approximation.
@@ -90,6 +94,96 @@ void MultipoleTable::PushBack(Float reflectance, Float transmitance, Float squar
 }
 
 
+// -------------------------- Multipole Profile ---------------------------------------------------------
+MultipoleProfile::MultipoleProfile(const MultipoleTable &table)
+{
+  // Sort the samples by distance and average the ones that land on the same radius.
+  std::vector<std::pair<Float, Float>> samples(table.NSamples());
+  for (std::size_t i = 0; i < table.NSamples(); ++i) {
+    samples[i] = std::make_pair(table.squaredDistance(i), std::max((Float)0, table.reflectance(i)));
+  }
+  std::sort(samples.begin(), samples.end());
+
+  // The profile always starts at r = 0, where the radial density vanishes.
+  m_radius.push_back(0);
+  m_radialProfile.push_back(0);
+  for (std::size_t i = 0; i < samples.size();) {
+    std::size_t j = i;
+    Float sum = 0;
+    for (; j < samples.size() && samples[j].first == samples[i].first; ++j) {
+      sum += samples[j].second;
+    }
+    Float r = std::sqrt(samples[i].first);
+    if (r > 0) {
+      m_radius.push_back(r);
+      m_radialProfile.push_back(2 * pbrt::Pi * r * sum / (j - i));
+    }
+    i = j;
+  }
+  if (m_radius.size() == 1) {
+    m_radius.push_back(1);
+    m_radialProfile.push_back(0);
+  }
+
+  // Integrate the piecewise-linear radial density.
+  m_cdf.resize(m_radius.size());
+  m_cdf[0] = 0;
+  for (std::size_t i = 1; i < m_radius.size(); ++i) {
+    m_cdf[i] = m_cdf[i - 1] + 
+      (m_radialProfile[i - 1] + m_radialProfile[i]) * (m_radius[i] - m_radius[i - 1]) / 2;
+  }
+}
+
+Float MultipoleProfile::RadialDensity(Float r) const
+{
+  if (r < 0 || r >= RMax()) return 0;
+  int i = pbrt::FindInterval(m_radius.size(), [&](int index) { return m_radius[index] <= r; });
+  Float t = (r - m_radius[i]) / (m_radius[i + 1] - m_radius[i]);
+  return pbrt::Lerp(t, m_radialProfile[i], m_radialProfile[i + 1]);
+}
+
+Float MultipoleProfile::Sr(Float r) const
+{
+  // At the origin use the limit of the linear density over the first segment.
+  if (r == 0) return m_radialProfile[1] / (2 * pbrt::Pi * m_radius[1]);
+  return RadialDensity(r) / (2 * pbrt::Pi * r);
+}
+
+Float MultipoleProfile::Sample(Float u) const
+{
+  Float total = TotalReflectance();
+  if (total == 0) return -1;
+  Float target = u * total;
+  int i = pbrt::FindInterval(m_cdf.size(), [&](int index) { return m_cdf[index] <= target; });
+
+  // Invert the CDF of the linear density f(t) = f0 + (f1 - f0) t over the segment:
+  // w*(f0*t + (f1 - f0)*t^2/2) = target - cdf[i].
+  Float w = m_radius[i + 1] - m_radius[i];
+  Float f0 = m_radialProfile[i], f1 = m_radialProfile[i + 1];
+  Float a = (f1 - f0) * w / 2, b = f0 * w, c = target - m_cdf[i];
+  Float denom = b + std::sqrt(std::max((Float)0, b * b + 4 * a * c));
+  Float t = denom > 0 ? pbrt::Clamp(2 * c / denom, 0, 1) : 0;
+  return m_radius[i] + t * w;
+}
+
+Float MultipoleProfile::Pdf(Float r) const
+{
+  Float total = TotalReflectance();
+  if (total == 0) return 0;
+  return Sr(r) / total;
+}
+
+// -------------------------- Multipole BSSRDF -----------------------------------------------------------
+pbrt::Spectrum MultipoleBSSRDF::Sr(Float r) const
+{
+  pbrt::Spectrum sr(0.f);
+  for (int ch = 0; ch < pbrt::Spectrum::nSamples; ++ch) {
+    sr[ch] = m_profiles[ch]->Sr(r);
+  }
+  return sr;
+}
+
+
 // ---------------------- Compute Diffusion Profile ------------------------------------------------------
 // Extracted from the original code 
 // https://github.com/patwonder/pbrt-v2-skin/blob/master/src/multipole/MultipoleProfileCalculator/MultipoleProfileCalculator.cpp
@@ -127,8 +221,8 @@ MatrixProfile ComputeLayerProfile(const MultipoleLayer &layer, Float stepSize, u
       real_type col2 = col * col;
       real_type r2 = (row2 + col2) * (normalizeFactor);
       for (const DipoleSolver &ds : dss) {
-        real_type r = ds.R((Float)r2) * normalizeFactor;
-        real_type t = ds.T((Float)r2) * normalizeFactor;
+        real_type r = ds.R(std::sqrt((Float)r2)) * normalizeFactor;
+        real_type t = ds.T(std::sqrt((Float)r2)) * normalizeFactor;
 
         /* std::cout <<"r(" << center + row << " ,  " << center + col << ") = " << r << "\n"; */
 
@@ -150,7 +244,7 @@ MatrixProfile ComputeLayerProfile(const MultipoleLayer &layer, Float stepSize, u
     for (unsigned int col = 0; col <= extent; col++) {
       real_type r = profile.reflectance(center + row, center + col);
       profile.reflectance(center - row, center + col) = r;
-      profile.reflectance(center + row, center + col) = r;
+      profile.reflectance(center + row, center - col) = r;
       profile.reflectance(center - row, center - col) = r;
 
       real_type t = profile.transmitance(center + row, center + col);
@@ -164,88 +258,184 @@ MatrixProfile ComputeLayerProfile(const MultipoleLayer &layer, Float stepSize, u
 }
 
 // The below two functions are also very similar with the original source:
-FFTMatrix<complex_type> runFFT(FFTMatrix<Float> &matrix) 
+void runFFT(const FFTMatrix<Float> &matrix, FFTMatrix<complex_type> *out) 
 {
   unsigned int length = matrix.NRows();
   unsigned int convolution_length = length;
   unsigned int center = (length - 1) / 2;
-  FFTMatrix<complex_type> out(convolution_length, convolution_length);
   const char *error_message = nullptr;
   
   bool success = simple_fft::FFT(matrix.ScaleAndShift(convolution_length, convolution_length, center, center),
-    out, convolution_length, convolution_length, error_message);
-  return out; 
+    *out, convolution_length, convolution_length, error_message);
+  if (!success) pbrt::Error("Multipole FFT failed: %s", error_message);
 }
 
-FFTMatrix<Float> runIFFT(FFTMatrix<complex_type> &matrix) 
+void runIFFT(FFTMatrix<complex_type> &matrix, FFTMatrix<complex_type> &scratch, FFTMatrix<Float> *out) 
 {
   unsigned int convolution_length = matrix.NRows();
   unsigned int length = convolution_length;
   unsigned int center = (length - 1) / 2;
-  FFTMatrix<complex_type> temp(convolution_length, convolution_length);
-  FFTMatrix<Float> out(convolution_length, convolution_length);
   const char *error_message = nullptr;
-  bool success = simple_fft::IFFT(matrix, temp, convolution_length, convolution_length, error_message);
-  
-  for (unsigned int i = 0; i < temp.NElements(); ++i) {
-    out[i] = temp[i].real();
+  bool success = simple_fft::IFFT(matrix, scratch, convolution_length, convolution_length, error_message);
+  if (!success) pbrt::Error("Multipole IFFT failed: %s", error_message);
+
+  FFTMatrix<Float> real(convolution_length, convolution_length);
+  for (unsigned int i = 0; i < scratch.NElements(); ++i) {
+    real[i] = scratch[i].real();
   }
 
-  return out.ScaleAndShiftReversed(length, length, center, center);
+  *out = real.ScaleAndShiftReversed(length, length, center, center);
 }
 
-MatrixProfile CombineProfiles(MatrixProfile &layer1, MatrixProfile &layer2)
+// Layer profiles in the frequency domain, where adding a layer reduces to
+// per-frequency arithmetic.
+struct FrequencyProfile
 {
-  MatrixProfile combined{layer1.length()};
-
-  FFTMatrix<complex_type> fR1 = runFFT(layer1.reflectance);
-  FFTMatrix<complex_type> fR2 = runFFT(layer2.reflectance);
-  FFTMatrix<complex_type> fT1 = runFFT(layer1.transmitance);
-  FFTMatrix<complex_type> fT2 = runFFT(layer2.transmitance);
-
-  /*for (unsigned int i = 0; i < fR1.NRows(); ++i) {
-    for (unsigned int j = 0; j < fR2.NCols(); ++j) {
-      std::cout << "layer1.R(" << i << ", " << j << ") = " << layer1.reflectance(i, j) << "\n";
-    }
-  }*/
-
-  FFTMatrix<complex_type> f1MinusR1TimesR2 = fR2*fR1;
-  f1MinusR1TimesR2.OneMinusSelf();
-  
-  FFTMatrix<complex_type> fR12 = fR1 + (fT1*fR2*fT1/f1MinusR1TimesR2);
-  FFTMatrix<complex_type> fT12 = (fT1 * fT2)/f1MinusR1TimesR2;
-
-  combined.reflectance = runIFFT(fR12);
-  combined.transmitance = runIFFT(fT12);
-
-  return combined;
+  FrequencyProfile(unsigned int length):
+    reflectance(length, length), transmitance(length, length)
+  {}
+
+  FFTMatrix<complex_type> reflectance;
+  FFTMatrix<complex_type> transmitance;
+};
+
+// Kubelka-Munk style combination of the accumulated stack (1) with the layer
+// below it (2), done in place on the accumulated profile:
+//   R12 = R1 + T1*R2*T1 / (1 - R1*R2)
+//   T12 = T1*T2 / (1 - R1*R2)
+void CombineProfiles(FrequencyProfile *layer1, const FrequencyProfile &layer2)
+{
+  for (unsigned int i = 0; i < layer1->reflectance.NElements(); ++i) {
+    complex_type R1 = layer1->reflectance[i], T1 = layer1->transmitance[i];
+    complex_type R2 = layer2.reflectance[i], T2 = layer2.transmitance[i];
+    complex_type denom = complex_type(1) - R2*R1;
+    layer1->reflectance[i] = R1 + (T1*R2*T1/denom);
+    layer1->transmitance[i] = (T1*T2)/denom;
+  }
 } 
 
-
 MultipoleTable ComputeMultipoleDiffusionProfile(const std::vector<MultipoleLayer> &layers, 
   const MultipoleOptions &options)
 {
   unsigned int length = RoundUpPow2(options.desiredLength);
-  MatrixProfile mp0{length * 2};
+  unsigned int profileLength = length * 2;
+
+  // A single layer needs no convolution at all.
+  MatrixProfile mp0{profileLength};
+  if (layers.size() == 1) {
+    mp0 = ComputeLayerProfile(layers[0], options.desiredStepSize, profileLength);
+  }
+  else {
+    // The per-layer profiles and their transforms are independent, so they
+    // are computed concurrently; the combination then stays in the frequency
+    // domain and only the final stack is transformed back.
+    std::vector<FrequencyProfile> fLayers(layers.size(), FrequencyProfile{profileLength});
+    pbrt::ParallelFor([&](int64_t i) {
+      MatrixProfile mp = ComputeLayerProfile(layers[i], options.desiredStepSize, profileLength);
+      runFFT(mp.reflectance, &fLayers[i].reflectance);
+      runFFT(mp.transmitance, &fLayers[i].transmitance);
+    }, layers.size());
+
+    for (unsigned int i = 1; i < layers.size(); ++i) {
+      CombineProfiles(&fLayers[0], fLayers[i]);
+    }
 
-  mp0 = ComputeLayerProfile(layers[0], options.desiredStepSize, mp0.length());
-  for (unsigned int i = 1; i < layers.size(); ++i) {
-    MatrixProfile mp1 = ComputeLayerProfile(layers[i], options.desiredStepSize, mp0.length());
-    mp0 = CombineProfiles(mp0, mp1);
+    FFTMatrix<complex_type> scratch(profileLength, profileLength);
+    runIFFT(fLayers[0].reflectance, scratch, &mp0.reflectance);
+    runIFFT(fLayers[0].transmitance, scratch, &mp0.transmitance);
   }
 
-  MultipoleTable table;
   unsigned int center = length - 1;
   unsigned int extent = center;
+
+  // Count the samples up front so that the table is allocated once.
+  std::size_t nSamples = 0;
+  for (unsigned int i = 0; i <= extent; ++i) {
+    for (unsigned int j = i; (i*i + j*j) <= extent*extent; j++) {
+      ++nSamples;
+    }
+  }
+
+  MultipoleTable table{nSamples};
   float denormalizeFactor = 1.f / (options.desiredStepSize * options.desiredStepSize);
+  int index = 0;
   for (unsigned int  i = 0; i <= extent; ++i) {
-    for (unsigned int j = i; (i*i + j*j) <= extent; j++) {
-      Float r = mp0.reflectance(center + i, center + j)  * denormalizeFactor;
-      Float t = mp0.transmitance(center + i, center + j) * denormalizeFactor;
-      Float sd = (float)(i*i + j*j) * options.desiredStepSize * options.desiredStepSize;
-      table.PushBack(r, t, sd);
+    for (unsigned int j = i; (i*i + j*j) <= extent*extent; j++) {
+      table.reflectance(index) = mp0.reflectance(center + i, center + j)  * denormalizeFactor;
+      table.transmitance(index) = mp0.transmitance(center + i, center + j) * denormalizeFactor;
+      table.squaredDistance(index) = (float)(i*i + j*j) * options.desiredStepSize * options.desiredStepSize;
+      ++index;
     }
   }
 
   return table;
-}
\ No newline at end of file
+}
+
+// ---------------------- Diffusion Profile Cache ------------------------------------------------------
+namespace {
+
+// Profiles are keyed on every parameter that affects them: the options and
+// the optical properties of each layer, in order.
+std::vector<Float> MultipoleProfileKey(const std::vector<MultipoleLayer> &layers, 
+  const MultipoleOptions &options)
+{
+  std::vector<Float> key;
+  key.reserve(2 + 5 * layers.size());
+  key.push_back(options.desiredStepSize);
+  key.push_back((Float)options.desiredLength);
+  for (const MultipoleLayer &layer : layers) {
+    key.push_back(layer.eta0);
+    key.push_back(layer.eta1);
+    key.push_back(layer.thickness);
+    key.push_back(layer.sigma_a);
+    key.push_back(layer.sigma_s_prime);
+  }
+  return key;
+}
+
+// Entries are inserted before their profile is computed, so that the lock is
+// only held for the lookup; other threads that want the same profile wait
+// for _ready_ to be set.
+struct ProfileCacheEntry
+{
+  std::shared_ptr<const MultipoleTable> table;
+  std::atomic<bool> ready{false};
+};
+
+std::mutex profileCacheMutex;
+std::map<std::vector<Float>, std::shared_ptr<ProfileCacheEntry>> profileCache;
+
+} // anonymous namespace
+
+std::shared_ptr<const MultipoleTable> GetMultipoleDiffusionProfile(
+  const std::vector<MultipoleLayer> &layers, const MultipoleOptions &options)
+{
+  std::vector<Float> key = MultipoleProfileKey(layers, options);
+  std::shared_ptr<ProfileCacheEntry> entry;
+  bool compute = false;
+  {
+    std::lock_guard<std::mutex> lock(profileCacheMutex);
+    std::shared_ptr<ProfileCacheEntry> &e = profileCache[key];
+    if (!e) {
+      e = std::make_shared<ProfileCacheEntry>();
+      compute = true;
+    }
+    entry = e;
+  }
+
+  // The computation uses ParallelFor(), so it mustn't run under the lock.
+  // Threads waiting for the profile sleep until they're woken up.
+  if (compute) {
+    entry->table = 
+      std::make_shared<MultipoleTable>(ComputeMultipoleDiffusionProfile(layers, options));
+    {
+      std::lock_guard<std::mutex> lock(profileCacheMutex);
+      entry->ready = true;
+    }
+    pbrt::WakeWorkers();
+  }
+  else {
+    pbrt::RunQueuedWorkUntil(nullptr, [&]() { return entry->ready.load(); });
+  }
+  return entry->table;
+}
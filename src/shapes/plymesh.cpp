@@ -35,20 +35,38 @@
 #include "shapes/triangle.h"
 #include "textures/constant.h"
 #include "paramset.h"
+#include "fileutil.h"
+#include "parallel.h"
 #include "ext/rply.h"
 
+#include <atomic>
+#include <cstring>
 #include <iostream>
+#include <limits>
+#include <sstream>
 
 namespace pbrt {
 using namespace std;
 
+STAT_COUNTER("Scene/PLY meshes read from memory-mapped files", nMappedPLYMeshes);
+
+// Vertex and index data of a PLY file, in the layout _TriangleMesh_ keeps
+// it in so that it can take ownership without copying.
+struct PLYMeshData {
+    int nVertices = 0;
+    std::unique_ptr<Point3f[]> p;
+    std::unique_ptr<Normal3f[]> n;
+    std::unique_ptr<Point2f[]> uv;
+    std::vector<int> indices, faceIndices;
+};
+
 struct CallbackContext {
     Point3f *p;
     Normal3f *n;
     Point2f *uv;
-    int *indices;
-    int *faceIndices;
-    int indexCtr, faceIndexCtr;
+    std::vector<int> indices;
+    std::vector<int> faceIndices;
+    bool readFaceIndices;
     int face[4];
     bool error;
     int vertexCount;
@@ -57,10 +75,7 @@ struct CallbackContext {
         : p(nullptr),
           n(nullptr),
           uv(nullptr),
-          indices(nullptr),
-          faceIndices(nullptr),
-          indexCtr(0),
-          faceIndexCtr(0),
+          readFaceIndices(false),
           error(false),
           vertexCount(0) {}
 
@@ -68,8 +83,6 @@ struct CallbackContext {
         delete[] p;
         delete[] n;
         delete[] uv;
-        delete[] indices;
-        delete[] faceIndices;
     }
 };
 
@@ -118,7 +131,7 @@ int rply_face_callback(p_ply_argument argument) {
             return 1;
         }
         if (length == 4)
-            CHECK(context->faceIndices == nullptr) <<
+            CHECK(!context->readFaceIndices) <<
                 "face_indices not yet supported for quads";
 
         if (value_index >= 0) {
@@ -135,39 +148,35 @@ int rply_face_callback(p_ply_argument argument) {
 
         if (value_index == length - 1) {
             for (int i = 0; i < 3; ++i)
-                context->indices[context->indexCtr++] = context->face[i];
+                context->indices.push_back(context->face[i]);
 
             if (length == 4) {
                 /* This was a quad */
-                context->indices[context->indexCtr++] = context->face[3];
-                context->indices[context->indexCtr++] = context->face[0];
-                context->indices[context->indexCtr++] = context->face[2];
+                context->indices.push_back(context->face[3]);
+                context->indices.push_back(context->face[0]);
+                context->indices.push_back(context->face[2]);
             }
         }
     } else {
         CHECK_EQ(1, flags);
         // Face indices
-        context->faceIndices[context->faceIndexCtr++] =
-            (int)ply_get_argument_value(argument);
+        context->faceIndices.push_back((int)ply_get_argument_value(argument));
     }
 
     return 1;
 }
 
-std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
-    const Transform *o2w, const Transform *w2o, bool reverseOrientation,
-    const ParamSet &params,
-    std::map<std::string, std::shared_ptr<Texture<Float>>> *floatTextures) {
-    const std::string filename = params.FindOneFilename("filename", "");
+static bool ReadPLYWithRply(const std::string &filename, PLYMeshData *data) {
     p_ply ply = ply_open(filename.c_str(), rply_message_callback, 0, nullptr);
     if (!ply) {
         Error("Couldn't open PLY file \"%s\"", filename.c_str());
-        return std::vector<std::shared_ptr<Shape>>();
+        return false;
     }
 
     if (!ply_read_header(ply)) {
         Error("Unable to read the header of PLY file \"%s\"", filename.c_str());
-        return std::vector<std::shared_ptr<Shape>>();
+        ply_close(ply);
+        return false;
     }
 
     p_ply_element element = nullptr;
@@ -188,7 +197,8 @@ std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
     if (vertexCount == 0 || faceCount == 0) {
         Error("%s: PLY file is invalid! No face/vertex elements found!",
               filename.c_str());
-        return std::vector<std::shared_ptr<Shape>>();
+        ply_close(ply);
+        return false;
     }
 
     CallbackContext context;
@@ -203,7 +213,8 @@ std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
     } else {
         Error("%s: Vertex coordinate property not found!",
               filename.c_str());
-        return std::vector<std::shared_ptr<Shape>>();
+        ply_close(ply);
+        return false;
     }
 
     if (ply_set_read_cb(ply, "vertex", "nx", rply_vertex_callback, &context,
@@ -234,27 +245,468 @@ std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
                          &context, 0x221)))
         context.uv = new Point2f[vertexCount];
 
-    /* Allocate enough space in case all faces are quads */
-    context.indices = new int[faceCount * 6];
+    /* Most meshes are all triangles; quads grow the index buffer */
+    context.indices.reserve(faceCount * 3);
     context.vertexCount = vertexCount;
 
     ply_set_read_cb(ply, "face", "vertex_indices", rply_face_callback, &context,
                     0);
     if (ply_set_read_cb(ply, "face", "face_indices", rply_face_callback, &context,
-                        1))
-        // Extra space in case they're quads
-        context.faceIndices = new int[faceCount];
+                        1)) {
+        context.readFaceIndices = true;
+        context.faceIndices.reserve(faceCount);
+    }
 
     if (!ply_read(ply)) {
         Error("%s: unable to read the contents of PLY file",
               filename.c_str());
         ply_close(ply);
-        return std::vector<std::shared_ptr<Shape>>();
+        return false;
     }
 
     ply_close(ply);
 
-    if (context.error) return std::vector<std::shared_ptr<Shape>>();
+    if (context.error) return false;
+
+    // Hand the buffers over to _data_
+    data->nVertices = vertexCount;
+    data->p.reset(context.p);
+    data->n.reset(context.n);
+    data->uv.reset(context.uv);
+    context.p = nullptr;
+    context.n = nullptr;
+    context.uv = nullptr;
+    data->indices = std::move(context.indices);
+    data->faceIndices = std::move(context.faceIndices);
+    return true;
+}
+
+// Binary PLY Reading Declarations
+enum class PLYType { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64 };
+
+struct PLYProperty {
+    std::string name;
+    PLYType type;
+    bool isList = false;
+    PLYType countType;
+};
+
+struct PLYElement {
+    std::string name;
+    int64_t count;
+    std::vector<PLYProperty> properties;
+};
+
+enum class PLYReadResult { Success, Failure, Unsupported };
+
+static bool ParsePLYType(const std::string &name, PLYType *type) {
+    if (name == "char" || name == "int8")
+        *type = PLYType::Int8;
+    else if (name == "uchar" || name == "uint8")
+        *type = PLYType::UInt8;
+    else if (name == "short" || name == "int16")
+        *type = PLYType::Int16;
+    else if (name == "ushort" || name == "uint16")
+        *type = PLYType::UInt16;
+    else if (name == "int" || name == "int32")
+        *type = PLYType::Int32;
+    else if (name == "uint" || name == "uint32")
+        *type = PLYType::UInt32;
+    else if (name == "float" || name == "float32")
+        *type = PLYType::Float32;
+    else if (name == "double" || name == "float64")
+        *type = PLYType::Float64;
+    else
+        return false;
+    return true;
+}
+
+static int PLYTypeSize(PLYType type) {
+    switch (type) {
+    case PLYType::Int8:
+    case PLYType::UInt8:
+        return 1;
+    case PLYType::Int16:
+    case PLYType::UInt16:
+        return 2;
+    case PLYType::Int32:
+    case PLYType::UInt32:
+    case PLYType::Float32:
+        return 4;
+    case PLYType::Float64:
+        return 8;
+    }
+    return 0;
+}
+
+template <typename T>
+static inline T LoadUnaligned(const char *ptr) {
+    T value;
+    memcpy(&value, ptr, sizeof(T));
+    return value;
+}
+
+static inline double ReadPLYValue(const char *ptr, PLYType type) {
+    switch (type) {
+    case PLYType::Int8:
+        return LoadUnaligned<int8_t>(ptr);
+    case PLYType::UInt8:
+        return LoadUnaligned<uint8_t>(ptr);
+    case PLYType::Int16:
+        return LoadUnaligned<int16_t>(ptr);
+    case PLYType::UInt16:
+        return LoadUnaligned<uint16_t>(ptr);
+    case PLYType::Int32:
+        return LoadUnaligned<int32_t>(ptr);
+    case PLYType::UInt32:
+        return LoadUnaligned<uint32_t>(ptr);
+    case PLYType::Float32:
+        return LoadUnaligned<float>(ptr);
+    case PLYType::Float64:
+        return LoadUnaligned<double>(ptr);
+    }
+    return 0;
+}
+
+static inline int64_t ReadPLYIndex(const char *ptr, PLYType type) {
+    switch (type) {
+    case PLYType::Int32:
+        return LoadUnaligned<int32_t>(ptr);
+    case PLYType::UInt32:
+        return LoadUnaligned<uint32_t>(ptr);
+    default:
+        return (int64_t)ReadPLYValue(ptr, type);
+    }
+}
+
+static bool IsLittleEndianHost() {
+    uint16_t value = 1;
+    uint8_t firstByte;
+    memcpy(&firstByte, &value, 1);
+    return firstByte == 1;
+}
+
+// Parses the header of a PLY file held in memory; returns false if it isn't
+// a binary little-endian file this reader understands, in which case rply
+// takes over (and reports any errors).
+static bool ParsePLYHeader(const char *data, size_t size,
+                           std::vector<PLYElement> *elements,
+                           size_t *headerBytes) {
+    size_t pos = 0;
+    bool sawFormat = false;
+    while (pos < size) {
+        const char *lineEnd = (const char *)memchr(data + pos, '\n', size - pos);
+        if (!lineEnd) return false;
+        std::string line(data + pos, lineEnd - (data + pos));
+        pos = lineEnd - data + 1;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+
+        std::istringstream in(line);
+        std::string keyword;
+        in >> keyword;
+        if (elements->empty() && !sawFormat && keyword == "ply")
+            continue;
+        else if (keyword == "format") {
+            std::string format, version;
+            in >> format >> version;
+            if (format != "binary_little_endian") return false;
+            sawFormat = true;
+        } else if (keyword == "comment" || keyword == "obj_info" ||
+                   keyword.empty())
+            continue;
+        else if (keyword == "element") {
+            PLYElement element;
+            if (!(in >> element.name >> element.count) || element.count < 0)
+                return false;
+            elements->push_back(element);
+        } else if (keyword == "property") {
+            if (elements->empty()) return false;
+            PLYProperty prop;
+            std::string type;
+            in >> type;
+            if (type == "list") {
+                std::string countType;
+                in >> countType >> type;
+                if (!ParsePLYType(countType, &prop.countType)) return false;
+                prop.isList = true;
+            }
+            if (!ParsePLYType(type, &prop.type) || !(in >> prop.name))
+                return false;
+            elements->back().properties.push_back(prop);
+        } else if (keyword == "end_header") {
+            *headerBytes = pos;
+            return sawFormat;
+        } else
+            return false;
+    }
+    return false;
+}
+
+// Reads a binary little-endian PLY file through a memory mapping, decoding
+// the vertex and face elements in parallel directly into _data_'s arrays.
+static PLYReadResult ReadMappedPLY(const std::string &filename,
+                                   PLYMeshData *data) {
+    if (!IsLittleEndianHost()) return PLYReadResult::Unsupported;
+    std::unique_ptr<MappedFile> file = MappedFile::Open(filename);
+    if (!file) return PLYReadResult::Unsupported;
+    const char *base = file->Data();
+    size_t size = file->Size();
+
+    std::vector<PLYElement> elements;
+    size_t offset;
+    if (!ParsePLYHeader(base, size, &elements, &offset))
+        return PLYReadResult::Unsupported;
+
+    // Find the vertex and face elements and where their data starts; only
+    // elements without lists can be skipped over to get there.
+    const PLYElement *vertexElement = nullptr, *faceElement = nullptr;
+    size_t vertexStart = 0, faceStart = 0;
+    for (const PLYElement &element : elements) {
+        if (element.name == "vertex") {
+            vertexElement = &element;
+            vertexStart = offset;
+        } else if (element.name == "face") {
+            faceElement = &element;
+            faceStart = offset;
+        }
+        if (vertexElement && faceElement) break;
+        size_t elementSize = 0;
+        for (const PLYProperty &prop : element.properties) {
+            if (prop.isList) return PLYReadResult::Unsupported;
+            elementSize += PLYTypeSize(prop.type);
+        }
+        offset += element.count * elementSize;
+    }
+    if (!vertexElement || !faceElement || vertexElement->count == 0 ||
+        faceElement->count == 0 ||
+        vertexElement->count > std::numeric_limits<int>::max() ||
+        faceElement->count > std::numeric_limits<int>::max() / 6)
+        return PLYReadResult::Unsupported;
+
+    // Lay out the vertex record
+    struct Field {
+        int offset = -1;
+        PLYType type;
+    };
+    auto findFields = [](const PLYElement &element,
+                         std::initializer_list<const char *> names,
+                         Field *fields, int *stride) {
+        *stride = 0;
+        int nFound = 0;
+        for (const PLYProperty &prop : element.properties) {
+            int i = 0;
+            for (const char *name : names) {
+                if (prop.name == name && fields[i].offset == -1) {
+                    fields[i].offset = *stride;
+                    fields[i].type = prop.type;
+                    ++nFound;
+                }
+                ++i;
+            }
+            *stride += PLYTypeSize(prop.type);
+        }
+        return nFound == (int)names.size();
+    };
+    for (const PLYProperty &prop : vertexElement->properties)
+        if (prop.isList) return PLYReadResult::Unsupported;
+    int vertexStride;
+    Field pFields[3], nFields[3], uvFields[2];
+    if (!findFields(*vertexElement, {"x", "y", "z"}, pFields, &vertexStride))
+        return PLYReadResult::Unsupported;
+    bool hasNormals =
+        findFields(*vertexElement, {"nx", "ny", "nz"}, nFields, &vertexStride);
+    /* There seem to be lots of different conventions regarding UV coordinate
+     * names */
+    bool hasUV = false;
+    for (auto uvNames : {std::make_pair("u", "v"), std::make_pair("s", "t"),
+                         std::make_pair("texture_u", "texture_v"),
+                         std::make_pair("texture_s", "texture_t")}) {
+        uvFields[0] = uvFields[1] = Field();
+        if (findFields(*vertexElement, {uvNames.first, uvNames.second},
+                       uvFields, &vertexStride)) {
+            hasUV = true;
+            break;
+        }
+    }
+    int nVertices = vertexElement->count;
+    if (vertexStart + size_t(nVertices) * vertexStride > size)
+        return PLYReadResult::Unsupported;
+
+    // Lay out the face record: a list of vertex indices and scalars,
+    // possibly including per-face indices, before and after it
+    const PLYProperty *indexList = nullptr;
+    int listOffset = 0, scalarBytes = 0;
+    Field faceIndexField;
+    bool faceIndexAfterList = false;
+    for (const PLYProperty &prop : faceElement->properties) {
+        if (prop.isList) {
+            if (prop.name != "vertex_indices" || indexList)
+                return PLYReadResult::Unsupported;
+            indexList = &prop;
+            continue;
+        }
+        if (prop.name == "face_indices") {
+            faceIndexField.offset = indexList ? scalarBytes - listOffset
+                                              : scalarBytes;
+            faceIndexField.type = prop.type;
+            faceIndexAfterList = indexList != nullptr;
+        }
+        if (!indexList) listOffset += PLYTypeSize(prop.type);
+        scalarBytes += PLYTypeSize(prop.type);
+    }
+    if (!indexList) return PLYReadResult::Unsupported;
+    const int countBytes = PLYTypeSize(indexList->countType);
+    const int indexBytes = PLYTypeSize(indexList->type);
+    const PLYType countType = indexList->countType, indexType = indexList->type;
+    const bool hasFaceIndices = faceIndexField.offset != -1;
+    ++nMappedPLYMeshes;
+
+    // Decode the vertices in parallel
+    data->nVertices = nVertices;
+    data->p.reset(new Point3f[nVertices]);
+    if (hasNormals) data->n.reset(new Normal3f[nVertices]);
+    if (hasUV) data->uv.reset(new Point2f[nVertices]);
+    const int64_t chunkSize = 65536;
+    ParallelFor([&](int64_t chunk) {
+        int start = chunk * chunkSize;
+        int end = std::min<int64_t>(nVertices, start + chunkSize);
+        for (int i = start; i < end; ++i) {
+            const char *v = base + vertexStart + size_t(i) * vertexStride;
+            for (int c = 0; c < 3; ++c)
+                data->p[i][c] = ReadPLYValue(v + pFields[c].offset,
+                                             pFields[c].type);
+            if (hasNormals)
+                for (int c = 0; c < 3; ++c)
+                    data->n[i][c] = ReadPLYValue(v + nFields[c].offset,
+                                                 nFields[c].type);
+            if (hasUV)
+                for (int c = 0; c < 2; ++c)
+                    data->uv[i][c] = ReadPLYValue(v + uvFields[c].offset,
+                                                  uvFields[c].type);
+        }
+    }, (nVertices + chunkSize - 1) / chunkSize, 1);
+
+    // Faces are decoded in parallel under the assumption that they all have
+    // the vertex count of the first one, which gives them a fixed stride;
+    // files with mixed triangles and quads fall back to a serial pass.
+    int nFaces = faceElement->count;
+    std::atomic<bool> outOfBounds{false}, mixedFaces{false};
+    std::atomic<int64_t> badIndex{0};
+    auto decodeFace = [&](const char *face, int length, int *indices,
+                          int *faceIndices) {
+        int64_t v[4];
+        const char *ptr = face + listOffset + countBytes;
+        for (int i = 0; i < length; ++i, ptr += indexBytes) {
+            v[i] = ReadPLYIndex(ptr, indexType);
+            if (v[i] < 0 || v[i] >= nVertices) {
+                badIndex = v[i];
+                outOfBounds = true;
+            }
+        }
+        for (int i = 0; i < 3; ++i) indices[i] = v[i];
+        if (length == 4) {
+            /* This was a quad */
+            indices[3] = v[3];
+            indices[4] = v[0];
+            indices[5] = v[2];
+        }
+        if (hasFaceIndices) {
+            const char *f = faceIndexAfterList ? ptr : face;
+            faceIndices[0] = ReadPLYValue(f + faceIndexField.offset,
+                                          faceIndexField.type);
+            if (length == 4) faceIndices[1] = faceIndices[0];
+        }
+    };
+    if (faceStart + listOffset + countBytes > size) {
+        Error("%s: unable to read the contents of PLY file", filename.c_str());
+        return PLYReadResult::Failure;
+    }
+    int length = ReadPLYValue(base + faceStart + listOffset, countType);
+    size_t faceStride = scalarBytes + countBytes + size_t(length) * indexBytes;
+    if ((length == 3 || length == 4) &&
+        faceStart + size_t(nFaces) * faceStride <= size) {
+        int nTris = length - 2;
+        data->indices.resize(size_t(nFaces) * 3 * nTris);
+        if (hasFaceIndices) data->faceIndices.resize(size_t(nFaces) * nTris);
+        ParallelFor([&](int64_t chunk) {
+            int start = chunk * chunkSize;
+            int end = std::min<int64_t>(nFaces, start + chunkSize);
+            for (int i = start; i < end; ++i) {
+                const char *face = base + faceStart + size_t(i) * faceStride;
+                if (ReadPLYValue(face + listOffset, countType) != length) {
+                    mixedFaces = true;
+                    return;
+                }
+                decodeFace(face, length, &data->indices[size_t(i) * 3 * nTris],
+                           hasFaceIndices ? &data->faceIndices[size_t(i) * nTris]
+                                          : nullptr);
+            }
+        }, (nFaces + chunkSize - 1) / chunkSize, 1);
+    } else
+        mixedFaces = true;
+
+    if (mixedFaces) {
+        data->indices.clear();
+        data->faceIndices.clear();
+        data->indices.reserve(size_t(nFaces) * 3);
+        outOfBounds = false;
+        const char *face = base + faceStart, *end = base + size;
+        for (int i = 0; i < nFaces; ++i) {
+            if (face + listOffset + countBytes > end) {
+                face = nullptr;
+                break;
+            }
+            int length = ReadPLYValue(face + listOffset, countType);
+            const char *next = face + scalarBytes + countBytes +
+                               size_t(std::max(length, 0)) * indexBytes;
+            if (length < 0 || next > end) {
+                face = nullptr;
+                break;
+            }
+            if (length != 3 && length != 4)
+                Warning("plymesh: Ignoring face with %i vertices (only "
+                        "triangles and quads are supported!)",
+                        length);
+            else {
+                int indices[6], faceIndices[2];
+                decodeFace(face, length, indices, faceIndices);
+                data->indices.insert(data->indices.end(), indices,
+                                     indices + 3 * (length - 2));
+                if (hasFaceIndices)
+                    data->faceIndices.insert(data->faceIndices.end(),
+                                             faceIndices,
+                                             faceIndices + length - 2);
+            }
+            face = next;
+        }
+        if (!face) {
+            Error("%s: unable to read the contents of PLY file",
+                  filename.c_str());
+            return PLYReadResult::Failure;
+        }
+    }
+
+    if (outOfBounds) {
+        Error("plymesh: Vertex reference %i is out of bounds! "
+              "Valid range is [0..%i)",
+              (int)badIndex, nVertices);
+        return PLYReadResult::Failure;
+    }
+    return PLYReadResult::Success;
+}
+
+std::shared_ptr<TriangleMesh> CreatePLYMeshData(
+    const Transform *o2w, const ParamSet &params,
+    std::map<std::string, std::shared_ptr<Texture<Float>>> *floatTextures) {
+    const std::string filename = params.FindOneFilename("filename", "");
+    PLYMeshData data;
+    PLYReadResult result = ReadMappedPLY(filename, &data);
+    if (result == PLYReadResult::Unsupported) {
+        data = PLYMeshData();
+        if (!ReadPLYWithRply(filename, &data))
+            return nullptr;
+    } else if (result == PLYReadResult::Failure)
+        return nullptr;
 
     // Look up an alpha texture, if applicable
     std::shared_ptr<Texture<Float>> alphaTex;
@@ -282,11 +734,20 @@ std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
     } else if (params.FindOneFloat("shadowalpha", 1.f) == 0.f)
         shadowAlphaTex.reset(new ConstantTexture<Float>(0.f));
 
-    return CreateTriangleMesh(o2w, w2o, reverseOrientation,
-                              context.indexCtr / 3, context.indices,
-                              vertexCount, context.p, nullptr, context.n,
-                              context.uv, alphaTex, shadowAlphaTex,
-                              context.faceIndices);
+    return std::make_shared<TriangleMesh>(
+        *o2w, std::move(data.indices), data.nVertices, std::move(data.p),
+        std::move(data.n), std::move(data.uv), alphaTex, shadowAlphaTex,
+        std::move(data.faceIndices));
+}
+
+std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
+    const Transform *o2w, const Transform *w2o, bool reverseOrientation,
+    const ParamSet &params,
+    std::map<std::string, std::shared_ptr<Texture<Float>>> *floatTextures) {
+    std::shared_ptr<TriangleMesh> mesh =
+        CreatePLYMeshData(o2w, params, floatTextures);
+    if (!mesh) return std::vector<std::shared_ptr<Shape>>();
+    return CreateTriangleMesh(o2w, w2o, reverseOrientation, mesh);
 }
 
 }  // namespace pbrt
@@ -43,6 +43,10 @@
 
 namespace pbrt {
 
+std::shared_ptr<TriangleMesh> CreatePLYMeshData(
+    const Transform *o2w, const ParamSet &params,
+    std::map<std::string, std::shared_ptr<Texture<Float>>> *floatTextures =
+        nullptr);
 std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
     const Transform *o2w, const Transform *w2o, bool reverseOrientation,
     const ParamSet &params,
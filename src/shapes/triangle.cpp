@@ -37,6 +37,7 @@
 #include "paramset.h"
 #include "sampling.h"
 #include "efloat.h"
+#include "parallel.h"
 #include "ext/rply.h"
 #include <array>
 
@@ -91,6 +92,41 @@ TriangleMesh::TriangleMesh(
         faceIndices = std::vector<int>(fIndices, fIndices + nTriangles);
 }
 
+TriangleMesh::TriangleMesh(
+    const Transform &ObjectToWorld, std::vector<int> vIndices, int nVertices,
+    std::unique_ptr<Point3f[]> P, std::unique_ptr<Normal3f[]> N,
+    std::unique_ptr<Point2f[]> UV,
+    const std::shared_ptr<Texture<Float>> &alphaMask,
+    const std::shared_ptr<Texture<Float>> &shadowAlphaMask,
+    std::vector<int> fIndices)
+    : nTriangles(vIndices.size() / 3),
+      nVertices(nVertices),
+      vertexIndices(std::move(vIndices)),
+      p(std::move(P)),
+      n(std::move(N)),
+      uv(std::move(UV)),
+      alphaMask(alphaMask),
+      shadowAlphaMask(shadowAlphaMask),
+      faceIndices(std::move(fIndices)) {
+    ++nMeshes;
+    nTris += nTriangles;
+    triMeshBytes += sizeof(*this) + vertexIndices.size() * sizeof(int) +
+                    faceIndices.size() * sizeof(int) +
+                    nVertices * (sizeof(Point3f) + (n ? sizeof(Normal3f) : 0) +
+                                 (uv ? sizeof(Point2f) : 0));
+
+    // Transform mesh vertices to world space in place
+    const int64_t chunkSize = 65536;
+    ParallelFor([&](int64_t chunk) {
+        int start = chunk * chunkSize;
+        int end = std::min<int64_t>(nVertices, start + chunkSize);
+        for (int i = start; i < end; ++i) {
+            p[i] = ObjectToWorld(p[i]);
+            if (n) n[i] = ObjectToWorld(n[i]);
+        }
+    }, (nVertices + chunkSize - 1) / chunkSize, 1);
+}
+
 std::vector<std::shared_ptr<Shape>> CreateTriangleMesh(
     const Transform *ObjectToWorld, const Transform *WorldToObject,
     bool reverseOrientation, int nTriangles, const int *vertexIndices,
@@ -101,6 +137,14 @@ std::vector<std::shared_ptr<Shape>> CreateTriangleMesh(
     std::shared_ptr<TriangleMesh> mesh = std::make_shared<TriangleMesh>(
         *ObjectToWorld, nTriangles, vertexIndices, nVertices, p, s, n, uv,
         alphaMask, shadowAlphaMask, faceIndices);
+    return CreateTriangleMesh(ObjectToWorld, WorldToObject,
+                              reverseOrientation, mesh);
+}
+
+std::vector<std::shared_ptr<Shape>> CreateTriangleMesh(
+    const Transform *ObjectToWorld, const Transform *WorldToObject,
+    bool reverseOrientation, const std::shared_ptr<TriangleMesh> &mesh) {
+    int nTriangles = mesh->nTriangles;
     std::vector<std::shared_ptr<Shape>> tris;
     tris.reserve(nTriangles);
     for (int i = 0; i < nTriangles; ++i)
@@ -168,31 +212,46 @@ bool WritePlyFile(const std::string &filename, int nTriangles,
     return true;
 }
 
-Bounds3f Triangle::ObjectBound() const {
-    // Get triangle vertices in _p0_, _p1_, and _p2_
-    const Point3f &p0 = mesh->p[v[0]];
-    const Point3f &p1 = mesh->p[v[1]];
-    const Point3f &p2 = mesh->p[v[2]];
-    return Union(Bounds3f((*WorldToObject)(p0), (*WorldToObject)(p1)),
-                 (*WorldToObject)(p2));
-}
-
-Bounds3f Triangle::WorldBound() const {
-    // Get triangle vertices in _p0_, _p1_, and _p2_
-    const Point3f &p0 = mesh->p[v[0]];
-    const Point3f &p1 = mesh->p[v[1]];
-    const Point3f &p2 = mesh->p[v[2]];
-    return Union(Bounds3f(p0, p1), p2);
-}
+// Triangle Intersection Helpers
+
+// _Triangle_ and _CompactTriangleMesh_ share the intersection routines
+// below; their _TriangleVertices_ argument gives access to the positions,
+// shading normals, tangents and $(u,v)$s at the triangle's three vertices.
+struct MeshTriangleVertices {
+    const Point3f &P(int i) const { return mesh.p[v[i]]; }
+    bool HasN() const { return mesh.n != nullptr; }
+    const Normal3f &N(int i) const { return mesh.n[v[i]]; }
+    bool HasS() const { return mesh.s != nullptr; }
+    const Vector3f &S(int i) const { return mesh.s[v[i]]; }
+    void GetUVs(Point2f uv[3]) const {
+        if (mesh.uv) {
+            uv[0] = mesh.uv[v[0]];
+            uv[1] = mesh.uv[v[1]];
+            uv[2] = mesh.uv[v[2]];
+        } else {
+            uv[0] = Point2f(0, 0);
+            uv[1] = Point2f(1, 0);
+            uv[2] = Point2f(1, 1);
+        }
+    }
 
-bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
-                         bool testAlphaTexture) const {
+    const TriangleMesh &mesh;
+    const int *v;
+};
+
+template <typename TriangleVertices>
+static bool IntersectTriangle(const TriangleVertices &vertices, const Ray &ray,
+                              Float *tHit, SurfaceInteraction *isect,
+                              bool testAlphaTexture,
+                              const Texture<Float> *alphaMask,
+                              const Shape *shape, int faceIndex,
+                              bool flipNormal) {
     ProfilePhase p(Prof::TriIntersect);
     ++nTests;
     // Get triangle vertices in _p0_, _p1_, and _p2_
-    const Point3f &p0 = mesh->p[v[0]];
-    const Point3f &p1 = mesh->p[v[1]];
-    const Point3f &p2 = mesh->p[v[2]];
+    const Point3f &p0 = vertices.P(0);
+    const Point3f &p1 = vertices.P(1);
+    const Point3f &p2 = vertices.P(2);
 
     // Perform ray--triangle intersection test
 
@@ -293,7 +352,7 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
     // Compute triangle partial derivatives
     Vector3f dpdu, dpdv;
     Point2f uv[3];
-    GetUVs(uv);
+    vertices.GetUVs(uv);
 
     // Compute deltas for triangle partial derivatives
     Vector2f duv02 = uv[0] - uv[2], duv12 = uv[1] - uv[2];
@@ -330,27 +389,27 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
     Point2f uvHit = b0 * uv[0] + b1 * uv[1] + b2 * uv[2];
 
     // Test intersection against alpha texture, if present
-    if (testAlphaTexture && mesh->alphaMask) {
+    if (testAlphaTexture && alphaMask) {
         SurfaceInteraction isectLocal(pHit, Vector3f(0, 0, 0), uvHit, -ray.d,
                                       dpdu, dpdv, Normal3f(0, 0, 0),
-                                      Normal3f(0, 0, 0), ray.time, this);
-        if (mesh->alphaMask->Evaluate(isectLocal) == 0) return false;
+                                      Normal3f(0, 0, 0), ray.time, shape);
+        if (alphaMask->Evaluate(isectLocal) == 0) return false;
     }
 
     // Fill in _SurfaceInteraction_ from triangle hit
     *isect = SurfaceInteraction(pHit, pError, uvHit, -ray.d, dpdu, dpdv,
                                 Normal3f(0, 0, 0), Normal3f(0, 0, 0), ray.time,
-                                this, faceIndex);
+                                shape, faceIndex);
 
     // Override surface normal in _isect_ for triangle
     isect->n = isect->shading.n = Normal3f(Normalize(Cross(dp02, dp12)));
-    if (mesh->n || mesh->s) {
+    if (vertices.HasN() || vertices.HasS()) {
         // Initialize _Triangle_ shading geometry
 
         // Compute shading normal _ns_ for triangle
         Normal3f ns;
-        if (mesh->n) {
-            ns = (b0 * mesh->n[v[0]] + b1 * mesh->n[v[1]] + b2 * mesh->n[v[2]]);
+        if (vertices.HasN()) {
+            ns = (b0 * vertices.N(0) + b1 * vertices.N(1) + b2 * vertices.N(2));
             if (ns.LengthSquared() > 0)
                 ns = Normalize(ns);
             else
@@ -360,8 +419,8 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
 
         // Compute shading tangent _ss_ for triangle
         Vector3f ss;
-        if (mesh->s) {
-            ss = (b0 * mesh->s[v[0]] + b1 * mesh->s[v[1]] + b2 * mesh->s[v[2]]);
+        if (vertices.HasS()) {
+            ss = (b0 * vertices.S(0) + b1 * vertices.S(1) + b2 * vertices.S(2));
             if (ss.LengthSquared() > 0)
                 ss = Normalize(ss);
             else
@@ -379,12 +438,12 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
 
         // Compute $\dndu$ and $\dndv$ for triangle shading geometry
         Normal3f dndu, dndv;
-        if (mesh->n) {
+        if (vertices.HasN()) {
             // Compute deltas for triangle partial derivatives of normal
             Vector2f duv02 = uv[0] - uv[2];
             Vector2f duv12 = uv[1] - uv[2];
-            Normal3f dn1 = mesh->n[v[0]] - mesh->n[v[2]];
-            Normal3f dn2 = mesh->n[v[1]] - mesh->n[v[2]];
+            Normal3f dn1 = vertices.N(0) - vertices.N(2);
+            Normal3f dn2 = vertices.N(1) - vertices.N(2);
             Float determinant = duv02[0] * duv12[1] - duv02[1] * duv12[0];
             bool degenerateUV = std::abs(determinant) < 1e-8;
             if (degenerateUV) {
@@ -394,8 +453,8 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
                 // (rather than giving up) so that ray differentials for
                 // rays reflected from triangles with degenerate
                 // parameterizations are still reasonable.
-                Vector3f dn = Cross(Vector3f(mesh->n[v[2]] - mesh->n[v[0]]),
-                                    Vector3f(mesh->n[v[1]] - mesh->n[v[0]]));
+                Vector3f dn = Cross(Vector3f(vertices.N(2) - vertices.N(0)),
+                                    Vector3f(vertices.N(1) - vertices.N(0)));
                 if (dn.LengthSquared() == 0)
                     dndu = dndv = Normal3f(0, 0, 0);
                 else {
@@ -412,25 +471,36 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
         } else
             dndu = dndv = Normal3f(0, 0, 0);
         isect->SetShadingGeometry(ss, ts, dndu, dndv, true);
+        if (!shape && flipNormal) {
+            // Account for the orientation, as _SetShadingGeometry()_ does
+            // for triangles with a _Shape_
+            isect->shading.n = -isect->shading.n;
+            isect->n = Faceforward(isect->n, isect->shading.n);
+        }
     }
 
     // Ensure correct orientation of the geometric normal
-    if (mesh->n)
+    if (vertices.HasN())
         isect->n = Faceforward(isect->n, isect->shading.n);
-    else if (reverseOrientation ^ transformSwapsHandedness)
+    else if (flipNormal)
         isect->n = isect->shading.n = -isect->n;
     *tHit = t;
     ++nHits;
     return true;
 }
 
-bool Triangle::IntersectP(const Ray &ray, bool testAlphaTexture) const {
+template <typename TriangleVertices>
+static bool IntersectPTriangle(const TriangleVertices &vertices, const Ray &ray,
+                               bool testAlphaTexture,
+                               const Texture<Float> *alphaMask,
+                               const Texture<Float> *shadowAlphaMask,
+                               const Shape *shape) {
     ProfilePhase p(Prof::TriIntersectP);
     ++nTests;
     // Get triangle vertices in _p0_, _p1_, and _p2_
-    const Point3f &p0 = mesh->p[v[0]];
-    const Point3f &p1 = mesh->p[v[1]];
-    const Point3f &p2 = mesh->p[v[2]];
+    const Point3f &p0 = vertices.P(0);
+    const Point3f &p1 = vertices.P(1);
+    const Point3f &p2 = vertices.P(2);
 
     // Perform ray--triangle intersection test
 
@@ -529,11 +599,11 @@ bool Triangle::IntersectP(const Ray &ray, bool testAlphaTexture) const {
     if (t <= deltaT) return false;
 
     // Test shadow ray intersection against alpha texture, if present
-    if (testAlphaTexture && (mesh->alphaMask || mesh->shadowAlphaMask)) {
+    if (testAlphaTexture && (alphaMask || shadowAlphaMask)) {
         // Compute triangle partial derivatives
         Vector3f dpdu, dpdv;
         Point2f uv[3];
-        GetUVs(uv);
+        vertices.GetUVs(uv);
 
         // Compute deltas for triangle partial derivatives
         Vector2f duv02 = uv[0] - uv[2], duv12 = uv[1] - uv[2];
@@ -561,17 +631,48 @@ bool Triangle::IntersectP(const Ray &ray, bool testAlphaTexture) const {
         Point2f uvHit = b0 * uv[0] + b1 * uv[1] + b2 * uv[2];
         SurfaceInteraction isectLocal(pHit, Vector3f(0, 0, 0), uvHit, -ray.d,
                                       dpdu, dpdv, Normal3f(0, 0, 0),
-                                      Normal3f(0, 0, 0), ray.time, this);
-        if (mesh->alphaMask && mesh->alphaMask->Evaluate(isectLocal) == 0)
+                                      Normal3f(0, 0, 0), ray.time, shape);
+        if (alphaMask && alphaMask->Evaluate(isectLocal) == 0)
             return false;
-        if (mesh->shadowAlphaMask &&
-            mesh->shadowAlphaMask->Evaluate(isectLocal) == 0)
+        if (shadowAlphaMask &&
+            shadowAlphaMask->Evaluate(isectLocal) == 0)
             return false;
     }
     ++nHits;
     return true;
 }
 
+Bounds3f Triangle::ObjectBound() const {
+    // Get triangle vertices in _p0_, _p1_, and _p2_
+    const Point3f &p0 = mesh->p[v[0]];
+    const Point3f &p1 = mesh->p[v[1]];
+    const Point3f &p2 = mesh->p[v[2]];
+    return Union(Bounds3f((*WorldToObject)(p0), (*WorldToObject)(p1)),
+                 (*WorldToObject)(p2));
+}
+
+Bounds3f Triangle::WorldBound() const {
+    // Get triangle vertices in _p0_, _p1_, and _p2_
+    const Point3f &p0 = mesh->p[v[0]];
+    const Point3f &p1 = mesh->p[v[1]];
+    const Point3f &p2 = mesh->p[v[2]];
+    return Union(Bounds3f(p0, p1), p2);
+}
+
+bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
+                         bool testAlphaTexture) const {
+    return IntersectTriangle(MeshTriangleVertices{*mesh, v}, ray, tHit, isect,
+                             testAlphaTexture, mesh->alphaMask.get(), this,
+                             faceIndex,
+                             reverseOrientation ^ transformSwapsHandedness);
+}
+
+bool Triangle::IntersectP(const Ray &ray, bool testAlphaTexture) const {
+    return IntersectPTriangle(MeshTriangleVertices{*mesh, v}, ray,
+                              testAlphaTexture, mesh->alphaMask.get(),
+                              mesh->shadowAlphaMask.get(), this);
+}
+
 Float Triangle::Area() const {
     // Get triangle vertices in _p0_, _p1_, and _p2_
     const Point3f &p0 = mesh->p[v[0]];
@@ -645,9 +746,188 @@ Float Triangle::SolidAngle(const Point3f &p, int nSamples) const {
         std::acos(Clamp(Dot(cross20, -cross01), -1, 1)) - Pi);
 }
 
-std::vector<std::shared_ptr<Shape>> CreateTriangleMeshShape(
-    const Transform *o2w, const Transform *w2o, bool reverseOrientation,
-    const ParamSet &params,
+// CompactTriangleMesh Local Definitions
+
+// Octahedral encoding of directions in 32 bits. The code 0 is reserved for
+// the zero vector, so that degenerate normals and tangents fall back to
+// the geometric ones as they do in _TriangleMesh_.
+static uint32_t EncodeOctahedral(Vector3f v) {
+    Float l1 = std::abs(v.x) + std::abs(v.y) + std::abs(v.z);
+    if (l1 == 0) return 0;
+    v /= l1;
+    Float ox = v.x, oy = v.y;
+    if (v.z < 0) {
+        ox = (1 - std::abs(v.y)) * (v.x >= 0 ? 1 : -1);
+        oy = (1 - std::abs(v.x)) * (v.y >= 0 ? 1 : -1);
+    }
+    auto quantize = [](Float f) {
+        return (uint32_t)std::round(Clamp((f + 1) / 2, 0, 1) * 65535.f);
+    };
+    uint32_t code = quantize(ox) | (quantize(oy) << 16);
+    // All four corners of the octahedral square map to -z; use another one
+    // for it than the reserved code
+    return code == 0 ? 0xffffffff : code;
+}
+
+static Vector3f DecodeOctahedral(uint32_t code) {
+    if (code == 0) return Vector3f(0, 0, 0);
+    Vector3f v(-1 + 2 * Float(code & 0xffff) / 65535.f,
+               -1 + 2 * Float(code >> 16) / 65535.f, 0);
+    v.z = 1 - std::abs(v.x) - std::abs(v.y);
+    if (v.z < 0) {
+        Float ox = v.x;
+        v.x = (1 - std::abs(v.y)) * (ox >= 0 ? 1 : -1);
+        v.y = (1 - std::abs(ox)) * (v.y >= 0 ? 1 : -1);
+    }
+    return Normalize(v);
+}
+
+struct CompactTriangleVertices {
+    CompactTriangleVertices(const CompactTriangleMesh &mesh, int tri)
+        : mesh(mesh) {
+        mesh.VertexIndices(tri, v);
+    }
+    const Point3f &P(int i) const { return mesh.p[v[i]]; }
+    bool HasN() const { return mesh.n != nullptr; }
+    Normal3f N(int i) const { return Normal3f(DecodeOctahedral(mesh.n[v[i]])); }
+    bool HasS() const { return mesh.s != nullptr; }
+    Vector3f S(int i) const { return DecodeOctahedral(mesh.s[v[i]]); }
+    void GetUVs(Point2f uv[3]) const {
+        if (mesh.uv) {
+            for (int i = 0; i < 3; ++i) {
+                uint32_t code = mesh.uv[v[i]];
+                uv[i] = mesh.uvBounds.Lerp(Point2f(Float(code & 0xffff) / 65535.f,
+                                                   Float(code >> 16) / 65535.f));
+            }
+        } else {
+            uv[0] = Point2f(0, 0);
+            uv[1] = Point2f(1, 0);
+            uv[2] = Point2f(1, 1);
+        }
+    }
+
+    const CompactTriangleMesh &mesh;
+    int v[3];
+};
+
+// CompactTriangleMesh Method Definitions
+CompactTriangleMesh::CompactTriangleMesh(TriangleMesh &mesh,
+                                         const std::vector<int> &triangleOrder,
+                                         bool reverseOrientation,
+                                         bool transformSwapsHandedness)
+    : nTriangles(mesh.nTriangles),
+      nVertices(mesh.nVertices),
+      p(std::move(mesh.p)),
+      alphaMask(mesh.alphaMask),
+      shadowAlphaMask(mesh.shadowAlphaMask),
+      flipNormal(reverseOrientation ^ transformSwapsHandedness) {
+    CHECK_EQ(nTriangles, (int)triangleOrder.size());
+    // The full-precision arrays of _mesh_ are released below
+    triMeshBytes -= mesh.vertexIndices.size() * sizeof(int) +
+                    mesh.faceIndices.size() * sizeof(int) +
+                    nVertices * (sizeof(Point3f) +
+                                 (mesh.n ? sizeof(Normal3f) : 0) +
+                                 (mesh.s ? sizeof(Vector3f) : 0) +
+                                 (mesh.uv ? sizeof(Point2f) : 0));
+    // Pack vertex indices in blocks of _TrianglesPerBlock_ triangles
+    int nBlocks = (nTriangles + TrianglesPerBlock - 1) / TrianglesPerBlock;
+    indexBlocks.resize(nBlocks);
+    uint32_t nWide = 0;
+    for (int b = 0; b < nBlocks; ++b) {
+        int start = b * TrianglesPerBlock;
+        int end = std::min(nTriangles, start + TrianglesPerBlock);
+        int minIndex = std::numeric_limits<int>::max(), maxIndex = 0;
+        for (int t = start; t < end; ++t)
+            for (int i = 0; i < 3; ++i) {
+                int index = mesh.vertexIndices[3 * triangleOrder[t] + i];
+                minIndex = std::min(minIndex, index);
+                maxIndex = std::max(maxIndex, index);
+            }
+        bool wide = maxIndex - minIndex > 0xffff;
+        indexBlocks[b].base = wide ? -1 : minIndex;
+        indexBlocks[b].nWideBefore = nWide;
+        for (int t = start; t < start + TrianglesPerBlock; ++t)
+            for (int i = 0; i < 3; ++i) {
+                int index = t < end
+                    ? mesh.vertexIndices[3 * triangleOrder[t] + i] : minIndex;
+                if (wide) {
+                    packedIndices.push_back(index & 0xffff);
+                    packedIndices.push_back(index >> 16);
+                } else
+                    packedIndices.push_back(index - minIndex);
+            }
+        if (wide) ++nWide;
+    }
+    packedIndices.shrink_to_fit();
+    std::vector<int>().swap(mesh.vertexIndices);
+
+    // Encode shading normals, tangents and $(u,v)$s
+    if (mesh.n) {
+        n.reset(new uint32_t[nVertices]);
+        for (int i = 0; i < nVertices; ++i)
+            n[i] = EncodeOctahedral(Vector3f(mesh.n[i]));
+        mesh.n.reset();
+    }
+    if (mesh.s) {
+        s.reset(new uint32_t[nVertices]);
+        for (int i = 0; i < nVertices; ++i) s[i] = EncodeOctahedral(mesh.s[i]);
+        mesh.s.reset();
+    }
+    if (mesh.uv) {
+        for (int i = 0; i < nVertices; ++i)
+            uvBounds = Union(uvBounds, mesh.uv[i]);
+        Vector2f extent = uvBounds.Diagonal();
+        uv.reset(new uint32_t[nVertices]);
+        for (int i = 0; i < nVertices; ++i) {
+            Vector2f o = uvBounds.Offset(mesh.uv[i]);
+            uint32_t u = extent.x > 0 ? std::round(o.x * 65535.f) : 0;
+            uint32_t v = extent.y > 0 ? std::round(o.y * 65535.f) : 0;
+            uv[i] = u | (v << 16);
+        }
+        mesh.uv.reset();
+    }
+    if (!mesh.faceIndices.empty()) {
+        faceIndices.resize(nTriangles);
+        for (int t = 0; t < nTriangles; ++t)
+            faceIndices[t] = mesh.faceIndices[triangleOrder[t]];
+        std::vector<int>().swap(mesh.faceIndices);
+    }
+    triMeshBytes += BytesUsed();
+}
+
+size_t CompactTriangleMesh::BytesUsed() const {
+    return sizeof(*this) + indexBlocks.size() * sizeof(IndexBlock) +
+           packedIndices.size() * sizeof(uint16_t) +
+           nVertices * (sizeof(Point3f) + (n ? sizeof(uint32_t) : 0) +
+                        (s ? sizeof(uint32_t) : 0) +
+                        (uv ? sizeof(uint32_t) : 0)) +
+           faceIndices.size() * sizeof(int);
+}
+
+Bounds3f CompactTriangleMesh::TriangleBound(int tri) const {
+    int v[3];
+    VertexIndices(tri, v);
+    return Union(Bounds3f(p[v[0]], p[v[1]]), p[v[2]]);
+}
+
+bool CompactTriangleMesh::Intersect(int tri, const Ray &ray, Float *tHit,
+                                    SurfaceInteraction *isect,
+                                    bool testAlphaTexture) const {
+    return IntersectTriangle(CompactTriangleVertices(*this, tri), ray, tHit,
+                             isect, testAlphaTexture, alphaMask.get(), nullptr,
+                             faceIndices.empty() ? 0 : faceIndices[tri],
+                             flipNormal);
+}
+
+bool CompactTriangleMesh::IntersectP(int tri, const Ray &ray,
+                                     bool testAlphaTexture) const {
+    return IntersectPTriangle(CompactTriangleVertices(*this, tri), ray,
+                              testAlphaTexture, alphaMask.get(),
+                              shadowAlphaMask.get(), nullptr);
+}
+
+std::shared_ptr<TriangleMesh> CreateTriangleMeshData(
+    const Transform *o2w, const ParamSet &params,
     std::map<std::string, std::shared_ptr<Texture<Float>>> *floatTextures) {
     int nvi, npi, nuvi, nsi, nni;
     const int *vi = params.FindInt("indices", &nvi);
@@ -682,11 +962,11 @@ std::vector<std::shared_ptr<Shape>> CreateTriangleMeshShape(
     if (!vi) {
         Error(
             "Vertex indices \"indices\" not provided with triangle mesh shape");
-        return std::vector<std::shared_ptr<Shape>>();
+        return nullptr;
     }
     if (!P) {
         Error("Vertex positions \"P\" not provided with triangle mesh shape");
-        return std::vector<std::shared_ptr<Shape>>();
+        return nullptr;
     }
     const Vector3f *S = params.FindVector3f("S", &nsi);
     if (S && nsi != npi) {
@@ -704,7 +984,7 @@ std::vector<std::shared_ptr<Shape>> CreateTriangleMeshShape(
                 "trianglemesh has out of-bounds vertex index %d (%d \"P\" "
                 "values were given",
                 vi[i], npi);
-            return std::vector<std::shared_ptr<Shape>>();
+            return nullptr;
         }
 
     int nfi;
@@ -739,8 +1019,19 @@ std::vector<std::shared_ptr<Shape>> CreateTriangleMeshShape(
     } else if (params.FindOneFloat("shadowalpha", 1.f) == 0.f)
         shadowAlphaTex.reset(new ConstantTexture<Float>(0.f));
 
-    return CreateTriangleMesh(o2w, w2o, reverseOrientation, nvi / 3, vi, npi, P,
-                              S, N, uvs, alphaTex, shadowAlphaTex, faceIndices);
+    return std::make_shared<TriangleMesh>(*o2w, nvi / 3, vi, npi, P, S, N, uvs,
+                                          alphaTex, shadowAlphaTex,
+                                          faceIndices);
+}
+
+std::vector<std::shared_ptr<Shape>> CreateTriangleMeshShape(
+    const Transform *o2w, const Transform *w2o, bool reverseOrientation,
+    const ParamSet &params,
+    std::map<std::string, std::shared_ptr<Texture<Float>>> *floatTextures) {
+    std::shared_ptr<TriangleMesh> mesh =
+        CreateTriangleMeshData(o2w, params, floatTextures);
+    if (!mesh) return std::vector<std::shared_ptr<Shape>>();
+    return CreateTriangleMesh(o2w, w2o, reverseOrientation, mesh);
 }
 
 }  // namespace pbrt
@@ -56,6 +56,14 @@ struct TriangleMesh {
                  const std::shared_ptr<Texture<Float>> &alphaMask,
                  const std::shared_ptr<Texture<Float>> &shadowAlphaMask,
                  const int *faceIndices);
+    // Takes ownership of vertex data that the caller has already
+    // allocated, transforming it to world space in place.
+    TriangleMesh(const Transform &ObjectToWorld, std::vector<int> vertexIndices,
+                 int nVertices, std::unique_ptr<Point3f[]> P,
+                 std::unique_ptr<Normal3f[]> N, std::unique_ptr<Point2f[]> uv,
+                 const std::shared_ptr<Texture<Float>> &alphaMask,
+                 const std::shared_ptr<Texture<Float>> &shadowAlphaMask,
+                 std::vector<int> faceIndices);
 
     // TriangleMesh Data
     const int nTriangles, nVertices;
@@ -92,6 +100,12 @@ class Triangle : public Shape {
     // Returns the solid angle subtended by the triangle w.r.t. the given
     // reference point p.
     Float SolidAngle(const Point3f &p, int nSamples = 0) const;
+    void GetVertices(Point3f p[3]) const {
+        for (int i = 0; i < 3; ++i) p[i] = mesh->p[v[i]];
+    }
+    bool HasAlphaTexture() const {
+        return mesh->alphaMask || mesh->shadowAlphaMask;
+    }
 
   private:
     // Triangle Private Methods
@@ -113,6 +127,71 @@ class Triangle : public Shape {
     int faceIndex;
 };
 
+// CompactTriangleMesh Declarations
+// A read-only triangle mesh in a fraction of _TriangleMesh_'s memory:
+// vertex indices are stored as 16-bit offsets from a per-block base,
+// shading normals and tangents are octahedral-encoded in 32 bits, and
+// $(u,v)$s are quantized to 16 bits within the mesh's $(u,v)$ bounds.
+// Triangles are addressed by index rather than through a _Triangle_ shape
+// per face; see _CompactMeshPrimitive_.
+class CompactTriangleMesh {
+  public:
+    // CompactTriangleMesh Public Methods
+    // Encodes the triangles of _mesh_ in the order given by
+    // _triangleOrder_, taking over its vertex positions.
+    CompactTriangleMesh(TriangleMesh &mesh,
+                        const std::vector<int> &triangleOrder,
+                        bool reverseOrientation, bool transformSwapsHandedness);
+    int NTriangles() const { return nTriangles; }
+    void VertexIndices(int tri, int v[3]) const {
+        const IndexBlock &block = indexBlocks[tri / TrianglesPerBlock];
+        const uint16_t *packed =
+            &packedIndices[size_t(tri / TrianglesPerBlock + block.nWideBefore) *
+                               3 * TrianglesPerBlock +
+                           3 * (tri % TrianglesPerBlock) *
+                               (block.base < 0 ? 2 : 1)];
+        if (block.base >= 0)
+            for (int i = 0; i < 3; ++i) v[i] = block.base + packed[i];
+        else
+            for (int i = 0; i < 3; ++i)
+                v[i] = int(packed[2 * i]) | (int(packed[2 * i + 1]) << 16);
+    }
+    Bounds3f TriangleBound(int tri) const;
+    bool Intersect(int tri, const Ray &ray, Float *tHit,
+                   SurfaceInteraction *isect,
+                   bool testAlphaTexture = true) const;
+    bool IntersectP(int tri, const Ray &ray,
+                    bool testAlphaTexture = true) const;
+    size_t BytesUsed() const;
+
+  private:
+    // CompactTriangleMesh Private Data
+    friend struct CompactTriangleVertices;
+    static PBRT_CONSTEXPR int TrianglesPerBlock = 16;
+    // Blocks whose indices span more than 16 bits have a _base_ of -1 and
+    // store full 32-bit indices, taking the space of two blocks.
+    struct IndexBlock {
+        int base;
+        uint32_t nWideBefore;
+    };
+    const int nTriangles, nVertices;
+    std::vector<IndexBlock> indexBlocks;
+    std::vector<uint16_t> packedIndices;
+    std::unique_ptr<Point3f[]> p;
+    std::unique_ptr<uint32_t[]> n, s, uv;
+    Bounds2f uvBounds;
+    std::shared_ptr<Texture<Float>> alphaMask, shadowAlphaMask;
+    std::vector<int> faceIndices;
+    const bool flipNormal;
+};
+
+std::shared_ptr<TriangleMesh> CreateTriangleMeshData(
+    const Transform *o2w, const ParamSet &params,
+    std::map<std::string, std::shared_ptr<Texture<Float>>> *floatTextures =
+        nullptr);
+std::vector<std::shared_ptr<Shape>> CreateTriangleMesh(
+    const Transform *o2w, const Transform *w2o, bool reverseOrientation,
+    const std::shared_ptr<TriangleMesh> &mesh);
 std::vector<std::shared_ptr<Shape>> CreateTriangleMesh(
     const Transform *o2w, const Transform *w2o, bool reverseOrientation,
     int nTriangles, const int *vertexIndices, int nVertices, const Point3f *p,
@@ -0,0 +1,177 @@
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "accelerators/bvh.h"
+#include "interaction.h"
+#include "parallel.h"
+#include "primitive.h"
+#include "rng.h"
+#include "sampling.h"
+#include "shapes/triangle.h"
+
+using namespace pbrt;
+
+static std::vector<std::shared_ptr<Primitive>> RandomTriangles(int nTris,
+                                                                RNG &rng) {
+    static Transform identity;
+    std::vector<Point3f> p;
+    std::vector<int> indices;
+    for (int i = 0; i < nTris; ++i) {
+        Point3f center(rng.UniformFloat(), rng.UniformFloat(),
+                       rng.UniformFloat());
+        for (int j = 0; j < 3; ++j) {
+            indices.push_back(p.size());
+            p.push_back(center + .05f * Vector3f(rng.UniformFloat() - .5f,
+                                                 rng.UniformFloat() - .5f,
+                                                 rng.UniformFloat() - .5f));
+        }
+    }
+    std::vector<std::shared_ptr<Shape>> tris = CreateTriangleMesh(
+        &identity, &identity, false, nTris, indices.data(), p.size(), p.data(),
+        nullptr, nullptr, nullptr, nullptr, nullptr);
+    std::vector<std::shared_ptr<Primitive>> prims;
+    for (const auto &tri : tris)
+        prims.push_back(std::make_shared<GeometricPrimitive>(
+            tri, nullptr, nullptr, MediumInterface()));
+    return prims;
+}
+
+TEST(BVH, WideMatchesBinary) {
+    RNG rng;
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(5000, rng);
+    BVHAccel bvh2(prims, 4, BVHAccel::SplitMethod::SAH, 2);
+    BVHAccel bvh4(prims, 4, BVHAccel::SplitMethod::SAH, 4);
+    BVHAccel bvh8(prims, 4, BVHAccel::SplitMethod::SAH, 8);
+    EXPECT_EQ(bvh2.WorldBound(), bvh4.WorldBound());
+    EXPECT_EQ(bvh2.WorldBound(), bvh8.WorldBound());
+
+    for (int i = 0; i < 10000; ++i) {
+        Point3f o(2 * rng.UniformFloat() - .5f, 2 * rng.UniformFloat() - .5f,
+                  2 * rng.UniformFloat() - .5f);
+        Vector3f d = UniformSampleSphere(
+            Point2f(rng.UniformFloat(), rng.UniformFloat()));
+        // Include rays parallel to the coordinate planes
+        if (i % 4 == 0) d[i / 4 % 3] = 0;
+        Float tMax = (i % 2) ? Infinity : rng.UniformFloat();
+        Ray r2(o, d, tMax), r4(o, d, tMax), r8(o, d, tMax);
+
+        SurfaceInteraction isect2, isect4, isect8;
+        bool hit2 = bvh2.Intersect(r2, &isect2);
+        EXPECT_EQ(hit2, bvh4.Intersect(r4, &isect4));
+        EXPECT_EQ(hit2, bvh8.Intersect(r8, &isect8));
+        EXPECT_EQ(r2.tMax, r4.tMax);
+        EXPECT_EQ(r2.tMax, r8.tMax);
+
+        Ray s(o, d, tMax);
+        bool hitP = bvh2.IntersectP(s);
+        EXPECT_EQ(hit2, hitP);
+        EXPECT_EQ(hitP, bvh4.IntersectP(s));
+        EXPECT_EQ(hitP, bvh8.IntersectP(s));
+    }
+}
+
+TEST(BVH, ParallelBuildMatchesSerial) {
+    RNG rng;
+    std::vector<std::shared_ptr<Primitive>> prims =
+        RandomTriangles(200000, rng);
+
+    int nThreads = PbrtOptions.nThreads;
+    PbrtOptions.nThreads = 1;
+    BVHAccel serial(prims);
+    PbrtOptions.nThreads = 4;
+    ParallelInit();
+    BVHAccel parallel(prims);
+    ParallelCleanup();
+    PbrtOptions.nThreads = nThreads;
+
+    EXPECT_EQ(serial.WorldBound(), parallel.WorldBound());
+    for (int i = 0; i < 10000; ++i) {
+        Point3f o(2 * rng.UniformFloat() - .5f, 2 * rng.UniformFloat() - .5f,
+                  2 * rng.UniformFloat() - .5f);
+        Vector3f d = UniformSampleSphere(
+            Point2f(rng.UniformFloat(), rng.UniformFloat()));
+        Ray rs(o, d), rp(o, d);
+        SurfaceInteraction isectSerial, isectParallel;
+        bool hit = serial.Intersect(rs, &isectSerial);
+        EXPECT_EQ(hit, parallel.Intersect(rp, &isectParallel));
+        EXPECT_EQ(rs.tMax, rp.tMax);
+        if (hit) EXPECT_EQ(isectSerial.primitive, isectParallel.primitive);
+    }
+}
+
+TEST(BVH, TriangleClustersMatchTriangles) {
+    RNG rng;
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(5000, rng);
+    for (int maxPrims : {4, 16}) {
+        BVHAccel plain(prims, maxPrims, BVHAccel::SplitMethod::SAH, 2, false);
+        BVHAccel clustered(prims, maxPrims, BVHAccel::SplitMethod::SAH, 2,
+                           true);
+        EXPECT_EQ(plain.WorldBound(), clustered.WorldBound());
+
+        for (int i = 0; i < 10000; ++i) {
+            Point3f o(2 * rng.UniformFloat() - .5f,
+                      2 * rng.UniformFloat() - .5f,
+                      2 * rng.UniformFloat() - .5f);
+            Vector3f d;
+            if (i % 2) {
+                // Aim at a vertex or edge midpoint to exercise the edge cases
+                Point3f v[3];
+                const GeometricPrimitive *gp =
+                    dynamic_cast<const GeometricPrimitive *>(
+                        prims[rng.UniformUInt32(prims.size())].get());
+                ((const Triangle *)gp->GetShape())->GetVertices(v);
+                int j = rng.UniformUInt32(3);
+                Point3f target =
+                    (i % 4 == 1) ? v[j] : (v[j] + v[(j + 1) % 3]) / 2;
+                d = target - o;
+            } else
+                d = UniformSampleSphere(
+                    Point2f(rng.UniformFloat(), rng.UniformFloat()));
+            Float tMax = (i % 3) ? Infinity : 2 * rng.UniformFloat();
+            Ray rp(o, d, tMax), rc(o, d, tMax);
+            SurfaceInteraction isectPlain, isectClustered;
+            bool hit = plain.Intersect(rp, &isectPlain);
+            ASSERT_EQ(hit, clustered.Intersect(rc, &isectClustered));
+            EXPECT_EQ(hit, clustered.IntersectP(Ray(o, d, tMax)));
+            if (!hit) continue;
+            EXPECT_EQ(rp.tMax, rc.tMax);
+            EXPECT_EQ(isectPlain.p, isectClustered.p);
+            EXPECT_EQ(isectPlain.primitive, isectClustered.primitive);
+        }
+    }
+}
+
+TEST(BVH, PacketsMatchSingleRays) {
+    RNG rng;
+    std::vector<std::shared_ptr<Primitive>> prims = RandomTriangles(5000, rng);
+    BVHAccel bvh(prims, 4);
+    const int maxRays = 13;
+    for (int i = 0; i < 2000; ++i) {
+        // Bundles of rays from a common origin, half of them coherent
+        int n = 1 + rng.UniformUInt32(maxRays);
+        Point3f o(2 * rng.UniformFloat() - .5f, 2 * rng.UniformFloat() - .5f,
+                  2 * rng.UniformFloat() - .5f);
+        Vector3f center = Point3f(.5f, .5f, .5f) - o;
+        Ray rays[maxRays], single[maxRays];
+        for (int j = 0; j < n; ++j) {
+            Vector3f d = UniformSampleSphere(
+                Point2f(rng.UniformFloat(), rng.UniformFloat()));
+            if (i % 2) d = center + .1f * d;
+            Float tMax = (j % 3) ? Infinity : 2 * rng.UniformFloat();
+            rays[j] = single[j] = Ray(o, d, tMax);
+        }
+
+        SurfaceInteraction isects[maxRays];
+        bool hits[maxRays], occluded[maxRays];
+        bvh.IntersectN(rays, isects, hits, n);
+        bvh.IntersectPN(single, occluded, n);
+        for (int j = 0; j < n; ++j) {
+            SurfaceInteraction isect;
+            bool hit = bvh.Intersect(single[j], &isect);
+            ASSERT_EQ(hit, hits[j]);
+            EXPECT_EQ(hit, occluded[j]);
+            if (!hit) continue;
+            EXPECT_EQ(single[j].tMax, rays[j].tMax);
+            EXPECT_EQ(isect.primitive, isects[j].primitive);
+        }
+    }
+}
@@ -0,0 +1,83 @@
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "accelerators/bvh.h"
+#include "accelerators/compactmesh.h"
+#include "interaction.h"
+#include "medium.h"
+#include "rng.h"
+#include "shapes/triangle.h"
+
+using namespace pbrt;
+
+// Intersects random rays with a bumpy grid, plus some long triangles that
+// connect far-apart vertices, stored both as individual _Triangle_s and as
+// a _CompactMeshPrimitive_; the hits must agree up to the quantization of
+// shading normals and $(u,v)$s.
+TEST(CompactMesh, MatchesTriangles) {
+    const int res = 300;  // more vertices than 16-bit indices can address
+    RNG rng;
+    std::vector<Point3f> p;
+    std::vector<Normal3f> n;
+    std::vector<Point2f> uv;
+    for (int y = 0; y < res; ++y)
+        for (int x = 0; x < res; ++x) {
+            p.push_back(Point3f(x, y, .3f * rng.UniformFloat()));
+            n.push_back(Normalize(Normal3f(.2f * rng.UniformFloat() - .1f,
+                                           .2f * rng.UniformFloat() - .1f, 1)));
+            uv.push_back(Point2f(2.f * x / res, 3.f * y / res));
+        }
+    std::vector<int> indices, faceIndices;
+    for (int y = 0; y < res - 1; ++y)
+        for (int x = 0; x < res - 1; ++x) {
+            int v = y * res + x;
+            for (int i : {v, v + 1, v + res, v + 1, v + res + 1, v + res})
+                indices.push_back(i);
+        }
+    for (int i = 0; i < 1000; ++i)
+        for (int j = 0; j < 3; ++j)
+            indices.push_back(rng.UniformUInt32(res * res));
+    for (size_t i = 0; i < indices.size() / 3; ++i) faceIndices.push_back(i);
+    int nTriangles = indices.size() / 3;
+
+    Transform identity, mirror = Scale(-1, 1, 1);
+    for (const Transform *o2w : {&identity, &mirror})
+        for (bool normals : {false, true}) {
+            Transform w2o = Inverse(*o2w);
+            const Normal3f *N = normals ? n.data() : nullptr;
+            std::vector<std::shared_ptr<Primitive>> prims;
+            for (const std::shared_ptr<Shape> &tri : CreateTriangleMesh(
+                     o2w, &w2o, false, nTriangles, indices.data(), p.size(),
+                     p.data(), nullptr, N, uv.data(), nullptr, nullptr,
+                     faceIndices.data()))
+                prims.push_back(std::make_shared<GeometricPrimitive>(
+                    tri, nullptr, nullptr, MediumInterface()));
+            BVHAccel bvh(prims);
+            TriangleMesh mesh(*o2w, nTriangles, indices.data(), p.size(),
+                              p.data(), nullptr, N, uv.data(), nullptr,
+                              nullptr, faceIndices.data());
+            CompactMeshPrimitive compact(mesh, o2w, false, nullptr,
+                                         MediumInterface());
+            EXPECT_EQ(bvh.WorldBound(), compact.WorldBound());
+
+            for (int i = 0; i < 2000; ++i) {
+                Point3f o = (*o2w)(Point3f(res * rng.UniformFloat(),
+                                           res * rng.UniformFloat(), 2));
+                Vector3f d = (*o2w)(Vector3f(rng.UniformFloat() - .5f,
+                                             rng.UniformFloat() - .5f, -1));
+                Ray ray(o, d), compactRay(o, d);
+                SurfaceInteraction isect, compactIsect;
+                bool hit = bvh.Intersect(ray, &isect);
+                ASSERT_EQ(hit, compact.Intersect(compactRay, &compactIsect));
+                EXPECT_EQ(hit, compact.IntersectP(Ray(o, d)));
+                if (!hit) continue;
+                EXPECT_EQ(ray.tMax, compactRay.tMax);
+                EXPECT_EQ(isect.p, compactIsect.p);
+                EXPECT_EQ(isect.n, compactIsect.n);
+                EXPECT_EQ(isect.faceIndex, compactIsect.faceIndex);
+                EXPECT_EQ(&compact, compactIsect.primitive);
+                EXPECT_LT(Distance(isect.uv, compactIsect.uv), 1e-3f);
+                EXPECT_LT((isect.shading.n - compactIsect.shading.n).Length(),
+                          1e-3f);
+            }
+        }
+}
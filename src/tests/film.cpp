@@ -0,0 +1,49 @@
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "film.h"
+#include "rng.h"
+
+using namespace pbrt;
+
+TEST(PixelVariance, MergeMatchesSequential) {
+    RNG rng;
+    PixelVariance all, a, b;
+    for (int i = 0; i < 1000; ++i) {
+        Float y = rng.UniformFloat() * (i < 300 ? 1 : 10);
+        all.Add(y);
+        if (i < 300)
+            a.Add(y);
+        else
+            b.Add(y);
+    }
+    a.Merge(b);
+    EXPECT_EQ(all.n, a.n);
+    EXPECT_LT(std::abs(all.mean - a.mean), 1e-4 * all.mean);
+    EXPECT_LT(std::abs(all.Variance() - a.Variance()), 1e-3 * all.Variance());
+}
+
+TEST(PixelVariance, Constant) {
+    PixelVariance v;
+    EXPECT_EQ(Infinity, v.RelativeError());
+    for (int i = 0; i < 16; ++i) v.Add(0.5);
+    EXPECT_EQ(0, v.Variance());
+    EXPECT_EQ(0, v.RelativeError());
+}
+
+TEST(FilmTile, PixelVariance) {
+    // Samples only update the statistics of the pixel they were taken in,
+    // even though the filter spreads them over neighboring pixels.
+    Float filterTable[4] = {1, 1, 1, 1};
+    FilmTile tile(Bounds2i(Point2i(0, 0), Point2i(4, 4)), Vector2f(1.5, 1.5),
+                  filterTable, 2, Infinity);
+    tile.AddSample(Point2f(1.25, 2.75), Spectrum(1.f));
+    tile.AddSample(Point2f(1.75, 2.5), Spectrum(3.f));
+    for (Point2i p : Bounds2i(Point2i(0, 0), Point2i(4, 4))) {
+        const FilmTilePixel &pixel = tile.GetPixel(p);
+        if (p == Point2i(1, 2)) {
+            EXPECT_EQ(2, pixel.variance.n);
+            EXPECT_FLOAT_EQ(2.f, pixel.variance.mean);
+        } else
+            EXPECT_EQ(0, pixel.variance.n);
+    }
+}
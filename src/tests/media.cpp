@@ -0,0 +1,131 @@
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "interaction.h"
+#include "media/grid.h"
+#include "media/sparsegrid.h"
+#include "memory.h"
+#include "parallel.h"
+#include "rng.h"
+#include "samplers/random.h"
+
+using namespace pbrt;
+
+static const int nx = 40, ny = 21, nz = 13;
+
+// Returns a mostly-empty density grid with a few dense blobs, at a
+// resolution that isn't a multiple of the majorant cell or brick size.
+static std::vector<Float> SparseDensities() {
+    std::vector<Float> d(nx * ny * nz, 0.f);
+    RNG rng;
+    for (int blob = 0; blob < 6; ++blob) {
+        Point3i c(rng.UniformUInt32(nx), rng.UniformUInt32(ny),
+                  rng.UniformUInt32(nz));
+        Float density = 4 * rng.UniformFloat();
+        for (int z = std::max(0, c.z - 2); z < std::min(nz, c.z + 3); ++z)
+            for (int y = std::max(0, c.y - 3); y < std::min(ny, c.y + 4); ++y)
+                for (int x = std::max(0, c.x - 3); x < std::min(nx, c.x + 4);
+                     ++x)
+                    d[(z * ny + y) * nx + x] = density * rng.UniformFloat();
+    }
+    return d;
+}
+
+static std::unique_ptr<SparseDensityGrid> WriteSparseGrid(
+    const std::vector<Float> &d) {
+    const char *filename = "test.svol";
+    if (!SparseDensityGrid::Write(
+            filename, Point3i(nx, ny, nz),
+            [&](const Point3i &p) { return d[(p.z * ny + p.y) * nx + p.x]; }))
+        return nullptr;
+    std::unique_ptr<SparseDensityGrid> grid = SparseDensityGrid::Read(filename);
+    remove(filename);
+    return grid;
+}
+
+// Transmittance along the ray up to _tMax_, found by integrating the
+// grid's interpolated density numerically over the medium's bounds.
+static Float ExpectedTr(const GridDensityMedium &medium,
+                        const Transform &worldToMedium, const Ray &r,
+                        Float sigma_t) {
+    const int nSteps = 20000;
+    Float dt = r.tMax / nSteps, tau = 0;
+    const Bounds3f b(Point3f(0, 0, 0), Point3f(1, 1, 1));
+    for (int i = 0; i < nSteps; ++i) {
+        Point3f p = worldToMedium(r((i + .5f) * dt));
+        if (Inside(p, b)) tau += medium.Density(p) * dt;
+    }
+    return std::exp(-sigma_t * tau);
+}
+
+TEST(GridMedium, MajorantTracking) {
+    ParallelInit();
+    Transform mediumToWorld = Translate(Vector3f(-1, -.5f, 0)) *
+                              Scale(2, 1.f, .75f);
+    Transform worldToMedium = Inverse(mediumToWorld);
+    std::vector<Float> d = SparseDensities();
+    std::unique_ptr<SparseDensityGrid> grid = WriteSparseGrid(d);
+    ASSERT_TRUE(grid != nullptr);
+    GridDensityMedium denseMedium(Spectrum(.5f), Spectrum(1.5f), 0.f, nx, ny,
+                                  nz, mediumToWorld, d.data());
+    GridDensityMedium sparseMedium(Spectrum(.5f), Spectrum(1.5f), 0.f,
+                                   std::move(grid), mediumToWorld);
+    ParallelCleanup();
+
+    RandomSampler sampler(1);
+    sampler.StartPixel(Point2i(0, 0));
+    MemoryArena arena;
+    RNG rng(7);
+    for (int i = 0; i < 20; ++i) {
+        // Pick a ray that starts outside the medium and may end inside it
+        Point3f p0(-2 + 4 * rng.UniformFloat(), -1 + 2 * rng.UniformFloat(),
+                   -.5f + 1.75f * rng.UniformFloat());
+        Point3f p1(-1 + 2 * rng.UniformFloat(), -.5f + rng.UniformFloat(),
+                   .75f * rng.UniformFloat());
+        Ray ray(p0 - 2 * (p1 - p0), p1 - p0, 2.5f);
+        Ray unitRay(ray.o, Normalize(ray.d), ray.tMax * ray.d.Length());
+        Float expected = ExpectedTr(denseMedium, worldToMedium, unitRay, 2.f);
+
+        for (const GridDensityMedium *medium : {&denseMedium, &sparseMedium}) {
+            const int nTrials = 20000;
+            Float trSum = 0;
+            int nEscaped = 0;
+            for (int j = 0; j < nTrials; ++j) {
+                trSum += medium->Tr(ray, sampler)[0];
+                MediumInteraction mi;
+                medium->Sample(ray, sampler, arena, &mi);
+                if (!mi.IsValid()) ++nEscaped;
+                arena.Reset();
+            }
+            EXPECT_NEAR(expected, trSum / nTrials, .015f) << ray;
+            EXPECT_NEAR(expected, Float(nEscaped) / nTrials, .015f) << ray;
+        }
+    }
+}
+
+TEST(GridMedium, SparseMatchesDense) {
+    std::vector<Float> d = SparseDensities();
+    std::unique_ptr<SparseDensityGrid> grid = WriteSparseGrid(d);
+    ASSERT_TRUE(grid != nullptr);
+    EXPECT_EQ(Point3i(nx, ny, nz), grid->Resolution());
+    EXPECT_GT(grid->StoredBricks(), 0);
+    EXPECT_LT(grid->StoredBricks(), 5 * 3 * 2);
+
+    ParallelInit();
+    GridDensityMedium denseMedium(Spectrum(1.f), Spectrum(1.f), 0.f, nx, ny,
+                                  nz, Transform(), d.data());
+    GridDensityMedium sparseMedium(Spectrum(1.f), Spectrum(1.f), 0.f,
+                                   std::move(grid), Transform());
+    ParallelCleanup();
+    for (int z = -1; z <= nz; ++z)
+        for (int y = -1; y <= ny; ++y)
+            for (int x = -1; x <= nx; ++x)
+                EXPECT_EQ(denseMedium.D(Point3i(x, y, z)),
+                          sparseMedium.D(Point3i(x, y, z)));
+    RNG rng;
+    for (int i = 0; i < 10000; ++i) {
+        Point3f p(1.2f * rng.UniformFloat() - .1f,
+                  1.2f * rng.UniformFloat() - .1f,
+                  1.2f * rng.UniformFloat() - .1f);
+        EXPECT_EQ(denseMedium.Density(p), sparseMedium.Density(p)) << p;
+    }
+}
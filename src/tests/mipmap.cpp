@@ -0,0 +1,124 @@
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "mipmap.h"
+#include "rng.h"
+
+using namespace pbrt;
+
+// Straightforward EWA filtering of a single MIP map level, visiting every
+// texel of the ellipse's bounding box through MIPMap::Texel().
+template <typename T>
+static T ReferenceEWA(const MIPMap<T> &mipmap, int level, Point2f st,
+                      Vector2f dst0, Vector2f dst1) {
+    if (level >= mipmap.Levels())
+        return mipmap.Texel(mipmap.Levels() - 1, 0, 0);
+    int w = std::max(1, mipmap.Width() >> level);
+    int h = std::max(1, mipmap.Height() >> level);
+    st[0] = st[0] * w - 0.5f;
+    st[1] = st[1] * h - 0.5f;
+    dst0[0] *= w;
+    dst0[1] *= h;
+    dst1[0] *= w;
+    dst1[1] *= h;
+
+    Float A = dst0[1] * dst0[1] + dst1[1] * dst1[1] + 1;
+    Float B = -2 * (dst0[0] * dst0[1] + dst1[0] * dst1[1]);
+    Float C = dst0[0] * dst0[0] + dst1[0] * dst1[0] + 1;
+    Float invF = 1 / (A * C - B * B * 0.25f);
+    A *= invF;
+    B *= invF;
+    C *= invF;
+    Float det = -B * B + 4 * A * C;
+    Float invDet = 1 / det;
+    Float uSqrt = std::sqrt(det * C), vSqrt = std::sqrt(A * det);
+    int s0 = std::ceil(st[0] - 2 * invDet * uSqrt);
+    int s1 = std::floor(st[0] + 2 * invDet * uSqrt);
+    int t0 = std::ceil(st[1] - 2 * invDet * vSqrt);
+    int t1 = std::floor(st[1] + 2 * invDet * vSqrt);
+
+    const int lutSize = 128;
+    T sum(0.f);
+    Float sumWts = 0;
+    for (int it = t0; it <= t1; ++it) {
+        Float tt = it - st[1];
+        for (int is = s0; is <= s1; ++is) {
+            Float ss = is - st[0];
+            Float r2 = A * ss * ss + B * ss * tt + C * tt * tt;
+            if (r2 < 1) {
+                int index = std::min((int)(r2 * lutSize), lutSize - 1);
+                Float lutR2 = Float(index) / Float(lutSize - 1);
+                Float weight = std::exp(-2 * lutR2) - std::exp(-2.f);
+                sum += mipmap.Texel(level, is, it) * weight;
+                sumWts += weight;
+            }
+        }
+    }
+    return sum / sumWts;
+}
+
+template <typename T>
+static T ReferenceLookup(const MIPMap<T> &mipmap, Point2f st, Vector2f dst0,
+                         Vector2f dst1, Float maxAnisotropy) {
+    if (dst0.LengthSquared() < dst1.LengthSquared()) std::swap(dst0, dst1);
+    Float majorLength = dst0.Length();
+    Float minorLength = dst1.Length();
+    if (minorLength * maxAnisotropy < majorLength && minorLength > 0) {
+        Float scale = majorLength / (minorLength * maxAnisotropy);
+        dst1 *= scale;
+        minorLength *= scale;
+    }
+    Float lod =
+        std::max((Float)0, mipmap.Levels() - (Float)1 + Log2(minorLength));
+    int ilod = std::floor(lod);
+    return Lerp(lod - ilod, ReferenceEWA(mipmap, ilod, st, dst0, dst1),
+                ReferenceEWA(mipmap, ilod + 1, st, dst0, dst1));
+}
+
+static Float MaxDifference(Float a, Float b) { return std::abs(a - b); }
+
+static Float MaxDifference(const RGBSpectrum &a, const RGBSpectrum &b) {
+    Float diff = 0;
+    for (int i = 0; i < RGBSpectrum::nSamples; ++i)
+        diff = std::max(diff, std::abs(a[i] - b[i]));
+    return diff;
+}
+
+template <typename T>
+static void TestEWA(std::function<T(RNG &)> randomTexel) {
+    Point2i res(128, 64);
+    RNG rng;
+    std::vector<T> image(res.x * res.y);
+    for (T &v : image) v = randomTexel(rng);
+
+    for (ImageWrap wrap :
+         {ImageWrap::Repeat, ImageWrap::Clamp, ImageWrap::Black}) {
+        MIPMap<T> mipmap(res, image.data(), false, 8.f, wrap);
+        for (int i = 0; i < 10000; ++i) {
+            // Mostly footprints inside the texture, some crossing its edges
+            Point2f st(1.2f * rng.UniformFloat() - .1f,
+                       1.2f * rng.UniformFloat() - .1f);
+            Float scale = std::pow(2.f, -10 * rng.UniformFloat());
+            Vector2f dst0(scale * (2 * rng.UniformFloat() - 1),
+                          scale * (2 * rng.UniformFloat() - 1));
+            Vector2f dst1(scale * (2 * rng.UniformFloat() - 1),
+                          scale * (2 * rng.UniformFloat() - 1));
+            if (dst0.Length() == 0 || dst1.Length() == 0) continue;
+            T ref = ReferenceLookup(mipmap, st, dst0, dst1, 8.f);
+            T ewa = mipmap.Lookup(st, dst0, dst1);
+            EXPECT_LT(MaxDifference(ref, ewa), 1e-5f)
+                << "st " << st << " dst0 " << dst0 << " dst1 " << dst1;
+        }
+    }
+}
+
+TEST(MIPMap, EWAMatchesReferenceFloat) {
+    TestEWA<Float>([](RNG &rng) { return rng.UniformFloat(); });
+}
+
+TEST(MIPMap, EWAMatchesReferenceSpectrum) {
+    TestEWA<RGBSpectrum>([](RNG &rng) {
+        Float rgb[3] = {rng.UniformFloat(), rng.UniformFloat(),
+                        rng.UniformFloat()};
+        return RGBSpectrum::FromRGB(rgb);
+    });
+}
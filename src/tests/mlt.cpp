@@ -0,0 +1,46 @@
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "integrators/mlt.h"
+#include <sstream>
+
+using namespace pbrt;
+
+// Runs a few iterations of a chain, accepting or rejecting each proposal
+static void MutateChain(MLTSampler &sampler, RNG &rng, int nIterations,
+                        std::vector<Float> *values) {
+    for (int i = 0; i < nIterations; ++i) {
+        sampler.StartIteration();
+        for (int stream = 0; stream < 3; ++stream) {
+            sampler.StartStream(stream);
+            for (int j = 0; j < 1 + i % 5; ++j)
+                values->push_back(sampler.Get1D());
+        }
+        if (rng.UniformFloat() < .5f)
+            sampler.Accept();
+        else
+            sampler.Reject();
+    }
+}
+
+TEST(MLTSampler, StateRoundTrip) {
+    MLTSampler sampler(16, 3, .01f, .3f, 3);
+    RNG rng;
+    std::vector<Float> values;
+    MutateChain(sampler, rng, 100, &values);
+
+    // A sampler restored from _sampler_'s state continues the same chain
+    std::stringstream state;
+    sampler.WriteState(state);
+    MLTSampler restored(16, 7, .01f, .3f, 3);
+    ASSERT_TRUE(restored.ReadState(state));
+    RNG restoredRng = rng;
+    std::vector<Float> expected, continued;
+    MutateChain(sampler, rng, 100, &expected);
+    MutateChain(restored, restoredRng, 100, &continued);
+    EXPECT_EQ(expected, continued);
+
+    // Truncated state is rejected
+    std::string s = state.str();
+    std::stringstream truncated(s.substr(0, s.size() - 1));
+    EXPECT_FALSE(restored.ReadState(truncated));
+}
@@ -0,0 +1,105 @@
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "parallel.h"
+#include "rng.h"
+#include "plugin/multipole/multipole.hpp"
+
+using namespace pbrt;
+
+// Table with an exponential falloff, given out of order and with duplicated
+// radii, as produced by ComputeMultipoleDiffusionProfile().
+static MultipoleTable ExponentialTable() {
+    MultipoleTable table;
+    for (int i = 20; i >= 0; --i) {
+        Float sd = i * i * 0.01f;
+        table.PushBack(std::exp(-std::sqrt(sd) * 5), 0, sd);
+        if (i % 3 == 0) table.PushBack(std::exp(-std::sqrt(sd) * 5), 0, sd);
+    }
+    return table;
+}
+
+// Integrates 2*pi*r*pdf(r) over [0, rMax] with the midpoint rule.
+static Float IntegrateRadialPdf(const MultipoleProfile &profile, Float rMax) {
+    const int n = 20000;
+    Float sum = 0;
+    for (int i = 0; i < n; ++i) {
+        Float r = (i + 0.5f) * rMax / n;
+        sum += 2 * Pi * r * profile.Pdf(r) * rMax / n;
+    }
+    return sum;
+}
+
+TEST(MultipoleProfile, PdfNormalized) {
+    MultipoleProfile profile(ExponentialTable());
+    EXPECT_FLOAT_EQ(2.f, profile.RMax());
+    EXPECT_NEAR(1.f, IntegrateRadialPdf(profile, profile.RMax()), 1e-3f);
+    EXPECT_EQ(0.f, profile.Pdf(2.5f));
+    EXPECT_NEAR(std::exp(-5.f), profile.Sr(1.f), 1e-5f);
+}
+
+TEST(MultipoleProfile, SamplingMatchesPdf) {
+    MultipoleProfile profile(ExponentialTable());
+    RNG rng;
+    for (int i = 0; i < 20; ++i) {
+        Float u = rng.UniformFloat();
+        Float r = profile.Sample(u);
+        ASSERT_GE(r, 0.f);
+        ASSERT_LE(r, profile.RMax());
+        // The fraction of the density below the sampled radius should
+        // match the sample value.
+        EXPECT_NEAR(u, IntegrateRadialPdf(profile, r), 2e-3f) << "u = " << u;
+    }
+}
+
+TEST(MultipoleProfile, Empty) {
+    MultipoleTable table;
+    table.PushBack(-1.f, 0.f, 0.f);
+    table.PushBack(0.f, 0.f, 1.f);
+    MultipoleProfile profile(table);
+    EXPECT_EQ(-1.f, profile.Sample(0.5f));
+    EXPECT_EQ(0.f, profile.Pdf(0.5f));
+}
+
+// A thick, strongly scattering slab should reflect a plausible fraction of
+// the incident light, with the table reaching out to the full extent of the
+// profile.
+TEST(MultipoleDiffusion, SingleLayerTable) {
+    std::vector<MultipoleLayer> layers;
+    layers.push_back(MultipoleLayer(1.f, 1.4f, 20.f, .05f, 5.f));
+    MultipoleOptions options(.02f, 64);
+    MultipoleTable table = ComputeMultipoleDiffusionProfile(layers, options);
+    Float maxSquaredDistance = 0;
+    for (size_t i = 0; i < table.NSamples(); ++i)
+        maxSquaredDistance = std::max(maxSquaredDistance, table.squaredDistance(i));
+    EXPECT_NEAR(63 * .02f, std::sqrt(maxSquaredDistance), 1e-4f);
+
+    MultipoleProfile profile(table);
+    EXPECT_GT(profile.TotalReflectance(), .2f);
+    EXPECT_LT(profile.TotalReflectance(), 1.f);
+    // The diffusion profile falls off with distance.
+    EXPECT_GT(profile.Sr(.05f), profile.Sr(.2f));
+    EXPECT_GT(profile.Sr(.2f), profile.Sr(1.f));
+}
+
+// Threads that ask for a profile while another thread is computing it
+// wait for that computation and get the same table.
+TEST(MultipoleDiffusion, ConcurrentProfileRequests) {
+    int nThreads = PbrtOptions.nThreads;
+    PbrtOptions.nThreads = 4;
+    ParallelInit();
+
+    std::vector<MultipoleLayer> layers;
+    layers.push_back(MultipoleLayer(1.f, 1.3f, 10.f, .07f, 3.f));
+    MultipoleOptions options(.03f, 64);
+    std::vector<std::shared_ptr<const MultipoleTable>> tables(8);
+    ParallelFor([&](int64_t i) {
+        tables[i] = GetMultipoleDiffusionProfile(layers, options);
+    }, tables.size());
+    for (const auto &table : tables) {
+        ASSERT_TRUE(table != nullptr);
+        EXPECT_EQ(tables[0].get(), table.get());
+    }
+
+    ParallelCleanup();
+    PbrtOptions.nThreads = nThreads;
+}
@@ -3,6 +3,8 @@
 #include "pbrt.h"
 #include "parallel.h"
 #include <atomic>
+#include <chrono>
+#include <thread>
 
 using namespace pbrt;
 
@@ -37,3 +39,72 @@ TEST(Parallel, DoNothing) {
 
     ParallelCleanup();
 }
+
+TEST(Parallel, Nested) {
+    int nThreads = PbrtOptions.nThreads;
+    PbrtOptions.nThreads = 4;
+    ParallelInit();
+
+    std::atomic<int> counter{0};
+    ParallelFor([&](int64_t) {
+        ParallelFor([&](int64_t) { ++counter; }, 100, 7);
+    }, 50);
+    EXPECT_EQ(50 * 100, counter);
+
+    counter = 0;
+    ParallelFor2D([&](Point2i p) {
+        ParallelFor([&](int64_t) { ++counter; }, 10);
+    }, Point2i(8, 9));
+    EXPECT_EQ(8 * 9 * 10, counter);
+
+    ParallelCleanup();
+    PbrtOptions.nThreads = nThreads;
+}
+
+TEST(Parallel, NestedDoesNotReenterThread) {
+    int nThreads = PbrtOptions.nThreads;
+    PbrtOptions.nThreads = 4;
+    ParallelInit();
+
+    // While a thread waits for a nested loop, it mustn't run other
+    // iterations of the outer loop, which would re-enter its per-thread
+    // state.
+    std::unique_ptr<std::atomic<bool>[]> inOuter(
+        new std::atomic<bool>[MaxThreadIndex()]);
+    for (int i = 0; i < MaxThreadIndex(); ++i) inOuter[i] = false;
+    std::atomic<int> nReentered{0}, counter{0};
+    ParallelFor([&](int64_t) {
+        if (inOuter[ThreadIndex].exchange(true)) ++nReentered;
+        // Slow iterations keep other threads busy with the nested loop
+        // after this thread has claimed its last chunk.
+        ParallelFor([&](int64_t) {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            ++counter;
+        }, 8);
+        inOuter[ThreadIndex] = false;
+    }, 200);
+    EXPECT_EQ(0, nReentered);
+    EXPECT_EQ(200 * 8, counter);
+
+    ParallelCleanup();
+    PbrtOptions.nThreads = nThreads;
+}
+
+TEST(Parallel, Async) {
+    int nThreads = PbrtOptions.nThreads;
+    PbrtOptions.nThreads = 4;
+    ParallelInit();
+
+    std::vector<Future<int>> futures;
+    for (int i = 0; i < 100; ++i)
+        futures.push_back(RunAsync([i]() {
+            // Tasks may issue loops of their own.
+            std::atomic<int> sum{0};
+            ParallelFor([&](int64_t j) { sum += j; }, i);
+            return sum.load();
+        }));
+    for (int i = 0; i < 100; ++i) EXPECT_EQ(i * (i - 1) / 2, futures[i].Get());
+
+    ParallelCleanup();
+    PbrtOptions.nThreads = nThreads;
+}
@@ -0,0 +1,110 @@
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "paramset.h"
+#include "rng.h"
+#include "shapes/plymesh.h"
+#include "transform.h"
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+using namespace pbrt;
+
+static std::vector<std::shared_ptr<Shape>> LoadPLY(const std::string &filename,
+                                                   const Transform *o2w,
+                                                   const Transform *w2o) {
+    ParamSet params;
+    std::unique_ptr<std::string[]> name(new std::string[1]);
+    name[0] = filename;
+    params.AddString("filename", std::move(name), 1);
+    return CreatePLYMesh(o2w, w2o, false, params);
+}
+
+template <typename T>
+static void Append(std::string *data, T value) {
+    data->append((const char *)&value, sizeof(T));
+}
+
+// Writes a mesh of random triangles and quads both as ASCII, which goes
+// through rply, and as binary little-endian, which is read from a memory
+// mapping; both must give the same triangles.
+TEST(PLYMesh, BinaryMatchesAscii) {
+    RNG rng;
+    const int nVertices = 1000, nFaces = 3000;
+    std::vector<Point3f> p;
+    for (int i = 0; i < nVertices; ++i)
+        p.push_back(Point3f(rng.UniformFloat(), rng.UniformFloat(),
+                            rng.UniformFloat()));
+
+    for (bool mixed : {false, true}) {
+        std::ostringstream header, ascii;
+        header << "element vertex " << nVertices << "\n"
+               << "property double x\nproperty float y\nproperty float z\n"
+               << "property uchar flags\n"
+               << "element face " << nFaces << "\n"
+               << "property uchar flags\n"
+               << "property list uchar int vertex_indices\n"
+               << "end_header\n";
+        std::string binary;
+        for (const Point3f &v : p) {
+            ascii << v.x << " " << v.y << " " << v.z << " 7\n";
+            Append<double>(&binary, v.x);
+            Append<float>(&binary, v.y);
+            Append<float>(&binary, v.z);
+            Append<uint8_t>(&binary, 7);
+        }
+        for (int i = 0; i < nFaces; ++i) {
+            int length = (mixed && (i % 5) == 3) ? 4 : 3;
+            ascii << "1 " << length;
+            Append<uint8_t>(&binary, 1);
+            Append<uint8_t>(&binary, length);
+            for (int j = 0; j < length; ++j) {
+                int index = rng.UniformUInt32(nVertices);
+                ascii << " " << index;
+                Append<int32_t>(&binary, index);
+            }
+            ascii << "\n";
+        }
+        std::ofstream("test_ascii.ply")
+            << "ply\nformat ascii 1.0\n" << header.str() << ascii.str();
+        std::ofstream("test_binary.ply", std::ios::binary)
+            << "ply\nformat binary_little_endian 1.0\ncomment test\n"
+            << header.str() << binary;
+
+        Transform o2w = Translate(Vector3f(1, 2, 3)), w2o = Inverse(o2w);
+        std::vector<std::shared_ptr<Shape>> asciiTris =
+            LoadPLY("test_ascii.ply", &o2w, &w2o);
+        std::vector<std::shared_ptr<Shape>> binaryTris =
+            LoadPLY("test_binary.ply", &o2w, &w2o);
+        EXPECT_EQ(0, remove("test_ascii.ply"));
+        EXPECT_EQ(0, remove("test_binary.ply"));
+
+        ASSERT_EQ(mixed ? nFaces + nFaces / 5 : nFaces, asciiTris.size());
+        ASSERT_EQ(asciiTris.size(), binaryTris.size());
+        for (size_t i = 0; i < asciiTris.size(); ++i) {
+            // ASCII output loses precision, so compare bounds loosely
+            Bounds3f ba = asciiTris[i]->WorldBound();
+            Bounds3f bb = binaryTris[i]->WorldBound();
+            for (int c = 0; c < 3; ++c) {
+                EXPECT_NEAR(ba.pMin[c], bb.pMin[c], 1e-4f);
+                EXPECT_NEAR(ba.pMax[c], bb.pMax[c], 1e-4f);
+            }
+        }
+    }
+}
+
+TEST(PLYMesh, BinaryIndexOutOfBounds) {
+    std::string binary;
+    for (int i = 0; i < 9; ++i) Append<float>(&binary, i);
+    Append<uint8_t>(&binary, 3);
+    for (int index : {0, 1, 3}) Append<int32_t>(&binary, index);
+    std::ofstream("test_bad.ply", std::ios::binary)
+        << "ply\nformat binary_little_endian 1.0\nelement vertex 3\n"
+        << "property float x\nproperty float y\nproperty float z\n"
+        << "element face 1\nproperty list uchar int vertex_indices\n"
+        << "end_header\n" << binary;
+    Transform identity;
+    EXPECT_TRUE(LoadPLY("test_bad.ply", &identity, &identity).empty());
+    EXPECT_EQ(0, remove("test_bad.ply"));
+}
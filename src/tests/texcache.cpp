@@ -0,0 +1,108 @@
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "mipmap.h"
+#include "rng.h"
+#include "texcache.h"
+
+using namespace pbrt;
+
+TEST(TextureTileCache, LRUEviction) {
+    // Each shard has room for two tiles; all tiles of texture 1 land in the
+    // same shard, so the least recently used one is evicted.
+    TextureTileCache cache(64 * 200);
+    uint64_t id = cache.NewTextureId();
+    int nLoads = 0;
+    auto get = [&](int tileIndex) {
+        return cache.GetTile(id, 64 * tileIndex, 100, [&]() {
+            ++nLoads;
+            return std::make_shared<int>(tileIndex);
+        });
+    };
+    EXPECT_EQ(0, *std::static_pointer_cast<const int>(get(0)));
+    EXPECT_EQ(1, *std::static_pointer_cast<const int>(get(1)));
+    EXPECT_EQ(2, nLoads);
+    get(0);
+    EXPECT_EQ(2, nLoads);
+    get(2);  // evicts tile 1
+    EXPECT_EQ(3, nLoads);
+    get(0);
+    EXPECT_EQ(3, nLoads);
+    EXPECT_EQ(1, *std::static_pointer_cast<const int>(get(1)));
+    EXPECT_EQ(4, nLoads);
+
+    cache.ReleaseTexture(id);
+    get(0);
+    EXPECT_EQ(5, nLoads);
+}
+
+TEST(TextureTileCache, FailedLoadNotCached) {
+    TextureTileCache cache(64 * 200);
+    uint64_t id = cache.NewTextureId();
+    int nLoads = 0;
+    bool fail = true;
+    auto get = [&]() {
+        return cache.GetTile(id, 0, 100, [&]() {
+            ++nLoads;
+            return fail ? nullptr : std::make_shared<int>(7);
+        });
+    };
+    EXPECT_TRUE(get() == nullptr);
+    EXPECT_TRUE(get() == nullptr);
+    EXPECT_EQ(2, nLoads);
+    fail = false;
+    EXPECT_EQ(7, *std::static_pointer_cast<const int>(get()));
+    get();
+    EXPECT_EQ(3, nLoads);
+}
+
+TEST(MIPMap, TiledMatchesInMemory) {
+    Point2i res(256, 128);
+    RNG rng;
+    std::vector<Float> image(res.x * res.y);
+    for (Float &v : image) v = rng.UniformFloat();
+
+    for (ImageWrap wrap : {ImageWrap::Repeat, ImageWrap::Clamp}) {
+        MIPMap<Float> mipmap(res, image.data(), false, 8.f, wrap);
+
+        // Write the levels of _mipmap_ to a tiled pyramid file
+        std::vector<Point2i> levelResolution;
+        std::vector<std::vector<float>> levels(mipmap.Levels());
+        std::vector<const float *> levelPtrs;
+        for (int level = 0; level < mipmap.Levels(); ++level) {
+            Point2i lres(std::max(1, res.x >> level),
+                         std::max(1, res.y >> level));
+            for (int t = 0; t < lres.y; ++t)
+                for (int s = 0; s < lres.x; ++s)
+                    levels[level].push_back(mipmap.Texel(level, s, t));
+            levelResolution.push_back(lres);
+            levelPtrs.push_back(levels[level].data());
+        }
+        const char *filename = "test.tmip";
+        ASSERT_TRUE(
+            TiledImagePyramid::Write(filename, 1, 32, levelResolution, levelPtrs));
+        std::unique_ptr<TiledImagePyramid> tiled =
+            TiledImagePyramid::Read(filename);
+        ASSERT_TRUE(tiled != nullptr);
+        EXPECT_EQ(mipmap.Levels(), tiled->Levels());
+        // Unscaled texels are used in place; scaled ones go through the
+        // tile cache
+        MIPMap<Float> tiledMIPMap(std::move(tiled), 1.f, false, 8.f, wrap);
+        MIPMap<Float> scaledMIPMap(TiledImagePyramid::Read(filename), 2.f,
+                                   false, 8.f, wrap);
+        EXPECT_EQ(0, remove(filename));
+
+        for (int i = 0; i < 1000; ++i) {
+            Point2f st(3 * rng.UniformFloat() - 1, 3 * rng.UniformFloat() - 1);
+            Float width = .1f * rng.UniformFloat();
+            EXPECT_EQ(mipmap.Lookup(st, width), tiledMIPMap.Lookup(st, width));
+            EXPECT_EQ(2 * mipmap.Lookup(st, width),
+                      scaledMIPMap.Lookup(st, width));
+            Vector2f dst0(.01f * rng.UniformFloat(), .01f * rng.UniformFloat());
+            Vector2f dst1(.02f * rng.UniformFloat(), -.01f * rng.UniformFloat());
+            EXPECT_EQ(mipmap.Lookup(st, dst0, dst1),
+                      tiledMIPMap.Lookup(st, dst0, dst1));
+            EXPECT_EQ(2 * mipmap.Lookup(st, dst0, dst1),
+                      scaledMIPMap.Lookup(st, dst0, dst1));
+        }
+    }
+}
@@ -50,16 +50,49 @@ ImageTexture<Tmemory, Treturn>::ImageTexture(
 }
 
 template <typename Tmemory, typename Treturn>
-MIPMap<Tmemory> *ImageTexture<Tmemory, Treturn>::GetTexture(
-    const std::string &filename, bool doTrilinear, Float maxAniso,
-    ImageWrap wrap, Float scale, bool gamma) {
+const std::unique_ptr<MIPMap<Tmemory>> *
+ImageTexture<Tmemory, Treturn>::GetTexture(const std::string &filename,
+                                           bool doTrilinear, Float maxAniso,
+                                           ImageWrap wrap, Float scale,
+                                           bool gamma) {
     // Return _MIPMap_ from texture cache if present
     TexInfo texInfo(filename, doTrilinear, maxAniso, wrap, scale, gamma);
-    if (textures.find(texInfo) != textures.end())
-        return textures[texInfo].get();
+    auto iter = textures.find(texInfo);
+    if (iter != textures.end()) return &iter->second;
+
+    // Start creating _MIPMap_ for _filename_; entries of _textures_ don't
+    // move, so the task can fill in its entry while parsing continues
+    std::unique_ptr<MIPMap<Tmemory>> &entry = textures[texInfo];
+    pendingLoads.push_back(RunAsync([=, &entry]() {
+        entry.reset(
+            CreateMIPMap(filename, doTrilinear, maxAniso, wrap, scale, gamma));
+    }));
+    return &entry;
+}
+
+template <typename Tmemory, typename Treturn>
+void ImageTexture<Tmemory, Treturn>::FinishLoading() {
+    for (Future<void> &load : pendingLoads) load.Wait();
+    pendingLoads.clear();
+}
 
-    // Create _MIPMap_ for _filename_
+template <typename Tmemory, typename Treturn>
+MIPMap<Tmemory> *ImageTexture<Tmemory, Treturn>::CreateMIPMap(
+    const std::string &filename, bool doTrilinear, Float maxAniso,
+    ImageWrap wrap, Float scale, bool gamma) {
     ProfilePhase _(Prof::TextureLoading);
+    if (HasExtension(filename, ".tmip")) {
+        // Create _MIPMap_ that pages in tiles of a pre-filtered pyramid
+        std::unique_ptr<TiledImagePyramid> tiled =
+            TiledImagePyramid::Read(filename);
+        if (tiled) {
+            if (gamma)
+                Warning("Ignoring \"gamma\" for tiled texture \"%s\"; "
+                        "its texels are linear.", filename.c_str());
+            return new MIPMap<Tmemory>(std::move(tiled), scale, doTrilinear,
+                                       maxAniso, wrap);
+        }
+    }
     Point2i resolution;
     std::unique_ptr<RGBSpectrum[]> texels = ReadImage(filename, &resolution);
     if (!texels) {
@@ -94,13 +127,14 @@ MIPMap<Tmemory> *ImageTexture<Tmemory, Treturn>::GetTexture(
         Tmemory oneVal = scale;
         mipmap = new MIPMap<Tmemory>(Point2i(1, 1), &oneVal);
     }
-    textures[texInfo].reset(mipmap);
     return mipmap;
 }
 
 template <typename Tmemory, typename Treturn>
 std::map<TexInfo, std::unique_ptr<MIPMap<Tmemory>>>
     ImageTexture<Tmemory, Treturn>::textures;
+template <typename Tmemory, typename Treturn>
+std::vector<Future<void>> ImageTexture<Tmemory, Treturn>::pendingLoads;
 ImageTexture<Float, Float> *CreateImageFloatTexture(const Transform &tex2world,
                                                     const TextureParams &tp) {
     // Initialize 2D texture mapping _map_ from _tp_
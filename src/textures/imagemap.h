@@ -43,6 +43,7 @@
 #include "texture.h"
 #include "mipmap.h"
 #include "paramset.h"
+#include "parallel.h"
 #include <map>
 
 namespace pbrt {
@@ -81,13 +82,15 @@ class ImageTexture : public Texture<Treturn> {
     ImageTexture(std::unique_ptr<TextureMapping2D> m,
                  const std::string &filename, bool doTri, Float maxAniso,
                  ImageWrap wm, Float scale, bool gamma);
+    static void FinishLoading();
     static void ClearCache() {
+        FinishLoading();
         textures.erase(textures.begin(), textures.end());
     }
     Treturn Evaluate(const SurfaceInteraction &si) const {
         Vector2f dstdx, dstdy;
         Point2f st = mapping->Map(si, &dstdx, &dstdy);
-        Tmemory mem = mipmap->Lookup(st, dstdx, dstdy);
+        Tmemory mem = (*mipmap)->Lookup(st, dstdx, dstdy);
         Treturn ret;
         convertOut(mem, &ret);
         return ret;
@@ -95,9 +98,12 @@ class ImageTexture : public Texture<Treturn> {
 
   private:
     // ImageTexture Private Methods
-    static MIPMap<Tmemory> *GetTexture(const std::string &filename,
-                                       bool doTrilinear, Float maxAniso,
-                                       ImageWrap wm, Float scale, bool gamma);
+    static const std::unique_ptr<MIPMap<Tmemory>> *GetTexture(
+        const std::string &filename, bool doTrilinear, Float maxAniso,
+        ImageWrap wm, Float scale, bool gamma);
+    static MIPMap<Tmemory> *CreateMIPMap(const std::string &filename,
+                                         bool doTrilinear, Float maxAniso,
+                                         ImageWrap wm, Float scale, bool gamma);
     static void convertIn(const RGBSpectrum &from, RGBSpectrum *to, Float scale,
                           bool gamma) {
         for (int i = 0; i < RGBSpectrum::nSamples; ++i)
@@ -116,8 +122,11 @@ class ImageTexture : public Texture<Treturn> {
 
     // ImageTexture Private Data
     std::unique_ptr<TextureMapping2D> mapping;
-    MIPMap<Tmemory> *mipmap;
+    // _mipmap_ points into _textures_, whose entry may still be filled in
+    // asynchronously until _FinishLoading()_ returns
+    const std::unique_ptr<MIPMap<Tmemory>> *mipmap;
     static std::map<TexInfo, std::unique_ptr<MIPMap<Tmemory>>> textures;
+    static std::vector<Future<void>> pendingLoads;
 };
 
 extern template class ImageTexture<Float, Float>;
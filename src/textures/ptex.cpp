@@ -36,10 +36,13 @@
 #include "error.h"
 #include "interaction.h"
 #include "paramset.h"
+#include "parallel.h"
 #include "stats.h"
 
 #include <Ptexture.h>
 
+#include <memory>
+
 namespace pbrt {
 
 namespace {
@@ -49,8 +52,31 @@ namespace {
 int nActiveTextures;
 Ptex::PtexCache *cache;
 
-STAT_COUNTER("Texture/Ptex lookups", nLookups);
+// Each thread keeps the Ptex texture handles and filters of the few
+// textures it looked up most recently, so that lookups don't go through
+// the cache's locks; the number per thread is bounded so that the handles
+// held across all threads stay within --ptexmaxfiles.
+struct ThreadFilter {
+    const void *owner = nullptr;
+    Ptex::PtexTexture *texture = nullptr;
+    Ptex::PtexFilter *filter = nullptr;
+    uint64_t lastUse = 0;
+};
+PBRT_CONSTEXPR int MaxFiltersPerThread = 4;
+int filtersPerThread;
+std::unique_ptr<ThreadFilter[]> threadFilters;
+
+void ReleaseFilter(ThreadFilter &tf) {
+    tf.filter->release();
+    tf.texture->release();
+    tf = ThreadFilter();
+}
+
+STAT_PERCENT("Texture/Ptex lookups reusing thread's filter", nFilterReuses,
+             nLookups);
 STAT_COUNTER("Texture/Ptex files accessed", nFilesAccessed);
+STAT_COUNTER("Texture/Ptex file reopens", nFileReopens);
+STAT_COUNTER("Texture/Ptex peak files open", peakFilesOpen);
 STAT_COUNTER("Texture/Ptex block reads", nBlockReads);
 STAT_MEMORY_COUNTER("Memory/Ptex peak memory used", peakMemoryUsed);
 
@@ -66,13 +92,17 @@ PtexTexture<T>::PtexTexture(const std::string &filename, Float gamma)
     : filename(filename), gamma(gamma) {
     if (!cache) {
         CHECK_EQ(nActiveTextures, 0);
-        int maxFiles = 100;
-        size_t maxMem = 1ull << 32;  // 4GB
+        int maxFiles = PbrtOptions.ptexMaxFiles;
+        size_t maxMem = size_t(PbrtOptions.ptexMaxMem) << 20;
         bool premultiply = true;
 
         cache = Ptex::PtexCache::create(maxFiles, maxMem, premultiply, nullptr,
                                         &errorHandler);
         // TODO? cache->setSearchPath(...);
+        filtersPerThread = Clamp(maxFiles / MaxThreadIndex(), 1,
+                                 MaxFiltersPerThread);
+        threadFilters.reset(
+            new ThreadFilter[MaxThreadIndex() * filtersPerThread]);
     }
     ++nActiveTextures;
 
@@ -97,14 +127,19 @@ PtexTexture<T>::PtexTexture(const std::string &filename, Float gamma)
 
 template <typename T>
 PtexTexture<T>::~PtexTexture() {
+    for (int i = 0; i < MaxThreadIndex() * filtersPerThread; ++i)
+        if (threadFilters[i].owner == this) ReleaseFilter(threadFilters[i]);
     if (--nActiveTextures == 0) {
         LOG(INFO) << "Releasing ptex cache";
         Ptex::PtexCache::Stats stats;
         cache->getStats(stats);
         nFilesAccessed += stats.filesAccessed;
+        nFileReopens += stats.fileReopens;
+        peakFilesOpen = stats.peakFilesOpen;
         nBlockReads += stats.blockReads;
         peakMemoryUsed = stats.peakMemUsed;
 
+        threadFilters.reset();
         cache->release();
         cache = nullptr;
     }
@@ -140,20 +175,36 @@ T PtexTexture<T>::Evaluate(const SurfaceInteraction &si) const {
     if (!valid) return T{};
 
     ++nLookups;
-    Ptex::String error;
-    Ptex::PtexTexture *texture = cache->get(filename.c_str(), error);
-    CHECK(texture != nullptr);
-    // TODO: make the filter an option?
-    Ptex::PtexFilter::Options opts(Ptex::PtexFilter::FilterType::f_bspline);
-    Ptex::PtexFilter *filter = Ptex::PtexFilter::getFilter(texture, opts);
-    int nc = texture->numChannels();
+    // Find this thread's filter for the texture, replacing the thread's
+    // least recently used one if there isn't one
+    ThreadFilter *filters = &threadFilters[ThreadIndex * filtersPerThread];
+    ThreadFilter *tf = nullptr, *lru = &filters[0];
+    uint64_t lastUse = 0;
+    for (int i = 0; i < filtersPerThread; ++i) {
+        if (filters[i].owner == this) tf = &filters[i];
+        if (filters[i].lastUse < lru->lastUse) lru = &filters[i];
+        lastUse = std::max(lastUse, filters[i].lastUse);
+    }
+    if (!tf) {
+        tf = lru;
+        if (tf->owner) ReleaseFilter(*tf);
+        Ptex::String error;
+        tf->texture = cache->get(filename.c_str(), error);
+        CHECK(tf->texture != nullptr);
+        // TODO: make the filter an option?
+        Ptex::PtexFilter::Options opts(
+            Ptex::PtexFilter::FilterType::f_bspline);
+        tf->filter = Ptex::PtexFilter::getFilter(tf->texture, opts);
+        tf->owner = this;
+    } else
+        ++nFilterReuses;
+    tf->lastUse = lastUse + 1;
+    int nc = tf->texture->numChannels();
 
     float result[3];
     int firstChan = 0;
-    filter->eval(result, firstChan, nc, si.faceIndex, si.uv[0],
-                 si.uv[1], si.dudx, si.dvdx, si.dudy, si.dvdy);
-    filter->release();
-    texture->release();
+    tf->filter->eval(result, firstChan, nc, si.faceIndex, si.uv[0],
+                     si.uv[1], si.dudx, si.dvdx, si.dudy, si.dvdy);
 
     if (gamma != 1)
         for (int i = 0; i < nc; ++i)
@@ -56,6 +56,7 @@ class PtexTexture : public Texture<T> {
     T Evaluate(const SurfaceInteraction &) const;
 
   private:
+    // PtexTexture Private Data
     bool valid;
     const std::string filename;
     const Float gamma;
@@ -0,0 +1,162 @@
+//
+// txmake.cpp
+//
+// Bakes an image into a tiled, pre-filtered MIP map pyramid (.tmip) that
+// image textures can page in on demand or map directly into memory.
+//
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fileutil.h"
+#include "imageio.h"
+#include "mipmap.h"
+#include "parallel.h"
+#include "pbrt.h"
+#include "spectrum.h"
+#include "texcache.h"
+#include <glog/logging.h>
+
+using namespace pbrt;
+
+static void usage(const char *msg = nullptr, ...) {
+    if (msg) {
+        va_list args;
+        va_start(args, msg);
+        fprintf(stderr, "txmake: ");
+        vfprintf(stderr, msg, args);
+        fprintf(stderr, "\n");
+    }
+    fprintf(stderr, R"(usage: txmake [options] <input image> <output.tmip>
+
+Resamples the image to power-of-two resolution, filters all MIP map levels
+and writes them as tiles of 32-bit floats. Texels are stored linearly; use
+the resulting file as the "filename" of an "imagemap" texture.
+
+options:
+    --channels <n>     Number of channels to write: 3 for RGB, 1 for
+                       luminance. Textures whose texels match the channel
+                       count ("spectrum" for 3, "float" for 1) and have a
+                       scale of 1 are used in place through a memory mapping.
+                       Default: 3
+    --gamma            Undo sRGB gamma of the input. Default: on for 8-bit
+                       formats (.tga, .png), off otherwise.
+    --linear           Don't undo gamma of the input.
+    --tilesize <n>     Tile size, a power of two >= 32. Default: 64
+    --wrap <mode>      Wrap mode used when resampling: "repeat", "clamp" or
+                       "black". Default: repeat
+)");
+    exit(1);
+}
+
+static void AppendTexel(Float texel, std::vector<float> *level) {
+    level->push_back(texel);
+}
+
+static void AppendTexel(const RGBSpectrum &texel, std::vector<float> *level) {
+    for (int c = 0; c < 3; ++c) level->push_back(texel[c]);
+}
+
+// Writes the levels of _mipmap_ to the tiled pyramid file _outFile_
+template <typename T>
+static bool WritePyramid(const MIPMap<T> &mipmap, int nChannels, int tileSize,
+                         const char *outFile) {
+    std::vector<Point2i> levelResolution;
+    std::vector<std::vector<float>> levels(mipmap.Levels());
+    std::vector<const float *> levelPtrs;
+    for (int level = 0; level < mipmap.Levels(); ++level) {
+        Point2i lres(std::max(1, mipmap.Width() >> level),
+                     std::max(1, mipmap.Height() >> level));
+        levels[level].reserve(nChannels * lres.x * lres.y);
+        for (int t = 0; t < lres.y; ++t)
+            for (int s = 0; s < lres.x; ++s)
+                AppendTexel(mipmap.Texel(level, s, t), &levels[level]);
+        levelResolution.push_back(lres);
+        levelPtrs.push_back(levels[level].data());
+    }
+    if (!TiledImagePyramid::Write(outFile, nChannels, tileSize,
+                                  levelResolution, levelPtrs))
+        return false;
+    printf("%s: %d x %d, %d levels\n", outFile, mipmap.Width(),
+           mipmap.Height(), mipmap.Levels());
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    google::InitGoogleLogging(argv[0]);
+    FLAGS_stderrthreshold = 1;  // Warning and above.
+
+    int nChannels = 3, tileSize = 64, gamma = -1;
+    ImageWrap wrap = ImageWrap::Repeat;
+    int i;
+    for (i = 1; i < argc && argv[i][0] == '-'; ++i) {
+        if (!strcmp(argv[i], "--channels") || !strcmp(argv[i], "-channels")) {
+            if (i + 1 == argc) usage("missing value after %s flag", argv[i]);
+            nChannels = atoi(argv[++i]);
+            if (nChannels != 1 && nChannels != 3)
+                usage("--channels must be 1 or 3");
+        } else if (!strcmp(argv[i], "--gamma") || !strcmp(argv[i], "-gamma"))
+            gamma = 1;
+        else if (!strcmp(argv[i], "--linear") || !strcmp(argv[i], "-linear"))
+            gamma = 0;
+        else if (!strcmp(argv[i], "--tilesize") ||
+                 !strcmp(argv[i], "-tilesize")) {
+            if (i + 1 == argc) usage("missing value after %s flag", argv[i]);
+            tileSize = atoi(argv[++i]);
+            if (tileSize < 32 || !IsPowerOf2(tileSize))
+                usage("--tilesize must be a power of two >= 32");
+        } else if (!strcmp(argv[i], "--wrap") || !strcmp(argv[i], "-wrap")) {
+            if (i + 1 == argc) usage("missing value after %s flag", argv[i]);
+            ++i;
+            if (!strcmp(argv[i], "repeat"))
+                wrap = ImageWrap::Repeat;
+            else if (!strcmp(argv[i], "clamp"))
+                wrap = ImageWrap::Clamp;
+            else if (!strcmp(argv[i], "black"))
+                wrap = ImageWrap::Black;
+            else
+                usage("unknown wrap mode \"%s\"", argv[i]);
+        } else
+            usage("unknown option \"%s\"", argv[i]);
+    }
+    if (i + 2 != argc) usage("expected input and output filenames");
+    const char *inFile = argv[i], *outFile = argv[i + 1];
+    if (gamma == -1)
+        gamma = HasExtension(inFile, ".tga") || HasExtension(inFile, ".png");
+
+    Point2i res;
+    std::unique_ptr<RGBSpectrum[]> image = ReadImage(inFile, &res);
+    if (!image) return 1;
+
+    // Flip image in y, as _ImageTexture_ does when it reads the image
+    // directly
+    for (int y = 0; y < res.y / 2; ++y)
+        for (int x = 0; x < res.x; ++x)
+            std::swap(image[y * res.x + x], image[(res.y - 1 - y) * res.x + x]);
+
+    // Build the pyramid with _MIPMap_ so that baked textures are filtered
+    // exactly like ones created at scene load
+    ParallelInit();
+    bool written;
+    if (nChannels == 1) {
+        // Take the luminance before undoing gamma, matching the conversion
+        // done for "float" image textures
+        std::vector<Float> texels(res.x * res.y);
+        for (int j = 0; j < res.x * res.y; ++j) {
+            Float y = image[j].y();
+            texels[j] = gamma ? InverseGammaCorrect(y) : y;
+        }
+        MIPMap<Float> mipmap(res, texels.data(), false, 8.f, wrap);
+        written = WritePyramid(mipmap, nChannels, tileSize, outFile);
+    } else {
+        if (gamma)
+            for (int j = 0; j < res.x * res.y; ++j)
+                for (int c = 0; c < RGBSpectrum::nSamples; ++c)
+                    image[j][c] = InverseGammaCorrect(image[j][c]);
+        MIPMap<RGBSpectrum> mipmap(res, image.get(), false, 8.f, wrap);
+        written = WritePyramid(mipmap, nChannels, tileSize, outFile);
+    }
+    ParallelCleanup();
+    return written ? 0 : 1;
+}
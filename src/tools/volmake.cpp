@@ -0,0 +1,96 @@
+//
+// volmake.cpp
+//
+// Converts a dense grid of raw 32-bit float densities into a sparse density
+// grid file (.svol) that "heterogeneous" media map directly into memory.
+//
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fileutil.h"
+#include "media/sparsegrid.h"
+#include "pbrt.h"
+#include <glog/logging.h>
+
+using namespace pbrt;
+
+static void usage(const char *msg = nullptr, ...) {
+    if (msg) {
+        va_list args;
+        va_start(args, msg);
+        fprintf(stderr, "volmake: ");
+        vfprintf(stderr, msg, args);
+        fprintf(stderr, "\n");
+    }
+    fprintf(stderr, R"(usage: volmake [options] <input.raw> <output.svol>
+
+Reads nx*ny*nz little-endian 32-bit floats, ordered like the "density"
+values of a "heterogeneous" medium (x varies fastest), and writes the
+8x8x8 bricks that have nonzero values. Use the resulting file as the
+"filename" of a "heterogeneous" medium.
+
+options:
+    --res <nx> <ny> <nz>  Resolution of the input grid. Required.
+    --threshold <t>       Store densities below t as zero. Default: 0
+)");
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    google::InitGoogleLogging(argv[0]);
+    FLAGS_stderrthreshold = 1;  // Warning and above.
+
+    Point3i res(0, 0, 0);
+    float threshold = 0;
+    int i;
+    for (i = 1; i < argc && argv[i][0] == '-'; ++i) {
+        if (!strcmp(argv[i], "--res") || !strcmp(argv[i], "-res")) {
+            if (i + 3 >= argc) usage("missing values after %s flag", argv[i]);
+            res.x = atoi(argv[++i]);
+            res.y = atoi(argv[++i]);
+            res.z = atoi(argv[++i]);
+            if (res.x < 1 || res.y < 1 || res.z < 1)
+                usage("--res values must be positive");
+        } else if (!strcmp(argv[i], "--threshold") ||
+                   !strcmp(argv[i], "-threshold")) {
+            if (i + 1 == argc) usage("missing value after %s flag", argv[i]);
+            threshold = atof(argv[++i]);
+        } else
+            usage("unknown option \"%s\"", argv[i]);
+    }
+    if (res.x == 0) usage("--res must be given");
+    if (i + 2 != argc) usage("expected input and output filenames");
+    const char *inFile = argv[i], *outFile = argv[i + 1];
+
+    std::unique_ptr<MappedFile> in = MappedFile::Open(inFile);
+    if (!in) {
+        fprintf(stderr, "volmake: %s: unable to map file\n", inFile);
+        return 1;
+    }
+    size_t nVoxels = size_t(res.x) * res.y * res.z;
+    if (in->Size() != nVoxels * sizeof(float)) {
+        fprintf(stderr,
+                "volmake: %s: file has %zu bytes; expected %zu for a %d x %d "
+                "x %d grid\n",
+                inFile, in->Size(), nVoxels * sizeof(float), res.x, res.y,
+                res.z);
+        return 1;
+    }
+    const float *density = (const float *)in->Data();
+    if (!SparseDensityGrid::Write(outFile, res, [&](const Point3i &p) {
+            float d =
+                density[(size_t(p.z) * res.y + p.y) * res.x + p.x];
+            return d < threshold ? 0.f : d;
+        }))
+        return 1;
+
+    std::unique_ptr<SparseDensityGrid> grid = SparseDensityGrid::Read(outFile);
+    if (!grid) return 1;
+    size_t nBricks = size_t((res.x + 7) / 8) * ((res.y + 7) / 8) *
+                     ((res.z + 7) / 8);
+    printf("%s: %d x %d x %d, %lld of %zu bricks stored\n", outFile, res.x,
+           res.y, res.z, (long long)grid->StoredBricks(), nBricks);
+    return 0;
+}